@@ -392,6 +392,7 @@ void run ()
         ++progress;
       }
     }
+    writer.clear();
 
   }
 
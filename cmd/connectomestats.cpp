@@ -22,6 +22,7 @@
 #include "math/stats/fwe.h"
 #include "math/stats/glm.h"
 #include "math/stats/import.h"
+#include "math/stats/measurements.h"
 #include "math/stats/shuffle.h"
 #include "math/stats/typedefs.h"
 
@@ -263,14 +264,7 @@ void run()
   // For compatibility with existing statistics code, symmetric matrix data is adjusted
   //   into vector form - one row per edge in the symmetric connectome. This has already
   //   been performed when the CohortDataImport class is initialised.
-  matrix_type data (importer.size(), num_edges);
-  {
-    ProgressBar progress ("Agglomerating input connectome data", importer.size());
-    for (size_t subject = 0; subject < importer.size(); subject++) {
-      (*importer[subject]) (data.row (subject));
-      ++progress;
-    }
-  }
+  const Math::Stats::Measurements data (importer, Math::Stats::Measurements::storage_type::FLOAT64, "Agglomerating input connectome data");
   const bool nans_in_data = !data.allFinite();
 
   // Only add contrast matrix row number to image outputs if there's more than one hypothesis
@@ -358,8 +352,9 @@ void run()
 
     matrix_type null_distribution, uncorrected_pvalues;
     count_matrix_type null_contributions;
-    Stats::PermTest::run_permutations (glm_test, enhancer, empirical_statistic, default_enhanced, fwe_strong,
-                                       null_distribution, null_contributions, uncorrected_pvalues);
+    if (!Stats::PermTest::run_permutations (glm_test, enhancer, empirical_statistic, default_enhanced, fwe_strong,
+                                            null_distribution, null_contributions, uncorrected_pvalues))
+      return;
     if (fwe_strong) {
       save_vector (null_distribution.col(0), output_prefix + "null_dist.txt");
     } else {
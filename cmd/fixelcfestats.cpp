@@ -29,6 +29,7 @@
 #include "math/stats/fwe.h"
 #include "math/stats/glm.h"
 #include "math/stats/import.h"
+#include "math/stats/measurements.h"
 #include "math/stats/shuffle.h"
 #include "math/stats/typedefs.h"
 #include "stats/cfe.h"
@@ -131,7 +132,9 @@ void usage ()
 
   + Option ("cfe_legacy", "use the legacy (non-normalised) form of the cfe equation")
 
-  + Math::Stats::GLM::glm_options ("fixel");
+  + Math::Stats::GLM::glm_options ("fixel")
+
+  + Math::Stats::measurements_options ("fixel");
 
 }
 
@@ -343,22 +346,30 @@ void run()
   output_header.keyval()["cfe_c"] = str(cfe_c);
   output_header.keyval()["cfe_legacy"] = str(cfe_legacy);
 
-  matrix_type data = matrix_type::Zero (importer.size(), num_fixels);
-  {
-    ProgressBar progress (std::string ("Loading fixel data (no smoothing)"), importer.size());
-    for (size_t subject = 0; subject != importer.size(); subject++) {
-      (*importer[subject]) (data.row (subject));
-      progress++;
-    }
-  }
-  // Detect non-finite values in mask fixels only; NaN-fill other fixels
+  // NaN-filling of fixels outside of the mask is applied prior to writing
+  //   of any cohort file; the mask therefore contributes to its validation
+  BitSet mask_fixels_bitset (num_fixels);
+  for (auto l = Loop(0) (mask); l; ++l)
+    mask_fixels_bitset[mask.index(0)] = mask.value();
+  const Math::Stats::Measurements data = Math::Stats::load_measurements (
+      importer,
+      Math::Stats::Measurements::storage_type::FLOAT32,
+      importer.fingerprint (mask_fixels_bitset),
+      "Loading fixel data (no smoothing)",
+      [&] (Math::Stats::Measurements& measurements) {
+        for (index_type f = 0; f != num_fixels; ++f) {
+          if (!mask_fixels_bitset[f]) {
+            for (size_t subject = 0; subject != measurements.rows(); ++subject)
+              measurements.set (subject, f, NaN);
+          }
+        }
+      });
+  // Detect non-finite values in mask fixels only
   bool nans_in_data = false;
-  for (auto l = Loop(0) (mask); l; ++l) {
-    if (mask.value()) {
-      if (!data.col (mask.index(0)).allFinite())
-        nans_in_data = true;
-    } else {
-      data.col (mask.index (0)).fill (NaN);
+  for (index_type f = 0; f != num_fixels; ++f) {
+    if (mask_fixels_bitset[f] && !data.allFinite (f)) {
+      nans_in_data = true;
+      break;
     }
   }
   if (nans_in_data) {
@@ -459,8 +470,9 @@ void run()
 
     matrix_type null_distribution, uncorrected_pvalues;
     count_matrix_type null_contributions;
-    Stats::PermTest::run_permutations (glm_test, cfe_integrator, empirical_cfe_statistic, default_enhanced, fwe_strong,
-                                       null_distribution, null_contributions, uncorrected_pvalues);
+    if (!Stats::PermTest::run_permutations (glm_test, cfe_integrator, empirical_cfe_statistic, default_enhanced, fwe_strong,
+                                            null_distribution, null_contributions, uncorrected_pvalues))
+      return;
 
     ProgressBar progress ("Outputting final results", (fwe_strong ? 1 : num_hypotheses) + 1 + 3*num_hypotheses);
 
@@ -23,6 +23,10 @@
 
 #define DEFAULT_ANGLE_THRESHOLD 45.0
 #define DEFAULT_CONNECTIVITY_THRESHOLD 0.01
+#define DEFAULT_MEMORY_LIMIT 8.0
+
+
+const char* const formats[] = { "mif", "csr", "csr16", NULL };
 
 
 using namespace MR;
@@ -57,7 +61,20 @@ void usage ()
     + Argument ("value").type_float (0.0, 90.0)
 
   + Option ("mask", "provide a fixel data file containing a mask of those fixels to be computed; fixels outside the mask will be empty in the output matrix")
-    + Argument ("file").type_image_in();
+    + Argument ("file").type_image_in()
+
+  + Option ("memory", "the amount of memory in GB to use for accumulating fixel-fixel connectivity across all threads; "
+                      "beyond this, partial results are written to temporary files and merged once all streamlines have been processed "
+                      "(default: " + str(DEFAULT_MEMORY_LIMIT, 2) + ")")
+    + Argument ("value").type_float (0.0)
+
+  + OptionGroup ("Options for the output matrix format")
+
+  + Option ("format", "the format in which to store the matrix; options are: "
+                      "mif (three images; the default); "
+                      "csr (a single memory-mappable file with compressed fixel indices); "
+                      "csr16 (as csr, with connectivity values additionally quantised to 16 bits)")
+    + Argument ("choice").type_choice (formats);
 
 }
 
@@ -93,14 +110,17 @@ void run()
       fixel_mask.value() = true;
   }
 
-  auto connectivity_matrix = Fixel::Matrix::generate (argument[1],
-                                                      index_image,
-                                                      fixel_mask,
-                                                      angular_threshold);
-
-  Fixel::Matrix::normalise_and_write (connectivity_matrix,
-                                      connectivity_threshold,
-                                      argument[2]);
+  const size_t memory_limit = std::round (get_option_value ("memory", DEFAULT_MEMORY_LIMIT) * 1024.0 * 1024.0 * 1024.0);
+  const Fixel::Matrix::format_type format = Fixel::Matrix::format_type (get_option_value ("format", 0));
+
+  Fixel::Matrix::generate_and_write (argument[1],
+                                     index_image,
+                                     fixel_mask,
+                                     angular_threshold,
+                                     connectivity_threshold,
+                                     argument[2],
+                                     memory_limit,
+                                     format);
 
 }
 
@@ -175,11 +175,20 @@ void run()
     Fixel::copy_index_and_directions_file (argument[0], argument[2]);
     ProgressBar progress (std::string ("Applying \"") + filters[argument[1]] + "\" operation to " + str(multiple_files.size()) + " fixel data files",
                           multiple_files.size());
-    for (auto& H : multiple_files) {
-      auto input_image = H.get_image<float>();
-      auto output_image = Image<float>::create (Path::join (argument[2], Path::basename (H.name())), H);
-      (*filter) (input_image, output_image);
-      ++progress;
+    // Pass data files to the filter in batches, so that filters able to
+    //   share work between files (e.g. the smoothing kernel) can do so
+    //   without needing to hold every file in memory at once
+    const size_t batch_size = 64;
+    for (size_t first = 0; first < multiple_files.size(); first += batch_size) {
+      const size_t last = std::min (first + batch_size, multiple_files.size());
+      vector<Image<float>> input_images, output_images;
+      for (size_t i = first; i != last; ++i) {
+        input_images.push_back (multiple_files[i].get_image<float>());
+        output_images.push_back (Image<float>::create (Path::join (argument[2], Path::basename (multiple_files[i].name())), multiple_files[i]));
+      }
+      (*filter) (input_images, output_images);
+      for (size_t i = first; i != last; ++i)
+        ++progress;
     }
   }
 
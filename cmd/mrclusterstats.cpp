@@ -24,6 +24,7 @@
 #include "math/stats/fwe.h"
 #include "math/stats/glm.h"
 #include "math/stats/import.h"
+#include "math/stats/measurements.h"
 #include "math/stats/shuffle.h"
 #include "math/stats/typedefs.h"
 
@@ -87,6 +88,8 @@ void usage ()
 
   + Math::Stats::GLM::glm_options ("voxel")
 
+  + Math::Stats::measurements_options ("voxel")
+
   + OptionGroup ("Additional options for mrclusterstats")
 
     + Option ("threshold", "the cluster-forming threshold to use for a standard cluster-based analysis. "
@@ -251,15 +254,20 @@ void run() {
                      + (extra_columns.size() ? " (taking into account the " + str(extra_columns.size()) + " uses of -column)" : ""));
   CONSOLE ("Number of hypotheses: " + str(num_hypotheses));
 
-  matrix_type data (importer.size(), num_voxels);
+  // The mapping from voxels to elements is determined by the analysis mask;
+  //   this must therefore contribute to validation of any pre-converted cohort file
+  BitSet mask_voxels (voxel_count (mask_image));
   {
-    // Load images
-    ProgressBar progress ("loading input images", importer.size());
-    for (size_t subject = 0; subject < importer.size(); subject++) {
-      (*importer[subject]) (data.row (subject));
-      progress++;
-    }
+    size_t index = 0;
+    for (auto l = Loop (mask_image) (mask_image); l; ++l)
+      mask_voxels[index++] = mask_image.value();
   }
+  const Measurements data = load_measurements (importer,
+                                               Measurements::storage_type::FLOAT32,
+                                               importer.fingerprint (mask_voxels),
+                                               "loading input images",
+                                               [] (Measurements&) { });
+  assert (data.cols() == num_voxels);
   const bool nans_in_data = !data.allFinite();
   if (nans_in_data) {
     INFO ("Non-finite values present in data; rows will be removed from voxel-wise design matrices accordingly");
@@ -376,8 +384,9 @@ void run() {
     matrix_type null_distribution, uncorrected_pvalue;
     count_matrix_type null_contributions;
 
-    Stats::PermTest::run_permutations (glm_test, enhancer, empirical_enhanced_statistic, default_enhanced, fwe_strong,
-                                       null_distribution, null_contributions, uncorrected_pvalue);
+    if (!Stats::PermTest::run_permutations (glm_test, enhancer, empirical_enhanced_statistic, default_enhanced, fwe_strong,
+                                            null_distribution, null_contributions, uncorrected_pvalue))
+      return;
 
     ProgressBar progress ("Outputting final results", (fwe_strong ? 1 : num_hypotheses) + 1 + 3*num_hypotheses);
 
@@ -75,6 +75,13 @@ void usage ()
              "each connectome edge, across the values of \"mean FA\" that were contributed by all "
              "of the streamlines assigned to that particular edge, the mean value is calculated.")
 
+  + Example ("Generate multiple connectome matrices from a single pass through the streamlines data",
+             "tck2connectome tracks.tck nodes.mif connectome.csv -tck_weights_in weights.csv "
+             "-extra_output length mean distances.csv -extra_output mean_FA_per_streamline.csv mean mean_FA_connectome.csv",
+             "Where more than one metric of connectivity is of interest, each additional matrix can be "
+             "requested using the -extra_output option; the streamlines data are then read, and each "
+             "streamline assigned to nodes, only once, rather than once per invocation of the command.")
+
   + Example ("Generate the connectivity fingerprint for streamlines seeded from a particular region",
              "tck2connectome fixed_seed_tracks.tck nodes.mif fingerprint.csv -vector",
              "This usage assumes that the streamlines being provided to the command have all been "
@@ -109,7 +116,19 @@ void usage ()
     + Argument ("path").type_file_out()
 
   + Option ("vector", "output a vector representing connectivities from a given seed point to target nodes, "
-                      "rather than a matrix of node-node connectivities");
+                      "rather than a matrix of node-node connectivities")
+
+  + Option ("extra_output", "generate an additional connectome matrix within the same pass through the streamlines data, "
+                            "with a different metric of connectivity and/or per-edge statistic. "
+                            "The metric can be \"count\" (the number of streamlines, or the sum of streamline weights), "
+                            "\"length\", \"invlength\", \"invnodevol\", "
+                            "or the path to a file containing one value per streamline (as for the -scale_file option). "
+                            "Options -scale_* and -stat_edge apply only to the primary output; "
+                            "all other options apply to all outputs. "
+                            "This option can be used multiple times.").allow_multiple()
+    + Argument ("metric").type_text()
+    + Argument ("statistic").type_choice (statistics)
+    + Argument ("path").type_file_out();
 
   REFERENCES
   + "If using the default streamline-parcel assignment mechanism (or -assignment_radial_search option): " // Internal
@@ -126,6 +145,68 @@ void usage ()
 
 
 
+// Maps each streamline to nodes and accumulates its contribution to the connectome
+//   within a thread-local partial matrix
+template <typename T>
+class Worker
+{ MEMALIGN(Worker)
+  public:
+    Worker (const Tck2nodes_base& tck2nodes, const vector<Metric>& metrics, Tractography::Connectome::Matrix<T>& connectome) :
+        mapper (tck2nodes, metrics),
+        provides_pair (tck2nodes.provides_pair()),
+        connectome (connectome),
+        partial (connectome.create()) { }
+
+    Worker (const Worker& that) :
+        mapper (that.mapper),
+        provides_pair (that.provides_pair),
+        connectome (that.connectome),
+        partial (connectome.create()) { }
+
+    bool operator() (const Tractography::Streamline<float>& in)
+    {
+      if (provides_pair) {
+        mapper (in, nodepair);
+        return partial (nodepair);
+      }
+      mapper (in, nodelist);
+      return partial (nodelist);
+    }
+
+  private:
+    Tractography::Connectome::Mapper mapper;
+    const bool provides_pair;
+    Tractography::Connectome::Matrix<T>& connectome;
+    typename Tractography::Connectome::Matrix<T>::Partial& partial;
+    Mapped_track_nodepair nodepair;
+    Mapped_track_nodelist nodelist;
+};
+
+
+
+void setup_extra_metric (Metric& metric, const std::string& spec, Image<node_t>& node_image)
+{
+  if (spec == "count")
+    return;
+  if (spec == "length") {
+    metric.set_scale_length();
+  } else if (spec == "invlength") {
+    metric.set_scale_invlength();
+  } else if (spec == "invnodevol") {
+    metric.set_scale_invnodevol (node_image);
+  } else {
+    try {
+      metric.set_scale_file (spec);
+    } catch (Exception& e) {
+      throw Exception (e, "-extra_output option expects either a metric name (count, length, invlength, invnodevol), "
+                          "or a file containing a list of numbers (one for each streamline); "
+                          "\"" + spec + "\" is neither of these");
+    }
+  }
+}
+
+
+
 template <typename T>
 void execute (Image<node_t>& node_image, const node_t max_node_index, const std::set<node_t>& missing_nodes)
 {
@@ -137,11 +218,21 @@ void execute (Image<node_t>& node_image, const node_t max_node_index, const std:
   const bool track_assignments = get_options ("out_assignments").size();
 
   // Get the metric, assignment mechanism & per-edge statistic for connectome construction
-  Metric metric;
-  Tractography::Connectome::setup_metric (metric, node_image);
+  vector<Metric> metrics (1);
+  Tractography::Connectome::setup_metric (metrics[0], node_image);
   std::unique_ptr<Tck2nodes_base> tck2nodes (load_assignment_mode (node_image));
   auto opt = get_options ("stat_edge");
-  const stat_edge statistic = opt.size() ? stat_edge(int(opt[0][0])) : stat_edge::SUM;
+  vector<stat_edge> statistics (1, opt.size() ? stat_edge(int(opt[0][0])) : stat_edge::SUM);
+  vector<std::string> output_paths (1, argument[2]);
+
+  // Any additional matrices are generated concurrently, each with its own metric & statistic
+  opt = get_options ("extra_output");
+  for (const auto& o : opt) {
+    metrics.push_back (Metric());
+    setup_extra_metric (metrics.back(), o[0], node_image);
+    statistics.push_back (stat_edge(int(o[1])));
+    output_paths.push_back (o[2]);
+  }
 
   // Prepare for reading the track data
   Tractography::Properties properties;
@@ -149,30 +240,22 @@ void execute (Image<node_t>& node_image, const node_t max_node_index, const std:
 
   // Initialise classes in preparation for multi-threading
   Mapping::TrackLoader loader (reader, properties["count"].empty() ? 0 : to<size_t>(properties["count"]), "Constructing connectome");
-  Tractography::Connectome::Mapper mapper (*tck2nodes, metric);
-  Tractography::Connectome::Matrix<T> connectome (max_node_index, statistic, vector_output, track_assignments);
+  Tractography::Connectome::Matrix<T> connectome (max_node_index, statistics, vector_output, track_assignments);
 
   // Multi-threaded connectome construction
-  if (tck2nodes->provides_pair()) {
-    Thread::run_queue (
-        loader,
-        Thread::batch (Tractography::Streamline<float>()),
-        Thread::multi (mapper),
-        Thread::batch (Mapped_track_nodepair()),
-        connectome);
-  } else {
+  {
+    Worker<T> worker (*tck2nodes, metrics, connectome);
     Thread::run_queue (
         loader,
         Thread::batch (Tractography::Streamline<float>()),
-        Thread::multi (mapper),
-        Thread::batch (Mapped_track_nodelist()),
-        connectome);
+        Thread::multi (worker));
   }
 
   connectome.finalize();
   connectome.error_check (missing_nodes);
 
-  connectome.save (argument[2], get_options ("keep_unassigned").size(), get_options ("symmetric").size(), get_options ("zero_diagonal").size());
+  for (size_t i = 0; i != output_paths.size(); ++i)
+    connectome.save (output_paths[i], get_options ("keep_unassigned").size(), get_options ("symmetric").size(), get_options ("zero_diagonal").size(), i);
 
   opt = get_options ("out_assignments");
   if (opt.size())
@@ -26,6 +26,7 @@
 
 #include "dwi/tractography/mapping/mapper.h"
 #include "dwi/tractography/mapping/loader.h"
+#include "dwi/tractography/mapping/partial_buffer.h"
 #include "dwi/tractography/mapping/writer.h"
 
 
@@ -45,17 +46,24 @@ class TrackProcessor { MEMALIGN (TrackProcessor)
 
    TrackProcessor (Image<index_type>& fixel_indexer,
                    const vector<Eigen::Vector3d>& fixel_directions,
-                   vector<uint16_t>& fixel_TDI,
                    const float angular_threshold):
      fixel_indexer (fixel_indexer) ,
      fixel_directions (fixel_directions),
-     fixel_TDI (fixel_TDI),
-     angular_threshold_dp (std::cos (angular_threshold * (Math::pi/180.0))) { }
+     angular_threshold_dp (std::cos (angular_threshold * (Math::pi/180.0))),
+     partials (new Partials()),
+     fixel_TDI (partials->create (fixel_directions.size())) { }
+
+   // Each copy accumulates into its own partial fixel TDI
+   TrackProcessor (const TrackProcessor& that) :
+     fixel_indexer (that.fixel_indexer),
+     fixel_directions (that.fixel_directions),
+     angular_threshold_dp (that.angular_threshold_dp),
+     partials (that.partials),
+     fixel_TDI (partials->create (fixel_directions.size())) { }
 
 
    bool operator () (const SetVoxelDir& in)  {
      // For each voxel tract tangent, assign to a fixel
-     vector<int32_t> tract_fixel_indices;
      for (SetVoxelDir::const_iterator i = in.begin(); i != in.end(); ++i) {
        assign_pos_of (*i).to (fixel_indexer);
        fixel_indexer.index(3) = 0;
@@ -74,21 +82,46 @@ class TrackProcessor { MEMALIGN (TrackProcessor)
              closest_fixel_index = j;
            }
          }
-         if (largest_dp > angular_threshold_dp) {
-           tract_fixel_indices.push_back (closest_fixel_index);
-           fixel_TDI[closest_fixel_index]++;
-         }
+         if (largest_dp > angular_threshold_dp)
+           (*fixel_TDI)[closest_fixel_index]++;
        }
      }
      return true;
    }
 
 
+   // Sum the partial fixel TDIs of all copies; only to be called once processing is complete
+   void reduce (vector<uint16_t>& result)
+   {
+     vector<vector<uint32_t>*> list;
+     for (auto& p : partials->data)
+       list.push_back (p.get());
+     DWI::Tractography::Mapping::tree_reduce (list, [] (vector<uint32_t>* a, vector<uint32_t>* b) {
+       for (size_t i = 0; i != a->size(); ++i)
+         (*a)[i] += (*b)[i];
+     });
+     result.assign (list[0]->begin(), list[0]->end());
+   }
+
+
  private:
+   class Partials { NOMEMALIGN
+     public:
+       vector<uint32_t>* create (const size_t num_fixels) {
+         std::lock_guard<std::mutex> lock (mutex);
+         data.push_back (make_unique<vector<uint32_t>> (num_fixels, 0));
+         return data.back().get();
+       }
+       vector<std::unique_ptr<vector<uint32_t>>> data;
+     private:
+       std::mutex mutex;
+   };
+
    Image<index_type> fixel_indexer;
    const vector<Eigen::Vector3d>& fixel_directions;
-   vector<uint16_t>& fixel_TDI;
    const float angular_threshold_dp;
+   std::shared_ptr<Partials> partials;
+   vector<uint32_t>* const fixel_TDI;
 };
 
 
@@ -172,13 +205,19 @@ void run ()
     DWI::Tractography::Mapping::TrackMapperBase mapper (index_image);
     mapper.set_upsample_ratio (DWI::Tractography::Mapping::determine_upsample_ratio (index_header, properties, 0.333f));
     mapper.set_use_precise_mapping (true);
-    TrackProcessor tract_processor (index_image, directions, fixel_TDI, angular_threshold);
+    TrackProcessor tract_processor (index_image, directions, angular_threshold);
+    // Each processing thread requires its own partial fixel TDI; if these would
+    //   exceed the permitted memory, reduce the number of such threads (down to
+    //   a single thread accumulating directly into the only buffer)
+    const size_t partial_bytes = num_fixels * sizeof(uint32_t);
+    const size_t num_processors = std::max (size_t(1), std::min (Thread::threads_to_execute(), DWI::Tractography::Mapping::partial_buffer_memory_limit() / partial_bytes));
     Thread::run_queue (
         loader,
         Thread::batch (DWI::Tractography::Streamline<float>()),
-        mapper,
+        Thread::multi (mapper),
         Thread::batch (SetVoxelDir()),
-        tract_processor);
+        Thread::multi (tract_processor, num_processors));
+    tract_processor.reduce (fixel_TDI);
   }
   track_file.close();
 
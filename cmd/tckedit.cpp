@@ -25,6 +25,7 @@
 #include "dwi/tractography/file.h"
 #include "dwi/tractography/properties.h"
 #include "dwi/tractography/roi.h"
+#include "dwi/tractography/spatial_sort.h"
 #include "dwi/tractography/weights.h"
 
 #include "dwi/tractography/editing/editing.h"
@@ -109,6 +110,21 @@ void usage ()
 
   + Option ("ends_only", "only test the ends of each streamline against the provided include/exclude ROIs")
 
+  + Option ("sort", "write the output streamlines in order along a space-filling curve, "
+                    "such that streamlines occupying similar regions of space are stored "
+                    "contiguously in the output file; this improves the memory access "
+                    "performance of commands that subsequently map streamlines to voxels "
+                    "or fixels (e.g. tckmap, tcksift, tcksift2). Options are: "
+                    + join(spatial_sort_curves, ", ") + ". Note that all output streamlines "
+                    "are held in memory when this option is used.")
+    + Argument ("curve").type_choice (spatial_sort_curves)
+
+  + Option ("tsf", "read a track scalar file corresponding to the input track file, and write "
+                   "to a new track scalar file those scalars corresponding to the output streamlines "
+                   "(not compatible with multiple input files or the -mask option)")
+    + Argument ("input").type_file_in()
+    + Argument ("output").type_file_out()
+
   // TODO Input weights with multiple input files currently not supported
   + OptionGroup ("Options for handling streamline weights")
   + Tractography::TrackWeightsInOption
@@ -218,7 +234,20 @@ void run ()
 
   Loader loader (input_file_list);
   Worker worker (properties, inverse, ends_only);
+  Properties tsf_tck_properties;
+  auto opt = get_options ("tsf");
+  if (opt.size()) {
+    if (num_inputs > 1)
+      throw Exception ("Cannot process track scalar files with multiple input track files");
+    Reader<float> (input_file_list[0], tsf_tck_properties);
+  }
+
   Receiver receiver (output_path, properties, number, skip);
+  if (opt.size())
+    receiver.set_scalars (opt[0][0], tsf_tck_properties, opt[0][1], properties);
+  auto sort_opt = get_options ("sort");
+  if (sort_opt.size())
+    receiver.set_sort (SpatialSort::curve_t (int (sort_opt[0][0])));
 
   Thread::run_ordered_queue (
       loader,
@@ -227,4 +256,6 @@ void run ()
       Thread::batch (Streamline<>()),
       receiver);
 
+  receiver.finalise();
+
 }
@@ -21,6 +21,7 @@
 #include "dwi/tractography/roi.h"
 
 #include "dwi/tractography/tracking/exec.h"
+#include "dwi/tractography/tracking/exec_packet.h"
 #include "dwi/tractography/tracking/method.h"
 #include "dwi/tractography/tracking/tractography.h"
 
@@ -254,10 +255,36 @@ void run ()
   Tracking::load_streamline_properties_and_rois (properties);
   properties.compare_stepsize_rois();
 
+  if (properties.find ("fod_cache") != properties.end() && !(algorithm == 1 || algorithm == 2 || algorithm == 5)) {
+    WARN ("-fod_cache option ignored - only applicable to FOD-based algorithms");
+    properties.erase ("fod_cache");
+  }
+  if (properties.find ("fod_lookup") != properties.end() && algorithm != 1) {
+    WARN ("-fod_lookup option ignored - only applicable to iFOD1 algorithm");
+    properties.erase ("fod_lookup");
+  }
+  if (properties.find ("fod_cache") != properties.end() && properties.find ("fod_lookup") != properties.end()) {
+    WARN ("-fod_cache option ignored - FOD amplitudes are instead obtained from the -fod_lookup table");
+    properties.erase ("fod_cache");
+  }
+
+  if (properties.find ("lockstep") != properties.end() && !(algorithm == 0 || algorithm == 5 || algorithm == 7)) {
+    WARN ("-lockstep option ignored - only applicable to deterministic algorithms");
+    properties.erase ("lockstep");
+  }
+  if (properties.find ("lockstep") != properties.end() && properties.find ("fod_cache") != properties.end()) {
+    WARN ("-lockstep option ignored - not applicable in conjunction with -fod_cache");
+    properties.erase ("lockstep");
+  }
+  const bool lockstep = properties.find ("lockstep") != properties.end();
+
   // Check validity of options -select and -seeds; these are meaningless if seeds are number-limited
   // By over-riding the values in properties, the progress bar should still be valid
   if (properties.seeds.is_finite()) {
 
+    if (properties.find ("checkpoint") != properties.end() || properties.find ("resume") != properties.end())
+      throw Exception ("Options -checkpoint and -resume cannot be used with seeding mechanisms that provide a finite number of seeds");
+
     if (properties["max_num_tracks"].size())
       WARN ("Overriding -select option (desired number of successful streamline selections), as seeds can only provide a finite number");
     properties["max_num_tracks"] = str (properties.seeds.get_total_count());
@@ -272,7 +299,10 @@ void run ()
 
   switch (algorithm) {
     case 0:
-      Exec<FACT>       ::run (argument[0], argument[1], properties);
+      if (lockstep)
+        ExecPacket<FACT>::run (argument[0], argument[1], properties);
+      else
+        Exec<FACT>       ::run (argument[0], argument[1], properties);
       break;
     case 1:
       Exec<iFOD1>      ::run (argument[0], argument[1], properties);
@@ -287,13 +317,19 @@ void run ()
       Exec<NullDist2>  ::run (argument[0], argument[1], properties);
       break;
     case 5:
-      Exec<SDStream>   ::run (argument[0], argument[1], properties);
+      if (lockstep)
+        ExecPacket<SDStream>::run (argument[0], argument[1], properties);
+      else
+        Exec<SDStream>   ::run (argument[0], argument[1], properties);
       break;
     case 6:
       Exec<Seedtest>   ::run (argument[0], argument[1], properties);
       break;
     case 7:
-      Exec<Tensor_Det> ::run (argument[0], argument[1], properties);
+      if (lockstep)
+        ExecPacket<Tensor_Det>::run (argument[0], argument[1], properties);
+      else
+        Exec<Tensor_Det> ::run (argument[0], argument[1], properties);
       break;
     case 8:
       Exec<Tensor_Prob>::run (argument[0], argument[1], properties);
@@ -28,6 +28,7 @@
 #include "dwi/tractography/properties.h"
 #include "dwi/tractography/weights.h"
 
+#include "dwi/tractography/mapping/accumulator.h"
 #include "dwi/tractography/mapping/loader.h"
 #include "dwi/tractography/mapping/mapper.h"
 #include "dwi/tractography/mapping/mapping.h"
@@ -248,6 +249,18 @@ MapWriterBase* make_writer (Header& H, const std::string& name, const vox_stat_t
 
 
 
+template <class MapperType, class SetType>
+void run_accumulator (TrackLoader& loader, const MapperType& mapper, MapWriterBase& writer, const Header& header, const writer_dim type)
+{
+  const size_t num_threads = Thread::threads_to_execute();
+  MapAccumulator<MapperType, SetType> accumulator (mapper, writer, header, type, num_threads, partial_buffer_memory_limit());
+  Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (accumulator, num_threads));
+  accumulator.finalise();
+}
+
+
+
+
 DataType determine_datatype (const DataType current_dt, const contrast_t contrast, const DataType default_dt, const bool precise)
 {
   if (current_dt == DataType::Undefined) {
@@ -603,18 +616,40 @@ void run () {
     case TOD:       writer.reset (new MapWriter<float>  (header, argument[1], stat_vox, TOD));       break;
   }
 
+  // For summed statistics, each mapping thread can accumulate its own partial
+  //   image rather than funneling all mapped voxel sets to a single writer thread
+  const bool accumulate = stat_vox == V_SUM && Thread::threads_to_execute() > 1 && partial_buffer_memory_limit();
+
   // Finally get to do some number crunching!
   // Complete branch here for Gaussian track-wise statistic; it's a nightmare to manage, so am
   //   keeping the code as separate as possible
   if (stat_tck == GAUSSIAN) {
     Gaussian::TrackMapper* const mapper_ptr = dynamic_cast<Gaussian::TrackMapper*>(mapper.get());
     mapper_ptr->set_gaussian_FWHM (gaussian_fwhm_tck);
+    if (accumulate) {
+      switch (writer_type) {
+        case UNDEFINED: throw Exception ("Invalid TWI writer image dimensionality");
+        case GREYSCALE: run_accumulator<Gaussian::TrackMapper, Gaussian::SetVoxel>    (loader, *mapper_ptr, *writer, header, writer_type); break;
+        case DEC:       run_accumulator<Gaussian::TrackMapper, Gaussian::SetVoxelDEC> (loader, *mapper_ptr, *writer, header, writer_type); break;
+        case DIXEL:     run_accumulator<Gaussian::TrackMapper, Gaussian::SetDixel>    (loader, *mapper_ptr, *writer, header, writer_type); break;
+        case TOD:       run_accumulator<Gaussian::TrackMapper, Gaussian::SetVoxelTOD> (loader, *mapper_ptr, *writer, header, writer_type); break;
+      }
+    } else {
+      switch (writer_type) {
+        case UNDEFINED: throw Exception ("Invalid TWI writer image dimensionality");
+        case GREYSCALE: Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxel()),    *writer); break;
+        case DEC:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxelDEC()), *writer); break;
+        case DIXEL:     Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetDixel()),    *writer); break;
+        case TOD:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxelTOD()), *writer); break;
+      }
+    }
+  } else if (accumulate) {
     switch (writer_type) {
       case UNDEFINED: throw Exception ("Invalid TWI writer image dimensionality");
-      case GREYSCALE: Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxel()),    *writer); break;
-      case DEC:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxelDEC()), *writer); break;
-      case DIXEL:     Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetDixel()),    *writer); break;
-      case TOD:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxelTOD()), *writer); break;
+      case GREYSCALE: run_accumulator<TrackMapperTWI, SetVoxel>    (loader, *mapper, *writer, header, writer_type); break;
+      case DEC:       run_accumulator<TrackMapperTWI, SetVoxelDEC> (loader, *mapper, *writer, header, writer_type); break;
+      case DIXEL:     run_accumulator<TrackMapperTWI, SetDixel>    (loader, *mapper, *writer, header, writer_type); break;
+      case TOD:       run_accumulator<TrackMapperTWI, SetVoxelTOD> (loader, *mapper, *writer, header, writer_type); break;
     }
   } else {
     switch (writer_type) {
@@ -72,6 +72,10 @@ void usage ()
   + Option ("out_selection", "output a text file containing the binary selection of streamlines")
     + Argument ("path").type_file_out()
 
+  + Option ("incremental", "update the gradients of only those streamlines that share fixels with each removed streamline, "
+                           "and re-rank them within a priority queue, rather than re-sorting all streamlines; "
+                           "this reduces the number of full gradient recalculations required, but will yield a different selection of streamlines")
+
   + SIFTTermOption;
 
 }
@@ -121,6 +125,7 @@ void run ()
     opt = get_options ("csv");
     if (opt.size())
       sifter.set_csv_path (opt[0][0]);
+    sifter.set_incremental (get_options ("incremental").size());
     opt = get_options ("output_at_counts");
     if (opt.size()) {
       vector<uint32_t> counts = parse_ints<uint32_t> (opt[0][0]);
@@ -44,6 +44,10 @@ using namespace MR::DWI::Tractography::SIFT2;
 
 
 
+const char* coeff_optimisers[] = { "batch", "iterative", "qls", "gss", nullptr };
+
+
+
 const OptionGroup SIFT2RegularisationOption = OptionGroup ("Regularisation options for SIFT2")
 
   + Option ("reg_tikhonov", "provide coefficient for regularising streamline weighting coefficients (Tikhonov regularisation) (default: " + str(SIFT2_REGULARISATION_TIKHONOV_DEFAULT, 2) + ")")
@@ -101,6 +105,13 @@ const OptionGroup SIFT2AlgorithmOption = OptionGroup ("Options for controlling t
                                "(default: " + str(SIFT2_MIN_CF_DECREASE_DEFAULT, 2) + ")")
     + Argument ("frac").type_float (0.0, 1.0)
 
+  + Option ("coeff_optimiser", "algorithm used to optimise the weighting coefficient of each streamline in each iteration; "
+                               "options are: " + join(coeff_optimisers, ", ") + ". "
+                               "'batch' (the default) and 'iterative' both perform Newton optimisation and yield identical results, "
+                               "but the former processes blocks of streamlines at once and is faster; "
+                               "'qls' and 'gss' perform quadratic and golden section line searches respectively")
+    + Argument ("choice").type_choice (coeff_optimisers)
+
   + Option ("linear", "perform a linear estimation of streamline weights, rather than the standard non-linear optimisation "
                       "(typically does not provide as accurate a model fit; but only requires a single pass)");
 
@@ -220,6 +231,9 @@ void run ()
     opt = get_options ("min_cf_decrease");
     if (opt.size())
       tckfactor.set_min_cf_decrease (float(opt[0][0]));
+    opt = get_options ("coeff_optimiser");
+    if (opt.size())
+      tckfactor.set_coeff_optimiser (coeff_optimiser_t (int(opt[0][0])));
 
     tckfactor.estimate_factors();
 
@@ -22,6 +22,7 @@
 #include "math/stats/fwe.h"
 #include "math/stats/glm.h"
 #include "math/stats/import.h"
+#include "math/stats/measurements.h"
 #include "math/stats/shuffle.h"
 #include "math/stats/typedefs.h"
 
@@ -169,9 +170,7 @@ void run()
   const std::string output_prefix = argument[3];
 
   // Load input data
-  matrix_type data (num_inputs, num_elements);
-  for (size_t subject = 0; subject != num_inputs; subject++)
-    (*importer[subject]) (data.row(subject));
+  const Math::Stats::Measurements data (importer, Math::Stats::Measurements::storage_type::FLOAT64, "Loading input data");
 
   const bool nans_in_data = !data.allFinite();
   if (nans_in_data) {
@@ -256,8 +255,9 @@ void run()
     matrix_type null_distribution, uncorrected_pvalues;
     count_matrix_type null_contributions;
     matrix_type empirical_distribution; // unused
-    Stats::PermTest::run_permutations (glm_test, enhancer, empirical_distribution, default_zstat, fwe_strong,
-                                       null_distribution, null_contributions, uncorrected_pvalues);
+    if (!Stats::PermTest::run_permutations (glm_test, enhancer, empirical_distribution, default_zstat, fwe_strong,
+                                            null_distribution, null_contributions, uncorrected_pvalues))
+      return;
     if (fwe_strong) {
       save_vector (null_distribution.col(0), output_prefix + "null_dist.csv");
     } else {
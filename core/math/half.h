@@ -0,0 +1,122 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __math_half_h__
+#define __math_half_h__
+
+#include <cstdint>
+#include <cstring>
+
+
+namespace MR
+{
+  namespace Math
+  {
+
+
+
+    //! functions for converting between single-precision and IEEE 754 half-precision floating-point
+    /*! Half-precision values are only used as a compact storage format; all
+     * arithmetic is performed on the single-precision values obtained via
+     * half2float(). Conversion from single-precision rounds to nearest-even,
+     * saturates to infinity on overflow, flushes values too small to be
+     * represented even as half-precision subnormals to (signed) zero, and
+     * preserves NaN. */
+    namespace Half
+    {
+
+      using storage_type = uint16_t;
+
+      inline storage_type float2half (const float value)
+      {
+        uint32_t f;
+        memcpy (&f, &value, sizeof (f));
+        const uint32_t sign = (f >> 16) & 0x8000u;
+        const uint32_t exponent = (f >> 23) & 0xFFu;
+        uint32_t mantissa = f & 0x007FFFFFu;
+
+        // NaN & infinity
+        if (exponent == 0xFFu)
+          return storage_type (sign | 0x7C00u | (mantissa ? (0x0200u | (mantissa >> 13)) : 0u));
+
+        const int32_t half_exponent = int32_t(exponent) - 127 + 15;
+
+        // Overflow: saturate to infinity
+        if (half_exponent >= 0x1F)
+          return storage_type (sign | 0x7C00u);
+
+        // Subnormal or underflow
+        if (half_exponent <= 0) {
+          if (half_exponent < -10)
+            return storage_type (sign);
+          mantissa |= 0x00800000u;
+          const uint32_t shift = uint32_t (14 - half_exponent);
+          uint32_t result = mantissa >> shift;
+          const uint32_t remainder = mantissa & ((1u << shift) - 1u);
+          const uint32_t halfway = 1u << (shift - 1u);
+          if (remainder > halfway || (remainder == halfway && (result & 1u)))
+            ++result;
+          return storage_type (sign | result);
+        }
+
+        // Normal: round mantissa to nearest-even; a carry out of the
+        //   mantissa correctly increments the exponent (possibly to infinity)
+        uint32_t result = (uint32_t(half_exponent) << 10) | (mantissa >> 13);
+        const uint32_t remainder = mantissa & 0x1FFFu;
+        if (remainder > 0x1000u || (remainder == 0x1000u && (result & 1u)))
+          ++result;
+        return storage_type (sign | result);
+      }
+
+
+
+      inline float half2float (const storage_type value)
+      {
+        const uint32_t sign = uint32_t (value & 0x8000u) << 16;
+        const uint32_t exponent = (value >> 10) & 0x1Fu;
+        uint32_t mantissa = value & 0x03FFu;
+        uint32_t f;
+
+        if (exponent == 0x1Fu) {
+          f = sign | 0x7F800000u | (mantissa << 13);
+        } else if (exponent) {
+          f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        } else if (mantissa) {
+          // Subnormal half: renormalise
+          int32_t e = -1;
+          do {
+            ++e;
+            mantissa <<= 1;
+          } while (!(mantissa & 0x0400u));
+          f = sign | (uint32_t (127 - 15 - e) << 23) | ((mantissa & 0x03FFu) << 13);
+        } else {
+          f = sign;
+        }
+
+        float result;
+        memcpy (&result, &f, sizeof (result));
+        return result;
+      }
+
+    }
+
+
+
+  }
+}
+
+#endif
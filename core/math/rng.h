@@ -52,13 +52,36 @@ namespace MR
         template <typename ValueType> class Integer;
 
         static std::mt19937::result_type get_seed () {
-          static std::mutex mutex;
-          std::lock_guard<std::mutex> lock (mutex);
-          static std::mt19937::result_type current_seed = get_seed_private();
-          return current_seed++;
+          std::lock_guard<std::mutex> lock (seed_mutex());
+          return current_seed()++;
+        }
+
+        //! the seed that will be used by the next RNG instance to be constructed
+        static std::mt19937::result_type next_seed () {
+          std::lock_guard<std::mutex> lock (seed_mutex());
+          return current_seed();
+        }
+
+        //! set the seed to be used by the next RNG instance to be constructed
+        /*! This is used when resuming a process from a checkpoint, to ensure
+         * that the seeds of the RNG instances used prior to the checkpoint
+         * are not re-used. */
+        static void set_next_seed (const std::mt19937::result_type seed) {
+          std::lock_guard<std::mutex> lock (seed_mutex());
+          current_seed() = seed;
         }
 
       private:
+        static std::mutex& seed_mutex () {
+          static std::mutex mutex;
+          return mutex;
+        }
+
+        static std::mt19937::result_type& current_seed () {
+          static std::mt19937::result_type seed = get_seed_private();
+          return seed;
+        }
+
         static std::mt19937::result_type get_seed_private () {
           //ENVVAR name: MRTRIX_RNG_SEED
           //ENVVAR Set the seed used for the random number generator.
@@ -331,7 +331,7 @@ namespace MR
 
 
 
-        void all_stats (const matrix_type& measurements,
+        void all_stats (const Measurements& measurements,
                         const matrix_type& fixed_design,
                         const vector<CohortDataImport>& extra_data,
                         const vector<Hypothesis>& hypotheses,
@@ -343,7 +343,25 @@ namespace MR
                         matrix_type& stdev)
         {
           if (extra_data.empty() && measurements.allFinite()) {
-            all_stats (measurements, fixed_design, hypotheses, variance_groups, betas, abs_effect_size, std_effect_size, stdev);
+            // Measurement data are converted to double precision one block of elements at a time
+            constexpr size_t element_block_size = 4096;
+            const size_t num_elements = measurements.cols();
+            betas.resize (fixed_design.cols(), num_elements);
+            abs_effect_size.resize (num_elements, hypotheses.size());
+            std_effect_size.resize (num_elements, hypotheses.size());
+            stdev.resize (variance_groups.size() ? variance_groups.maxCoeff()+1 : 1, num_elements);
+            ProgressBar progress ("Calculating basic properties of default permutation", (num_elements + element_block_size - 1) / element_block_size);
+            matrix_type data, block_betas, block_abs_effect_size, block_std_effect_size, block_stdev;
+            for (size_t block_start = 0; block_start < num_elements; block_start += element_block_size) {
+              const size_t block_size = std::min (element_block_size, num_elements - block_start);
+              measurements.block (block_start, block_size, data);
+              all_stats (data, fixed_design, hypotheses, variance_groups, block_betas, block_abs_effect_size, block_std_effect_size, block_stdev);
+              betas.middleCols (block_start, block_size) = block_betas;
+              abs_effect_size.middleRows (block_start, block_size) = block_abs_effect_size;
+              std_effect_size.middleRows (block_start, block_size) = block_std_effect_size;
+              stdev.middleCols (block_start, block_size) = block_stdev;
+              ++progress;
+            }
             return;
           }
 
@@ -374,7 +392,7 @@ namespace MR
           class Functor
           { MEMALIGN(Functor)
             public:
-              Functor (const matrix_type& data, const matrix_type& design_fixed, const vector<CohortDataImport>& extra_data, const vector<Hypothesis>& hypotheses, const index_array_type& variance_groups,
+              Functor (const Measurements& data, const matrix_type& design_fixed, const vector<CohortDataImport>& extra_data, const vector<Hypothesis>& hypotheses, const index_array_type& variance_groups,
                        vector_type& cond, matrix_type& betas, matrix_type& abs_effect_size, matrix_type& std_effect_size, matrix_type& stdev) :
                   data (data),
                   design_fixed (design_fixed),
@@ -392,7 +410,7 @@ namespace MR
               }
               bool operator() (const size_t& element_index)
               {
-                const matrix_type element_data = data.col (element_index);
+                const matrix_type element_data = data.block (element_index, 1);
                 matrix_type element_design (design_fixed.rows(), design_fixed.cols() + extra_data.size());
                 element_design.leftCols (design_fixed.cols()) = design_fixed;
                 // For each element-wise design matrix column,
@@ -402,12 +420,12 @@ namespace MR
                 // For each element-wise design matrix, remove any NaN values
                 //   present in either the input data or imported from the element-wise design matrix column data
                 ssize_t valid_rows = 0;
-                for (ssize_t row = 0; row != data.rows(); ++row) {
+                for (ssize_t row = 0; row != element_data.rows(); ++row) {
                   if (std::isfinite (element_data(row)) && element_design.row (row).allFinite())
                     ++valid_rows;
                 }
                 default_type condition_number = 0.0;
-                if (valid_rows == data.rows()) { // No NaNs present
+                if (valid_rows == element_data.rows()) { // No NaNs present
                   condition_number = Math::condition_number (element_design);
                   if (!std::isfinite (condition_number) || condition_number > 1e5) {
                     zero();
@@ -421,7 +439,7 @@ namespace MR
                   matrix_type element_design_finite (valid_rows, element_design.cols());
                   index_array_type variance_groups_finite (variance_groups.size() ? valid_rows : 0);
                   ssize_t output_row = 0;
-                  for (ssize_t row = 0; row != data.rows(); ++row) {
+                  for (ssize_t row = 0; row != element_data.rows(); ++row) {
                     if (std::isfinite (element_data(row)) && element_design.row (row).allFinite()) {
                       element_data_finite(output_row, 0) = element_data(row);
                       element_design_finite.row (output_row) = element_design.row (row);
@@ -451,7 +469,7 @@ namespace MR
                 return true;
               }
             private:
-              const matrix_type& data;
+              const Measurements& data;
               const matrix_type& design_fixed;
               const vector<CohortDataImport>& extra_data;
               const vector<Hypothesis>& hypotheses;
@@ -553,6 +571,15 @@ namespace MR
 
 
 
+        void TestBase::batch (const vector<matrix_type>& shuffling_matrices, vector<matrix_type>& output) const
+        {
+          output.resize (shuffling_matrices.size());
+          for (size_t i = 0; i != shuffling_matrices.size(); ++i)
+            (*this) (shuffling_matrices[i], output[i]);
+        }
+
+
+
 
 
 
@@ -564,7 +591,7 @@ namespace MR
 
 
 
-        TestFixedHomoscedastic::TestFixedHomoscedastic (const matrix_type& measurements, const matrix_type& design, const vector<Hypothesis>& hypotheses) :
+        TestFixedHomoscedastic::TestFixedHomoscedastic (const Measurements& measurements, const matrix_type& design, const vector<Hypothesis>& hypotheses) :
             TestBase (measurements, design, hypotheses),
             pinvM (Math::pinv (M)),
             Rm (matrix_type::Identity (num_inputs(), num_inputs()) - (M*pinvM))
@@ -584,12 +611,62 @@ namespace MR
                                                 matrix_type& stats,
                                                 matrix_type& zstats) const
         {
-          assert (size_t(shuffling_matrix.rows()) == num_inputs());
-          stats .resize (num_elements(), num_hypotheses());
-          zstats.resize (num_elements(), num_hypotheses());
+          vector<matrix_type> all_stats, all_zstats;
+          evaluate (vector<matrix_type> (1, shuffling_matrix), &all_stats, all_zstats);
+          std::swap (stats, all_stats[0]);
+          std::swap (zstats, all_zstats[0]);
+        }
+
 
-          matrix_type Sy, lambdas, residuals, beta;
-          vector_type sse;
+
+        void TestFixedHomoscedastic::batch (const vector<matrix_type>& shuffling_matrices, vector<matrix_type>& output) const
+        {
+          evaluate (shuffling_matrices, nullptr, output);
+        }
+
+
+
+        size_t TestFixedHomoscedastic::batch_size() const
+        {
+          // Each shuffle in a batch requires its own output statistics (and the
+          //   corresponding product of shuffling and nuisance residual-forming matrices)
+          //   to be held in memory until the batch is complete
+          const size_t bytes_per_shuffle = (num_elements() * num_hypotheses() + num_inputs() * num_inputs()) * sizeof (default_type);
+          return std::max (size_t(1), std::min (size_t(GLM_BATCH_MAX_SHUFFLES), size_t(GLM_BATCH_MEMORY) / bytes_per_shuffle));
+        }
+
+
+
+        void TestFixedHomoscedastic::evaluate (const vector<matrix_type>& shuffling_matrices,
+                                               vector<matrix_type>* stats,
+                                               vector<matrix_type>& zstats) const
+        {
+          const size_t num_shuffles = shuffling_matrices.size();
+          if (stats)
+            stats->resize (num_shuffles);
+          zstats.resize (num_shuffles);
+          for (size_t is = 0; is != num_shuffles; ++is) {
+            assert (size_t(shuffling_matrices[is].rows()) == num_inputs());
+            if (stats)
+              (*stats)[is].resize (num_elements(), num_hypotheses());
+            zstats[is].resize (num_elements(), num_hypotheses());
+          }
+
+          // The estimation of the effects of interest and of the residuals of the full
+          //   model are combined in advance with the permutation of the data for each
+          //   shuffle; these are then stacked across shuffles, such that the model fit for
+          //   all shuffles is obtained from just two matrix products per block of elements,
+          //   rather than three products per shuffle
+          matrix_type SRz, beta_forming, residual_forming (num_shuffles * num_inputs(), num_inputs());
+
+          // The elements are processed in blocks, such that the data for each block
+          //   (along with the intermediate products derived from them) remain in
+          //   cache while the products for all shuffles are evaluated
+          const size_t bytes_per_element = ((num_shuffles + 1) * num_inputs() + num_shuffles * M.cols()) * sizeof (default_type);
+          const size_t element_block_size = std::max (size_t(64), (size_t(GLM_BATCH_CACHE_SIZE) / bytes_per_element) & ~size_t(7));
+
+          matrix_type data, betas, residuals, XtXbetas;
+          Eigen::Array<default_type, 1, Eigen::Dynamic> F;
 
           // Freedman-Lane for fixed design matrix case
           // Each hypothesis needs to be handled explicitly on its own
@@ -598,64 +675,63 @@ namespace MR
             // First, we perform permutation of the input data
             // In Freedman-Lane, the initial 'effective' regression against the nuisance
             //   variables, and permutation of the data, are done in a single step
-#ifdef GLM_TEST_DEBUG
-            VAR (shuffling_matrix.rows());
-            VAR (shuffling_matrix.cols());
-            VAR (partitions[ih].Rz.rows());
-            VAR (partitions[ih].Rz.cols());
-            VAR (y.rows());
-            VAR (y.cols());
-#endif
-            Sy.noalias() = shuffling_matrix * partitions[ih].Rz * y;
-#ifdef GLM_TEST_DEBUG
-            VAR (Sy.rows());
-            VAR (Sy.cols());
-            VAR (pinvM.rows());
-            VAR (pinvM.cols());
-#endif
-            // Now, we regress this shuffled data against the full model
-            lambdas.noalias() = pinvM * Sy;
-#ifdef GLM_TEST_DEBUG
-            VAR (lambdas.rows());
-            VAR (lambdas.cols());
-            //VAR (matrix_type(c[ih]).rows());
-            //VAR (matrix_type(c[ih]).cols());
-            VAR (Rm.rows());
-            VAR (Rm.cols());
-            VAR (XtX[ih].rows());
-            VAR (XtX[ih].cols());
-            VAR (one_over_dof);
-#endif
+            const size_t num_betas = c[ih].matrix().rows();
+            beta_forming.resize (num_shuffles * num_betas, num_inputs());
+            for (size_t is = 0; is != num_shuffles; ++is) {
+              SRz.noalias() = shuffling_matrices[is] * partitions[ih].Rz;
+              beta_forming.middleRows (is * num_betas, num_betas).noalias() = c[ih].matrix() * pinvM * SRz;
+              residual_forming.middleRows (is * num_inputs(), num_inputs()).noalias() = Rm * SRz;
+            }
+
             const size_t dof = num_inputs() - partitions[ih].rank_x - partitions[ih].rank_z;
             const default_type one_over_dof = 1.0 / default_type(dof);
-            sse = (Rm*Sy).colwise().squaredNorm();
 #ifdef GLM_TEST_DEBUG
+            VAR (element_block_size);
             VAR (dof);
             VAR (one_over_dof);
-            VAR (sse.size());
 #endif
-            for (size_t ie = 0; ie != num_elements(); ++ie) {
-              beta.noalias() = c[ih].matrix() * lambdas.col (ie);
-              const default_type F = ((beta.transpose() * XtX[ih] * beta) (0,0) / c[ih].rank()) /
-                                     (one_over_dof * sse[ie]);
-              if (!std::isfinite (F)) {
-                stats  (ie, ih) = zstats (ie, ih) = value_type(0);
-              } else if (c[ih].is_F()) {
-                stats  (ie, ih) = F;
+
+            for (size_t block_start = 0; block_start != num_elements();) {
+              const size_t block_size = std::min (element_block_size, num_elements() - block_start);
+              y.block (block_start, block_size, data);
+
+              // Now, we regress the shuffled data against the full model
+              betas.noalias() = beta_forming * data;
+              residuals.noalias() = residual_forming * data;
+
+              for (size_t is = 0; is != num_shuffles; ++is) {
+                const auto beta = betas.middleRows (is * num_betas, num_betas);
+                XtXbetas.noalias() = XtX[ih] * beta;
+                F = ((beta.array() * XtXbetas.array()).colwise().sum() / default_type(c[ih].rank())) /
+                    (one_over_dof * residuals.middleRows (is * num_inputs(), num_inputs()).colwise().squaredNorm().array());
+                for (size_t i = 0; i != block_size; ++i) {
+                  const size_t ie = block_start + i;
+                  default_type stat, zstat;
+                  if (!std::isfinite (F[i])) {
+                    stat = zstat = value_type(0);
+                  } else if (c[ih].is_F()) {
+                    stat = F[i];
 #ifdef MRTRIX_USE_ZSTATISTIC_LOOKUP
-                zstats (ie, ih) = stat2z->F2z (F, c[ih].rank(), dof);
+                    zstat = stat2z->F2z (F[i], c[ih].rank(), dof);
 #else
-                zstats (ie, ih) = Math::F2z (F, c[ih].rank(), dof);
+                    zstat = Math::F2z (F[i], c[ih].rank(), dof);
 #endif
-              } else {
-                assert (beta.rows() == 1);
-                stats  (ie, ih) = std::sqrt (F) * (beta.sum() > 0.0 ? 1.0 : -1.0);
+                  } else {
+                    assert (num_betas == 1);
+                    stat = std::sqrt (F[i]) * (beta (0, i) > 0.0 ? 1.0 : -1.0);
 #ifdef MRTRIX_USE_ZSTATISTIC_LOOKUP
-                zstats (ie, ih) = stat2z->t2z (stats (ie, ih), dof);
+                    zstat = stat2z->t2z (stat, dof);
 #else
-                zstats (ie, ih) = Math::t2z (stats (ie, ih), dof);
+                    zstat = Math::t2z (stat, dof);
 #endif
+                  }
+                  if (stats)
+                    (*stats)[is] (ie, ih) = stat;
+                  zstats[is] (ie, ih) = zstat;
+                }
               }
+
+              block_start += block_size;
             }
 
           }
@@ -669,7 +745,7 @@ namespace MR
 
 
 
-        TestFixedHeteroscedastic::TestFixedHeteroscedastic (const matrix_type& measurements, const matrix_type& design, const vector<Hypothesis>& hypotheses, const index_array_type& variance_groups) :
+        TestFixedHeteroscedastic::TestFixedHeteroscedastic (const Measurements& measurements, const matrix_type& design, const vector<Hypothesis>& hypotheses, const index_array_type& variance_groups) :
             TestFixedHomoscedastic (measurements, design, hypotheses),
             VG (variance_groups),
             num_vgs (VG.maxCoeff() + 1),
@@ -711,107 +787,121 @@ namespace MR
           stats.resize (num_elements(), num_hypotheses());
           zstats.resize (num_elements(), num_hypotheses());
 
-          matrix_type Sy, lambdas;
+          matrix_type SRz, data, Sy, lambdas;
           Eigen::Array<default_type, Eigen::Dynamic, Eigen::Dynamic> sq_residuals, sse, Wterms;
           Eigen::Matrix<default_type, Eigen::Dynamic, 1> W (num_inputs());
 #ifdef GLM_TEST_DEBUG
           VAR (shuffling_matrix);
 #endif
 
+          // Measurement data are converted to double precision and processed one block
+          //   of elements at a time, such that no full-size matrix is ever constructed;
+          //   any short remainder is absorbed into the final block
+          constexpr size_t element_block_size = 1024;
+
           for (size_t ih = 0; ih != c.size(); ++ih) {
-            // First two steps are identical to the homoscedastic case
-            Sy.noalias() = shuffling_matrix * partitions[ih].Rz * y;
+            SRz.noalias() = shuffling_matrix * partitions[ih].Rz;
+            for (size_t block_start = 0; block_start != num_elements();) {
+              size_t block_size = std::min (element_block_size, num_elements() - block_start);
+              if (num_elements() - (block_start + block_size) < 32)
+                block_size = num_elements() - block_start;
+              // First two steps are identical to the homoscedastic case
+              y.block (block_start, block_size, data);
+              Sy.noalias() = SRz * data;
 #ifdef GLM_TEST_DEBUG
-            VAR (Sy);
+              VAR (Sy);
 #endif
-            lambdas.noalias() = pinvM * Sy;
+              lambdas.noalias() = pinvM * Sy;
 #ifdef GLM_TEST_DEBUG
-            VAR (lambdas);
+              VAR (lambdas);
 #endif
-            // Compute sum of residuals per VG immediately
-            // Variance groups appear across rows, and one column per element tested
-            // Immediately calculate squared residuals; simplifies summation over variance groups
-            sq_residuals = (Rm*Sy).array().square();
+              // Compute sum of residuals per VG immediately
+              // Variance groups appear across rows, and one column per element tested
+              // Immediately calculate squared residuals; simplifies summation over variance groups
+              sq_residuals = (Rm*Sy).array().square();
 #ifdef GLM_TEST_DEBUG
-            VAR (sq_residuals);
-            VAR (sq_residuals.rows());
-            VAR (sq_residuals.cols());
+              VAR (sq_residuals);
+              VAR (sq_residuals.rows());
+              VAR (sq_residuals.cols());
 #endif
-            sse = matrix_type::Zero (num_variance_groups(), num_elements());
-            for (size_t input = 0; input != num_inputs(); ++input)
-              sse.row(VG[input]) += sq_residuals.row(input);
+              sse = matrix_type::Zero (num_variance_groups(), block_size);
+              for (size_t input = 0; input != num_inputs(); ++input)
+                sse.row(VG[input]) += sq_residuals.row(input);
 #ifdef GLM_TEST_DEBUG
-            VAR (sse);
-            VAR (sse.rows());
-            VAR (sse.cols());
+              VAR (sse);
+              VAR (sse.rows());
+              VAR (sse.cols());
 #endif
-            // These terms are what appears in the weighting matrix based on the VG to which each input belongs;
-            //   one row per variance group, one column per element to be tested
-            Wterms = sse.array().inverse().colwise() * Rnn_sums;
-            for (size_t col = 0; col != num_elements(); ++col) {
-              for (size_t row = 0; row != num_vgs; ++row) {
-                if (!std::isfinite (Wterms (row, col)))
-                  Wterms (row, col) = 0.0;
+              // These terms are what appears in the weighting matrix based on the VG to which each input belongs;
+              //   one row per variance group, one column per element to be tested
+              Wterms = sse.array().inverse().colwise() * Rnn_sums;
+              for (size_t col = 0; col != block_size; ++col) {
+                for (size_t row = 0; row != num_vgs; ++row) {
+                  if (!std::isfinite (Wterms (row, col)))
+                    Wterms (row, col) = 0.0;
+                }
               }
-            }
 #ifdef GLM_TEST_DEBUG
-            VAR (Wterms);
-            VAR (Wterms.rows());
-            VAR (Wterms.cols());
+              VAR (Wterms);
+              VAR (Wterms.rows());
+              VAR (Wterms.cols());
 #endif
-            for (size_t ie = 0; ie != num_elements(); ++ie) {
-              // Need to construct the weights diagonal matrix; is unique for each element
-              default_type W_trace (0.0);
-              for (size_t input = 0; input != num_inputs(); ++input) {
-                W[input] = Wterms(VG[input], ie);
-                W_trace += W[input];
-              }
+              for (size_t i = 0; i != block_size; ++i) {
+                const size_t ie = block_start + i;
+                // Need to construct the weights diagonal matrix; is unique for each element
+                default_type W_trace (0.0);
+                for (size_t input = 0; input != num_inputs(); ++input) {
+                  W[input] = Wterms(VG[input], i);
+                  W_trace += W[input];
+                }
 #ifdef GLM_TEST_DEBUG
-              VAR (W_trace);
+                VAR (W_trace);
 #endif
-              const default_type numerator = lambdas.col (ie).transpose() * c[ih].matrix().transpose() * (c[ih].matrix() * (M.transpose() * W.asDiagonal() * M).inverse() * c[ih].matrix().transpose()).inverse() * c[ih].matrix() * lambdas.col (ie);
+                const default_type numerator = lambdas.col (i).transpose() * c[ih].matrix().transpose() * (c[ih].matrix() * (M.transpose() * W.asDiagonal() * M).inverse() * c[ih].matrix().transpose()).inverse() * c[ih].matrix() * lambdas.col (i);
 #ifdef GLM_TEST_DEBUG
-              VAR (numerator);
+                VAR (numerator);
 #endif
-              default_type gamma (0.0);
-              for (size_t vg_index = 0; vg_index != num_vgs; ++vg_index)
-                // Since Wnn is the same for every n in the variance group, can compute that summation as the product of:
-                //   - the value inserted in W for that particular VG
-                //   - the number of inputs that are a part of that VG
-                gamma += inv_Rnn_sums[vg_index] * Math::pow2 (1.0 - ((Wterms(vg_index, ie) * inputs_per_vg[vg_index]) / W_trace));
-              gamma = 1.0 + (gamma_weights[ih] * gamma);
+                default_type gamma (0.0);
+                for (size_t vg_index = 0; vg_index != num_vgs; ++vg_index)
+                  // Since Wnn is the same for every n in the variance group, can compute that summation as the product of:
+                  //   - the value inserted in W for that particular VG
+                  //   - the number of inputs that are a part of that VG
+                  gamma += inv_Rnn_sums[vg_index] * Math::pow2 (1.0 - ((Wterms(vg_index, i) * inputs_per_vg[vg_index]) / W_trace));
+                gamma = 1.0 + (gamma_weights[ih] * gamma);
 #ifdef GLM_TEST_DEBUG
-              VAR (gamma);
+                VAR (gamma);
 #endif
-              const default_type denominator = gamma * c[ih].rank();
-              const default_type G = numerator / denominator;
-              if (!std::isfinite (G)) {
-                stats  (ie, ih) = zstats (ie, ih) = value_type(0);
-              } else {
-                stats  (ie, ih) = c[ih].is_F() ?
-                                  G :
-                                  std::sqrt (G) * ((c[ih].matrix() * lambdas.col (ie)).sum() > 0.0 ? 1.0 : -1.0);
-                if (c[ih].is_F() && c[ih].rank() > 1) {
-                  const default_type dof = 2.0 * default_type(c[ih].rank() - 1) / (3.0 * (gamma - 1.0));
+                const default_type denominator = gamma * c[ih].rank();
+                const default_type G = numerator / denominator;
+                if (!std::isfinite (G)) {
+                  stats  (ie, ih) = zstats (ie, ih) = value_type(0);
+                } else {
+                  stats  (ie, ih) = c[ih].is_F() ?
+                                    G :
+                                    std::sqrt (G) * ((c[ih].matrix() * lambdas.col (i)).sum() > 0.0 ? 1.0 : -1.0);
+                  if (c[ih].is_F() && c[ih].rank() > 1) {
+                    const default_type dof = 2.0 * default_type(c[ih].rank() - 1) / (3.0 * (gamma - 1.0));
 #ifdef GLM_TEST_DEBUG
-                  VAR (dof);
+                    VAR (dof);
 #endif
-                  zstats (ie, ih) = stat2z->F2z (G, c[ih].rank(), dof);
-                } else {
-                  const default_type dof = Math::welch_satterthwaite (Wterms.col (ie).inverse(), inputs_per_vg);
+                    zstats (ie, ih) = stat2z->F2z (G, c[ih].rank(), dof);
+                  } else {
+                    const default_type dof = Math::welch_satterthwaite (Wterms.col (i).inverse(), inputs_per_vg);
 #ifdef GLM_TEST_DEBUG
-                  VAR (dof);
+                    VAR (dof);
 #endif
-                  zstats (ie, ih) = c[ih].is_F() ?
+                    zstats (ie, ih) = c[ih].is_F() ?
 #ifdef MRTRIX_USE_ZSTATISTIC_LOOKUP
-                                    stat2z->G2z (G, c[ih].rank(), dof) :
-                                    stat2z->v2z (stats (ie, ih), dof);
+                                      stat2z->G2z (G, c[ih].rank(), dof) :
+                                      stat2z->v2z (stats (ie, ih), dof);
 #else
-                                    Math::F2z (G, c[ih].rank(), dof) :
-                                    Math::t2z (stats (ie, ih), dof);
+                                      Math::F2z (G, c[ih].rank(), dof) :
+                                      Math::t2z (stats (ie, ih), dof);
 #endif
+                  }
                 }
               }
+              block_start += block_size;
             }
 
           }
@@ -829,7 +919,7 @@ namespace MR
 
 
         TestVariableHomoscedastic::TestVariableHomoscedastic (const vector<CohortDataImport>& importers,
-                                                              const matrix_type& measurements,
+                                                              const Measurements& measurements,
                                                               const matrix_type& design,
                                                               const vector<Hypothesis>& hypotheses,
                                                               const bool nans_in_data,
@@ -837,7 +927,8 @@ namespace MR
             TestBase (measurements, design, hypotheses),
             importers (importers),
             nans_in_data (nans_in_data),
-            nans_in_columns (nans_in_columns)
+            nans_in_columns (nans_in_columns),
+            unmasked_design (new MaskedDesign (M, BitSet (M.rows(), true)))
         {
           // Make sure that the specified contrast matrix reflects the full design matrix (with additional
           //   data loaded)
@@ -853,15 +944,13 @@ namespace MR
           stats .resize (num_elements(), num_hypotheses());
           zstats.resize (num_elements(), num_hypotheses());
 
-          matrix_type dof (num_elements(), num_hypotheses());
           matrix_type extra_column_data (num_inputs(), importers.size());
           BitSet element_mask (num_inputs());
-          matrix_type shuffling_matrix_masked, Mfull_masked, pinvMfull_masked, Rm;
-          vector_type y_masked, Sy, lambda;
-          matrix_type XtX, beta;
+          Model model;
+          vector_type y_masked, a, Rzy, Sy, b, beta;
 
           // Let's loop over elements first, then hypotheses in the inner loop
-          for (ssize_t ie = 0; ie != y.cols(); ++ie) {
+          for (size_t ie = 0; ie != num_elements(); ++ie) {
 
             // For each element (row in y), need to load the additional data for that element
             //   for all subjects in order to construct the design matrix
@@ -876,17 +965,15 @@ namespace MR
             // - Import the element-wise data
             // - Identify rows to be excluded based on NaNs in the design matrix
             // - Identify rows to be excluded based on NaNs in the input data
+            // - Obtain the QR decomposition of the fixed design matrix with those rows
+            //   excluded; this is shared between all elements with the same pattern
+            //   of excluded inputs
+            // - Append the element-wise columns to that decomposition
             //
-            // Note that this is going to have to operate slightly differently to
-            //   how it used to be done, i.e. via the permutation labelling vector,
-            //   if we are to support taking the shuffling matrix as input to this functor
-            // I think the approach will have to be:
-            //   - Both NaNs in design matrix and NaNs in input data need to be removed
-            //     in order to perform the initial regression against nuisance variables
-            //   - Can then remove the corresponding _columns_ of the permutation matrix?
-            //     No, don't think it's removal of columns; think it's removal of any rows
-            //     that contain non-zero values in those columns
-            //
+            // Both NaNs in design matrix and NaNs in input data need to be removed
+            //   in order to perform the initial regression against nuisance variables;
+            //   the shuffling matrix is then reduced by removing any rows that contain
+            //   non-zero values in the columns corresponding to excluded inputs
             get_mask (ie, element_mask, extra_column_data);
             const size_t finite_count = element_mask.count();
             // Additional rejection here:
@@ -897,81 +984,75 @@ namespace MR
             if (finite_count < std::min (num_inputs(), 2 * num_factors())) {
               stats.row (ie).setZero();
               zstats.row (ie).setZero();
-              dof.row (ie).fill (NaN);
-            } else {
-              apply_mask (element_mask,
-                          y.col (ie),
-                          shuffling_matrix,
-                          extra_column_data,
-                          Mfull_masked,
-                          shuffling_matrix_masked,
-                          y_masked);
-              assert (Mfull_masked.allFinite());
-
-              // Test condition number of NaN-masked & data-filled design matrix;
-              //   need to skip statistical testing if it is too poor
-              // TODO Condition number testing may be quite slow;
-              //   would a rank calculation with tolerance be faster?
-              const default_type condition_number = Math::condition_number (Mfull_masked);
-              if (!std::isfinite (condition_number) || condition_number > 1e5) {
-                stats.row (ie).fill (0.0);
-                zstats.row (ie).fill (0.0);
-                dof.row (ie).fill (NaN);
-              } else {
-
-                pinvMfull_masked = Math::pinv (Mfull_masked);
+              continue;
+            }
 
-                Rm.noalias() = matrix_type::Identity (finite_count, finite_count) - (Mfull_masked*pinvMfull_masked);
+            const auto design = get_design (element_mask);
+            // Need to skip statistical testing if the condition number of the
+            //   NaN-masked & data-filled design matrix is too poor
+            if (!factorise (*design, extra_column_data, model)) {
+              stats.row (ie).setZero();
+              zstats.row (ie).setZero();
+              continue;
+            }
 
-                // We now have our permutation (shuffling) matrix and design matrix prepared,
-                //   and can commence regressing the partitioned model of each hypothesis
-                for (size_t ih = 0; ih != c.size(); ++ih) {
+            y_masked.resize (finite_count);
+            for (size_t i = 0; i != finite_count; ++i)
+              y_masked[i] = y (design->included[i], ie);
+            assert (y_masked.allFinite());
+            a.matrix().noalias() = model.Q.transpose() * y_masked.matrix();
 
-                  const auto partition = c[ih].partition (Mfull_masked);
-                  dof (ie, ih) = finite_count - partition.rank_x - partition.rank_z;
-                  if (dof (ie, ih) < 1) {
-                    stats (ie, ih) = zstats (ie, ih) = dof (ie, ih) = value_type(0);
-                  } else {
+            const default_type dof = finite_count - num_factors();
 
-                    XtX.noalias() = partition.X.transpose()*partition.X;
+            for (size_t ih = 0; ih != c.size(); ++ih) {
 
-                    // Now that we have the individual hypothesis model partition for these data,
-                    //   the rest of this function should proceed similarly to the fixed
-                    //   design matrix case
-                    Sy = shuffling_matrix_masked * partition.Rz * y_masked.matrix();
-                    lambda = pinvMfull_masked * Sy.matrix();
-                    beta.noalias() = c[ih].matrix() * lambda.matrix();
-                    const default_type sse = (Rm*Sy.matrix()).squaredNorm();
+              if (dof < 1) {
+                stats (ie, ih) = zstats (ie, ih) = value_type(0);
+                continue;
+              }
 
-                    const default_type F = ((beta.transpose() * XtX * beta) (0, 0) / c[ih].rank()) /
-                                            (sse / dof (ie, ih));
+              // Regress out the nuisance regressors of this hypothesis' partition:
+              //   the column space of Z is that part of the column space of the
+              //   design matrix that is orthogonal to the effect of interest
+              Rzy.matrix().noalias() = model.Qx[ih].transpose() * a.matrix();
+              b.matrix().noalias() = model.Qx[ih] * Rzy.matrix();
+              b = a - b;
+              Rzy = y_masked;
+              Rzy.matrix().noalias() -= model.Q * b.matrix();
+
+              // Now that we have the individual hypothesis model partition for these data,
+              //   the rest of this function should proceed similarly to the fixed
+              //   design matrix case
+              shuffle (shuffling_matrix, *design, Rzy, Sy);
+              b.matrix().noalias() = model.Q.transpose() * Sy.matrix();
+              beta.matrix().noalias() = model.W[ih].transpose() * b.matrix();
+              Rzy = Sy;
+              Rzy.matrix().noalias() -= model.Q * b.matrix();
+              const default_type sse = Rzy.matrix().squaredNorm();
+
+              const default_type F = ((beta.matrix().transpose() * model.XtX[ih] * beta.matrix()) (0, 0) / c[ih].rank()) /
+                                      (sse / dof);
 
-                    if (!std::isfinite (F)) {
-                      stats  (ie, ih) = zstats (ie, ih) = value_type(0);
-                    } else if (c[ih].is_F()) {
-                      stats  (ie, ih) = F;
+              if (!std::isfinite (F)) {
+                stats  (ie, ih) = zstats (ie, ih) = value_type(0);
+              } else if (c[ih].is_F()) {
+                stats  (ie, ih) = F;
 #ifdef MRTRIX_USE_ZSTATISTIC_LOOKUP
-                      zstats (ie, ih) = stat2z->F2z (F, c[ih].rank(), dof (ie, ih));
+                zstats (ie, ih) = stat2z->F2z (F, c[ih].rank(), dof);
 #else
-                      zstats (ie, ih) = Math::F2z (F, c[ih].rank(), dof (ie, ih));
+                zstats (ie, ih) = Math::F2z (F, c[ih].rank(), dof);
 #endif
-                    } else {
-                      assert (beta.rows() == 1);
-                      stats  (ie, ih) = std::sqrt (F) * (beta.sum() > 0 ? 1.0 : -1.0);
+              } else {
+                assert (beta.size() == 1);
+                stats  (ie, ih) = std::sqrt (F) * (beta.sum() > 0 ? 1.0 : -1.0);
 #ifdef MRTRIX_USE_ZSTATISTIC_LOOKUP
-                      zstats (ie, ih) = stat2z->t2z (stats (ie, ih), dof (ie, ih));
+                zstats (ie, ih) = stat2z->t2z (stats (ie, ih), dof);
 #else
-                      zstats (ie, ih) = Math::t2z (stats (ie, ih), dof (ie, ih));
+                zstats (ie, ih) = Math::t2z (stats (ie, ih), dof);
 #endif
-                    }
-
-                  } // End checking for sufficient degrees of freedom
-
-                } // End looping over hypotheses
-
-              } // End checking for adequate condition number after NaN removal
+              }
 
-            } // End checking for adequate number of remaining inputs after NaN removal
+            } // End looping over hypotheses
 
           } // End looping over elements
 
@@ -988,7 +1069,7 @@ namespace MR
         {
           mask.clear (true);
           if (nans_in_data) {
-            for (ssize_t row = 0; row != y.rows(); ++row) {
+            for (size_t row = 0; row != y.rows(); ++row) {
               if (!std::isfinite (y (row, ie)))
                 mask[row] = false;
             }
@@ -1003,67 +1084,137 @@ namespace MR
 
 
 
-        void TestVariableHomoscedastic::apply_mask (const BitSet& mask,
-                                                    matrix_type::ConstColXpr data,
-                                                    const matrix_type& shuffling_matrix,
-                                                    const matrix_type& extra_column_data,
-                                                    matrix_type& Mfull_masked,
-                                                    matrix_type& shuffling_matrix_masked,
-                                                    vector_type& data_masked) const
+        TestVariableHomoscedastic::MaskedDesign::MaskedDesign (const matrix_type& design, const BitSet& mask)
         {
-          const size_t finite_count = mask.count();
-          // Do we need to reduce the size of our matrices / vectors
-          //   based on the presence of non-finite values?
-          if (finite_count == num_inputs()) {
+          for (size_t i = 0; i != mask.size(); ++i) {
+            if (mask[i])
+              included.push_back (i);
+            else
+              excluded.push_back (i);
+          }
+          const ssize_t n = included.size(), p = design.cols();
+          matrix_type masked (n, p);
+          for (ssize_t i = 0; i != n; ++i)
+            masked.row (i) = design.row (included[i]);
+          if (p) {
+            Eigen::HouseholderQR<matrix_type> qr (masked);
+            Q = qr.householderQ() * matrix_type::Identity (n, p);
+            R = qr.matrixQR().topRows (p).triangularView<Eigen::Upper>();
+          } else {
+            Q.resize (n, 0);
+            R.resize (0, 0);
+          }
+        }
+
 
-            Mfull_masked.resize (num_inputs(), num_factors());
-            Mfull_masked.block (0, 0, num_inputs(), M.cols()) = M;
-            Mfull_masked.block (0, M.cols(), num_inputs(), extra_column_data.cols()) = extra_column_data;
-            shuffling_matrix_masked = shuffling_matrix;
-            data_masked = data;
 
+        std::shared_ptr<const TestVariableHomoscedastic::MaskedDesign> TestVariableHomoscedastic::get_design (const BitSet& mask) const
+        {
+          if (mask.full())
+            return unmasked_design;
+          vector<size_t> excluded;
+          for (size_t i = 0; i != mask.size(); ++i) {
+            if (!mask[i])
+              excluded.push_back (i);
+          }
+          {
+            std::lock_guard<std::mutex> lock (masked_designs_mutex);
+            auto it = masked_designs.find (excluded);
+            if (it != masked_designs.end())
+              return it->second;
+          }
+          // Computed outside of the lock; if another thread has concurrently
+          //   computed the same decomposition, the first one inserted is retained
+          std::shared_ptr<const MaskedDesign> result (new MaskedDesign (M, mask));
+          // Bound memory usage in the (unlikely) case where there is a very
+          //   large number of unique patterns of excluded inputs
+          constexpr size_t max_cached_designs = 4096;
+          std::lock_guard<std::mutex> lock (masked_designs_mutex);
+          if (masked_designs.size() < max_cached_designs)
+            return masked_designs.insert (std::make_pair (std::move (excluded), result)).first->second;
+          return result;
+        }
+
+
+
+        bool TestVariableHomoscedastic::factorise (const MaskedDesign& design, const matrix_type& extra_column_data, Model& model) const
+        {
+          const ssize_t n = design.included.size(), p = M.cols(), k = importers.size();
+          model.extra.resize (n, k);
+          for (ssize_t i = 0; i != n; ++i)
+            model.extra.row (i) = extra_column_data.row (design.included[i]);
+          assert (model.extra.allFinite());
+
+          if (k) {
+            // Orthogonalise the element-wise columns with respect to the (cached)
+            //   fixed design matrix decomposition, with a second pass for numerical
+            //   stability; only the remainder then requires decomposition
+            model.B.noalias() = design.Q.transpose() * model.extra;
+            model.extra.noalias() -= design.Q * model.B;
+            const matrix_type correction = design.Q.transpose() * model.extra;
+            model.extra.noalias() -= design.Q * correction;
+            model.B += correction;
+            Eigen::HouseholderQR<matrix_type> qr (model.extra);
+            model.Q.resize (n, p+k);
+            model.Q.leftCols (p) = design.Q;
+            model.Q.rightCols (k) = qr.householderQ() * matrix_type::Identity (n, k);
+            model.R = matrix_type::Zero (p+k, p+k);
+            model.R.topLeftCorner (p, p) = design.R;
+            model.R.topRightCorner (p, k) = model.B;
+            model.R.bottomRightCorner (k, k) = qr.matrixQR().topRows (k).triangularView<Eigen::Upper>();
           } else {
+            model.Q = design.Q;
+            model.R = design.R;
+          }
 
-            Mfull_masked.resize (finite_count, num_factors());
-            data_masked.resize (finite_count);
-            BitSet perm_matrix_mask (num_inputs(), true);
-            size_t out_index = 0;
-            for (size_t in_index = 0; in_index != num_inputs(); ++in_index) {
-              if (mask[in_index]) {
-                Mfull_masked.block (out_index, 0, 1, M.cols()) = M.row (in_index);
-                Mfull_masked.block (out_index, M.cols(), 1, extra_column_data.cols()) = extra_column_data.row (in_index);
-                data_masked[out_index++] = data[in_index];
-              } else {
-                // Any row in the permutation matrix that contains a non-zero entry
-                //   in the column corresponding to in_row needs to be removed
-                //   from the permutation matrix
-                for (ssize_t perm_row = 0; perm_row != shuffling_matrix.rows(); ++perm_row) {
-                  if (shuffling_matrix (perm_row, in_index))
-                    perm_matrix_mask[perm_row] = false;
-                }
+          // Condition number of the design matrix is equal to that of R
+          const default_type condition_number = Math::condition_number (model.R);
+          if (!std::isfinite (condition_number) || condition_number > 1e5)
+            return false;
+
+          model.W.resize (c.size());
+          model.Qx.resize (c.size());
+          model.XtX.resize (c.size());
+          for (size_t ih = 0; ih != c.size(); ++ih) {
+            model.W[ih] = model.R.transpose().triangularView<Eigen::Lower>().solve (c[ih].matrix().transpose());
+            model.XtX[ih] = (model.W[ih].transpose() * model.W[ih]).inverse();
+            Eigen::HouseholderQR<matrix_type> qr (model.W[ih]);
+            model.Qx[ih] = qr.householderQ() * matrix_type::Identity (p+k, model.W[ih].cols());
+          }
+          return true;
+        }
+
+
+
+        void TestVariableHomoscedastic::shuffle (const matrix_type& shuffling_matrix,
+                                                 const MaskedDesign& design,
+                                                 const vector_type& in,
+                                                 vector_type& out) const
+        {
+          if (design.excluded.empty()) {
+            out.matrix().noalias() = shuffling_matrix * in.matrix();
+            return;
+          }
+          vector_type full = vector_type::Zero (num_inputs());
+          for (size_t i = 0; i != design.included.size(); ++i)
+            full[design.included[i]] = in[i];
+          const vector_type shuffled = shuffling_matrix * full.matrix();
+          out.resize (design.included.size());
+          size_t out_index = 0;
+          for (ssize_t row = 0; row != shuffling_matrix.rows(); ++row) {
+            // Any row in the shuffling matrix that contains a non-zero entry
+            //   in a column corresponding to an excluded input is removed
+            bool keep = true;
+            for (auto col : design.excluded) {
+              if (shuffling_matrix (row, col)) {
+                keep = false;
+                break;
               }
             }
-            assert (out_index == finite_count);
-            assert (perm_matrix_mask.count() == finite_count);
-            assert (data_masked.allFinite());
-            // Only after we've reduced the design matrix do we now reduce the shuffling matrix
-            // Step 1: Remove rows that contain non-zero entries in columns to be removed
-            matrix_type temp (finite_count, num_inputs());
-            out_index = 0;
-            for (size_t in_index = 0; in_index != num_inputs(); ++in_index) {
-              if (perm_matrix_mask[in_index])
-                temp.row (out_index++) = shuffling_matrix.row (in_index);
-            }
-            assert (out_index == finite_count);
-            // Step 2: Remove columns
-            shuffling_matrix_masked.resize (finite_count, finite_count);
-            out_index = 0;
-            for (size_t in_index = 0; in_index != num_inputs(); ++in_index) {
-              if (mask[in_index])
-                shuffling_matrix_masked.col (out_index++) = temp.col (in_index);
-            }
-            assert (out_index == finite_count);
+            if (keep)
+              out[out_index++] = shuffled[row];
           }
+          assert (out_index == design.included.size());
         }
 
 
@@ -1079,7 +1230,7 @@ namespace MR
 
 
         TestVariableHeteroscedastic::TestVariableHeteroscedastic (const vector<CohortDataImport>& importers,
-                                                                  const matrix_type& measurements,
+                                                                  const Measurements& measurements,
                                                                   const matrix_type& design,
                                                                   const vector<Hypothesis>& hypotheses,
                                                                   const index_array_type& variance_groups,
@@ -1106,12 +1257,13 @@ namespace MR
 
           matrix_type extra_column_data (num_inputs(), importers.size());
           BitSet element_mask (num_inputs());
-          matrix_type Mfull_masked, shuffling_matrix_masked, pinvMfull_masked, Rm;
+          Model model;
+          matrix_type QtWQ, Wc;
           Eigen::Matrix<default_type, Eigen::Dynamic, 1> W;
           index_array_type VG_masked, VG_counts;
-          vector_type y_masked, Sy, lambda, sq_residuals, sse, Rnn_sums, Wterms;
+          vector_type y_masked, a, Rzy, Sy, b, beta, Rnn, sq_residuals, sse, Rnn_sums, Wterms;
 
-          for (ssize_t ie = 0; ie != y.cols(); ++ie) {
+          for (size_t ie = 0; ie != num_elements(); ++ie) {
             // Common ground to the TestVariableHomoscedastic case
             for (ssize_t col = 0; col != ssize_t(importers.size()); ++col)
               extra_column_data.col (col) = importers[col] (ie);
@@ -1120,92 +1272,99 @@ namespace MR
             if (finite_count < std::min (num_inputs(), 2 * num_factors())) {
               stats.row (ie).setZero();
               zstats.row (ie).setZero();
-            } else {
-              apply_mask (element_mask,
-                          y.col (ie),
-                          shuffling_matrix,
-                          extra_column_data,
-                          Mfull_masked,
-                          shuffling_matrix_masked,
-                          y_masked);
-              const default_type condition_number = Math::condition_number (Mfull_masked);
-              if (!std::isfinite (condition_number) || condition_number > 1e5) {
-                stats.row (ie).fill (0.0);
-                zstats.row (ie).fill (0.0);
+              continue;
+            }
+            const auto design = get_design (element_mask);
+            if (!factorise (*design, extra_column_data, model)) {
+              stats.row (ie).setZero();
+              zstats.row (ie).setZero();
+              continue;
+            }
+            apply_mask_VG (*design, VG_masked, VG_counts);
+            if (VG_counts.minCoeff() <= 1) {
+              stats.row (ie).setZero();
+              zstats.row (ie).setZero();
+              continue;
+            }
+
+            y_masked.resize (finite_count);
+            for (size_t i = 0; i != finite_count; ++i)
+              y_masked[i] = y (design->included[i], ie);
+            a.matrix().noalias() = model.Q.transpose() * y_masked.matrix();
+            // Diagonal of the residual-forming matrix
+            Rnn = 1.0 - model.Q.rowwise().squaredNorm().array();
+
+            for (size_t ih = 0; ih != c.size(); ++ih) {
+
+              Rzy.matrix().noalias() = model.Qx[ih].transpose() * a.matrix();
+              b.matrix().noalias() = model.Qx[ih] * Rzy.matrix();
+              b = a - b;
+              Rzy = y_masked;
+              Rzy.matrix().noalias() -= model.Q * b.matrix();
+
+              // At this point the implementation diverges from the TestVariableHomoscedastic case,
+              //   more closely mimicing the TestFixedHeteroscedastic case
+              shuffle (shuffling_matrix, *design, Rzy, Sy);
+              b.matrix().noalias() = model.Q.transpose() * Sy.matrix();
+              beta.matrix().noalias() = model.W[ih].transpose() * b.matrix();
+              Rzy = Sy;
+              Rzy.matrix().noalias() -= model.Q * b.matrix();
+              sq_residuals = Rzy.square();
+              sse = vector_type::Zero (num_variance_groups());
+              Rnn_sums = vector_type::Zero (num_variance_groups());
+              for (size_t input = 0; input != finite_count; ++input) {
+                sse[VG_masked[input]] += sq_residuals[input];
+                Rnn_sums[VG_masked[input]] += Rnn[input];
+              }
+              Wterms = sse.inverse() * Rnn_sums;
+              for (size_t vg = 0; vg != num_vgs; ++vg) {
+                if (!std::isfinite (Wterms[vg]))
+                  Wterms[vg] = 0.0;
+              }
+              default_type W_trace (0.0);
+              W.resize (finite_count);
+              for (size_t input = 0; input != finite_count; ++input) {
+                W[input] = Wterms[VG_masked[input]];
+                W_trace += W[input];
+              }
+
+              // c (M^T W M)^-1 c^T = W_c^T (Q^T W Q)^-1 W_c
+              QtWQ.noalias() = model.Q.transpose() * W.asDiagonal() * model.Q;
+              Wc.noalias() = QtWQ.inverse() * model.W[ih];
+              const default_type numerator = beta.matrix().transpose() * (model.W[ih].transpose() * Wc).inverse() * beta.matrix();
+
+              default_type gamma (0.0);
+              for (size_t vg_index = 0; vg_index != num_vgs; ++vg_index)
+                gamma += Math::pow2 (1.0 - ((Wterms[vg_index] * VG_counts[vg_index]) / W_trace)) / Rnn_sums[vg_index];
+              gamma = 1.0 + (gamma_weights[ih] * gamma);
+
+              const default_type denominator = gamma * c[ih].rank();
+              const default_type G = numerator / denominator;
+
+              if (!std::isfinite (G)) {
+                stats  (ie, ih) = zstats (ie, ih) = value_type(0);
               } else {
-                apply_mask_VG (element_mask, VG_masked, VG_counts);
-                if (VG_counts.minCoeff() <= 1) {
-                  stats.row (ie).fill (0.0);
-                  zstats.row (ie).fill (0.0);
+                stats  (ie, ih) = c[ih].is_F() ?
+                                  G :
+                                  std::sqrt (G) * (beta.sum() > 0.0 ? 1.0 : -1.0);
+                if (c[ih].is_F() && c[ih].rank() > 1) {
+                  const default_type dof = 2.0 * default_type(c[ih].rank() - 1) / (3.0 * (gamma - 1.0));
+                  zstats (ie, ih) = stat2z->F2z (G, c[ih].rank(), dof);
                 } else {
-                  pinvMfull_masked = Math::pinv (Mfull_masked);
-                  Rm.noalias() = matrix_type::Identity (finite_count, finite_count) - (Mfull_masked*pinvMfull_masked);
-                  for (size_t ih = 0; ih != c.size(); ++ih) {
-                    const auto partition = c[ih].partition (Mfull_masked);
-
-                    // At this point the implementation diverges from the TestVariableHomoscedastic case,
-                    //   more closely mimicing the TestFixedHeteroscedastic case
-                    Sy = shuffling_matrix_masked * partition.Rz * y_masked.matrix();
-                    lambda = pinvMfull_masked * Sy.matrix();
-                    sq_residuals = (Rm*Sy.matrix()).array().square();
-                    sse = vector_type::Zero (num_variance_groups());
-                    Rnn_sums = vector_type::Zero (num_variance_groups());
-                    for (size_t input = 0; input != finite_count; ++input) {
-                      sse[VG_masked[input]] += sq_residuals[input];
-                      Rnn_sums[VG_masked[input]] += Rm.diagonal()[input];
-                    }
-                    Wterms = sse.inverse() * Rnn_sums;
-                    for (size_t vg = 0; vg != num_vgs; ++vg) {
-                      if (!std::isfinite (Wterms[vg]))
-                        Wterms[vg] = 0.0;
-                    }
-                    default_type W_trace (0.0);
-                    W.resize (finite_count);
-                    for (size_t input = 0; input != finite_count; ++input) {
-                      W[input] = Wterms[VG_masked[input]];
-                      W_trace += W[input];
-                    }
-
-                    const default_type numerator = lambda.matrix().transpose() * c[ih].matrix().transpose() * (c[ih].matrix() * (Mfull_masked.transpose() * W.asDiagonal() * Mfull_masked).inverse() * c[ih].matrix().transpose()).inverse() * c[ih].matrix() * lambda.matrix();
-
-                    default_type gamma (0.0);
-                    for (size_t vg_index = 0; vg_index != num_vgs; ++vg_index)
-                      gamma += Math::pow2 (1.0 - ((Wterms[vg_index] * VG_counts[vg_index]) / W_trace)) / Rnn_sums[vg_index];
-                    gamma = 1.0 + (gamma_weights[ih] * gamma);
-
-                    const default_type denominator = gamma * c[ih].rank();
-                    const default_type G = numerator / denominator;
-
-                    if (!std::isfinite (G)) {
-                      stats  (ie, ih) = zstats (ie, ih) = value_type(0);
-                    } else {
-                      stats  (ie, ih) = c[ih].is_F() ?
-                                        G :
-                                        std::sqrt (G) * ((c[ih].matrix() * lambda.matrix()).sum() > 0.0 ? 1.0 : -1.0);
-                      if (c[ih].is_F() && c[ih].rank() > 1) {
-                        const default_type dof = 2.0 * default_type(c[ih].rank() - 1) / (3.0 * (gamma - 1.0));
-                        zstats (ie, ih) = stat2z->F2z (G, c[ih].rank(), dof);
-                      } else {
-                        const default_type dof = Math::welch_satterthwaite (Wterms.inverse(), VG_counts);
-                        zstats (ie, ih) = c[ih].is_F() ?
+                  const default_type dof = Math::welch_satterthwaite (Wterms.inverse(), VG_counts);
+                  zstats (ie, ih) = c[ih].is_F() ?
 #ifdef MRTRIX_USE_ZSTATISTIC_LOOKUP
-                                          stat2z->G2z (G, c[ih].rank(), dof) :
-                                          stat2z->v2z (stats (ie, ih), dof);
+                                    stat2z->G2z (G, c[ih].rank(), dof) :
+                                    stat2z->v2z (stats (ie, ih), dof);
 #else
-                                          Math::F2z (G, c[ih].rank(), dof) :
-                                          Math::t2z (stats (ie, ih), dof);
+                                    Math::F2z (G, c[ih].rank(), dof) :
+                                    Math::t2z (stats (ie, ih), dof);
 #endif
-                      } // End switching for F-test with rank > 1
+                } // End switching for F-test with rank > 1
 
-                    } // End checking for G being finite
+              } // End checking for G being finite
 
-                  } // End looping over hypotheses for this element
-
-                } // End check for preservation of at least two elements in each VG
-
-              } // End checking for adequate condition number after NaN removal
-
-            } // End checking for adequate number of remaining inputs after NaN removal
+            } // End looping over hypotheses for this element
 
           } // End looping over elements
         }
@@ -1214,20 +1373,16 @@ namespace MR
 
 
 
-        void TestVariableHeteroscedastic::apply_mask_VG (const BitSet& mask,
+        void TestVariableHeteroscedastic::apply_mask_VG (const MaskedDesign& design,
                                                          index_array_type& VG_masked,
                                                          index_array_type& VG_counts) const
         {
-          VG_masked.resize (mask.count());
+          VG_masked.resize (design.included.size());
           VG_counts = index_array_type::Zero (num_vgs);
-          size_t out_index = 0;
-          for (size_t in_index = 0; in_index != mask.size(); ++in_index) {
-            if (mask[in_index]) {
-              VG_masked[out_index++] = VG[in_index];
-              VG_counts[VG[in_index]]++;
-            }
+          for (size_t i = 0; i != design.included.size(); ++i) {
+            VG_masked[i] = VG[design.included[i]];
+            VG_counts[VG_masked[i]]++;
           }
-          assert (out_index == size_t(VG_masked.size()));
         }
 
 
@@ -17,6 +17,10 @@
 #ifndef __math_stats_glm_h__
 #define __math_stats_glm_h__
 
+#include <map>
+#include <memory>
+#include <mutex>
+
 #include "app.h"
 #include "types.h"
 
@@ -24,10 +28,22 @@
 #include "math/least_squares.h"
 #include "math/zstatistic.h"
 #include "math/stats/import.h"
+#include "math/stats/measurements.h"
 #include "math/stats/typedefs.h"
 
 #include "misc/bitset.h"
 
+
+// Maximal memory (in bytes) to be occupied by the output statistics of a single
+//   batch of shuffles within TestFixedHomoscedastic::batch()
+#define GLM_BATCH_MEMORY 67108864
+// Maximal number of shuffles to be processed in a single batch; beyond this, there is
+//   little further benefit from re-use of each block of data
+#define GLM_BATCH_MAX_SHUFFLES 32
+// Size (in bytes) of the working set for each block of elements within
+//   TestFixedHomoscedastic::batch(); chosen such that it fits within L2 cache
+#define GLM_BATCH_CACHE_SIZE 262144
+
 namespace MR
 {
   namespace Math
@@ -189,7 +205,7 @@ namespace MR
         /*! Compute all GLM-related statistics
          * This function can be used when the design matrix varies between elements,
          * due to importing external data for each element from external files
-         * @param measurements a matrix storing the measured data for each subject in a column
+         * @param measurements the measured data for each subject in a row
          * @param design the fixed portion of the design matrix
          * @param extra_columns the variable columns of the design matrix
          * @param hypotheses a vector of Hypothesis class instances defining the effects of interest
@@ -198,7 +214,7 @@ namespace MR
          * @param std_effect_size the matrix containing the output standardised effect size
          * @param stdev the matrix containing the output standard deviation
          */
-        void all_stats (const matrix_type& measurements, const matrix_type& design, const vector<CohortDataImport>& extra_columns, const vector<Hypothesis>& hypotheses, const index_array_type& variance_groups,
+        void all_stats (const Measurements& measurements, const matrix_type& design, const vector<CohortDataImport>& extra_columns, const vector<Hypothesis>& hypotheses, const index_array_type& variance_groups,
                         vector_type& cond, matrix_type& betas, matrix_type& abs_effect_size, matrix_type& std_effect_size, matrix_type& stdev);
 
         //! @}
@@ -212,7 +228,7 @@ namespace MR
         class TestBase
         { MEMALIGN(TestBase)
           public:
-            TestBase (const matrix_type& measurements, const matrix_type& design, const vector<Hypothesis>& hypotheses) :
+            TestBase (const Measurements& measurements, const matrix_type& design, const vector<Hypothesis>& hypotheses) :
                 y (measurements),
                 M (design),
                 c (hypotheses),
@@ -242,6 +258,19 @@ namespace MR
              */
             virtual void operator() (const matrix_type& shuffling_matrix, matrix_type& stat, matrix_type& zstat) const = 0;
 
+            /*! Compute Z-statistics for multiple shuffles at once
+             * @param shuffling_matrices the matrices to permute / sign flip the residuals
+             * @param output the Z-statistics for each shuffle (one column per hypothesis)
+             *
+             * By default, each shuffle is simply processed in turn; derived classes
+             *   that are able to share computation across shuffles should override
+             *   both this function and batch_size()
+             */
+            virtual void batch (const vector<matrix_type>& shuffling_matrices, vector<matrix_type>& output) const;
+
+            //! The number of shuffles that should ideally be provided to batch()
+            virtual size_t batch_size() const { return 1; }
+
 
             size_t num_inputs () const { return M.rows(); }
             size_t num_elements () const { return y.cols(); }
@@ -250,7 +279,8 @@ namespace MR
             virtual size_t num_factors() const { return M.cols(); }
 
           protected:
-            const matrix_type& y, M;
+            const Measurements& y;
+            const matrix_type& M;
             const vector<Hypothesis>& c;
             std::shared_ptr<Math::Zstatistic> stat2z;
 
@@ -278,7 +308,7 @@ namespace MR
              * @param design the design matrix
              * @param hypotheses a vector of Hypothesis instances
              */
-            TestFixedHomoscedastic (const matrix_type& measurements,
+            TestFixedHomoscedastic (const Measurements& measurements,
                                     const matrix_type& design,
                                     const vector<Hypothesis>& hypotheses);
 
@@ -289,6 +319,15 @@ namespace MR
              */
             void operator() (const matrix_type& shuffling_matrix, matrix_type& stats, matrix_type& zstats) const override;
 
+            /*! Compute Z-statistics for multiple shuffles at once
+             * The model fits for all shuffles in the batch are stacked, such that
+             *   each block of elements requires only two (large) matrix products
+             *   regardless of the number of shuffles; the statistics therefore agree
+             *   with those of operator() to within floating-point precision only.
+             */
+            void batch (const vector<matrix_type>& shuffling_matrices, vector<matrix_type>& output) const override;
+            size_t batch_size() const override;
+
           protected:
             // New classes to store information relevant to Freedman-Lane implementation
             vector<Hypothesis::Partition> partitions;
@@ -297,6 +336,11 @@ namespace MR
             vector<matrix_type> XtX;
             vector<default_type> one_over_dof;
 
+            // The statistics are only stored if stats is non-null
+            void evaluate (const vector<matrix_type>& shuffling_matrices,
+                           vector<matrix_type>* stats,
+                           vector<matrix_type>& zstats) const;
+
         };
         //! @}
 
@@ -321,7 +365,7 @@ namespace MR
              * @param hypotheses a vector of Hypothesis instances
              * @param variance_groups a vector of integers corresponding to variance group assignments (should be indexed from zero)
              */
-            TestFixedHeteroscedastic (const matrix_type& measurements,
+            TestFixedHeteroscedastic (const Measurements& measurements,
                                       const matrix_type& design,
                                       const vector<Hypothesis>& hypotheses,
                                       const index_array_type& variance_groups);
@@ -335,6 +379,10 @@ namespace MR
              */
             void operator() (const matrix_type& shuffling_matrix, matrix_type& stats, matrix_type& zstats) const override;
 
+            // Shuffles are not processed in batches for the heteroscedastic case
+            void batch (const vector<matrix_type>& shuffling_matrices, vector<matrix_type>& output) const override { TestBase::batch (shuffling_matrices, output); }
+            size_t batch_size() const override { return 1; }
+
           protected:
             // Variance group assignments
             const index_array_type& VG;
@@ -374,7 +422,7 @@ namespace MR
         { MEMALIGN(TestVariableHomoscedastic)
           public:
             TestVariableHomoscedastic (const vector<CohortDataImport>& importers,
-                                       const matrix_type& measurements,
+                                       const Measurements& measurements,
                                        const matrix_type& design,
                                        const vector<Hypothesis>& hypotheses,
                                        const bool nans_in_data,
@@ -396,14 +444,44 @@ namespace MR
             const vector<CohortDataImport>& importers;
             const bool nans_in_data, nans_in_columns;
 
+            // QR decomposition of the fixed design matrix following exclusion of those inputs
+            //   for which either the data or the element-wise columns are non-finite.
+            //   This depends only on which inputs are excluded, and can therefore be computed
+            //   once and shared between all elements exhibiting the same pattern.
+            class MaskedDesign
+            { MEMALIGN(MaskedDesign)
+              public:
+                MaskedDesign (const matrix_type& design, const BitSet& mask);
+                vector<size_t> included, excluded;
+                matrix_type Q, R;
+            };
+
+            // QR decomposition of the full design matrix for one element, obtained by
+            //   appending the element-wise columns to the decomposition of the masked fixed
+            //   design matrix, along with those quantities required for each hypothesis:
+            //   - W = R^-T c^T, such that the effect of interest is W^T Q^T y
+            //   - Qx: orthonormal basis of W, spanning the effect of interest within Q
+            //   - XtX = (c (M^T M)^-1 c^T)^-1 = (W^T W)^-1
+            class Model
+            { MEMALIGN(Model)
+              public:
+                matrix_type Q, R, extra, B;
+                vector<matrix_type> W, Qx, XtX;
+            };
+
+            std::shared_ptr<const MaskedDesign> unmasked_design;
+            mutable std::map<vector<size_t>, std::shared_ptr<const MaskedDesign>> masked_designs;
+            mutable std::mutex masked_designs_mutex;
+
             void get_mask (const size_t ie, BitSet&, const matrix_type& extra_columns) const;
-            void apply_mask (const BitSet& mask,
-                             matrix_type::ConstColXpr data,
-                             const matrix_type& shuffling_matrix,
-                             const matrix_type& extra_column_data,
-                             matrix_type& Mfull_masked,
-                             matrix_type& shuffling_matrix_masked,
-                             vector_type& y_masked) const;
+            std::shared_ptr<const MaskedDesign> get_design (const BitSet& mask) const;
+
+            // Returns false if the full design matrix is too poorly conditioned for testing
+            bool factorise (const MaskedDesign& design, const matrix_type& extra_column_data, Model& model) const;
+
+            // Apply the shuffling matrix to data from which inputs have been excluded:
+            //   any row of the shuffling matrix that maps from an excluded input is removed
+            void shuffle (const matrix_type& shuffling_matrix, const MaskedDesign& design, const vector_type& in, vector_type& out) const;
 
         };
 
@@ -428,7 +506,7 @@ namespace MR
         { MEMALIGN(TestVariableHeteroscedastic)
           public:
             TestVariableHeteroscedastic (const vector<CohortDataImport>& importers,
-                                         const matrix_type& measurements,
+                                         const Measurements& measurements,
                                          const matrix_type& design,
                                          const vector<Hypothesis>& hypotheses,
                                          const index_array_type& variance_groups,
@@ -456,7 +534,7 @@ namespace MR
             vector_type gamma_weights;
 
             // Need to apply the row selection mask to the variance groups in addition to other data
-            void apply_mask_VG (const BitSet& mask,
+            void apply_mask_VG (const MaskedDesign& design,
                                 index_array_type& VG_masked,
                                 index_array_type& VG_counts) const;
 
@@ -16,6 +16,8 @@
 
 #include "math/stats/import.h"
 
+#include <sys/stat.h>
+
 namespace MR
 {
   namespace Math
@@ -61,6 +63,36 @@ namespace MR
 
 
 
+      uint64_t CohortDataImport::fingerprint (const BitSet& element_mask) const
+      {
+        // 64-bit FNV-1a
+        uint64_t result = 0xcbf29ce484222325ULL;
+        auto feed = [&] (const uint64_t value)
+        {
+          for (size_t i = 0; i != 8; ++i) {
+            result ^= (value >> (8*i)) & 0xFF;
+            result *= 0x100000001b3ULL;
+          }
+        };
+        feed (files.size());
+        for (const auto& f : files) {
+          for (auto c : f->name())
+            feed (uint8_t (c));
+          struct stat sbuf;
+          if (!stat (f->name().c_str(), &sbuf)) {
+            feed (sbuf.st_size);
+            feed (sbuf.st_mtime);
+          }
+        }
+        feed (element_mask.size());
+        for (size_t i = 0; i != element_mask.size(); ++i)
+          feed (element_mask[i]);
+        return result;
+      }
+
+
+
+
     }
   }
 }
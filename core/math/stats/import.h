@@ -27,6 +27,8 @@
 
 #include "math/stats/typedefs.h"
 
+#include "misc/bitset.h"
+
 
 namespace MR
 {
@@ -110,6 +112,13 @@ namespace MR
 
           bool allFinite() const;
 
+          /*!
+           * Compute a hash identifying the input files (based on their paths, sizes and
+           * modification times), and the mask of elements to be tested; used to
+           * verify that a pre-converted cohort file corresponds to these data
+           */
+          uint64_t fingerprint (const BitSet& element_mask) const;
+
         protected:
           vector<std::shared_ptr<SubjectDataImportBase>> files;
       };
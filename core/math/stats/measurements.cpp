@@ -0,0 +1,404 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "math/stats/measurements.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "progressbar.h"
+#include "raw.h"
+#include "signal_handler.h"
+#include "thread_queue.h"
+#include "file/entry.h"
+#include "file/ofstream.h"
+#include "file/path.h"
+
+namespace MR
+{
+  namespace Math
+  {
+    namespace Stats
+    {
+
+
+
+      const char* precision_choices[] = { "float64", "float32", "float16", nullptr };
+
+
+
+      App::OptionGroup measurements_options (const std::string& element_name)
+      {
+        using namespace App;
+        OptionGroup result = OptionGroup ("Options relating to storage of the input data")
+
+        + Option ("precision", "set the precision with which the " + element_name + "-wise input data are stored in memory; "
+                               "options are: " + join (precision_choices, ",") + " (default: float32). "
+                               "Input images are read as single-precision floating-point, so float32 incurs no loss of "
+                               "precision relative to float64 while halving memory requirements; float16 halves memory "
+                               "requirements again, at the cost of approximately three significant figures of precision, and cannot "
+                               "store values of magnitude greater than 65504. "
+                               "All computations are nevertheless performed in double precision.")
+          + Argument ("type").type_choice (precision_choices)
+
+        + Option ("cohort", "memory-map the input data from a single pre-converted cohort file, "
+                            "as generated by a previous invocation using the -export_cohort option, "
+                            "rather than importing them from the subject files. "
+                            "The file must have been generated from the same set of input files and processing mask; "
+                            "otherwise the command will terminate with an error. "
+                            "The data are used at the precision with which they were written to the file.")
+          + Argument ("path").type_file_in()
+
+        + Option ("export_cohort", "write the input data, once imported from the subject files, to a single cohort file "
+                                   "(at the precision set via the -precision option), for re-use by subsequent invocations "
+                                   "via the -cohort option; the data are then memory-mapped from this file.")
+          + Argument ("path").type_file_out();
+
+        return result;
+      }
+
+
+
+      Measurements::storage_type get_storage_type (const Measurements::storage_type default_storage)
+      {
+        auto opt = App::get_options ("precision");
+        if (!opt.size())
+          return default_storage;
+        switch (int(opt[0][0])) {
+          case 0: return Measurements::storage_type::FLOAT64;
+          case 1: return Measurements::storage_type::FLOAT32;
+          case 2: return Measurements::storage_type::FLOAT16;
+        }
+        assert (false);
+        return default_storage;
+      }
+
+
+
+
+      namespace
+      {
+        // Cohort file format:
+        // - 64-byte header (all integers little-endian):
+        //   - 16 bytes: magic string
+        //   - uint32: format version
+        //   - uint32: storage type
+        //   - uint64: number of inputs
+        //   - uint64: number of elements
+        //   - uint64: fingerprint of the input data
+        //   - uint64: byte offset to data
+        // - data in native little-endian byte order, with all inputs for the first
+        //   element stored contiguously, followed by all inputs for the second element, etc.
+        const char cohort_magic[] = "mrtrix cohort   ";
+        constexpr size_t cohort_magic_size = 16;
+        constexpr size_t cohort_header_size = 64;
+        constexpr uint32_t cohort_version = 1;
+
+        constexpr size_t cache_line_size = 64;
+
+        // Largest finite magnitude representable at half precision;
+        //   anything larger would be stored as infinity, and hence treated as missing data
+        constexpr default_type float16_max = 65504.0;
+
+        uint32_t storage_code (const Measurements::storage_type type)
+        {
+          switch (type) {
+            case Measurements::storage_type::FLOAT64: return 0;
+            case Measurements::storage_type::FLOAT32: return 1;
+            case Measurements::storage_type::FLOAT16: return 2;
+          }
+          return 0;
+        }
+
+        // Convert the data for one input for storage at reduced precision
+        template <typename ValueType>
+        void convert_row (const matrix_type& row, uint8_t* const out)
+        {
+          Eigen::Map<Eigen::Matrix<ValueType, 1, Eigen::Dynamic>> (reinterpret_cast<ValueType*> (out), row.cols()) = row.row (0).cast<ValueType>();
+        }
+
+        // Transpose a group of consecutive inputs, stored with the data for each
+        //   input contiguous, into the element-major measurement storage
+        template <typename ValueType>
+        void transpose_group (const uint8_t* const group, const size_t count, const size_t num_elements,
+                              uint8_t* const storage, const size_t first_input, const size_t num_inputs)
+        {
+          const ValueType* in = reinterpret_cast<const ValueType*> (group);
+          ValueType* out = reinterpret_cast<ValueType*> (storage) + first_input;
+          for (size_t element = 0; element != num_elements; ++element) {
+            for (size_t i = 0; i != count; ++i)
+              out[i] = in[i * num_elements + element];
+            out += num_inputs;
+          }
+        }
+      }
+
+
+
+      Measurements::Measurements (matrix_type&& data) :
+          type (storage_type::FLOAT64),
+          num_inputs (data.rows()),
+          num_elements (data.cols()),
+          double_data (std::move (data)),
+          address (reinterpret_cast<uint8_t*> (double_data.data())) { }
+
+
+
+      Measurements::Measurements (const CohortDataImport& importer, const storage_type storage, const std::string& message) :
+          type (storage),
+          num_inputs (importer.size()),
+          num_elements (importer.size() ? importer[0]->size() : 0),
+          address (nullptr)
+      {
+        for (size_t i = 0; i != importer.size(); ++i) {
+          if (importer[i]->size() != num_elements)
+            throw Exception ("Number of elements in input \"" + importer[i]->name() + "\" (" + str(importer[i]->size()) + ")"
+                             + " does not match that of input \"" + importer[0]->name() + "\" (" + str(num_elements) + ")");
+        }
+        if (type == storage_type::FLOAT64) {
+          double_data.resize (num_inputs, num_elements);
+          address = reinterpret_cast<uint8_t*> (double_data.data());
+        } else {
+          buffer.reset (new uint8_t [num_inputs * num_elements * bytes_per_value()]);
+          address = buffer.get();
+        }
+
+        // Inputs are distributed to threads in groups spanning one cache line of
+        //   the element-major storage, such that different threads can only write
+        //   to the same cache line at the boundaries between groups
+        const size_t group_size = std::max (size_t(1), cache_line_size / bytes_per_value());
+
+        class Source
+        { NOMEMALIGN
+          public:
+            Source (const size_t num_inputs, const size_t group_size, const std::string& message) :
+                num_inputs (num_inputs),
+                group_size (group_size),
+                counter (0),
+                progress (message, (num_inputs + group_size - 1) / group_size) { }
+            bool operator() (size_t& first_input)
+            {
+              first_input = counter;
+              if (first_input >= num_inputs)
+                return false;
+              counter += group_size;
+              ++progress;
+              return true;
+            }
+          private:
+            const size_t num_inputs, group_size;
+            size_t counter;
+            ProgressBar progress;
+        };
+
+        // Each input of the group is imported in double precision, and converted
+        //   into a per-thread buffer with one row per input; once the group is
+        //   complete, the buffer is transposed into the element-major storage
+        class Sink
+        { MEMALIGN(Sink)
+          public:
+            Sink (const CohortDataImport& importer, const size_t group_size, Measurements& data) :
+                importer (importer),
+                group_size (group_size),
+                data (data) { }
+            bool operator() (const size_t& first_input)
+            {
+              const size_t count = std::min (group_size, data.num_inputs - first_input);
+              row.resize (1, data.num_elements);
+              buffer.resize (count * data.num_elements * data.bytes_per_value());
+              for (size_t i = 0; i != count; ++i) {
+                (*importer[first_input + i]) (row.row (0));
+                if (data.type == storage_type::FLOAT16 && (row.array().isFinite() && row.array().abs() > float16_max).any())
+                  throw Exception ("Input \"" + importer[first_input + i]->name() + "\" contains values of magnitude greater than "
+                                   + str(float16_max) + ", which cannot be stored at float16 precision; use -precision float32 instead");
+                uint8_t* const group_row = buffer.data() + i * data.num_elements * data.bytes_per_value();
+                switch (data.type) {
+                  case storage_type::FLOAT64: convert_row<double>      (row, group_row); break;
+                  case storage_type::FLOAT32: convert_row<float>       (row, group_row); break;
+                  case storage_type::FLOAT16: convert_row<Eigen::half> (row, group_row); break;
+                }
+              }
+              switch (data.type) {
+                case storage_type::FLOAT64: transpose_group<double>      (buffer.data(), count, data.num_elements, data.address, first_input, data.num_inputs); break;
+                case storage_type::FLOAT32: transpose_group<float>       (buffer.data(), count, data.num_elements, data.address, first_input, data.num_inputs); break;
+                case storage_type::FLOAT16: transpose_group<Eigen::half> (buffer.data(), count, data.num_elements, data.address, first_input, data.num_inputs); break;
+              }
+              return true;
+            }
+          private:
+            const CohortDataImport& importer;
+            const size_t group_size;
+            Measurements& data;
+            matrix_type row;
+            vector<uint8_t> buffer;
+        };
+
+        Source source (num_inputs, group_size, message);
+        Sink sink (importer, group_size, *this);
+        Thread::run_queue (source, size_t(), Thread::multi (sink));
+      }
+
+
+
+      Measurements::Measurements (const std::string& path, const uint64_t fingerprint) :
+          address (nullptr)
+      {
+#ifdef MRTRIX_BYTE_ORDER_BIG_ENDIAN
+        throw Exception ("Memory-mapping of cohort files is not supported on big-endian systems");
+#endif
+        mmap.reset (new File::MMap (File::Entry (path)));
+        const uint8_t* base = mmap->address();
+        const uint64_t file_size = mmap->size();
+        if (file_size < cohort_header_size || memcmp (base, cohort_magic, cohort_magic_size))
+          throw Exception ("File \"" + path + "\" is not a valid cohort file");
+        if (Raw::fetch_LE<uint32_t> (base + 16) != cohort_version)
+          throw Exception ("Cohort file \"" + path + "\" was written using an incompatible version of MRtrix3");
+        switch (Raw::fetch_LE<uint32_t> (base + 20)) {
+          case 0: type = storage_type::FLOAT64; break;
+          case 1: type = storage_type::FLOAT32; break;
+          case 2: type = storage_type::FLOAT16; break;
+          default: throw Exception ("Cohort file \"" + path + "\" contains unsupported data type");
+        }
+        num_inputs = Raw::fetch_LE<uint64_t> (base + 24);
+        num_elements = Raw::fetch_LE<uint64_t> (base + 32);
+        if (Raw::fetch_LE<uint64_t> (base + 40) != fingerprint)
+          throw Exception ("Cohort file \"" + path + "\" was not generated from the same input data and processing mask; "
+                           "delete this file in order for it to be regenerated");
+        const uint64_t data_offset = Raw::fetch_LE<uint64_t> (base + 48);
+        if (data_offset < cohort_header_size || data_offset + num_inputs * num_elements * bytes_per_value() > file_size)
+          throw Exception ("Cohort file \"" + path + "\" is truncated");
+        address = mmap->address() + data_offset;
+        DEBUG ("Cohort file \"" + path + "\" memory-mapped: " + str(num_inputs) + " inputs, " + str(num_elements) + " elements");
+      }
+
+
+
+      void Measurements::save (const std::string& path, const uint64_t fingerprint) const
+      {
+#ifdef MRTRIX_BYTE_ORDER_BIG_ENDIAN
+        throw Exception ("Writing of cohort files is not supported on big-endian systems");
+#endif
+        const std::string temp_path = path + ".tmp";
+        SignalHandler::mark_file_for_deletion (temp_path);
+        {
+          File::OFStream out (temp_path, std::ios_base::out | std::ios_base::binary);
+          uint8_t header[cohort_header_size];
+          memset (header, 0, cohort_header_size);
+          memcpy (header, cohort_magic, cohort_magic_size);
+          Raw::store_LE<uint32_t> (cohort_version,      header + 16);
+          Raw::store_LE<uint32_t> (storage_code (type), header + 20);
+          Raw::store_LE<uint64_t> (num_inputs,          header + 24);
+          Raw::store_LE<uint64_t> (num_elements,        header + 32);
+          Raw::store_LE<uint64_t> (fingerprint,         header + 40);
+          Raw::store_LE<uint64_t> (cohort_header_size,  header + 48);
+          out.write (reinterpret_cast<const char*> (header), cohort_header_size);
+          ProgressBar progress ("Writing cohort file \"" + Path::basename (path) + "\"");
+          const size_t bytes_per_element = num_inputs * bytes_per_value();
+          // Write in chunks so as to not stall the progress bar
+          constexpr size_t chunk_size = 1024;
+          for (size_t element = 0; element < num_elements; element += chunk_size) {
+            out.write (reinterpret_cast<const char*> (address + element * bytes_per_element),
+                       std::min (chunk_size, num_elements - element) * bytes_per_element);
+            ++progress;
+          }
+          if (!out.good())
+            throw Exception ("Error writing cohort file \"" + temp_path + "\"");
+        }
+        if (std::rename (temp_path.c_str(), path.c_str()))
+          throw Exception ("Error renaming cohort file \"" + temp_path + "\" to \"" + path + "\": " + strerror (errno));
+        SignalHandler::unmark_file_for_deletion (temp_path);
+      }
+
+
+
+      void Measurements::set (const size_t input, const size_t element, const default_type value)
+      {
+        assert (input < num_inputs && element < num_elements);
+        if (mmap)
+          throw Exception ("Cannot modify memory-mapped cohort data");
+        const size_t index = element * num_inputs + input;
+        switch (type) {
+          case storage_type::FLOAT64: reinterpret_cast<double*> (address)[index] = value; break;
+          case storage_type::FLOAT32: reinterpret_cast<float*> (address)[index] = value; break;
+          case storage_type::FLOAT16:
+            if (std::isfinite (value) && abs (value) > float16_max)
+              throw Exception ("Value " + str(value) + " cannot be stored at float16 precision; use -precision float32 instead");
+            reinterpret_cast<Eigen::half*> (address)[index] = Eigen::half (float (value));
+            break;
+        }
+      }
+
+
+
+      void Measurements::block (const size_t first_element, const size_t count, matrix_type& data) const
+      {
+        assert (first_element + count <= num_elements);
+        const size_t offset = first_element * num_inputs;
+        switch (type) {
+          case storage_type::FLOAT64:
+            data = Eigen::Map<const matrix_type> (reinterpret_cast<const double*> (address) + offset, num_inputs, count);
+            break;
+          case storage_type::FLOAT32:
+            data = Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>> (reinterpret_cast<const float*> (address) + offset, num_inputs, count).cast<default_type>();
+            break;
+          case storage_type::FLOAT16:
+            data = Eigen::Map<const Eigen::Matrix<Eigen::half, Eigen::Dynamic, Eigen::Dynamic>> (reinterpret_cast<const Eigen::half*> (address) + offset, num_inputs, count).cast<float>().cast<default_type>();
+            break;
+        }
+      }
+
+
+
+      bool Measurements::allFinite() const
+      {
+        // Process in blocks to avoid converting the entire matrix at once
+        constexpr size_t block_size = 1024;
+        matrix_type data;
+        for (size_t element = 0; element < num_elements; element += block_size) {
+          block (element, std::min (block_size, num_elements - element), data);
+          if (!data.allFinite())
+            return false;
+        }
+        return true;
+      }
+
+      bool Measurements::allFinite (const size_t element) const
+      {
+        for (size_t input = 0; input != num_inputs; ++input) {
+          if (!std::isfinite ((*this) (input, element)))
+            return false;
+        }
+        return true;
+      }
+
+
+
+      size_t Measurements::bytes_per_value() const
+      {
+        switch (type) {
+          case storage_type::FLOAT64: return sizeof (double);
+          case storage_type::FLOAT32: return sizeof (float);
+          case storage_type::FLOAT16: return sizeof (Eigen::half);
+        }
+        return 0;
+      }
+
+
+
+    }
+  }
+}
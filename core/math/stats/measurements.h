@@ -0,0 +1,178 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __math_stats_measurements_h__
+#define __math_stats_measurements_h__
+
+#include <memory>
+#include <string>
+
+#include "app.h"
+#include "types.h"
+
+#include "file/mmap.h"
+
+#include "math/stats/import.h"
+#include "math/stats/typedefs.h"
+
+
+namespace MR
+{
+  namespace Math
+  {
+    namespace Stats
+    {
+
+
+
+      // Command-line options controlling how the measurement matrix is stored:
+      // - Precision with which the data are stored
+      // - Memory-mapping of a pre-converted cohort file, and export of such a file
+      extern const char* precision_choices[];
+      App::OptionGroup measurements_options (const std::string& element_name);
+
+
+
+      /** \addtogroup Statistics
+      @{ */
+      /*! Storage for the measurement matrix
+       * The measurement matrix contains one row per input, and one column
+       * per element being tested. Rather than always storing these data as
+       * double-precision values in RAM, this class permits storage of the
+       * data at reduced precision, and/or memory-mapping of the data from a
+       * single pre-converted cohort file; all computations are nevertheless
+       * performed in double precision, with the data converted as they are
+       * accessed.
+       *
+       * Data for each element are stored contiguously, such that access to
+       * all inputs for one element, or to a block of consecutive elements,
+       * is efficient.
+       */
+      class Measurements
+      { NOMEMALIGN
+        public:
+          enum class storage_type { FLOAT64, FLOAT32, FLOAT16 };
+
+          //! Take ownership of data already loaded in double precision
+          Measurements (matrix_type&& data);
+
+          //! Import data for all inputs, reading from multiple subject files concurrently
+          Measurements (const CohortDataImport& importer, const storage_type storage, const std::string& message);
+
+          //! Memory-map a cohort file written using save()
+          /*! @param fingerprint must match the value provided when the file was written
+           */
+          Measurements (const std::string& path, const uint64_t fingerprint);
+
+          Measurements (Measurements&&) = default;
+          Measurements (const Measurements&) = delete;
+
+          //! Write the data to a cohort file, for memory-mapping by subsequent invocations
+          void save (const std::string& path, const uint64_t fingerprint) const;
+
+          size_t rows() const { return num_inputs; }
+          size_t cols() const { return num_elements; }
+          storage_type storage() const { return type; }
+          bool is_mapped() const { return bool(mmap); }
+
+          default_type operator() (const size_t input, const size_t element) const
+          {
+            assert (input < num_inputs && element < num_elements);
+            const size_t index = element * num_inputs + input;
+            switch (type) {
+              case storage_type::FLOAT64: return reinterpret_cast<const double*> (address)[index];
+              case storage_type::FLOAT32: return reinterpret_cast<const float*> (address)[index];
+              case storage_type::FLOAT16: return float (reinterpret_cast<const Eigen::half*> (address)[index]);
+            }
+            return NaN;
+          }
+
+          //! Set the value for a particular input & element; not possible for memory-mapped data
+          void set (const size_t input, const size_t element, const default_type value);
+
+          //! Obtain the data for a block of consecutive elements (one column per element)
+          void block (const size_t first_element, const size_t count, matrix_type& data) const;
+          matrix_type block (const size_t first_element, const size_t count) const
+          {
+            matrix_type result;
+            block (first_element, count, result);
+            return result;
+          }
+
+          bool allFinite() const;
+          bool allFinite (const size_t element) const;
+
+        protected:
+          storage_type type;
+          size_t num_inputs, num_elements;
+          matrix_type double_data;
+          std::unique_ptr<uint8_t[]> buffer;
+          std::unique_ptr<File::MMap> mmap;
+          uint8_t* address;
+
+          size_t bytes_per_value() const;
+      };
+      //! @}
+
+
+
+      //! Parse the -precision command-line option
+      Measurements::storage_type get_storage_type (const Measurements::storage_type default_storage);
+
+      //! Load the measurement matrix according to the -precision, -cohort and -export_cohort command-line options
+      /*! If -cohort is specified, the nominated file is memory-mapped directly,
+       * provided that it was written from the same subject data (as determined
+       * by \a fingerprint). Otherwise the data are imported from the subject
+       * files; \a preprocess is then applied, after which the data are written
+       * to the file nominated via -export_cohort (if any) and memory-mapped from it.
+       */
+      template <class Functor>
+      Measurements load_measurements (const CohortDataImport& importer,
+                                      const Measurements::storage_type default_storage,
+                                      const uint64_t fingerprint,
+                                      const std::string& message,
+                                      Functor&& preprocess)
+      {
+        auto opt = App::get_options ("cohort");
+        auto export_opt = App::get_options ("export_cohort");
+        if (opt.size()) {
+          if (export_opt.size())
+            throw Exception ("Options -cohort and -export_cohort are mutually exclusive");
+          Measurements result (opt[0][0], fingerprint);
+          if (result.rows() != importer.size() || (importer.size() && result.cols() != importer[0]->size()))
+            throw Exception ("Dimensions of cohort file \"" + std::string (opt[0][0]) + "\" do not match input data");
+          if (App::get_options ("precision").size() && get_storage_type (default_storage) != result.storage())
+            WARN ("Data in cohort file \"" + std::string (opt[0][0]) + "\" are stored as " +
+                  precision_choices[int(result.storage())] + "; -precision option ignored");
+          return result;
+        }
+        Measurements result (importer, get_storage_type (default_storage), message);
+        preprocess (result);
+        if (!export_opt.size())
+          return result;
+        result.save (export_opt[0][0], fingerprint);
+        return Measurements (export_opt[0][0], fingerprint);
+      }
+
+
+
+    }
+  }
+}
+
+
+#endif
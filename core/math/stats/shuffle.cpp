@@ -18,10 +18,13 @@
 #include "math/stats/shuffle.h"
 
 #include <algorithm>
+#include <numeric>
 #include <random>
+#include <unordered_set>
 
 #include "math/factorial.h"
 #include "math/math.h"
+#include "math/rng.h"
 
 namespace MR
 {
@@ -35,6 +38,71 @@ namespace MR
       const char* error_types[] = { "ee", "ise", "both", nullptr };
 
 
+
+      namespace {
+
+        // SplitMix64 finaliser
+        inline uint64_t mix (uint64_t x)
+        {
+          x += 0x9E3779B97F4A7C15ULL;
+          x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+          x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+          return x ^ (x >> 31);
+        }
+
+        // Counter-based random number generator: the n'th number yielded depends
+        //   only on the key and on n, such that any randomly generated shuffle can be
+        //   regenerated at any time, by any thread, given only its key
+        class CounterRNG
+        { NOMEMALIGN
+          public:
+            using result_type = uint64_t;
+            CounterRNG (const uint64_t key) : key (key), counter (0) { }
+            static constexpr result_type min() { return std::numeric_limits<result_type>::min(); }
+            static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+            result_type operator() () { return mix (key ^ mix (counter++)); }
+          private:
+            const uint64_t key;
+            uint64_t counter;
+        };
+
+        // Separate streams for permutations and sign-flips,
+        //   such that the two are independent when combined
+        constexpr uint64_t permutation_stream = 1;
+        constexpr uint64_t signflip_stream = 2;
+
+        inline uint64_t make_key (const uint64_t seed, const uint64_t stream, const uint64_t index, const uint64_t attempt)
+        {
+          return mix (mix (mix (seed ^ mix (stream)) ^ index) ^ attempt);
+        }
+
+        // Hashes used for rejection of duplicate shuffles; a hash collision
+        //   between two distinct shuffles merely results in one being regenerated
+        uint64_t hash (const vector<size_t>& labels)
+        {
+          uint64_t result = mix (labels.size());
+          for (const auto i : labels)
+            result = mix (result ^ i);
+          return result;
+        }
+
+        uint64_t hash (const BitSet& bits)
+        {
+          uint64_t result = mix (bits.size()), word = 0;
+          for (size_t i = 0; i != bits.size(); ++i) {
+            if (bits[i])
+              word |= uint64_t(1) << (i % 64);
+            if (i % 64 == 63 || i+1 == bits.size()) {
+              result = mix (result ^ word);
+              word = 0;
+            }
+          }
+          return result;
+        }
+
+      }
+
+
       App::OptionGroup shuffle_options (const bool include_nonstationarity, const default_type default_skew)
       {
         using namespace App;
@@ -62,7 +130,28 @@ namespace MR
                                   "where each relabelling is defined as a column vector of size m, and the number of columns, n, defines "
                                   "the number of permutations. Can be generated with the palm_quickperms function in PALM (http://fsl.fmrib.ox.ac.uk/fsl/fslwiki/PALM). "
                                   "Overrides the -nshuffles option.")
-          + Argument ("file").type_file_in();
+          + Argument ("file").type_file_in()
+
+        + Option ("shard", "process only one subset of the shuffles, writing the partial results of permutation testing to file "
+                           "rather than generating the final outputs; the shuffles are divided into \"count\" contiguous shards, "
+                           "of which the shard with index \"index\" (starting from zero) is processed. "
+                           "Checkpoints are written to the output file during processing, such that a pre-empted job can be continued "
+                           "using the -resume_shard option. All shards must be generated using the same input data and command-line options, and "
+                           "must yield the same set of shuffles: this requires either the -permutations option, or that the MRTRIX_RNG_SEED "
+                           "environment variable be set to the same value for all shards.")
+          + Argument ("index").type_integer (0)
+          + Argument ("count").type_integer (1)
+          + Argument ("path").type_file_out()
+
+        + Option ("resume_shard", "continue processing of a shard from the last checkpoint stored in a file generated using the -shard option "
+                                  "(e.g. following a pre-empted job); the shard index and number of shards are read from this file. "
+                                  "The command will terminate with an error if the file was not generated from the same input data and command-line options.")
+          + Argument ("path").type_file_in()
+
+        + Option ("merge_shards", "rather than running permutations, import the partial results of permutation testing from "
+                                  "the files generated using the -shard option, as listed in the input text file, and merge them in order to "
+                                  "generate the final outputs. All other inputs and command-line options must match those used to generate the shards.")
+          + Argument ("list").type_file_in();
 
         if (include_nonstationarity) {
 
@@ -92,8 +181,14 @@ namespace MR
 
       Shuffler::Shuffler (const size_t num_rows, const bool is_nonstationarity, const std::string msg) :
           rows (num_rows),
+          permutation_default_first (false),
+          signflip_default_first (false),
+          permutation_blocks_type (blocks_t::NONE),
+          permutation_divisor (1),
           nshuffles (is_nonstationarity ? DEFAULT_NUMBER_SHUFFLES_NONSTATIONARITY : DEFAULT_NUMBER_SHUFFLES),
-          counter (0)
+          counter (0),
+          reproducible (true),
+          msg (msg)
       {
         using namespace App;
         auto opt = get_options ("errors");
@@ -151,9 +246,7 @@ namespace MR
 
 
         initialise (error_types, nshuffles_explicit, is_nonstationarity, eb_within, eb_whole);
-
-        if (msg.size())
-          progress.reset (new ProgressBar (msg, nshuffles));
+        set_range (0, nshuffles);
       }
 
 
@@ -177,11 +270,16 @@ namespace MR
                           const index_array_type& eb_whole,
                           const std::string msg) :
           rows (num_rows),
-          nshuffles (num_shuffles)
+          permutation_default_first (false),
+          signflip_default_first (false),
+          permutation_blocks_type (blocks_t::NONE),
+          permutation_divisor (1),
+          nshuffles (num_shuffles),
+          reproducible (true),
+          msg (msg)
       {
         initialise (error_types, true, is_nonstationarity, eb_within, eb_whole);
-        if (msg.size())
-          progress.reset (new ProgressBar (msg, nshuffles));
+        set_range (0, nshuffles);
       }
 
 
@@ -190,35 +288,57 @@ namespace MR
 
       bool Shuffler::operator() (Shuffle& output)
       {
-        output.index = counter;
-        if (counter >= nshuffles) {
+        if (!next (output.index)) {
+          output.data.resize (0, 0);
+          return false;
+        }
+        get (output.index, output.data);
+        return true;
+      }
+
+
+
+      bool Shuffler::next (size_t& index)
+      {
+        index = counter;
+        if (counter >= last) {
           if (progress)
             progress.reset (nullptr);
-          output.data.resize (0, 0);
           return false;
         }
+        ++counter;
+        if (progress)
+          ++(*progress);
+        return true;
+      }
+
+
+
+      void Shuffler::get (const size_t index, matrix_type& data) const
+      {
+        assert (index < nshuffles);
         // TESTME Think I need to adjust the signflips application based on the permutations
-        if (permutations.size()) {
-          output.data = matrix_type::Zero (rows, rows);
+        if (has_permutations()) {
+          PermuteLabels labels;
+          get_permutation (index, labels);
+          data = matrix_type::Zero (rows, rows);
           for (size_t i = 0; i != rows; ++i)
-            output.data (i, permutations[counter][i]) = 1.0;
+            data (i, labels[i]) = 1.0;
         } else {
-          output.data = matrix_type::Identity (rows, rows);
+          data = matrix_type::Identity (rows, rows);
         }
-        if (signflips.size()) {
+        if (has_signflips()) {
+          BitSet flips (rows);
+          get_signflip (index, flips);
           for (size_t r = 0; r != rows; ++r) {
-            if (signflips[counter][r]) {
+            if (flips[r]) {
               for (size_t c = 0; c != rows; ++c) {
-                if (output.data (r, c))
-                  output.data (r, c) *= -1.0;
+                if (data (r, c))
+                  data (r, c) *= -1.0;
               }
             }
           }
         }
-        ++counter;
-        if (progress)
-          ++(*progress);
-        return true;
       }
 
 
@@ -227,12 +347,56 @@ namespace MR
 
       void Shuffler::reset()
       {
-        counter = 0;
+        counter = first;
         progress.reset();
       }
 
 
 
+      void Shuffler::set_range (const size_t range_first, const size_t range_last)
+      {
+        assert (range_first <= range_last && range_last <= nshuffles);
+        first = counter = range_first;
+        last = range_last;
+        progress.reset (msg.size() ? new ProgressBar (msg, last - first) : nullptr);
+      }
+
+
+
+      uint64_t Shuffler::fingerprint() const
+      {
+        // 64-bit FNV-1a
+        uint64_t result = 0xcbf29ce484222325ULL;
+        auto feed = [&] (const uint64_t value)
+        {
+          for (size_t i = 0; i != 8; ++i) {
+            result ^= (value >> (8*i)) & 0xFF;
+            result *= 0x100000001b3ULL;
+          }
+        };
+        feed (rows);
+        feed (nshuffles);
+        feed (permutation_divisor);
+        for (const auto& p : permutations) {
+          for (const auto i : p)
+            feed (i);
+        }
+        for (const auto& s : signflips) {
+          for (size_t i = 0; i != s.size(); ++i)
+            feed (s[i]);
+        }
+        // Randomly generated shuffles are fully determined by their keys
+        feed (permutation_default_first);
+        for (const auto k : permutation_keys)
+          feed (k);
+        feed (signflip_default_first);
+        for (const auto k : signflip_keys)
+          feed (k);
+        return result;
+      }
+
+
+
 
 
 
@@ -322,16 +486,11 @@ namespace MR
         if (ee && !permutations.size()) {
           if (ise) {
             if (nshuffles == max_shuffles) {
+              // Each permutation is used max_num_signflips times in succession;
+              //   rather than duplicating the permutations, the shuffle index is divided accordingly
               generate_all_permutations (rows, eb_within, eb_whole);
               assert (permutations.size() == max_num_permutations);
-              vector<PermuteLabels> duplicated_permutations;
-              duplicated_permutations.reserve (max_shuffles);
-              for (const auto& p : permutations) {
-                for (size_t i = 0; i != max_num_signflips; ++i)
-                  duplicated_permutations.push_back (p);
-              }
-              std::swap (permutations, duplicated_permutations);
-              assert (permutations.size() == max_shuffles);
+              permutation_divisor = max_num_signflips;
             } else if (nshuffles == max_num_permutations) {
               generate_all_permutations (rows, eb_within, eb_whole);
               assert (permutations.size() == max_num_permutations);
@@ -352,14 +511,10 @@ namespace MR
         if (ise) {
           if (ee) {
             if (nshuffles == max_shuffles) {
+              // The full set of sign-flips is cycled through once per permutation;
+              //   this is handled by taking the shuffle index modulo the number of sign-flips
               generate_all_signflips (rows, eb_whole);
               assert (signflips.size() == max_num_signflips);
-              vector<BitSet> duplicated_signflips;
-              duplicated_signflips.reserve (max_shuffles);
-              for (size_t i = 0; i != max_num_permutations; ++i)
-                duplicated_signflips.insert (duplicated_signflips.end(), signflips.begin(), signflips.end());
-              std::swap (signflips, duplicated_signflips);
-              assert (signflips.size() == max_shuffles);
             } else if (nshuffles == max_num_signflips) {
               generate_all_signflips (rows, eb_whole);
               assert (signflips.size() == max_num_signflips);
@@ -414,25 +569,63 @@ namespace MR
 
 
 
-      bool Shuffler::is_duplicate (const PermuteLabels& v1, const PermuteLabels& v2) const
+      void Shuffler::get_permutation (const size_t index, PermuteLabels& labels) const
       {
-        assert (v1.size() == v2.size());
-        for (size_t i = 0; i < v1.size(); i++) {
-          if (v1[i] != v2[i])
-            return false;
+        if (permutations.size()) {
+          labels = permutations[index / permutation_divisor];
+          return;
         }
-        return true;
+        assert (index < permutation_keys.size());
+        if (permutation_default_first && !index) {
+          labels.resize (rows);
+          std::iota (labels.begin(), labels.end(), 0);
+          return;
+        }
+        random_permutation (permutation_keys[index], labels);
       }
 
 
 
-      bool Shuffler::is_duplicate (const PermuteLabels& perm) const
+      void Shuffler::random_permutation (const uint64_t key, PermuteLabels& labels) const
       {
-        for (const auto& p : permutations) {
-          if (is_duplicate (perm, p))
-            return true;
+        CounterRNG rng (key);
+        labels.resize (rows);
+        std::iota (labels.begin(), labels.end(), 0);
+        switch (permutation_blocks_type) {
+
+          // Unrestricted exchangeability
+          case blocks_t::NONE:
+            std::shuffle (labels.begin(), labels.end(), rng);
+            break;
+
+          // Within-block exchangeability:
+          //   random permutation within each block independently
+          case blocks_t::WITHIN:
+            for (const auto& block : permutation_blocks) {
+              vector<size_t> permuted_block (block);
+              std::shuffle (permuted_block.begin(), permuted_block.end(), rng);
+              for (size_t i = 0; i != permuted_block.size(); ++i)
+                labels[block[i]] = permuted_block[i];
+            }
+            break;
+
+          // Whole-block exchangeability:
+          //   randomly order a list corresponding to the block indices, and then
+          //   generate the full permutation label listing accordingly
+          case blocks_t::WHOLE:
+          {
+            const size_t num_blocks = permutation_blocks.size();
+            PermuteLabels permuted_blocks (num_blocks);
+            std::iota (permuted_blocks.begin(), permuted_blocks.end(), 0);
+            std::shuffle (permuted_blocks.begin(), permuted_blocks.end(), rng);
+            for (size_t ib = 0; ib != num_blocks; ++ib) {
+              for (size_t i = 0; i != permutation_blocks[ib].size(); ++i)
+                labels[permutation_blocks[ib][i]] = permutation_blocks[permuted_blocks[ib]][i];
+            }
+          }
+            break;
+
         }
-        return false;
       }
 
 
@@ -444,76 +637,45 @@ namespace MR
                                                    const bool include_default,
                                                    const bool permit_duplicates)
       {
+        assert (num_rows == rows);
         permutations.clear();
-        permutations.reserve (num_perms);
+        permutation_keys.assign (num_perms, 0);
+        const uint64_t seed = Math::RNG::get_seed();
+        if (!getenv ("MRTRIX_RNG_SEED"))
+          reproducible = false;
 
-        PermuteLabels default_labelling (num_rows);
-        for (size_t i = 0; i < num_rows; ++i)
-          default_labelling[i] = i;
+        if (eb_within.size()) {
+          permutation_blocks_type = blocks_t::WITHIN;
+          permutation_blocks = indices2blocks (eb_within);
+        } else if (eb_whole.size()) {
+          permutation_blocks_type = blocks_t::WHOLE;
+          permutation_blocks = indices2blocks (eb_whole);
+          assert (!(num_rows % permutation_blocks.size()));
+        } else {
+          permutation_blocks_type = blocks_t::NONE;
+          permutation_blocks.clear();
+        }
 
+        // Only the hash of each accepted permutation needs to be retained
+        //   in order to reject duplicates
+        std::unordered_set<uint64_t> accepted;
+        PermuteLabels labelling (num_rows);
         size_t p = 0;
+        permutation_default_first = include_default;
         if (include_default) {
-          permutations.push_back (default_labelling);
+          std::iota (labelling.begin(), labelling.end(), 0);
+          accepted.insert (hash (labelling));
           ++p;
         }
 
-        // Unrestricted exchangeability
-        if (!eb_within.size() && !eb_whole.size()) {
-          for (; p != num_perms; ++p) {
-            PermuteLabels permuted_labelling (default_labelling);
-            do {
-              std::random_shuffle (permuted_labelling.begin(), permuted_labelling.end());
-            } while (!permit_duplicates && is_duplicate (permuted_labelling));
-            permutations.push_back (permuted_labelling);
-          }
-          return;
-        }
-
-        vector<vector<size_t>> blocks;
-
-        // Within-block exchangeability
-        if (eb_within.size()) {
-          blocks = indices2blocks (eb_within);
-          PermuteLabels permuted_labelling (default_labelling);
-          for (; p != num_perms; ++p) {
-            do {
-              permuted_labelling = default_labelling;
-              // Random permutation within each block independently
-              for (size_t ib = 0; ib != blocks.size(); ++ib) {
-                vector<size_t> permuted_block (blocks[ib]);
-                std::random_shuffle (permuted_block.begin(), permuted_block.end());
-                for (size_t i = 0; i != permuted_block.size(); ++i)
-                  permuted_labelling[blocks[ib][i]] = permuted_block[i];
-              }
-            } while (!permit_duplicates && is_duplicate (permuted_labelling));
-            permutations.push_back (permuted_labelling);
-          }
-          return;
-        }
-
-        // Whole-block exchangeability
-        blocks = indices2blocks (eb_whole);
-        const size_t num_blocks = blocks.size();
-        assert (!(num_rows % num_blocks));
-        const size_t block_size = num_rows / num_blocks;
-        PermuteLabels default_blocks (num_blocks);
-        for (size_t i = 0; i != num_blocks; ++i)
-          default_blocks[i] = i;
-        PermuteLabels permuted_labelling (default_labelling);
         for (; p != num_perms; ++p) {
+          uint64_t key, attempt = 0;
           do {
-            // Randomly order a list corresponding to the block indices, and then
-            //   generate the full permutation label listing accordingly
-            PermuteLabels permuted_blocks (default_blocks);
-            std::random_shuffle (permuted_blocks.begin(), permuted_blocks.end());
-            for (size_t ib = 0; ib != num_blocks; ++ib) {
-              for (size_t i = 0; i != block_size; ++i)
-                permuted_labelling[blocks[ib][i]] = blocks[permuted_blocks[ib]][i];
-            }
-          } while (!permit_duplicates && is_duplicate (permuted_labelling));
-          permutations.push_back (permuted_labelling);
+            key = make_key (seed, permutation_stream, p, attempt++);
+            random_permutation (key, labelling);
+          } while (!accepted.insert (hash (labelling)).second && !permit_duplicates);
+          permutation_keys[p] = key;
         }
-
       }
 
 
@@ -619,13 +781,47 @@ namespace MR
 
 
 
-      bool Shuffler::is_duplicate (const BitSet& sign) const
+      void Shuffler::get_signflip (const size_t index, BitSet& flips) const
       {
-        for (const auto& s : signflips) {
-          if (sign == s)
-            return true;
+        if (signflips.size()) {
+          flips = signflips[index % signflips.size()];
+          return;
+        }
+        assert (index < signflip_keys.size());
+        if (signflip_default_first && !index) {
+          flips.clear();
+          return;
+        }
+        random_signflip (signflip_keys[index], flips);
+      }
+
+
+
+      void Shuffler::random_signflip (const uint64_t key, BitSet& flips) const
+      {
+        assert (flips.size() == rows);
+        // Each random number provides 64 sign-flips
+        CounterRNG rng (key);
+        uint64_t word = 0;
+
+        // Whole-block sign-flipping
+        if (signflip_blocks.size()) {
+          for (size_t ib = 0; ib != signflip_blocks.size(); ++ib) {
+            if (!(ib % 64))
+              word = rng();
+            const bool value = (word >> (ib % 64)) & 1;
+            for (const auto i : signflip_blocks[ib])
+              flips[i] = value;
+          }
+          return;
+        }
+
+        // Unrestricted sign-flipping
+        for (size_t ir = 0; ir != rows; ++ir) {
+          if (!(ir % 64))
+            word = rng();
+          flips[ir] = (word >> (ir % 64)) & 1;
         }
-        return false;
       }
 
 
@@ -636,44 +832,34 @@ namespace MR
                                                 const bool include_default,
                                                 const bool permit_duplicates)
       {
+        assert (num_rows == rows);
         signflips.clear();
-        signflips.reserve (num_signflips);
+        signflip_keys.assign (num_signflips, 0);
+        const uint64_t seed = Math::RNG::get_seed();
+        if (!getenv ("MRTRIX_RNG_SEED"))
+          reproducible = false;
+
+        if (block_indices.size())
+          signflip_blocks = indices2blocks (block_indices);
+        else
+          signflip_blocks.clear();
+
+        std::unordered_set<uint64_t> accepted;
+        BitSet rows_to_flip (num_rows, false);
         size_t s = 0;
+        signflip_default_first = include_default;
         if (include_default) {
-          BitSet default_labelling (num_rows, false);
-          signflips.push_back (default_labelling);
+          accepted.insert (hash (rows_to_flip));
           ++s;
         }
-        std::random_device rd;
-        std::mt19937 generator (rd());
-        std::uniform_int_distribution<> distribution (0, 1);
-
-        BitSet rows_to_flip (num_rows);
-
-        // Whole-block sign-flipping
-        if (block_indices.size()) {
-          const auto blocks = indices2blocks (block_indices);
-          for (; s != num_signflips; ++s) {
-            do {
-              for (size_t ib = 0; ib != blocks.size(); ++ib) {
-                const bool value = distribution (generator);
-                for (const auto i : blocks[ib])
-                  rows_to_flip[i] = value;
-              }
-            } while (!permit_duplicates && is_duplicate (rows_to_flip));
-            signflips.push_back (rows_to_flip);
-          }
-          return;
-        }
 
-        // Unrestricted sign-flipping
         for (; s != num_signflips; ++s) {
+          uint64_t key, attempt = 0;
           do {
-            // TODO Should be a faster mechanism for generating / storing random bits
-            for (size_t ir = 0; ir != num_rows; ++ir)
-              rows_to_flip[ir] = distribution (generator);
-          } while (!permit_duplicates && is_duplicate (rows_to_flip));
-          signflips.push_back (rows_to_flip);
+            key = make_key (seed, signflip_stream, s, attempt++);
+            random_signflip (key, rows_to_flip);
+          } while (!accepted.insert (hash (rows_to_flip)).second && !permit_duplicates);
+          signflip_keys[s] = key;
         }
       }
 
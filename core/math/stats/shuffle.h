@@ -90,17 +90,51 @@ namespace MR
           //   generate each as it is required, based on the more compressed representations
           bool operator() (Shuffle& output);
 
+          // Yield only the index of the next shuffle, leaving generation of the
+          //   corresponding shuffling matrix to the caller via get(); since get()
+          //   does not modify the Shuffler, multiple threads may call it concurrently
+          bool next (size_t& index);
+          void get (const size_t index, matrix_type& data) const;
+
           size_t size() const { return nshuffles; }
 
           // Go back to the first permutation
           void reset();
 
+          // Restrict the shuffles yielded by operator() to those with indices in [first, last);
+          //   the indices of the shuffles, and the total number reported by size(), are unchanged
+          void set_range (const size_t first, const size_t last);
+
+          // Whether an identical set of shuffles would be generated by another invocation
+          //   of the same command; this requires either that the shuffles be enumerated
+          //   exhaustively or imported from file, or that the random number generator be
+          //   seeded explicitly using the MRTRIX_RNG_SEED environment variable
+          bool is_reproducible() const { return reproducible; }
+
+          // A hash of the full set of shuffles, used to verify that independently
+          //   generated subsets of shuffles originate from the same set
+          uint64_t fingerprint() const;
+
 
         private:
+          enum class blocks_t { NONE, WITHIN, WHOLE };
+
           const size_t rows;
+          // Permutations and sign-flips are stored explicitly only if enumerated exhaustively
+          //   or loaded from file; randomly generated shuffles are instead regenerated on demand
+          //   from a per-shuffle key for a counter-based random number generator
           vector<PermuteLabels> permutations;
           vector<BitSet> signflips;
-          size_t nshuffles, counter;
+          vector<uint64_t> permutation_keys, signflip_keys;
+          bool permutation_default_first, signflip_default_first;
+          blocks_t permutation_blocks_type;
+          vector<vector<size_t>> permutation_blocks, signflip_blocks;
+          // If all combinations of permutations and sign-flips are used, each stored
+          //   permutation is paired with every stored sign-flip in turn
+          size_t permutation_divisor;
+          size_t nshuffles, counter, first, last;
+          bool reproducible;
+          const std::string msg;
           std::unique_ptr<ProgressBar> progress;
 
 
@@ -116,9 +150,12 @@ namespace MR
           index_array_type load_blocks (const std::string& filename, const bool equal_sizes);
 
 
-          // For generating unique permutations
-          bool is_duplicate (const PermuteLabels&, const PermuteLabels&) const;
-          bool is_duplicate (const PermuteLabels&) const;
+          bool has_permutations() const { return permutations.size() || permutation_keys.size(); }
+          bool has_signflips() const { return signflips.size() || signflip_keys.size(); }
+          void get_permutation (const size_t index, PermuteLabels&) const;
+          void get_signflip (const size_t index, BitSet&) const;
+          void random_permutation (const uint64_t key, PermuteLabels&) const;
+          void random_signflip (const uint64_t key, BitSet&) const;
 
           // Note that this function does not take into account identical rows and therefore generated
           // permutations are not guaranteed to be unique wrt the computed test statistic.
@@ -137,8 +174,6 @@ namespace MR
           void load_permutations (const std::string& filename);
 
           // Similar functions required for sign-flipping
-          bool is_duplicate (const BitSet&) const;
-
           void generate_random_signflips (const size_t num_signflips,
                                           const size_t num_rows,
                                           const index_array_type& blocks,
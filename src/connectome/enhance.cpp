@@ -71,6 +71,16 @@ namespace MR {
 
 
 
+      bool NBS::integrate (in_column_type in, const vector<value_type>& thresholds, const value_type E, const value_type H, out_column_type out) const
+      {
+        Stats::TFCE::integrate_clusters (in, *adjacency,
+                                         [] (const value_type value, const value_type T) { return std::isfinite (value) && value >= T; },
+                                         thresholds, E, H, out);
+        return true;
+      }
+
+
+
       void NBS::initialise (const node_t num_nodes)
       {
         const Mat2Vec mat2vec (num_nodes);
@@ -0,0 +1,158 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __dwi_tractography_sift_fixel_td_partials_h__
+#define __dwi_tractography_sift_fixel_td_partials_h__
+
+#include <atomic>
+#include <mutex>
+
+#include "memory.h"
+#include "thread.h"
+#include "types.h"
+
+#include "dwi/tractography/SIFT/types.h"
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace SIFT
+      {
+
+
+
+#define SIFT_FIXEL_MERGE_BLOCK_SIZE 4096
+
+
+
+      // Per-thread partial fixel streamline densities
+      // During streamline mapping, each thread accumulates the contributions of its
+      //   own streamlines into one of these partials, rather than contending on the
+      //   shared fixel data; once mapping is complete, merge() sums them into the model
+      //   fixels, with each thread responsible for a different block of fixels
+      class FixelTDPartials
+      { NOMEMALIGN
+
+        public:
+          class Partial
+          { NOMEMALIGN
+            public:
+              Partial (const size_t num_fixels) :
+                  TD_sum (0.0),
+                  TD (num_fixels, 0.0),
+                  count (num_fixels, 0) { }
+              void add (const size_t fixel_index, const double length)
+              {
+                TD[fixel_index] += length;
+                ++count[fixel_index];
+              }
+              double TD_sum;
+              vector<double> TD;
+              vector<track_t> count;
+          };
+
+          FixelTDPartials (const size_t num_fixels) :
+              num_fixels (num_fixels) { }
+          FixelTDPartials (const FixelTDPartials&) = delete;
+
+          // Thread-safe; one per mapping thread
+          Partial& create();
+
+          // Invokes functor (fixel_index, sum_TD, sum_count) for every fixel to which
+          //   at least one streamline contributed, from multiple threads (but never
+          //   concurrently for the same fixel); returns the sum of all TD_sum members
+          template <class Functor>
+            double merge (Functor&& functor);
+
+        private:
+          const size_t num_fixels;
+          std::mutex mutex;
+          vector<std::unique_ptr<Partial>> partials;
+
+      };
+
+
+
+      template <class Functor>
+        double FixelTDPartials::merge (Functor&& functor)
+        {
+          class Worker
+          { NOMEMALIGN
+            public:
+              Worker (const vector<std::unique_ptr<Partial>>& partials, const size_t num_fixels, Functor& functor, std::atomic<size_t>& next) :
+                  partials (partials),
+                  num_fixels (num_fixels),
+                  functor (functor),
+                  next (next),
+                  TD (SIFT_FIXEL_MERGE_BLOCK_SIZE),
+                  count (SIFT_FIXEL_MERGE_BLOCK_SIZE) { }
+              void execute ()
+              {
+                size_t start;
+                while ((start = SIFT_FIXEL_MERGE_BLOCK_SIZE * next++) < num_fixels) {
+                  const size_t size = std::min (size_t(SIFT_FIXEL_MERGE_BLOCK_SIZE), num_fixels - start);
+                  std::fill (TD.begin(), TD.begin() + size, 0.0);
+                  std::fill (count.begin(), count.begin() + size, 0);
+                  for (const auto& p : partials) {
+                    for (size_t i = 0; i != size; ++i) {
+                      TD[i] += p->TD[start + i];
+                      count[i] += p->count[start + i];
+                    }
+                  }
+                  for (size_t i = 0; i != size; ++i) {
+                    if (count[i])
+                      functor (start + i, TD[i], count[i]);
+                  }
+                }
+              }
+            private:
+              const vector<std::unique_ptr<Partial>>& partials;
+              const size_t num_fixels;
+              Functor& functor;
+              std::atomic<size_t>& next;
+              vector<double> TD;
+              vector<track_t> count;
+          };
+
+          std::atomic<size_t> next (0);
+          Worker worker (partials, num_fixels, functor, next);
+          const size_t num_blocks = (num_fixels + SIFT_FIXEL_MERGE_BLOCK_SIZE - 1) / SIFT_FIXEL_MERGE_BLOCK_SIZE;
+          const size_t num_threads = std::min (num_blocks, Thread::threads_to_execute());
+          if (num_threads > 1)
+            Thread::run (Thread::multi (worker, num_threads), "fixel TD merge");
+          else
+            worker.execute();
+
+          double TD_sum = 0.0;
+          for (const auto& p : partials)
+            TD_sum += p->TD_sum;
+          partials.clear();
+          return TD_sum;
+        }
+
+
+
+      }
+    }
+  }
+}
+
+
+#endif
@@ -0,0 +1,150 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+#include "dwi/tractography/SIFT/gradient_queue.h"
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace SIFT
+      {
+
+
+
+
+      FixelTrackIndex::FixelTrackIndex (const TrackContributions& contributions, const size_t num_fixels) :
+          offsets (num_fixels + 1, 0)
+      {
+        for (track_t track_index = 0; track_index != contributions.size(); ++track_index) {
+          for (const auto& i : contributions[track_index])
+            ++offsets[i.get_fixel_index() + 1];
+        }
+        for (size_t fixel_index = 0; fixel_index != num_fixels; ++fixel_index)
+          offsets[fixel_index + 1] += offsets[fixel_index];
+        tracks.resize (offsets.back());
+        lengths.resize (offsets.back());
+        vector<size_t> position (offsets.begin(), offsets.end() - 1);
+        for (track_t track_index = 0; track_index != contributions.size(); ++track_index) {
+          for (const auto& i : contributions[track_index]) {
+            const size_t p = position[i.get_fixel_index()]++;
+            tracks[p] = track_index;
+            lengths[p] = i.length;
+          }
+        }
+        ends.assign (offsets.begin() + 1, offsets.end());
+      }
+
+
+
+
+      constexpr track_t GradientQueue::absent;
+
+
+
+      GradientQueue::GradientQueue (const vector<Cost_fn_gradient_sort>& in) :
+          gradients (in),
+          position (in.size(), absent)
+      {
+        for (track_t track_index = 0; track_index != gradients.size(); ++track_index) {
+          if (gradients[track_index].get_tck_index() == track_index && gradients[track_index].get_gradient_per_unit_length() < 0.0) {
+            position[track_index] = heap.size();
+            heap.push_back (track_index);
+          }
+        }
+        for (size_t i = heap.size() / 2; i--; )
+          sift_down (i);
+      }
+
+
+
+      const Cost_fn_gradient_sort* GradientQueue::get()
+      {
+        if (heap.empty())
+          return nullptr;
+        const track_t top = heap.front();
+        position[top] = absent;
+        const track_t last = heap.back();
+        heap.pop_back();
+        if (heap.size()) {
+          place (0, last);
+          sift_down (0);
+        }
+        return &gradients[top];
+      }
+
+
+
+      void GradientQueue::update (const track_t track_index)
+      {
+        if (position[track_index] == absent) {
+          if (gradients[track_index].get_tck_index() != track_index || gradients[track_index].get_gradient_per_unit_length() >= 0.0)
+            return;
+          position[track_index] = heap.size();
+          heap.push_back (track_index);
+          sift_up (heap.size() - 1);
+        } else {
+          // Streamlines whose gradient becomes non-negative are left in the heap,
+          //   as they can no longer reach the top while any negative gradient remains
+          sift_up (position[track_index]);
+          sift_down (position[track_index]);
+        }
+      }
+
+
+
+      void GradientQueue::sift_up (size_t i)
+      {
+        const track_t track_index = heap[i];
+        while (i) {
+          const size_t parent = (i - 1) / 2;
+          if (!precedes (track_index, heap[parent]))
+            break;
+          place (i, heap[parent]);
+          i = parent;
+        }
+        place (i, track_index);
+      }
+
+
+
+      void GradientQueue::sift_down (size_t i)
+      {
+        const track_t track_index = heap[i];
+        while (true) {
+          size_t child = 2*i + 1;
+          if (child >= heap.size())
+            break;
+          if (child + 1 < heap.size() && precedes (heap[child+1], heap[child]))
+            ++child;
+          if (!precedes (heap[child], track_index))
+            break;
+          place (i, heap[child]);
+          i = child;
+        }
+        place (i, track_index);
+      }
+
+
+
+
+      }
+    }
+  }
+}
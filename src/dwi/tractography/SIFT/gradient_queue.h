@@ -0,0 +1,134 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+#ifndef __dwi_tractography_sift_gradient_queue_h__
+#define __dwi_tractography_sift_gradient_queue_h__
+
+
+#include <limits>
+
+#include "types.h"
+
+#include "dwi/tractography/SIFT/gradient_sort.h"
+#include "dwi/tractography/SIFT/track_contribution.h"
+#include "dwi/tractography/SIFT/types.h"
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace SIFT
+      {
+
+
+
+
+      // Reverse of TrackContributions: for each fixel, the streamlines traversing it, and the
+      //   (quantised) length of each within that fixel
+      // Stored in compressed sparse row form, with track indices and lengths in separate
+      //   arrays, for a total of 5 bytes per streamline-fixel contribution
+      // Entries corresponding to streamlines that have been removed from the reconstruction
+      //   can be erased, such that subsequent traversals of each fixel only visit those
+      //   streamlines that remain
+      class FixelTrackIndex
+      { NOMEMALIGN
+        public:
+          FixelTrackIndex (const TrackContributions&, const size_t num_fixels);
+
+          class Entries
+          { NOMEMALIGN
+            public:
+              Entries (FixelTrackIndex& master, const size_t fixel_index) :
+                  master (master),
+                  fixel_index (fixel_index),
+                  first (master.offsets[fixel_index]) { }
+              size_t size() const { return master.ends[fixel_index] - first; }
+              track_t track  (const size_t i) const { return master.tracks[first+i]; }
+              float   length (const size_t i) const { return master.get_length (first+i); }
+              // Erase entry i; the last remaining entry for this fixel takes its place
+              void erase (const size_t i)
+              {
+                const size_t last = --master.ends[fixel_index];
+                master.tracks[first+i] = master.tracks[last];
+                master.lengths[first+i] = master.lengths[last];
+              }
+            private:
+              FixelTrackIndex& master;
+              const size_t fixel_index, first;
+          };
+
+          Entries operator[] (const size_t fixel_index) { return Entries (*this, fixel_index); }
+
+          size_t bytes() const { return (offsets.size() + ends.size()) * sizeof(size_t) + tracks.size() * sizeof(track_t) + lengths.size() * sizeof(uint8_t); }
+
+        private:
+          vector<size_t> offsets, ends;
+          vector<track_t> tracks;
+          vector<uint8_t> lengths;
+
+          float get_length (const size_t i) const { return lengths[i] * Track_fixel_contribution::scale_from_storage; }
+      };
+
+
+
+
+      // Alternative to MT_gradient_vector_sorter for incremental filtering
+      // Streamlines with a negative cost function gradient are held in a binary heap (built
+      //   in linear time rather than requiring a full sort), keyed on the gradient per unit
+      //   length as stored in the gradient vector (which here remains indexed by streamline);
+      //   the position of each streamline within the heap is tracked, such that when its
+      //   gradient is modified, its position can be updated in logarithmic time
+      class GradientQueue
+      { NOMEMALIGN
+        public:
+          GradientQueue (const vector<Cost_fn_gradient_sort>&);
+
+          // Remove and return the streamline with the most negative gradient per unit length;
+          //   returns nullptr if the heap is empty
+          const Cost_fn_gradient_sort* get();
+
+          // Notify of a change to the gradient of a streamline in the gradient vector
+          void update (const track_t);
+
+        private:
+          const vector<Cost_fn_gradient_sort>& gradients;
+          vector<track_t> heap, position;
+
+          static constexpr track_t absent = std::numeric_limits<track_t>::max();
+
+          bool precedes (const track_t a, const track_t b) const
+          {
+            const double ga = gradients[a].get_gradient_per_unit_length(), gb = gradients[b].get_gradient_per_unit_length();
+            return (ga < gb) || (ga == gb && a < b);
+          }
+          void place (const size_t i, const track_t track_index) { heap[i] = track_index; position[track_index] = i; }
+          void sift_up (size_t);
+          void sift_down (size_t);
+      };
+
+
+
+
+      }
+    }
+  }
+}
+
+
+#endif
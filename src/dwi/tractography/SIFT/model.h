@@ -71,7 +71,7 @@ namespace MR
           }
           Model (const Model& that) = delete;
 
-          virtual ~Model ();
+          virtual ~Model () { }
 
 
           // Over-rides the function defined in ModelBase; need to build contributions member also
@@ -92,7 +92,7 @@ namespace MR
 
         protected:
           std::string tck_file_path;
-          vector<TrackContribution*> contributions;
+          TrackContributions contributions;
 
           using Fixel_map<Fixel>::accessor;
           using Fixel_map<Fixel>::begin;
@@ -108,13 +108,12 @@ namespace MR
           class TrackMappingWorker
           { MEMALIGN(TrackMappingWorker)
             public:
-              TrackMappingWorker (Model& i, const default_type upsample_ratio) :
+              TrackMappingWorker (Model& i, FixelTDPartials& p, const default_type upsample_ratio) :
                   master (i),
                   mapper (i.header(), i.dirs),
-                  mutex (new std::mutex),
-                  TD_sum (0.0),
-                  fixel_TDs (master.fixels.size(), 0.0),
-                  fixel_counts (master.fixels.size(), 0)
+                  writer (i.contributions),
+                  partials (p),
+                  partial (p.create())
               {
                 mapper.set_upsample_ratio (upsample_ratio);
                 mapper.set_use_precise_mapping (true);
@@ -122,31 +121,33 @@ namespace MR
               TrackMappingWorker (const TrackMappingWorker& that) :
                   master (that.master),
                   mapper (that.mapper),
-                  mutex (that.mutex),
-                  TD_sum (0.0),
-                  fixel_TDs (master.fixels.size(), 0.0),
-                  fixel_counts (master.fixels.size(), 0) { }
-              ~TrackMappingWorker();
+                  writer (that.writer),
+                  partials (that.partials),
+                  partial (partials.create()) { }
               bool operator() (const Tractography::Streamline<>&);
             private:
               Model& master;
               Mapping::TrackMapperBase mapper;
-              std::shared_ptr<std::mutex> mutex;
-              double TD_sum;
-              vector<double> fixel_TDs;
-              vector<track_t> fixel_counts;
+              TrackContributions::Writer writer;
+              FixelTDPartials& partials;
+              FixelTDPartials::Partial& partial;
+              Mapping::SetDixel dixels;
+              vector<Track_fixel_contribution> masked_contributions;
           };
 
           class FixelRemapper
           { MEMALIGN(FixelRemapper)
             public:
-              FixelRemapper (Model& i, vector<size_t>& r) :
+              FixelRemapper (Model& i, vector<size_t>& r, TrackContributions& out) :
                 master   (i),
-                remapper (r) { }
+                remapper (r),
+                writer   (out) { }
               bool operator() (const TrackIndexRange&);
             private:
               Model& master;
               vector<size_t>& remapper;
+              TrackContributions::Writer writer;
+              vector<Track_fixel_contribution> new_cont;
           };
 
       };
@@ -155,20 +156,6 @@ namespace MR
 
 
 
-      template <class Fixel>
-      Model<Fixel>::~Model ()
-      {
-        for (vector<TrackContribution*>::iterator i = contributions.begin(); i != contributions.end(); ++i) {
-          if (*i) {
-            delete *i;
-            *i = nullptr;
-          }
-        }
-      }
-
-
-
-
       template <class Fixel>
       void Model<Fixel>::map_streamlines (const std::string& path)
       {
@@ -179,17 +166,25 @@ namespace MR
         if (!count)
           throw Exception ("Cannot map streamlines: track file " + Path::basename(path) + " is empty");
 
-        contributions.assign (count, nullptr);
+        contributions.set_out_of_core (App::get_options ("out_of_core").size());
+        contributions.initialise (count);
 
         {
           Mapping::TrackLoader loader (file, count);
-          TrackMappingWorker worker (*this, Mapping::determine_upsample_ratio (Fixel_map<Fixel>::header(), properties, 0.1));
+          FixelTDPartials partials (fixels.size());
+          TrackMappingWorker worker (*this, partials, Mapping::determine_upsample_ratio (Fixel_map<Fixel>::header(), properties, 0.1));
           Thread::run_queue (loader,
                              Thread::batch (Tractography::Streamline<>()),
                              Thread::multi (worker));
+          TD_sum += partials.merge ([&] (const size_t fixel_index, const double TD, const track_t count) {
+            increment (fixels[fixel_index], TD, count);
+          });
         }
+        contributions.finalise();
+        DEBUG ("Streamline fixel contributions occupy " + str(contributions.bytes()) + " bytes"
+               + (contributions.is_out_of_core() ? " in memory, " + str(contributions.file_bytes()) + " bytes on disk" : ""));
 
-        if (!contributions.back()) {
+        if (!contributions[contributions.size() - 1]) {
           track_t num_tracks = 0, max_index = 0;
           for (track_t i = 0; i != contributions.size(); ++i) {
             if (contributions[i]) {
@@ -255,9 +250,16 @@ namespace MR
 
         fixels.swap (new_fixels);
 
-        TrackIndexRangeWriter writer (SIFT_TRACK_INDEX_BUFFER_SIZE, num_tracks(), "Removing excluded fixels");
-        FixelRemapper remapper (*this, fixel_index_mapping);
-        Thread::run_queue (writer, TrackIndexRange(), Thread::multi (remapper));
+        {
+          TrackContributions remapped;
+          remapped.set_out_of_core (contributions.is_out_of_core());
+          remapped.initialise (num_tracks());
+          TrackIndexRangeWriter writer (SIFT_TRACK_INDEX_BUFFER_SIZE, num_tracks(), "Removing excluded fixels");
+          FixelRemapper remapper (*this, fixel_index_mapping, remapped);
+          Thread::run_queue (writer, TrackIndexRange(), Thread::multi (remapper));
+          remapped.finalise();
+          contributions.swap (remapped);
+        }
 
         TD_sum = 0.0;
         for (typename vector<Fixel>::const_iterator i = fixels.begin(); i != fixels.end(); ++i)
@@ -285,9 +287,9 @@ namespace MR
         VAR (sum_from_fixels);
         VAR (sum_from_fixels_weighted);
         double sum_from_tracks = 0.0;
-        for (vector<TrackContribution*>::const_iterator i = contributions.begin(); i != contributions.end(); ++i) {
-          if (*i)
-            sum_from_tracks += (*i)->get_total_contribution();
+        for (track_t i = 0; i != contributions.size(); ++i) {
+          if (contributions[i])
+            sum_from_tracks += contributions[i].get_total_contribution();
         }
         VAR (sum_from_tracks);
       }
@@ -306,7 +308,7 @@ namespace MR
         ProgressBar progress ("Writing non-contributing streamlines output file", contributions.size());
         track_t tck_counter = 0;
         while (reader (tck) && tck_counter < contributions.size()) {
-          if (contributions[tck_counter] && !contributions[tck_counter++]->get_total_contribution())
+          if (contributions[tck_counter] && !contributions[tck_counter++].get_total_contribution())
             writer (tck);
           else
             writer.skip();
@@ -319,50 +321,16 @@ namespace MR
 
 
 
-      namespace {
-        // Split multi-threaded increment here based on whether or not the Fixel
-        //   template class does or does not possess member add_TD (const double, const track_t)
-        template <typename... Ts>
-        using void_t = void;
-
-        template <typename T, typename = void>
-        struct has_add_TD_function : std::false_type { NOMEMALIGN };
-        template <typename T>
-        struct has_add_TD_function<T, decltype (std::declval<T>().add_TD(0.0, 0))> : std::true_type { NOMEMALIGN };
-
-        template <typename FixelType>
-        typename std::enable_if<has_add_TD_function<FixelType>::value, void>::type increment (FixelType& fixel, const double length, const track_t count) {
-          fixel.add_TD (length, count);
-        }
-        template <typename FixelType>
-        typename std::enable_if<!has_add_TD_function<FixelType>::value, void>::type increment (FixelType& fixel, const double length, const track_t count) {
-          fixel += length;
-        }
-      }
-
-      template <class Fixel>
-      Model<Fixel>::TrackMappingWorker::~TrackMappingWorker()
-      {
-        std::lock_guard<std::mutex> lock (*mutex);
-        master.TD_sum += TD_sum;
-        for (size_t i = 0; i != fixel_TDs.size(); ++i)
-          increment (master.fixels[i], fixel_TDs[i], fixel_counts[i]);
-      }
-
-
-
       template <class Fixel>
       bool Model<Fixel>::TrackMappingWorker::operator() (const Tractography::Streamline<>& in)
       {
         assert (in.get_index() < master.contributions.size());
-        assert (!master.contributions[in.get_index()]);
 
         try {
 
-          Mapping::SetDixel dixels;
           mapper (in, dixels);
 
-          vector<Track_fixel_contribution> masked_contributions;
+          masked_contributions.clear();
           default_type total_contribution = 0.0, total_length = 0.0;
 
           for (Mapping::SetDixel::const_iterator i = dixels.begin(); i != dixels.end(); ++i) {
@@ -380,13 +348,11 @@ namespace MR
             }
           }
 
-          master.contributions[in.get_index()] = new TrackContribution (masked_contributions, total_contribution, total_length);
+          writer (in.get_index(), masked_contributions, total_contribution, total_length);
 
-          TD_sum += total_contribution;
-          for (vector<Track_fixel_contribution>::const_iterator i = masked_contributions.begin(); i != masked_contributions.end(); ++i) {
-            fixel_TDs [i->get_fixel_index()] += i->get_length();
-            ++fixel_counts [i->get_fixel_index()];
-          }
+          partial.TD_sum += total_contribution;
+          for (vector<Track_fixel_contribution>::const_iterator i = masked_contributions.begin(); i != masked_contributions.end(); ++i)
+            partial.add (i->get_fixel_index(), i->get_length());
 
           return true;
 
@@ -404,20 +370,18 @@ namespace MR
       bool Model<Fixel>::FixelRemapper::operator() (const TrackIndexRange& in)
       {
         for (track_t track_index = in.first; track_index != in.second; ++track_index) {
-          if (master.contributions[track_index]) {
-            TrackContribution& this_cont (*master.contributions[track_index]);
-            vector<Track_fixel_contribution> new_cont;
+          const TrackContribution this_cont (master.contributions[track_index]);
+          if (this_cont) {
+            new_cont.clear();
             double total_contribution = 0.0;
-            for (size_t i = 0; i != this_cont.dim(); ++i) {
-              const size_t new_index = remapper[this_cont[i].get_fixel_index()];
+            for (const auto& i : this_cont) {
+              const size_t new_index = remapper[i.get_fixel_index()];
               if (new_index) {
-                new_cont.push_back (Track_fixel_contribution (new_index, this_cont[i].get_length()));
-                total_contribution += this_cont[i].get_length() * master[new_index].get_weight();
+                new_cont.push_back (Track_fixel_contribution (new_index, i.get_length()));
+                total_contribution += i.get_length() * master[new_index].get_weight();
               }
             }
-            TrackContribution* new_contribution = new TrackContribution (new_cont, total_contribution, this_cont.get_total_length());
-            delete master.contributions[track_index];
-            master.contributions[track_index] = new_contribution;
+            writer (track_index, new_cont, total_contribution, this_cont.get_total_length());
           }
         }
         return true;
@@ -33,6 +33,7 @@
 #include "dwi/tractography/mapping/mapping.h"
 #include "dwi/tractography/mapping/voxel.h"
 
+#include "dwi/tractography/SIFT/fixel_td_partials.h"
 #include "dwi/tractography/SIFT/proc_mask.h"
 #include "dwi/tractography/SIFT/types.h"
 
@@ -116,6 +117,24 @@ namespace MR
 
 
 
+        // Split multi-threaded increment here based on whether or not the Fixel
+        //   template class does or does not possess member add_TD (const double, const track_t)
+        template <typename T, typename = void>
+        struct has_add_TD_function : std::false_type { NOMEMALIGN };
+        template <typename T>
+        struct has_add_TD_function<T, decltype (std::declval<T>().add_TD(0.0, 0))> : std::true_type { NOMEMALIGN };
+
+        template <typename FixelType>
+        inline typename std::enable_if<has_add_TD_function<FixelType>::value, void>::type increment (FixelType& fixel, const double length, const track_t count) {
+          fixel.add_TD (length, count);
+        }
+        template <typename FixelType>
+        inline typename std::enable_if<!has_add_TD_function<FixelType>::value, void>::type increment (FixelType& fixel, const double length, const track_t count) {
+          fixel += length;
+        }
+
+
+
         // Templated Fixel class should derive from FixelBase to ensure that it has adequate functionality
         // This class stores the necessary fixel information (including streamline densities), but does not retain the
         //   list of fixels traversed by each streamline. If this information is necessary, use the Model class (model.h)
@@ -185,6 +204,35 @@ namespace MR
             void output_fixel_count_image (const std::string&) const;
             void output_untracked_fixels (const std::string&, const std::string&) const;
 
+
+          private:
+            // Maps streamlines and accumulates their fixel densities into a per-thread partial
+            class TrackMappingWorker
+            { MEMALIGN(TrackMappingWorker)
+              public:
+                TrackMappingWorker (ModelBase& i, FixelTDPartials& p, const default_type upsample_ratio) :
+                    master (i),
+                    mapper (i.header(), i.dirs),
+                    partials (p),
+                    partial (p.create())
+                {
+                  mapper.set_upsample_ratio (upsample_ratio);
+                  mapper.set_use_precise_mapping (true);
+                }
+                TrackMappingWorker (const TrackMappingWorker& that) :
+                    master (that.master),
+                    mapper (that.mapper),
+                    partials (that.partials),
+                    partial (partials.create()) { }
+                bool operator() (const Tractography::Streamline<>&);
+              private:
+                ModelBase& master;
+                Mapping::TrackMapperBase mapper;
+                FixelTDPartials& partials;
+                FixelTDPartials::Partial& partial;
+                Mapping::SetDixel dixels;
+            };
+
         };
 
 
@@ -240,16 +288,18 @@ namespace MR
           if (!count)
             throw Exception ("Cannot map streamlines: track file " + Path::basename(path) + " is empty");
 
-          Mapping::TrackLoader loader (file, count);
-          Mapping::TrackMapperBase mapper (Fixel_map<Fixel>::header(), dirs);
-          mapper.set_upsample_ratio (Mapping::determine_upsample_ratio (Fixel_map<Fixel>::header(), properties, 0.1));
-          mapper.set_use_precise_mapping (true);
-          Thread::run_queue (
-              loader,
-              Thread::batch (Tractography::Streamline<float>()),
-              Thread::multi (mapper),
-              Thread::batch (Mapping::SetDixel()),
-              *this);
+          {
+            Mapping::TrackLoader loader (file, count);
+            FixelTDPartials partials (fixels.size());
+            TrackMappingWorker worker (*this, partials, Mapping::determine_upsample_ratio (Fixel_map<Fixel>::header(), properties, 0.1));
+            Thread::run_queue (
+                loader,
+                Thread::batch (Tractography::Streamline<float>()),
+                Thread::multi (worker));
+            TD_sum += partials.merge ([&] (const size_t fixel_index, const double TD, const track_t count) {
+              increment (fixels[fixel_index], TD, count);
+            });
+          }
 
           INFO ("Proportionality coefficient after streamline mapping is " + str (mu()));
         }
@@ -257,6 +307,23 @@ namespace MR
 
 
 
+        template <class Fixel>
+        bool ModelBase<Fixel>::TrackMappingWorker::operator() (const Tractography::Streamline<>& in)
+        {
+          mapper (in, dixels);
+          for (Mapping::SetDixel::const_iterator i = dixels.begin(); i != dixels.end(); ++i) {
+            const size_t fixel_index = master.dixel2fixel (*i);
+            if (fixel_index) {
+              partial.add (fixel_index, i->get_length());
+              partial.TD_sum += master.fixels[fixel_index].get_weight() * i->get_length();
+            }
+          }
+          return true;
+        }
+
+
+
+
         template <class Fixel>
         bool ModelBase<Fixel>::operator() (const FMLS::FOD_lobes& in)
         {
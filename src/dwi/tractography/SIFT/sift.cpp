@@ -43,7 +43,11 @@ const OptionGroup SIFTModelOption = OptionGroup ("Options affecting the SIFT mod
 
   + Option ("fd_thresh", "fibre density threshold; exclude an FOD lobe from filtering processing if its integral is less than this amount "
                          "(streamlines will still be mapped to it, but it will not contribute to the cost function or the filtering)")
-    + Argument ("value").type_float (0.0, 2.0 * Math::pi);
+    + Argument ("value").type_float (0.0, 2.0 * Math::pi)
+
+  + Option ("out_of_core", "store the streamline-fixel contributions in a temporary file rather than in RAM; "
+                           "this permits processing of tractograms whose contributions would not otherwise fit in memory, "
+                           "at the expense of some computation time (file location is determined by config file option TmpFileDir)");
 
 
 
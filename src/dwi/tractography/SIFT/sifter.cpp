@@ -60,10 +60,10 @@ namespace MR
         vector<track_t> noncontributing_indices;
         for (track_t i = 0; i != contributions.size(); ++i) {
           if (contributions[i]) {
-            if (contributions[i]->get_total_contribution()) {
-              sum_contributing_length    += contributions[i]->get_total_length();
+            if (contributions[i].get_total_contribution()) {
+              sum_contributing_length    += contributions[i].get_total_length();
             } else {
-              sum_noncontributing_length += contributions[i]->get_total_length();
+              sum_noncontributing_length += contributions[i].get_total_length();
               noncontributing_indices.push_back (i);
             }
           }
@@ -79,6 +79,15 @@ namespace MR
           throw Exception ("Error assigning memory for SIFT gradient vector");
         }
 
+        // For incremental filtering, only those streamlines sharing fixels with a removed streamline
+        //   have their gradients updated, and these are re-ranked within a heap rather than
+        //   re-sorting all streamlines
+        std::unique_ptr<FixelTrackIndex> fixel_tracks;
+        if (incremental) {
+          fixel_tracks.reset (new FixelTrackIndex (contributions, fixels.size()));
+          DEBUG ("Fixel-streamline index occupies " + str(fixel_tracks->bytes()) + " bytes");
+        }
+
         unsigned int tracks_remaining = num_tracks();
 
         if (tracks_remaining < term_number)
@@ -110,6 +119,7 @@ namespace MR
           const double current_mu     = mu();
           const double current_cf     = calc_cost_function();
           const double current_roc_cf = calc_roc_cost_function();
+          const double current_TD_sum = TD_sum;
 
 
           TrackIndexRangeWriter range_writer (SIFT_TRACK_INDEX_BUFFER_SIZE, num_tracks());
@@ -131,8 +141,14 @@ namespace MR
           // Trying a heuristic for now; go for a sort size of 1000 following initial sort, assuming half of all
           //   remaining streamlines have a negative gradient
 
-          const track_t sort_size = std::min (std::ceil(num_tracks() / double(Thread::number_of_threads())), std::round (2000.0 * double(num_tracks()) / double(tracks_remaining)));
-          MT_gradient_vector_sorter sorter (gradient_vector, sort_size);
+          std::unique_ptr<MT_gradient_vector_sorter> sorter;
+          std::unique_ptr<GradientQueue> queue;
+          if (incremental) {
+            queue.reset (new GradientQueue (gradient_vector));
+          } else {
+            const track_t sort_size = std::min (std::ceil(num_tracks() / double(Thread::number_of_threads())), std::round (2000.0 * double(num_tracks()) / double(tracks_remaining)));
+            sorter.reset (new MT_gradient_vector_sorter (gradient_vector, sort_size));
+          }
 
           // Remove candidate streamlines one at a time, and correspondingly modify the fixels to which they were attributed
           removed_this_iteration = 0;
@@ -170,16 +186,22 @@ namespace MR
               noncontributing_indices.pop_back();
 
               // Remove this streamline, and adjust all of the relevant quantities
-              noncontributing_length_removed += contributions[to_remove]->get_total_length();
-              delete contributions[to_remove];
-              contributions[to_remove] = nullptr;
+              noncontributing_length_removed += contributions[to_remove].get_total_length();
+              contributions.remove (to_remove);
               ++removed_this_iteration;
               --tracks_remaining;
 
             } else { // Proceed as normal
 
-              const vector<Cost_fn_gradient_sort>::iterator candidate = sorter.get();
-              if (candidate == gradient_vector.end()) {
+              const Cost_fn_gradient_sort* candidate = nullptr;
+              if (queue) {
+                candidate = queue->get();
+              } else {
+                const vector<Cost_fn_gradient_sort>::iterator i = sorter->get();
+                if (i != gradient_vector.end())
+                  candidate = &*i;
+              }
+              if (!candidate) {
                 recalculate = POS_GRADIENT;
                 if (!removed_this_iteration)
                   another_iteration = false;
@@ -200,7 +222,7 @@ namespace MR
               const double streamline_density_ratio = candidate->get_cost_gradient() / (sum_contributing_length - contributing_length_removed);
               const double required_cf_change_ratio = - term_ratio * streamline_density_ratio * current_cf;
 
-              const TrackContribution& candidate_contribution (*contributions[candidate_index]);
+              const TrackContribution candidate_contribution (contributions[candidate_index]);
 
               const double old_mu = mu();
               const double new_mu = FOD_sum / (TD_sum - candidate_contribution.get_total_contribution());
@@ -210,8 +232,7 @@ namespace MR
               double this_actual_cf_change = current_roc_cf * mu_change;
               double quantisation = 0.0;
 
-              for (size_t f = 0; f != candidate_contribution.dim(); ++f) {
-                const Track_fixel_contribution& fixel_cont = candidate_contribution[f];
+              for (const auto& fixel_cont : candidate_contribution) {
                 const float length = fixel_cont.get_length();
                 Fixel& this_fixel = fixels[fixel_cont.get_fixel_index()];
                 quantisation += this_fixel.calc_quantisation (old_mu, length);
@@ -226,14 +247,20 @@ namespace MR
               if (this_actual_cf_change < std::min ( {required_cf_change_ratio, required_cf_change_quantisation, this_nonlinearity })) {
 
                 // Candidate streamline removal meets all criteria; remove from reconstruction
-                for (size_t f = 0; f != candidate_contribution.dim(); ++f) {
-                  const Track_fixel_contribution& fixel_cont = candidate_contribution[f];
-                  fixels[fixel_cont.get_fixel_index()] -= fixel_cont.get_length();
+                if (queue) {
+                  gradient_vector[candidate_index].set (num_tracks(), 0.0, 0.0);
+                  for (const auto& fixel_cont : candidate_contribution) {
+                    const Fixel before (fixels[fixel_cont.get_fixel_index()]);
+                    fixels[fixel_cont.get_fixel_index()] -= fixel_cont.get_length();
+                    update_gradients (fixel_cont.get_fixel_index(), before, *fixel_tracks, gradient_vector, *queue, current_mu, current_TD_sum);
+                  }
+                } else {
+                  for (const auto& fixel_cont : candidate_contribution)
+                    fixels[fixel_cont.get_fixel_index()] -= fixel_cont.get_length();
                 }
                 TD_sum -= candidate_contribution.get_total_contribution();
                 contributing_length_removed += candidate_contribution.get_total_length();
-                delete contributions[candidate_index];
-                contributions[candidate_index] = nullptr;
+                contributions.remove (candidate_index);
                 ++removed_this_iteration;
                 --tracks_remaining;
 
@@ -434,20 +461,48 @@ namespace MR
       {
         if (!contributions[index])
           return std::numeric_limits<double>::max();
-        const TrackContribution& tck_cont = *contributions[index];
+        const TrackContribution tck_cont (contributions[index]);
         const double TD_sum_if_removed = TD_sum - tck_cont.get_total_contribution();
         const double mu_if_removed = FOD_sum / TD_sum_if_removed;
         const double mu_change_if_removed = mu_if_removed - current_mu;
         double gradient = current_roc_cost * mu_change_if_removed;
-        for (size_t f = 0; f != tck_cont.dim(); ++f) {
-          const Fixel& fixel = fixels[tck_cont[f].get_fixel_index()];
+        for (const auto& f : tck_cont) {
+          const Fixel& fixel = fixels[f.get_fixel_index()];
           const double undo_gradient_mu_only = fixel.get_d_cost_d_mu (current_mu) * mu_change_if_removed;
-          const double gradient_remove_tck = fixel.get_cost_wo_track (mu_if_removed, tck_cont[f].get_length()) - fixel.get_cost (current_mu);
+          const double gradient_remove_tck = fixel.get_cost_wo_track (mu_if_removed, f.get_length()) - fixel.get_cost (current_mu);
           gradient = gradient - undo_gradient_mu_only + gradient_remove_tck;
         }
         return gradient;
       }
 
+      void SIFTer::update_gradients (const size_t fixel_index, const Fixel& before, FixelTrackIndex& fixel_tracks, vector<Cost_fn_gradient_sort>& gradient_vector, GradientQueue& queue, const double current_mu, const double current_TD_sum) const
+      {
+        // Gradients were calculated using the values of mu and TD_sum at the start of the iteration;
+        //   only the terms of calc_gradient() specific to this fixel are updated
+        const Fixel& after (fixels[fixel_index]);
+        auto entries = fixel_tracks[fixel_index];
+        for (size_t i = 0; i != entries.size(); ) {
+          const track_t track_index = entries.track (i);
+          Cost_fn_gradient_sort& gradient (gradient_vector[track_index]);
+          // Streamline has been removed; no need to visit it again
+          if (gradient.get_tck_index() != track_index) {
+            entries.erase (i);
+            continue;
+          }
+          const float length = entries.length (i);
+          const double total_contribution = contributions.get_total_contribution (track_index);
+          const double mu_if_removed = FOD_sum / (current_TD_sum - total_contribution);
+          const double mu_change_if_removed = mu_if_removed - current_mu;
+          auto fixel_term = [&] (const Fixel& fixel) {
+            return fixel.get_cost_wo_track (mu_if_removed, length) - fixel.get_cost (current_mu) - (fixel.get_d_cost_d_mu (current_mu) * mu_change_if_removed);
+          };
+          const double new_gradient = gradient.get_cost_gradient() + fixel_term (after) - fixel_term (before);
+          gradient.set (track_index, new_gradient, total_contribution ? (new_gradient / total_contribution) : 0.0);
+          queue.update (track_index);
+          ++i;
+        }
+      }
+
 
 
 
@@ -458,7 +513,7 @@ namespace MR
         for (track_t track_index = in.first; track_index != in.second; ++track_index) {
           if (master.contributions[track_index]) {
             const double gradient = master.calc_gradient (track_index, current_mu, current_roc_cost);
-            const double grad_per_unit_length = master.contributions[track_index]->get_total_contribution() ? (gradient / master.contributions[track_index]->get_total_contribution()) : 0.0;
+            const double grad_per_unit_length = master.contributions[track_index].get_total_contribution() ? (gradient / master.contributions[track_index].get_total_contribution()) : 0.0;
             gradient_vector[track_index].set (track_index, gradient, grad_per_unit_length);
           } else {
             gradient_vector[track_index].set (master.num_tracks(), 0.0, 0.0);
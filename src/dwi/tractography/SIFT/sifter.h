@@ -27,6 +27,7 @@
 #include "dwi/fixel_map.h"
 #include "dwi/directions/set.h"
 #include "dwi/tractography/SIFT/fixel.h"
+#include "dwi/tractography/SIFT/gradient_queue.h"
 #include "dwi/tractography/SIFT/gradient_sort.h"
 #include "dwi/tractography/SIFT/model.h"
 #include "dwi/tractography/SIFT/output.h"
@@ -61,7 +62,8 @@ namespace MR
             term_number (0),
             term_ratio (0.0),
             term_mu (0.0),
-            enforce_quantisation (true) { }
+            enforce_quantisation (true),
+            incremental (false) { }
 
         SIFTer (const SIFTer& that) = delete;
 
@@ -78,6 +80,7 @@ namespace MR
         void set_term_ratio  (const float i)        { term_ratio = i; }
         void set_term_mu     (const float i)        { term_mu = i; }
         void set_csv_path    (const std::string& i) { csv_path = i; }
+        void set_incremental (const bool i)         { incremental = i; }
 
         void set_regular_outputs (const vector<uint32_t>&, const bool);
 
@@ -104,12 +107,17 @@ namespace MR
         double  term_mu;
         bool    enforce_quantisation;
         std::string csv_path;
+        bool    incremental;
 
 
         // Convenience functions
         double calc_roc_cost_function() const;
         double calc_gradient (const track_t, const double, const double) const;
 
+        // For incremental filtering: following a change to the streamline density in a fixel,
+        //   update the gradients of all streamlines traversing it, given its prior state
+        void update_gradients (const size_t, const Fixel&, FixelTrackIndex&, vector<Cost_fn_gradient_sort>&, GradientQueue&, const double, const double) const;
+
 
 
         // For calculating the streamline removal gradients in a multi-threaded fashion
@@ -16,6 +16,9 @@
 
 #include "dwi/tractography/SIFT/track_contribution.h"
 
+#include "signal_handler.h"
+#include "file/utils.h"
+
 namespace MR
 {
   namespace DWI
@@ -31,6 +34,268 @@ namespace MR
         float Track_fixel_contribution::min_length_for_storage = 0.0;
 
 
+
+
+        constexpr uint64_t TrackContributions::absent;
+        constexpr size_t TrackContributions::block_size;
+        constexpr size_t TrackContributions::max_pending_blocks;
+
+
+
+        void TrackContributions::Writer::operator() (const size_t track_index, const vector<Track_fixel_contribution>& in, const float total_contribution, const float total_length)
+        {
+          record.clear();
+          Varint::write (record, in.size());
+          int64_t previous = 0;
+          for (const auto& i : in) {
+            Varint::write (record, Varint::zigzag (int64_t(i.fixel) - previous));
+            record.push_back (i.length);
+            previous = i.fixel;
+          }
+          if (!block || block->data.size() + record.size() > block->data.capacity()) {
+            if (block)
+              master.retire_block (block_index);
+            block = master.create_block (record.size(), block_index);
+          }
+          master.offsets[track_index] = (uint64_t(block_index) << block_shift) | uint64_t(block->data.size());
+          master.total_contributions[track_index] = total_contribution;
+          master.total_lengths[track_index] = total_length;
+          block->data.insert (block->data.end(), record.begin(), record.end());
+          ++block->num_records;
+        }
+
+
+
+        TrackContributions::~TrackContributions()
+        {
+          close_file();
+        }
+
+
+
+        void TrackContributions::initialise (const size_t num_tracks)
+        {
+          arena.clear();
+          offsets.assign (num_tracks, absent);
+          total_contributions.assign (num_tracks, 0.0f);
+          total_lengths.assign (num_tracks, 0.0f);
+          blocks.clear();
+          block_file_offsets.clear();
+          close_file();
+          if (out_of_core) {
+            file_path = File::create_tempfile (0, "sift");
+            SignalHandler::mark_file_for_deletion (file_path);
+            file.reset (new File::OFStream (file_path));
+            pending.clear();
+            writer_stop = write_failed = false;
+            writer = std::async (std::launch::async, &TrackContributions::write_blocks, this);
+          }
+        }
+
+
+
+        void TrackContributions::finalise()
+        {
+          if (out_of_core) {
+            stop_writer (false);
+            writer.get();
+            // Blocks still held by the mapping threads were never retired
+            for (size_t index = 0; index != blocks.size(); ++index) {
+              if (blocks[index]) {
+                block_file_offsets[index] = append (*blocks[index]);
+                blocks[index].reset();
+              }
+            }
+            blocks.clear();
+            file->close();
+            if (!file->good())
+              throw Exception ("Error writing streamline contributions to temporary file \"" + file_path + "\"");
+            file.reset();
+            for (auto& offset : offsets) {
+              if (offset != absent)
+                offset = block_file_offsets[offset >> block_shift] + (offset & ((uint64_t(1) << block_shift) - 1));
+            }
+            block_file_offsets.clear();
+            if (file_size)
+              mmap.reset (new File::MMap (File::Entry (file_path)));
+            return;
+          }
+
+          size_t total_size = 0;
+          for (const auto& b : blocks)
+            total_size += b->data.size();
+          arena.clear();
+          arena.shrink_to_fit();
+          arena.reserve (total_size);
+          for (auto& offset : offsets) {
+            if (offset == absent)
+              continue;
+            auto& block = blocks[offset >> block_shift];
+            const uint8_t* const record = block->data.data() + (offset & ((uint64_t(1) << block_shift) - 1));
+            offset = arena.size();
+            arena.insert (arena.end(), record, record + record_size (record));
+            if (!--block->num_records)
+              block.reset();
+          }
+          blocks.clear();
+        }
+
+
+
+        size_t TrackContributions::bytes() const
+        {
+          return arena.capacity() * sizeof(uint8_t)
+              + offsets.capacity() * sizeof(uint64_t)
+              + (total_contributions.capacity() + total_lengths.capacity()) * sizeof(float);
+        }
+
+
+
+        void TrackContributions::swap (TrackContributions& that)
+        {
+          assert (blocks.empty() && that.blocks.empty());
+          arena.swap (that.arena);
+          offsets.swap (that.offsets);
+          total_contributions.swap (that.total_contributions);
+          total_lengths.swap (that.total_lengths);
+          std::swap (out_of_core, that.out_of_core);
+          file_path.swap (that.file_path);
+          std::swap (file_size, that.file_size);
+          mmap.swap (that.mmap);
+        }
+
+
+
+        TrackContributions::Block* TrackContributions::create_block (const size_t min_capacity, size_t& index)
+        {
+          std::lock_guard<std::mutex> lock (mutex);
+          if (blocks.size() == (size_t(1) << (64 - block_shift)))
+            throw Exception ("Too many memory blocks allocated for streamline contributions");
+          blocks.push_back (make_unique<Block> (std::max (block_size, min_capacity)));
+          block_file_offsets.push_back (absent);
+          index = blocks.size() - 1;
+          return blocks.back().get();
+        }
+
+
+
+        void TrackContributions::retire_block (const size_t index)
+        {
+          if (!out_of_core)
+            return;
+          {
+            std::unique_lock<std::mutex> lock (mutex);
+            pending_changed.wait (lock, [&] { return pending.size() < max_pending_blocks || write_failed; });
+            // Error will be reported by finalise()
+            if (write_failed) {
+              blocks[index].reset();
+              return;
+            }
+            pending.push_back (index);
+          }
+          pending_changed.notify_all();
+        }
+
+
+
+        uint64_t TrackContributions::append (const Block& block)
+        {
+          const uint64_t offset = file_size;
+          file->write (reinterpret_cast<const char*> (block.data.data()), block.data.size());
+          if (!file->good())
+            throw Exception ("Error writing streamline contributions to temporary file \"" + file_path + "\"");
+          file_size += block.data.size();
+          return offset;
+        }
+
+
+
+        void TrackContributions::write_blocks()
+        {
+          try {
+            while (true) {
+              size_t index;
+              std::unique_ptr<Block> block;
+              {
+                std::unique_lock<std::mutex> lock (mutex);
+                pending_changed.wait (lock, [&] { return pending.size() || writer_stop; });
+                if (pending.empty())
+                  return;
+                index = pending.front();
+                pending.pop_front();
+                block = std::move (blocks[index]);
+              }
+              pending_changed.notify_all();
+              const uint64_t offset = append (*block);
+              std::lock_guard<std::mutex> lock (mutex);
+              block_file_offsets[index] = offset;
+            }
+          } catch (...) {
+            // Release any threads waiting to retire a block
+            {
+              std::lock_guard<std::mutex> lock (mutex);
+              write_failed = true;
+              for (const auto index : pending)
+                blocks[index].reset();
+              pending.clear();
+            }
+            pending_changed.notify_all();
+            throw;
+          }
+        }
+
+
+
+        // Once all queued blocks have been written (or discarded),
+        //   the writer thread exits; its exception, if any, is
+        //   retained in the future
+        void TrackContributions::stop_writer (const bool discard)
+        {
+          if (!writer.valid())
+            return;
+          {
+            std::lock_guard<std::mutex> lock (mutex);
+            if (discard)
+              pending.clear();
+            writer_stop = true;
+          }
+          pending_changed.notify_all();
+          writer.wait();
+        }
+
+
+
+        void TrackContributions::close_file()
+        {
+          stop_writer (true);
+          if (writer.valid()) {
+            try { writer.get(); }
+            catch (Exception&) { }
+          }
+          mmap.reset();
+          file.reset();
+          file_size = 0;
+          if (file_path.size()) {
+            std::remove (file_path.c_str());
+            SignalHandler::unmark_file_for_deletion (file_path);
+            file_path.clear();
+          }
+        }
+
+
+
+        size_t TrackContributions::record_size (const uint8_t* record)
+        {
+          const uint8_t* p = record;
+          const uint64_t num_fixels = Varint::read (p);
+          for (uint64_t i = 0; i != num_fixels; ++i) {
+            Varint::read (p);
+            ++p;
+          }
+          return p - record;
+        }
+
+
       }
     }
   }
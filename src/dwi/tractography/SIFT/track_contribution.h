@@ -18,11 +18,19 @@
 #define __dwi_tractography_sift_track_contribution_h__
 
 
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <future>
+#include <limits>
+#include <mutex>
 
 #include "header.h"
-#include "min_mem_array.h"
+#include "memory.h"
+#include "types.h"
 
+#include "file/mmap.h"
+#include "file/ofstream.h"
 #include "math/math.h"
 
 
@@ -41,17 +49,16 @@ namespace MR
       class Track_fixel_contribution
       { MEMALIGN(Track_fixel_contribution)
         public:
-          Track_fixel_contribution (const uint32_t fixel_index, const float length)
-          {
-            const uint32_t length_as_int = std::min (uint32_t(255), uint32_t(std::round (scale_to_storage * length)));
-            data = (fixel_index & 0x00FFFFFF) | (length_as_int << 24);
-          }
+          Track_fixel_contribution (const uint32_t fixel_index, const float length) :
+              fixel (fixel_index),
+              length (std::min (uint32_t(255), uint32_t(std::round (scale_to_storage * length)))) { }
 
           Track_fixel_contribution() :
-            data (0) { }
+              fixel (0),
+              length (0) { }
 
-          uint32_t get_fixel_index() const { return (data & 0x00FFFFFF); }
-          float    get_length()      const { return (uint32_t((data & 0xFF000000) >> 24) * scale_from_storage); }
+          uint32_t get_fixel_index() const { return fixel; }
+          float    get_length()      const { return length * scale_from_storage; }
 
 
           bool add (const float length)
@@ -59,10 +66,9 @@ namespace MR
             // Allow summing of multiple contributions to a fixel, UNLESS it would cause truncation, in which
             //   case keep them separate
             const uint32_t increment = std::round (scale_to_storage * length);
-            const uint32_t existing = (data & 0xFF000000) >> 24;
-            if (existing + increment > 255)
+            if (this->length + increment > 255)
               return false;
-            data = (data & 0x00FFFFFF) | ((existing + increment) << 24);
+            this->length += increment;
             return true;
           }
 
@@ -78,77 +84,236 @@ namespace MR
           }
 
 
-          // Minimum length that will be non-zero once converted to an integer for word-sharing storage
+          // Minimum length that will be non-zero once converted to an integer for storage
           static float min() { return min_length_for_storage; }
 
 
         private:
-          uint32_t data;
+          uint32_t fixel;
+          uint8_t length;
 
           static float scale_to_storage, scale_from_storage, min_length_for_storage;
 
-      };
+          friend class TrackContribution;
+          friend class TrackContributions;
+          friend class FixelTrackIndex;
 
+      };
 
 
 
-/*
-// This is a 'safe' version of Track_fixel_contribution that does not use byte-sharing, but requires double the RAM
-// Simply comment the class above and un-comment this one to use
-class Track_fixel_contribution
-{ MEMALIGN(Track_fixel_contribution)
-  public:
-    Track_fixel_contribution (const uint32_t fixel_index, const float length) :
-      fixel (fixel_index),
-      length (length) { }
 
-    Track_fixel_contribution() :
-      fixel (0),
-      length (0.0) { }
+      // Encoding of the fixels traversed by a streamline, as stored within TrackContributions:
+      //   the number of fixels as a variable-length integer, followed by each fixel index
+      //   as a zig-zag variable-length integer of the difference from the previous index
+      //   (most consecutive fixels are spatial neighbours), then the 8-bit quantised length
+      namespace Varint
+      {
+        inline void write (vector<uint8_t>& out, uint64_t value)
+        {
+          while (value >= 0x80) {
+            out.push_back (uint8_t(value) | 0x80);
+            value >>= 7;
+          }
+          out.push_back (uint8_t(value));
+        }
+        inline uint64_t read (const uint8_t*& in)
+        {
+          uint64_t value = 0;
+          for (int shift = 0; ; shift += 7) {
+            const uint8_t byte = *in++;
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+              return value;
+          }
+        }
+        inline uint64_t zigzag   (const int64_t delta)  { return delta < 0 ? uint64_t(-2 * delta - 1) : uint64_t(2 * delta); }
+        inline int64_t  unzigzag (const uint64_t value) { return (value & 1) ? -int64_t((value + 1) >> 1) : int64_t(value >> 1); }
+      }
 
 
-    bool add (const float length) { value += length; return true; }
 
-    uint32_t get_fixel_index() const { return fixel; }
-    float    get_length()      const { return length; }
 
+      // Lightweight view of the fixels traversed by one streamline
+      // An invalid (default-constructed) view evaluates to false; this is the case for
+      //   streamlines that have not been mapped, or have been removed from the reconstruction
+      class TrackContribution
+      { NOMEMALIGN
 
-    static void set_scaling (const Image::Info& in) { min_length_for_storage = 0.0; }
-    static float min() { return min_length_for_storage; }
+        public:
+          class const_iterator
+          { NOMEMALIGN
+            public:
+              const_iterator (const uint8_t* data, const uint32_t remaining) :
+                  data (data),
+                  remaining (remaining),
+                  previous (0) { decode(); }
+              const Track_fixel_contribution& operator*  () const { return current; }
+              const Track_fixel_contribution* operator-> () const { return &current; }
+              const_iterator& operator++ () { --remaining; decode(); return *this; }
+              bool operator!= (const const_iterator& that) const { return remaining != that.remaining; }
+            private:
+              const uint8_t* data;
+              uint32_t remaining;
+              int64_t previous;
+              Track_fixel_contribution current;
+              void decode()
+              {
+                if (!remaining)
+                  return;
+                previous += Varint::unzigzag (Varint::read (data));
+                current.fixel = uint32_t(previous);
+                current.length = *data++;
+              }
+          };
+
+          TrackContribution () :
+              data (nullptr),
+              num_fixels (0),
+              total_contribution (0.0),
+              total_length (0.0) { }
+
+          TrackContribution (const uint8_t* record, const float c, const float l) :
+              data (record),
+              num_fixels (Varint::read (data)),
+              total_contribution (c),
+              total_length (l) { }
+
+          explicit operator bool() const { return data; }
+
+          size_t dim() const { return num_fixels; }
+          float get_total_contribution() const { return total_contribution; }
+          float get_total_length      () const { return total_length; }
+
+          const_iterator begin() const { return const_iterator (data, num_fixels); }
+          const_iterator end()   const { return const_iterator (data, 0); }
 
+        private:
+          const uint8_t* data;
+          uint32_t num_fixels;
+          float total_contribution, total_length;
 
-  private:
-    uint32_t fixel;
-    float length;
+      };
 
-    static float scale_to_storage, scale_from_storage, min_length_for_storage;
 
-};
-*/
 
 
+      // Storage of the fixels traversed by all streamlines in a single contiguous arena
+      //   (compressed sparse row-style: one encoded record per streamline, plus offsets),
+      //   rather than one heap allocation per streamline
+      // During streamline mapping, each thread encodes records into its own blocks of
+      //   memory via a Writer; finalise() must then be called to concatenate these in
+      //   streamline order, releasing each block as soon as its records have been moved
+      // In out-of-core mode, each block is instead appended to a temporary file as soon
+      //   as it is full, and finalise() memory-maps that file; records then remain in the
+      //   order in which they were written, and only the offsets are held in RAM
+      // These writes are performed by a dedicated thread, such that file I/O overlaps with
+      //   streamline mapping; threads retiring a block only wait if the number of blocks
+      //   queued for writing reaches max_pending_blocks
+      class TrackContributions
+      { NOMEMALIGN
 
-      class TrackContribution : public Min_mem_array<Track_fixel_contribution>
-      { MEMALIGN(TrackContribution)
+        private:
+          class Block
+          { NOMEMALIGN
+            public:
+              Block (const size_t capacity) : num_records (0) { data.reserve (capacity); }
+              vector<uint8_t> data;
+              size_t num_records;
+          };
 
         public:
-        TrackContribution (const vector<Track_fixel_contribution>& in, const float c, const float l) :
-            Min_mem_array<Track_fixel_contribution> (in),
-            total_contribution (c),
-            total_length       (l) { }
+          class Writer
+          { NOMEMALIGN
+            public:
+              Writer (TrackContributions& master) :
+                  master (master),
+                  block_index (0),
+                  block (nullptr) { }
+              Writer (const Writer& that) :
+                  master (that.master),
+                  block_index (0),
+                  block (nullptr) { }
+              void operator() (const size_t track_index, const vector<Track_fixel_contribution>&, const float total_contribution, const float total_length);
+            private:
+              TrackContributions& master;
+              size_t block_index;
+              Block* block;
+              vector<uint8_t> record;
+          };
+
+          TrackContributions () : out_of_core (false), file_size (0), writer_stop (false), write_failed (false) { }
+          TrackContributions (const TrackContributions&) = delete;
+          ~TrackContributions();
+
+          // Must be set prior to initialise()
+          void set_out_of_core (const bool value) { out_of_core = value; }
+          bool is_out_of_core() const { return out_of_core; }
+
+          // Prepare for the mapping of a given number of streamlines
+          void initialise (const size_t num_tracks);
+          void finalise();
+
+          size_t size() const { return offsets.size(); }
+          void resize (const size_t num_tracks) { offsets.resize (num_tracks); total_contributions.resize (num_tracks); total_lengths.resize (num_tracks); }
+
+          TrackContribution operator[] (const size_t track_index) const
+          {
+            assert (blocks.empty());
+            if (offsets[track_index] == absent)
+              return TrackContribution();
+            return TrackContribution (data() + offsets[track_index], total_contributions[track_index], total_lengths[track_index]);
+          }
+
+          // Equivalent to (*this)[track_index].get_total_contribution(), without accessing the record
+          float get_total_contribution (const size_t track_index) const { return total_contributions[track_index]; }
 
-        TrackContribution () :
-            Min_mem_array<Track_fixel_contribution> (),
-            total_contribution (0.0),
-            total_length       (0.0) { }
+          // Remove a streamline from the reconstruction; storage is not reclaimed
+          void remove (const size_t track_index) { offsets[track_index] = absent; }
 
-        ~TrackContribution() { }
+          // Memory occupied; in out-of-core mode, the records themselves are in a file of size file_bytes()
+          size_t bytes() const;
+          size_t file_bytes() const { return file_size; }
 
-        float get_total_contribution() const { return total_contribution; }
-        float get_total_length      () const { return total_length; }
+          void swap (TrackContributions&);
 
         private:
-          const float total_contribution, total_length;
+          static constexpr uint64_t absent = std::numeric_limits<uint64_t>::max();
+          // While records are being written by multiple threads, the upper 24 bits of
+          //   each offset identify the block, and the lower 40 bits the position within it
+          static constexpr int block_shift = 40;
+          static constexpr size_t block_size = 4 * 1024 * 1024;
+          static constexpr size_t max_pending_blocks = 4;
+
+          vector<uint8_t> arena;
+          vector<uint64_t> offsets;
+          vector<float> total_contributions, total_lengths;
+
+          std::mutex mutex;
+          vector<std::unique_ptr<Block>> blocks;
+
+          bool out_of_core;
+          std::string file_path;
+          std::unique_ptr<File::OFStream> file;
+          uint64_t file_size;
+          vector<uint64_t> block_file_offsets;
+          std::unique_ptr<File::MMap> mmap;
+
+          // Blocks queued for writing to the temporary file, and the thread writing them
+          std::deque<size_t> pending;
+          std::condition_variable pending_changed;
+          bool writer_stop, write_failed;
+          std::future<void> writer;
+
+          const uint8_t* data() const { return mmap ? mmap->address() : arena.data(); }
+
+          Block* create_block (const size_t min_capacity, size_t& index);
+          void retire_block (const size_t index);
+          uint64_t append (const Block&);
+          void write_blocks();
+          void stop_writer (const bool discard);
+          void close_file();
+          static size_t record_size (const uint8_t*);
 
       };
 
@@ -18,6 +18,7 @@
 
 #include "dwi/tractography/SIFT2/coeff_optimiser.h"
 #include "dwi/tractography/SIFT2/line_search.h"
+#include "dwi/tractography/SIFT2/regularisation.h"
 #include "dwi/tractography/SIFT2/tckfactor.h"
 
 
@@ -96,6 +97,8 @@ namespace MR {
       bool CoefficientOptimiserBase::operator() (const SIFT::TrackIndexRange& range)
       {
 
+        prepare (range);
+
         for (SIFT::track_t track_index = range.first; track_index != range.second; ++track_index) {
 
           double dFs = get_coeff_change (track_index);
@@ -137,7 +140,7 @@ namespace MR {
           // Update the stats
           local_stats_steps += dFs;
           local_stats_coefficients += new_coefficient;
-          if (master.contributions[track_index] && master.contributions[track_index]->dim() && new_coefficient > master.min_coeff)
+          if (master.contributions[track_index] && master.contributions[track_index].dim() && new_coefficient > master.min_coeff)
             ++local_nonzero_count;
 
 #ifdef STREAMLINE_OF_INTEREST
@@ -172,15 +175,15 @@ namespace MR {
 
       double CoefficientOptimiserBase::do_fixel_exclusion (const SIFT::track_t track_index)
       {
-        const SIFT::TrackContribution& this_contribution (*(master.contributions[track_index]));
+        const SIFT::TrackContribution this_contribution (master.contributions[track_index]);
 
         // Task 1: Identify the fixel that should be excluded
         size_t index_to_exclude = 0.0;
         float cost_to_exclude = 0.0;
 
-        for (size_t j = 0; j != this_contribution.dim(); ++j) {
-          const size_t fixel_index = this_contribution[j].get_fixel_index();
-          const float length = this_contribution[j].get_length();
+        for (const auto& j : this_contribution) {
+          const size_t fixel_index = j.get_fixel_index();
+          const float length = j.get_length();
           const Fixel& fixel = master.fixels[fixel_index];
           if (!fixel.is_excluded() && (fixel.get_diff (mu) < 0.0)) {
 
@@ -201,9 +204,9 @@ namespace MR {
         // Task 2: Calculate a new coefficient for this streamline
         double weighted_sum = 0.0, sum_weights = 0.0;
 
-        for (size_t j = 0; j != this_contribution.dim(); ++j) {
-          const size_t fixel_index = this_contribution[j].get_fixel_index();
-          const float length = this_contribution[j].get_length();
+        for (const auto& j : this_contribution) {
+          const size_t fixel_index = j.get_fixel_index();
+          const float length = j.get_length();
           const Fixel& fixel = master.fixels[fixel_index];
           if (!fixel.is_excluded() && (fixel_index != index_to_exclude)) {
 
@@ -379,6 +382,174 @@ namespace MR {
 
 
 
+
+
+
+
+
+
+
+
+      CoefficientOptimiserBatch::CoefficientOptimiserBatch (TckFactor& tckfactor, StreamlineStats& step_stats, StreamlineStats& coefficient_stats, unsigned int& nonzero_streamlines, BitSet& fixels_to_exclude, double& sum_costs) :
+            CoefficientOptimiserBase (tckfactor, step_stats, coefficient_stats, nonzero_streamlines, fixels_to_exclude, sum_costs),
+            first_track (0) { }
+
+      CoefficientOptimiserBatch::CoefficientOptimiserBatch (const CoefficientOptimiserBatch& that) :
+            CoefficientOptimiserBase (that),
+            first_track (0) { }
+
+
+
+      void CoefficientOptimiserBatch::prepare (const SIFT::TrackIndexRange& range)
+      {
+        first_track = range.first;
+        coeff_changes.resize (range.second - range.first);
+        // Gather and then optimise streamlines in batches small enough for their data to remain in cache
+        SIFT::track_t batch_start = range.first;
+        clear();
+        for (SIFT::track_t track_index = range.first; track_index != range.second; ++track_index) {
+          gather (track_index);
+          if (length.size() >= SIFT2_COEFF_OPTIMISER_BATCH_SIZE || track_index + 1 == range.second) {
+            for (size_t s = 0; s != Fs.size(); ++s)
+              coeff_changes[batch_start - first_track + s] = optimise (s);
+            batch_start = track_index + 1;
+            clear();
+          }
+        }
+      }
+
+
+
+      void CoefficientOptimiserBatch::clear()
+      {
+        offsets.assign (1, 0);
+        Fs.clear();
+        reg_tv.clear();
+        for (auto v : { &length, &weighted_cost_frac, &TD, &dTD_dFs, &FOD, &SL_eff, &meanFs, &expmeanFs })
+          v->clear();
+      }
+
+
+
+      void CoefficientOptimiserBatch::gather (const SIFT::track_t track_index)
+      {
+        const SIFT::TrackContribution track_contribution (master.contributions[track_index]);
+        const double coeff = master.coefficients[track_index];
+        const double factor = std::exp (coeff);
+        Fs.push_back (coeff);
+        reg_tv.push_back (master.reg_multiplier_tv / track_contribution.get_total_contribution());
+        // Expressions here must match those in LineSearchFunctor::Fixel exactly
+        for (const auto& i : track_contribution) {
+          const Fixel& fixel (master.fixels[i.get_fixel_index()]);
+          if (fixel.is_excluded())
+            continue;
+          const double l = i.get_length();
+          const double PM = fixel.get_weight();
+          length.push_back (l);
+          weighted_cost_frac.push_back ((l / fixel.get_orig_TD()) * PM);
+          TD.push_back (fixel.get_TD() - (l * factor));
+          dTD_dFs.push_back ((fixel.get_orig_TD() - l) * factor);
+          FOD.push_back (fixel.get_FOD());
+          SL_eff.push_back (PM * l);
+          meanFs.push_back (fixel.get_mean_coeff());
+          expmeanFs.push_back (std::exp (fixel.get_mean_coeff()));
+        }
+        offsets.push_back (length.size());
+      }
+
+
+
+      // Must match CoefficientOptimiserIterative::get_coeff_change()
+      double CoefficientOptimiserBatch::optimise (const size_t s)
+      {
+        double dFs = 0.0;
+        double change = 0.0;
+        size_t iter = 0;
+        do {
+
+          double first_deriv, second_deriv;
+          get_derivs (s, dFs, first_deriv, second_deriv);
+
+          change = second_deriv ? (-first_deriv / second_deriv) : 0.0;
+          if (second_deriv < 0.0)
+            change = -change;
+          if (!std::isfinite (change))
+            change = 0.0;
+
+          if (change > master.max_coeff_step)
+            change = master.max_coeff_step;
+          else if (change < -master.max_coeff_step)
+            change = -master.max_coeff_step;
+
+          if (dFs >= master.max_coeff_step && change > 0.0) {
+            dFs = master.max_coeff_step;
+            change = 0.0;
+          } else if (dFs <= -master.max_coeff_step && change < 0.0) {
+            dFs = -master.max_coeff_step;
+            change = 0.0;
+          } else {
+            dFs += change;
+          }
+
+        } while ((++iter < 100) && (abs (change) > 0.001));
+
+        local_sum_costs += get_cost (s);
+        return dFs;
+      }
+
+
+
+      double CoefficientOptimiserBatch::get_coeff_change (const SIFT::track_t track_index) const
+      {
+        return coeff_changes[track_index - first_track];
+      }
+
+
+
+      // Equivalent to the first and second derivatives of LineSearchFunctor::get()
+      void CoefficientOptimiserBatch::get_derivs (const size_t s, const double dFs, double& first_deriv, double& second_deriv) const
+      {
+        const double coefficient = Fs[s] + dFs;
+        const double factor = std::exp (coefficient);
+
+        double data_first = 0.0, data_second = 0.0, tv_first = 0.0, tv_second = 0.0;
+        for (size_t i = offsets[s]; i != offsets[s+1]; ++i) {
+
+          const double contribution = length[i] * factor;
+          const double scaled_contribution = mu * contribution;
+          const double roc_contribution = mu * (contribution + dTD_dFs[i]);
+          const double diff = (mu * (TD[i] + contribution + (dTD_dFs[i] * dFs))) - FOD[i];
+
+          data_first  += 2.0 * weighted_cost_frac[i] * (roc_contribution * diff);
+          data_second += 2.0 * weighted_cost_frac[i] * (Math::pow2 (roc_contribution) + (scaled_contribution * diff));
+
+          const bool below = coefficient <= meanFs[i];
+          tv_first  += below ? (SL_eff[i] * 2.0 * (coefficient - meanFs[i])) : (SL_eff[i] * 2.0 * factor * (factor - expmeanFs[i]));
+          tv_second += below ? (SL_eff[i] * 2.0)                             : (SL_eff[i] * 2.0 * factor * ((2.0*factor) - expmeanFs[i]));
+
+        }
+
+        first_deriv  = (data_first  + (master.reg_multiplier_tikhonov * 2.0 * coefficient)) + (tv_first  * reg_tv[s]);
+        second_deriv = (data_second + (master.reg_multiplier_tikhonov * 2.0))               + (tv_second * reg_tv[s]);
+      }
+
+
+
+      // Equivalent to LineSearchFunctor::operator() (0.0)
+      double CoefficientOptimiserBatch::get_cost (const size_t s) const
+      {
+        double cf_data = 0.0;
+        double cf_reg_tv = 0.0;
+        for (size_t i = offsets[s]; i != offsets[s+1]; ++i) {
+          cf_data   += weighted_cost_frac[i] * Math::pow2 ((mu * (TD[i] + (length[i] * std::exp (Fs[s])))) - FOD[i]);
+          cf_reg_tv += SL_eff[i] * SIFT2::tvreg (Fs[s], meanFs[i]);
+        }
+        const double cf_reg_tik = Math::pow2 (Fs[s]);
+        return (cf_data + (master.reg_multiplier_tikhonov * cf_reg_tik) + (reg_tv[s] * cf_reg_tv));
+      }
+
+
+
       }
     }
   }
@@ -31,6 +31,11 @@
 //#define SIFT2_COEFF_OPTIMISER_DEBUG
 
 
+// Number of streamline-fixel pairs gathered by CoefficientOptimiserBatch before optimising
+//   the corresponding streamlines; chosen such that the gathered data fit within L2 cache
+#define SIFT2_COEFF_OPTIMISER_BATCH_SIZE 2048
+
+
 namespace MR {
   namespace DWI {
     namespace Tractography {
@@ -56,6 +61,9 @@ namespace MR {
           TckFactor& master;
           const double mu;
 
+          // Optionally perform any computation that is common to all streamlines within a range,
+          //   prior to get_coeff_change() being invoked for each
+          virtual void prepare (const SIFT::TrackIndexRange&) { }
           virtual double get_coeff_change (const SIFT::track_t) const = 0;
 
 
@@ -151,6 +159,48 @@ namespace MR {
 
 
 
+      // Performs the same Newton optimisation as CoefficientOptimiserIterative, but for a
+      //   whole block of streamlines at once: the terms for all fixels traversed by all
+      //   streamlines in the block are gathered once into contiguous arrays (one per term),
+      //   rather than constructing a LineSearchFunctor with its own vector of fixel data for
+      //   each streamline, and the line search is then evaluated over those arrays without
+      //   branching
+      // The summation order within each streamline is unchanged, so the resulting coefficient
+      //   changes are identical to those of CoefficientOptimiserIterative
+      class CoefficientOptimiserBatch : public CoefficientOptimiserBase
+      { MEMALIGN(CoefficientOptimiserBatch)
+
+        public:
+          CoefficientOptimiserBatch (TckFactor&, StreamlineStats&, StreamlineStats&, unsigned int&, BitSet&, double&);
+          CoefficientOptimiserBatch (const CoefficientOptimiserBatch&);
+          ~CoefficientOptimiserBatch() { }
+
+        private:
+          SIFT::track_t first_track;
+
+          vector<double> coeff_changes;
+
+          // Per streamline within the current batch
+          vector<size_t> offsets;
+          vector<double> Fs, reg_tv;
+
+          // Per streamline-fixel pair within the current batch
+          vector<double> length, weighted_cost_frac, TD, dTD_dFs, FOD, SL_eff, meanFs, expmeanFs;
+
+          void prepare (const SIFT::TrackIndexRange&) override;
+          double get_coeff_change (const SIFT::track_t) const override;
+
+          void clear();
+          void gather (const SIFT::track_t);
+          double optimise (const size_t);
+          void get_derivs (const size_t, const double, double&, double&) const;
+          double get_cost (const size_t) const;
+
+      };
+
+
+
+
 
       }
     }
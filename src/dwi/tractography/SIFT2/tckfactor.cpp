@@ -114,11 +114,11 @@ namespace MR {
         TD_sum = 0.0;
 
         for (SIFT::track_t track_index = 0; track_index != num_tracks(); ++track_index) {
-          const SIFT::TrackContribution& tck_cont (*contributions[track_index]);
+          const SIFT::TrackContribution tck_cont (contributions[track_index]);
           const double weight = 1.0 / tck_cont.get_total_length();
           coefficients[track_index] = std::log (weight);
-          for (size_t i = 0; i != tck_cont.dim(); ++i)
-            fixels[tck_cont[i].get_fixel_index()] += weight * tck_cont[i].get_length();
+          for (const auto& i : tck_cont)
+            fixels[i.get_fixel_index()] += weight * i.get_length();
           TD_sum += weight * tck_cont.get_total_contribution();
         }
 
@@ -160,12 +160,12 @@ namespace MR {
             Functor (const Functor&) = default;
             bool operator() (const SIFT::TrackIndexRange& range) const {
               for (SIFT::track_t track_index = range.first; track_index != range.second; ++track_index) {
-                const SIFT::TrackContribution& tckcont = *master.contributions[track_index];
+                const SIFT::TrackContribution tckcont (master.contributions[track_index]);
                 double sum_afd = 0.0;
-                for (size_t f = 0; f != tckcont.dim(); ++f) {
-                  const size_t fixel_index = tckcont[f].get_fixel_index();
+                for (const auto& f : tckcont) {
+                  const size_t fixel_index = f.get_fixel_index();
                   const Fixel& fixel = master.fixels[fixel_index];
-                  const float length = tckcont[f].get_length();
+                  const float length = f.get_length();
                   sum_afd += fixel.get_weight() * fixel.get_FOD() * (length / fixel.get_orig_TD());
                 }
                 if (sum_afd && tckcont.get_total_contribution()) {
@@ -222,7 +222,7 @@ namespace MR {
 
         unsigned int nonzero_streamlines = 0;
         for (SIFT::track_t i = 0; i != num_tracks(); ++i) {
-          if (contributions[i] && contributions[i]->dim())
+          if (contributions[i] && contributions[i].dim())
             ++nonzero_streamlines;
         }
 
@@ -269,10 +269,24 @@ namespace MR {
           double sum_costs = 0.0;
           {
             SIFT::TrackIndexRangeWriter writer (SIFT_TRACK_INDEX_BUFFER_SIZE, num_tracks());
-            //CoefficientOptimiserGSS worker (*this, /*projected_steps,*/ step_stats, coefficient_stats, nonzero_streamlines, fixels_to_exclude, sum_costs);
-            //CoefficientOptimiserQLS worker (*this, /*projected_steps,*/ step_stats, coefficient_stats, nonzero_streamlines, fixels_to_exclude, sum_costs);
-            CoefficientOptimiserIterative worker (*this, /*projected_steps,*/ step_stats, coefficient_stats, nonzero_streamlines, fixels_to_exclude, sum_costs);
-            Thread::run_queue (writer, SIFT::TrackIndexRange(), Thread::multi (worker));
+            switch (coeff_optimiser) {
+              case coeff_optimiser_t::BATCH: {
+                CoefficientOptimiserBatch worker (*this, step_stats, coefficient_stats, nonzero_streamlines, fixels_to_exclude, sum_costs);
+                Thread::run_queue (writer, SIFT::TrackIndexRange(), Thread::multi (worker));
+              } break;
+              case coeff_optimiser_t::ITERATIVE: {
+                CoefficientOptimiserIterative worker (*this, step_stats, coefficient_stats, nonzero_streamlines, fixels_to_exclude, sum_costs);
+                Thread::run_queue (writer, SIFT::TrackIndexRange(), Thread::multi (worker));
+              } break;
+              case coeff_optimiser_t::QLS: {
+                CoefficientOptimiserQLS worker (*this, step_stats, coefficient_stats, nonzero_streamlines, fixels_to_exclude, sum_costs);
+                Thread::run_queue (writer, SIFT::TrackIndexRange(), Thread::multi (worker));
+              } break;
+              case coeff_optimiser_t::GSS: {
+                CoefficientOptimiserGSS worker (*this, step_stats, coefficient_stats, nonzero_streamlines, fixels_to_exclude, sum_costs);
+                Thread::run_queue (writer, SIFT::TrackIndexRange(), Thread::multi (worker));
+              } break;
+            }
           }
           step_stats.normalise();
           coefficient_stats.normalise();
@@ -385,18 +399,18 @@ namespace MR {
           ProgressBar progress ("Generating streamline coefficient statistic images", num_tracks());
           for (SIFT::track_t i = 0; i != num_tracks(); ++i) {
             const double coeff = coefficients[i];
-            const SIFT::TrackContribution& this_contribution (*contributions[i]);
+            const SIFT::TrackContribution this_contribution (contributions[i]);
             if (coeff > min_coeff) {
-              for (size_t j = 0; j != this_contribution.dim(); ++j) {
-                const size_t fixel_index = this_contribution[j].get_fixel_index();
+              for (const auto& j : this_contribution) {
+                const size_t fixel_index = j.get_fixel_index();
                 const double mean_coeff = fixels[fixel_index].get_mean_coeff();
                 mins  [fixel_index] = std::min (mins[fixel_index], coeff);
                 stdevs[fixel_index] += Math::pow2 (coeff - mean_coeff);
                 maxs  [fixel_index] = std::max (maxs[fixel_index], coeff);
               }
             } else {
-              for (size_t j = 0; j != this_contribution.dim(); ++j)
-                ++zeroed[this_contribution[j].get_fixel_index()];
+              for (const auto& j : this_contribution)
+                ++zeroed[j.get_fixel_index()];
             }
             ++progress;
           }
@@ -45,6 +45,7 @@
 #define SIFT2_MAX_COEFF_DEFAULT (std::numeric_limits<default_type>::infinity())
 #define SIFT2_MAX_COEFF_STEP_DEFAULT 1.0
 #define SIFT2_MIN_CF_DECREASE_DEFAULT 2.5e-5
+#define SIFT2_COEFF_OPTIMISER_DEFAULT coeff_optimiser_t::BATCH
 
 
 
@@ -56,6 +57,10 @@ namespace MR {
 
 
 
+      enum class coeff_optimiser_t { BATCH, ITERATIVE, QLS, GSS };
+
+
+
       class TckFactor : public SIFT::Model<Fixel>
       { MEMALIGN(TckFactor)
 
@@ -71,6 +76,7 @@ namespace MR {
               max_coeff (SIFT2_MAX_COEFF_DEFAULT),
               max_coeff_step (SIFT2_MAX_COEFF_STEP_DEFAULT),
               min_cf_decrease_percentage (SIFT2_MIN_CF_DECREASE_DEFAULT),
+              coeff_optimiser (SIFT2_COEFF_OPTIMISER_DEFAULT),
               data_scale_term (0.0) { }
 
 
@@ -83,6 +89,7 @@ namespace MR {
           void set_max_coeff       (const double i) { max_coeff = i; }
           void set_max_coeff_step  (const double i) { max_coeff_step = i; }
           void set_min_cf_decrease (const double i) { min_cf_decrease_percentage = i; }
+          void set_coeff_optimiser (const coeff_optimiser_t i) { coeff_optimiser = i; }
 
           void set_csv_path (const std::string& i) { csv_path = i; }
 
@@ -114,6 +121,7 @@ namespace MR {
           double reg_multiplier_tikhonov, reg_multiplier_tv;
           size_t min_iters, max_iters;
           double min_coeff, max_coeff, max_coeff_step, min_cf_decrease_percentage;
+          coeff_optimiser_t coeff_optimiser;
           std::string csv_path;
 
           double data_scale_term;
@@ -124,6 +132,7 @@ namespace MR {
           friend class CoefficientOptimiserGSS;
           friend class CoefficientOptimiserQLS;
           friend class CoefficientOptimiserIterative;
+          friend class CoefficientOptimiserBatch;
           friend class FixelUpdater;
           friend class RegularisationCalculator;
 
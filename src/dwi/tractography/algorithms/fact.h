@@ -21,6 +21,7 @@
 #include "interp/nearest.h"
 
 #include "dwi/tractography/tracking/method.h"
+#include "dwi/tractography/tracking/packet.h"
 #include "dwi/tractography/tracking/shared.h"
 #include "dwi/tractography/tracking/tractography.h"
 #include "dwi/tractography/tracking/types.h"
@@ -119,6 +120,61 @@ namespace MR
         return select_fixel (d);
       }
 
+      // Equivalent to next() for each active lane, with fixel selection
+      //   performed across the packet
+      static void next (Packet<FACT>& packet)
+      {
+        packet.interpolate_nearest();
+        const Shared& S (packet.lanes[0]->S);
+
+        using row_type = Eigen::Array<float, 1, packet_size>;
+        row_type dx, dy, dz;
+        for (size_t lane = 0; lane != packet_size; ++lane) {
+          const Eigen::Vector3f& d (packet.lanes[lane]->dir);
+          dx[lane] = d[0]; dy[lane] = d[1]; dz[lane] = d[2];
+        }
+
+        row_type max_abs_dot = row_type::Zero(), max_dot = row_type::Zero(), max_norm = row_type::Zero();
+        Eigen::Array<int, 1, packet_size> idx = Eigen::Array<int, 1, packet_size>::Constant (-1);
+        for (size_t n = 0; n < S.num_vec; ++n) {
+          const row_type vx = packet.values.row (3*n).array();
+          const row_type vy = packet.values.row (3*n+1).array();
+          const row_type vz = packet.values.row (3*n+2).array();
+          const row_type norm = (vx*vx + vy*vy + vz*vz).sqrt();
+          const row_type dot = (vx*dx + vy*dy + vz*dz) / norm;
+          const row_type abs_dot = dot.abs();
+          const Eigen::Array<bool, 1, packet_size> select = (abs_dot >= S.dot_threshold) && (max_abs_dot < abs_dot);
+          max_abs_dot = select.select (abs_dot, max_abs_dot);
+          max_dot = select.select (dot, max_dot);
+          max_norm = select.select (norm, max_norm);
+          idx = select.select (int(n), idx);
+        }
+
+        for (size_t lane = 0; lane != packet_size; ++lane) {
+          if (!packet.active[lane])
+            continue;
+          if (!packet.valid[lane]) {
+            packet.terminations[lane] = EXIT_IMAGE;
+            continue;
+          }
+          // As per select_fixel(), which returns zero if no fixel is selected
+          if ((idx[lane] < 0 ? 0.0f : max_norm[lane]) < S.threshold) {
+            packet.terminations[lane] = MODEL;
+            continue;
+          }
+          FACT& method (*packet.lanes[lane]);
+          if (idx[lane] >= 0) {
+            const size_t i = 3*idx[lane];
+            method.dir = { packet.values(i,lane), packet.values(i+1,lane), packet.values(i+2,lane) };
+            method.dir.normalize();
+            if (max_dot[lane] < 0.0)
+              method.dir = -method.dir;
+          }
+          method.pos += S.step_size * method.dir;
+          packet.terminations[lane] = CONTINUE;
+        }
+      }
+
 
       protected:
       const Shared& S;
@@ -0,0 +1,196 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "dwi/tractography/algorithms/fod_lookup.h"
+
+#include "algo/loop.h"
+#include "algo/threaded_loop.h"
+#include "math/SH.h"
+
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace Algorithms
+      {
+
+
+
+        const char* fod_lookup_sizes[] = { "60", "129", "300", "321", "469", "513", "1281", "5000", nullptr };
+
+
+
+        FODLookup::FODLookup (Image<float>& image, const size_t num_directions) :
+            dirs (num_directions),
+            transform (image),
+            dim { image.size(0), image.size(1), image.size(2) },
+            rows (dim[0] * dim[1] * dim[2], no_data)
+        {
+          init_triangles();
+
+          // Only voxels containing some non-zero data are stored
+          size_t num_rows = 0;
+          for (auto l = Loop ("identifying voxels for FOD amplitude lookup table", image, 0, 3) (image); l; ++l) {
+            for (auto v = Loop (image, 3) (image); v; ++v) {
+              if (image.value()) {
+                rows[voxel_index (image.index(0), image.index(1), image.index(2))] = num_rows++;
+                break;
+              }
+            }
+          }
+          if (num_rows > size_t(no_data))
+            throw Exception ("Too many voxels for FOD amplitude lookup table");
+
+          const size_t N = dirs.size();
+          INFO ("FOD amplitude lookup table on " + str(N) + " directions requires "
+                + str ((num_rows * N * sizeof(float)) / (1024*1024)) + " MB");
+          amplitudes.resize (num_rows * N);
+
+          Eigen::MatrixXd dirs_matrix (N, 3);
+          for (size_t i = 0; i != N; ++i)
+            dirs_matrix.row (i) = dirs[i];
+          const Eigen::MatrixXf SHT = Math::SH::init_transform_cart (dirs_matrix, Math::SH::LforN (image.size(3))).cast<float>();
+
+          auto fill = [&] (Image<float>& in) {
+            const uint32_t row = rows[voxel_index (in.index(0), in.index(1), in.index(2))];
+            if (row == no_data)
+              return;
+            Eigen::VectorXf coefs (in.size(3));
+            for (auto v = Loop (in, 3) (in); v; ++v)
+              coefs[in.index(3)] = in.value();
+            Eigen::Map<Eigen::VectorXf> (amplitudes.data() + size_t(row) * N, N) = SHT * coefs;
+          };
+          ThreadedLoop ("computing FOD amplitude lookup table", image, 0, 3).run (fill, image);
+        }
+
+
+
+        void FODLookup::init_triangles()
+        {
+          triangles.resize (dirs.size());
+          for (Directions::index_type centre = 0; centre != dirs.size(); ++centre) {
+            const Eigen::Vector3d& n (dirs[centre]);
+            const auto& adj (dirs.get_adj_dirs (centre));
+            for (size_t i = 0; i != adj.size(); ++i) {
+              for (size_t j = i+1; j != adj.size(); ++j) {
+                if (!dirs.dirs_are_adjacent (adj[i], adj[j]))
+                  continue;
+                // Use the antipodal direction where necessary, such that all
+                //   three vertices lie on the same side of the sphere
+                const Eigen::Vector3d a (dirs[adj[i]] * (dirs[adj[i]].dot (n) < 0.0 ? -1.0 : 1.0));
+                const Eigen::Vector3d b (dirs[adj[j]] * (dirs[adj[j]].dot (n) < 0.0 ? -1.0 : 1.0));
+                Eigen::Matrix3d M;
+                M.col(0) = n;
+                M.col(1) = a;
+                M.col(2) = b;
+                Triangle t;
+                t.vertices[0] = adj[i];
+                t.vertices[1] = adj[j];
+                t.inverse = M.inverse().cast<float>();
+                triangles[centre].push_back (t);
+              }
+            }
+          }
+        }
+
+
+
+
+        bool FODLookup::Interp::scanner (const Eigen::Vector3f& scanner_pos)
+        {
+          const Eigen::Vector3d pos = L.transform.scanner2voxel * scanner_pos.cast<default_type>();
+
+          // Same bounds & implicit masking behaviour as Interp::Masked<Interp::Linear>
+          for (size_t axis = 0; axis != 3; ++axis) {
+            if (pos[axis] <= -0.5 || pos[axis] >= L.dim[axis] - 0.5)
+              return false;
+          }
+          if (L.rows[L.voxel_index (std::round (pos[0]), std::round (pos[1]), std::round (pos[2]))] == no_data)
+            return false;
+
+          ssize_t cell[3];
+          float weights[3][2];
+          for (size_t axis = 0; axis != 3; ++axis) {
+            const default_type floor = std::floor (pos[axis]);
+            cell[axis] = ssize_t (floor);
+            const float f = (pos[axis] < 0.0 || pos[axis] > L.dim[axis] - 1.0) ? 0.0f : float (pos[axis] - floor);
+            weights[axis][0] = 1.0f - f;
+            weights[axis][1] = f;
+          }
+
+          auto clamp = [] (const ssize_t x, const ssize_t dim) { return std::min (std::max (x, ssize_t(0)), dim-1); };
+          const size_t N = L.dirs.size();
+          size_t i = 0;
+          for (ssize_t z = 0; z != 2; ++z) {
+            const ssize_t vz = clamp (cell[2] + z, L.dim[2]);
+            for (ssize_t y = 0; y != 2; ++y) {
+              const ssize_t vy = clamp (cell[1] + y, L.dim[1]);
+              const float partial_weight = weights[1][y] * weights[2][z];
+              for (ssize_t x = 0; x != 2; ++x) {
+                const ssize_t vx = clamp (cell[0] + x, L.dim[0]);
+                factors[i] = weights[0][x] * partial_weight;
+                const uint32_t row = L.rows[L.voxel_index (vx, vy, vz)];
+                corners[i] = (factors[i] < 1.0e-6f || row == no_data) ? nullptr : L.amplitudes.data() + size_t(row) * N;
+                ++i;
+              }
+            }
+          }
+          return true;
+        }
+
+
+
+        float FODLookup::Interp::value (const Eigen::Vector3f& dir) const
+        {
+          const Directions::index_type nearest = L.dirs.select_direction (dir.cast<default_type>());
+          float result;
+          if (interpolate (nearest, dir, result))
+            return result;
+          // The nearest direction is not guaranteed to be a vertex of the
+          //   triangle containing the requested direction
+          for (const auto i : L.dirs.get_adj_dirs (nearest)) {
+            if (interpolate (i, dir, result))
+              return result;
+          }
+          return amplitude (nearest);
+        }
+
+
+
+        bool FODLookup::Interp::interpolate (const Directions::index_type centre, const Eigen::Vector3f& dir, float& result) const
+        {
+          const Eigen::Vector3f d (L.dirs[centre].cast<float>().dot (dir) < 0.0f ? -dir : dir);
+          for (const auto& t : L.triangles[centre]) {
+            const Eigen::Vector3f w (t.inverse * d);
+            if (w.minCoeff() >= -1.0e-6f) {
+              result = (w[0] * amplitude (centre) + w[1] * amplitude (t.vertices[0]) + w[2] * amplitude (t.vertices[1])) / w.sum();
+              return true;
+            }
+          }
+          return false;
+        }
+
+
+
+      }
+    }
+  }
+}
@@ -0,0 +1,141 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __dwi_tractography_algorithms_fod_lookup_h__
+#define __dwi_tractography_algorithms_fod_lookup_h__
+
+#include "image.h"
+#include "memory.h"
+#include "transform.h"
+#include "types.h"
+#include "dwi/directions/set.h"
+
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace Algorithms
+      {
+
+
+
+        // Sizes of the pre-defined direction sets provided by DWI::Directions::Set
+        extern const char* fod_lookup_sizes[];
+
+
+
+        //! Lookup table of FOD amplitudes for probabilistic tractography
+        /*! For every voxel containing non-zero data, the FOD amplitudes are
+         * computed once on one of the pre-defined direction sets provided by
+         * DWI::Directions::Set. During tracking, the amplitude in an
+         * arbitrary direction is obtained by locating the nearest direction in
+         * the set, identifying the triangle of the direction set tessellation
+         * within which the requested direction lies, and interpolating
+         * barycentrically between the amplitudes at its three vertices;
+         * these are in turn interpolated tri-linearly across space.
+         *
+         * Since the SH transform is linear, the spatial interpolation is
+         * identical to that obtained by interpolating the SH coefficients;
+         * the only source of error is the interpolation across directions,
+         * which decreases with the density of the direction set. The
+         * memory requirement is (number of directions) x 4 bytes per voxel
+         * containing data. */
+        class FODLookup { MEMALIGN(FODLookup)
+
+          public:
+            FODLookup (Image<float>& image, const size_t num_directions);
+
+            size_t num_directions() const { return dirs.size(); }
+
+
+            class Interp { MEMALIGN(Interp)
+              public:
+                Interp (const FODLookup& lookup) :
+                    L (lookup) { }
+
+                //! Set the current position to scanner-space position \a pos
+                /*! Returns false if the position lies outside of the image, or
+                 * the nearest voxel contains no non-zero data. */
+                bool scanner (const Eigen::Vector3f& pos);
+
+                //! Get the interpolated FOD amplitude along unit direction \a dir
+                float value (const Eigen::Vector3f& dir) const;
+
+              private:
+                const FODLookup& L;
+                // Amplitudes of the eight voxels contributing to the
+                //   interpolation; nullptr where the voxel contains no data
+                std::array<const float*, 8> corners;
+                Eigen::Matrix<float, 8, 1> factors;
+
+                float amplitude (const Directions::index_type i) const
+                {
+                  float result = 0.0f;
+                  for (size_t c = 0; c != 8; ++c) {
+                    if (corners[c])
+                      result += factors[c] * corners[c][i];
+                  }
+                  return result;
+                }
+
+                bool interpolate (const Directions::index_type centre, const Eigen::Vector3f& dir, float& result) const;
+            };
+
+
+          private:
+            class Triangle { MEMALIGN(Triangle)
+              public:
+                Directions::index_type vertices[2];
+                // Maps a direction onto barycentric coordinates, with
+                //   vertices ordered as [ centre vertices[0] vertices[1] ]
+                Eigen::Matrix3f inverse;
+            };
+
+            const Directions::FastLookupSet dirs;
+            // The triangles of the direction set tessellation sharing each direction
+            vector<vector<Triangle>> triangles;
+
+            const MR::Transform transform;
+            const ssize_t dim[3];
+            // Row of the amplitudes table for each voxel; no_data if the voxel
+            //   contains no non-zero data (equivalent to Interp::Masked)
+            vector<uint32_t> rows;
+            vector<float> amplitudes;
+
+            static constexpr uint32_t no_data = std::numeric_limits<uint32_t>::max();
+
+            size_t voxel_index (const ssize_t x, const ssize_t y, const ssize_t z) const
+            {
+              return x + dim[0] * (y + dim[1] * z);
+            }
+
+            void init_triangles();
+        };
+
+
+
+      }
+    }
+  }
+}
+
+#endif
+
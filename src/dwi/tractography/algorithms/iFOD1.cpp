@@ -31,13 +31,25 @@ namespace MR
         const OptionGroup iFODOptions = OptionGroup ("Options specific to the iFOD tracking algorithms")
 
         + Option ("power", "raise the FOD to the power specified (defaults are: 1.0 for iFOD1; 1.0/nsamples for iFOD2).")
-          + Argument ("value").type_float (0.0);
+          + Argument ("value").type_float (0.0)
+
+        + Option ("fod_lookup", "(iFOD1 only) precompute the FOD amplitudes within each voxel on a fixed "
+                                "set of directions, and during tracking interpolate amplitudes from this "
+                                "lookup table rather than evaluating the spherical harmonic series. "
+                                "The number of directions (one of: 60, 129, 300, 321, 469, 513, 1281, 5000) "
+                                "determines the trade-off between accuracy and memory usage "
+                                "(4 bytes per direction for every voxel containing data); "
+                                "the speed benefit increases with the maximal spherical harmonic degree of the FOD image.")
+          + Argument ("directions").type_choice (fod_lookup_sizes);
 
 
         void load_iFOD_options (Tractography::Properties& properties)
         {
           auto opt = get_options ("power");
           if (opt.size()) properties["fod_power"] = str<float> (opt[0][0]);
+
+          opt = get_options ("fod_lookup");
+          if (opt.size()) properties["fod_lookup"] = fod_lookup_sizes[int(opt[0][0])];
         }
 
       }
@@ -23,6 +23,7 @@
 #include "dwi/tractography/tracking/tractography.h"
 #include "dwi/tractography/tracking/types.h"
 #include "dwi/tractography/algorithms/calibrator.h"
+#include "dwi/tractography/algorithms/fod_lookup.h"
 
 
 
@@ -85,6 +86,10 @@ namespace MR
           properties.set (precomputed, "sh_precomputed");
           if (precomputed)
             precomputer.init (lmax);
+          if (properties.find ("fod_lookup") != properties.end())
+            lookup.reset (new FODLookup (source, to<size_t> (properties["fod_lookup"])));
+          else
+            init_fod_cache();
 
         }
 
@@ -113,6 +118,7 @@ namespace MR
         size_t lmax, max_trials;
         float sin_max_angle_1o, fod_power;
         Math::SH::PrecomputedAL<float> precomputer;
+        std::unique_ptr<FODLookup> lookup;
 
         private:
         mutable double mean_samples, mean_truncations, max_max_truncation;
@@ -128,6 +134,7 @@ namespace MR
         MethodBase (shared),
         S (shared),
         source (S.source),
+        lookup (S.lookup ? new FODLookup::Interp (*S.lookup) : nullptr),
         mean_sample_num (0),
         num_sample_runs (0),
         num_truncations (0),
@@ -135,6 +142,18 @@ namespace MR
         calibrate (*this);
       }
 
+      iFOD1 (const iFOD1& that) :
+        MethodBase (that),
+        S (that.S),
+        source (S.source),
+        lookup (S.lookup ? new FODLookup::Interp (*S.lookup) : nullptr),
+        calibrate_ratio (that.calibrate_ratio),
+        mean_sample_num (0),
+        num_sample_runs (0),
+        num_truncations (0),
+        max_truncation (0.0),
+        calibrate_list (that.calibrate_list) { }
+
 
       ~iFOD1 ()
       {
@@ -147,7 +166,7 @@ namespace MR
 
       bool init() override
       {
-        if (!get_data (source))
+        if (!set_position (pos))
           return (false);
 
         if (!S.init_dir.allFinite()) {
@@ -179,7 +198,7 @@ namespace MR
 
       term_t next () override
       {
-        if (!get_data (source))
+        if (!set_position (pos))
           return EXIT_IMAGE;
 
         float max_val = 0.0;
@@ -229,7 +248,7 @@ namespace MR
 
       float get_metric (const Eigen::Vector3f& position, const Eigen::Vector3f& direction) override
       {
-        if (!get_data (source, position))
+        if (!set_position (position))
           return 0.0;
         return FOD (direction);
       }
@@ -238,13 +257,21 @@ namespace MR
       protected:
       const Shared& S;
       Interpolator<Image<float>>::type source;
+      std::unique_ptr<FODLookup::Interp> lookup;
       float calibrate_ratio;
       size_t mean_sample_num, num_sample_runs, num_truncations;
       float max_truncation;
       vector< Eigen::Vector3f > calibrate_list;
 
+      bool set_position (const Eigen::Vector3f& position)
+      {
+        return (lookup ? lookup->scanner (position) : get_data (source, position));
+      }
+
       float FOD (const Eigen::Vector3f& d) const
       {
+        if (lookup)
+          return lookup->value (d);
         return (S.precomputer ?
             S.precomputer.value (values, d) :
             Math::SH::value (values, d, S.lmax)
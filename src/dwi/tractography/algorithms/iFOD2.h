@@ -83,6 +83,7 @@ namespace MR
                   properties.set (precomputed, "sh_precomputed");
                   if (precomputed)
                     precomputer.init (lmax);
+                  init_fod_cache();
 
                   // num_samples is number of samples excluding first point
                   --num_samples;
@@ -19,6 +19,7 @@
 
 #include "math/SH.h"
 #include "dwi/tractography/tracking/method.h"
+#include "dwi/tractography/tracking/packet.h"
 #include "dwi/tractography/tracking/shared.h"
 #include "dwi/tractography/tracking/tractography.h"
 #include "dwi/tractography/tracking/types.h"
@@ -62,6 +63,7 @@ class SDStream : public MethodBase { MEMALIGN(SDStream)
           properties.set (precomputed, "sh_precomputed");
           if (precomputed)
             precomputer = new Math::SH::PrecomputedAL<float> (lmax);
+          init_fod_cache();
         }
 
         ~Shared () {
@@ -120,17 +122,35 @@ class SDStream : public MethodBase { MEMALIGN(SDStream)
     {
       if (!get_data (source))
         return EXIT_IMAGE;
+      return do_next();
+    }
 
-      const Eigen::Vector3f prev_dir (dir);
-
-      if (!find_peak())
-        return MODEL;
-
-      if (prev_dir.dot (dir) < S.dot_threshold)
-        return HIGH_CURVATURE;
 
-      pos += dir * S.step_size;
-      return CONTINUE;
+    // Equivalent to next() for each active lane, with the image
+    //   interpolation performed across the packet
+    static void next (Packet<SDStream>& packet)
+    {
+      // The FOD cache provides its own interpolation, which must be used
+      //   in order for results to be identical to next()
+      if (packet.lanes[0]->S.has_fod_cache()) {
+        for (size_t lane = 0; lane != packet_size; ++lane) {
+          if (packet.active[lane])
+            packet.terminations[lane] = packet.lanes[lane]->next();
+        }
+        return;
+      }
+      packet.interpolate_linear();
+      for (size_t lane = 0; lane != packet_size; ++lane) {
+        if (!packet.active[lane])
+          continue;
+        if (!packet.valid[lane]) {
+          packet.terminations[lane] = EXIT_IMAGE;
+          continue;
+        }
+        SDStream& method (*packet.lanes[lane]);
+        method.values = packet.values.col (lane);
+        packet.terminations[lane] = method.do_next();
+      }
     }
 
 
@@ -146,6 +166,20 @@ class SDStream : public MethodBase { MEMALIGN(SDStream)
       const Shared& S;
       Interpolator<Image<float>>::type source;
 
+      term_t do_next ()
+      {
+        const Eigen::Vector3f prev_dir (dir);
+
+        if (!find_peak())
+          return MODEL;
+
+        if (prev_dir.dot (dir) < S.dot_threshold)
+          return HIGH_CURVATURE;
+
+        pos += dir * S.step_size;
+        return CONTINUE;
+      }
+
       float find_peak ()
       {
         float FOD = Math::SH::get_peak (values, S.lmax, dir, S.precomputer);
@@ -27,6 +27,7 @@
 #include "dwi/gradient.h"
 #include "dwi/tensor.h"
 #include "dwi/tractography/tracking/method.h"
+#include "dwi/tractography/tracking/packet.h"
 #include "dwi/tractography/tracking/shared.h"
 #include "dwi/tractography/tracking/tractography.h"
 #include "dwi/tractography/tracking/types.h"
@@ -126,6 +127,25 @@ namespace MR
         return tensor2FA (dt);
       }
 
+      // Equivalent to next() for each active lane, with the image
+      //   interpolation performed across the packet; the tensor fit is
+      //   performed per lane, such that results are identical to next()
+      static void next (Packet<Tensor_Det>& packet)
+      {
+        packet.interpolate_linear();
+        for (size_t lane = 0; lane != packet_size; ++lane) {
+          if (!packet.active[lane])
+            continue;
+          if (!packet.valid[lane]) {
+            packet.terminations[lane] = EXIT_IMAGE;
+            continue;
+          }
+          Tensor_Det& method (*packet.lanes[lane]);
+          method.values = packet.values.col (lane);
+          packet.terminations[lane] = method.do_next();
+        }
+      }
+
 
       protected:
       const Shared& S;
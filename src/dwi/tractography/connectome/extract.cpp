@@ -16,7 +16,9 @@
 
 #include "dwi/tractography/connectome/extract.h"
 
+#include "file/config.h"
 #include "misc/bitset.h"
+#include "thread_queue.h"
 
 
 namespace MR {
@@ -88,14 +90,12 @@ WriterExemplars::WriterExemplars (const Tractography::Properties& properties, co
   else
     length = std::round (to<float>(max_dist_it->second) / step_size) + 1;
 
-  size_t index = 0;
   if (exclusive) {
     for (size_t i = 0; i != nodes.size(); ++i) {
       const node_t one = nodes[i];
       for (size_t j = i; j != nodes.size(); ++j) {
         const node_t two = nodes[j];
-        selectors.push_back (Selector (one, two));
-        exemplars.push_back (Exemplar (index++, length, std::make_pair (one, two), std::make_pair (COMs[one], COMs[two])));
+        add (one, two, length, COMs);
       }
     }
   } else {
@@ -103,10 +103,8 @@ WriterExemplars::WriterExemplars (const Tractography::Properties& properties, co
     //   determining which exemplars get written to which file
     for (node_t one = first_node; one != COMs.size(); ++one) {
       for (node_t two = one; two != COMs.size(); ++two) {
-        if (std::find (nodes.begin(), nodes.end(), one) != nodes.end() || std::find (nodes.begin(), nodes.end(), two) != nodes.end()) {
-          selectors.push_back (Selector (one, two));
-          exemplars.push_back (Exemplar (index++, length, std::make_pair (one, two), std::make_pair (COMs[one], COMs[two])));
-        }
+        if (std::find (nodes.begin(), nodes.end(), one) != nodes.end() || std::find (nodes.begin(), nodes.end(), two) != nodes.end())
+          add (one, two, length, COMs);
       }
     }
   }
@@ -114,34 +112,49 @@ WriterExemplars::WriterExemplars (const Tractography::Properties& properties, co
 
 
 
+void WriterExemplars::add (const node_t one, const node_t two, const size_t length, const vector<Eigen::Vector3f>& COMs)
+{
+  edge_exemplars[edge_key (one, two)] = exemplars.size();
+  selectors.push_back (Selector (one, two));
+  exemplars.push_back (Exemplar (exemplars.size(), length, std::make_pair (one, two), std::make_pair (COMs[one], COMs[two])));
+}
+
+
+
 bool WriterExemplars::operator() (const Tractography::Connectome::Streamline_nodepair& in)
 {
-  for (size_t index = 0; index != selectors.size(); ++index) {
-    if (selectors[index] (in.get_nodes()))
-      exemplars[index].add (in);
-  }
+  auto it = edge_exemplars.find (edge_key (in.get_nodes().first, in.get_nodes().second));
+  if (it != edge_exemplars.end())
+    exemplars[it->second].add (in);
   return true;
 }
 
 bool WriterExemplars::operator() (const Tractography::Connectome::Streamline_nodelist& in)
 {
-  for (size_t index = 0; index != selectors.size(); ++index) {
-    if (selectors[index] (in.get_nodes()))
-      exemplars[index].add (in);
+  // Every exemplar for which both nodes are present in the list
+  vector<node_t> nodes (in.get_nodes());
+  std::sort (nodes.begin(), nodes.end());
+  nodes.erase (std::unique (nodes.begin(), nodes.end()), nodes.end());
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    for (size_t j = i; j != nodes.size(); ++j) {
+      auto it = edge_exemplars.find (edge_key (nodes[i], nodes[j]));
+      if (it != edge_exemplars.end())
+        exemplars[it->second].add (in);
+    }
   }
   return true;
 }
 
 
 
-// TODO Multi-thread
 void WriterExemplars::finalize()
 {
+  // Each exemplar is finalized independently of all others
   ProgressBar progress ("finalizing exemplars", exemplars.size());
-  for (vector<Exemplar>::iterator i = exemplars.begin(); i != exemplars.end(); ++i) {
-    i->finalize (step_size);
-    ++progress;
-  }
+  size_t next = 0;
+  auto source = [&] (size_t& index) { if (next == exemplars.size()) return false; index = next++; ++progress; return true; };
+  auto sink = [&] (const size_t& index) { exemplars[index].finalize (step_size); return true; };
+  Thread::run_queue (source, Thread::batch (size_t()), Thread::multi (sink));
 }
 
 
@@ -151,18 +164,17 @@ void WriterExemplars::write (const node_t one, const node_t two, const std::stri
   Tractography::Properties properties;
   properties["step_size"] = str(step_size);
   Tractography::WriterUnbuffered<float> writer (path, properties);
+  auto it = edge_exemplars.find (edge_key (one, two));
   for (size_t i = 0; i != exemplars.size(); ++i) {
-    if (selectors[i] (one, two))
+    if (it != edge_exemplars.end() && i == it->second)
       writer (exemplars[i].get());
     else
       writer.skip();
   }
   if (weights_path.size()) {
     File::OFStream output (weights_path);
-    for (size_t i = 0; i != exemplars.size(); ++i) {
-      if (selectors[i] (one, two))
-        output << str(exemplars[i].get_weight()) << "\n";
-    }
+    if (it != edge_exemplars.end())
+      output << str(exemplars[it->second].get_weight()) << "\n";
   }
 }
 
@@ -209,19 +221,71 @@ void WriterExemplars::write (const std::string& path, const std::string& weights
 
 
 
+size_t WriterBucket::append (const Tractography::Streamline<float>& tck)
+{
+  const size_t bytes_before = buffered_bytes();
+  for (const auto& p : tck) {
+    assert (p.allFinite());
+    buffer.push_back (vector_type());
+    format_point (p, buffer.back());
+  }
+  buffer.push_back (vector_type());
+  format_point (delimiter(), buffer.back());
+  if (weights_name.size())
+    weights_buffer += str(tck.weight) + "\n";
+  ++count;
+  ++total_count;
+  return buffered_bytes() - bytes_before;
+}
+
+
+
+void WriterBucket::flush()
+{
+  if (buffer.size()) {
+    // Space for the barrier
+    const size_t num_points = buffer.size();
+    buffer.push_back (vector_type());
+    commit (buffer.data(), num_points);
+    vector<vector_type>().swap (buffer);
+  }
+  if (weights_buffer.size()) {
+    write_weights (weights_buffer);
+    std::string().swap (weights_buffer);
+  }
+}
+
+
+
+
+
+
+
+
+
+
+//CONF option: ConnectomeExtractionBufferSize
+//CONF default: 134217728
+//CONF The total size (in bytes) of the RAM buffers used by connectome2tck
+//CONF to hold streamlines data for all output track files, before
+//CONF committing this data to those files; a larger value reduces the
+//CONF number of times each output file must be re-opened.
 WriterExtraction::WriterExtraction (const Tractography::Properties& p, const vector<node_t>& nodes, const bool exclusive, const bool keep_self) :
     properties (p),
     node_list (nodes),
     exclusive (exclusive),
-    keep_self (keep_self) { }
-
+    keep_self (keep_self),
+    buffer_capacity (File::Config::get_int ("ConnectomeExtractionBufferSize", CONNECTOME_EXTRACTION_DEFAULT_BUFFER_SIZE)),
+    buffer_size (0),
+    streamline_count (0) { }
 
 
 
 void WriterExtraction::add (const node_t node, const std::string& path, const std::string weights_path = "")
 {
+  node_writers[node].push_back (writers.size());
   selectors.emplace_back (Selector (node, keep_self));
-  writers.emplace_back (new Tractography::WriterUnbuffered<float> (path, properties));
+  writers.emplace_back (new WriterBucket (path, properties));
   if (weights_path.size())
     writers.back()->set_weights_path (weights_path);
 }
@@ -229,8 +293,9 @@ void WriterExtraction::add (const node_t node, const std::string& path, const st
 void WriterExtraction::add (const node_t node_one, const node_t node_two, const std::string& path, const std::string weights_path = "")
 {
   if (keep_self || (node_one != node_two)) {
+    edge_writers[edge_key (node_one, node_two)].push_back (writers.size());
     selectors.emplace_back (Selector (node_one, node_two));
-    writers.emplace_back (new Tractography::WriterUnbuffered<float> (path, properties));
+    writers.emplace_back (new WriterBucket (path, properties));
     if (weights_path.size())
       writers.back()->set_weights_path (weights_path);
   }
@@ -238,8 +303,9 @@ void WriterExtraction::add (const node_t node_one, const node_t node_two, const
 
 void WriterExtraction::add (const vector<node_t>& list, const std::string& path, const std::string weights_path = "")
 {
+  list_writers.push_back (writers.size());
   selectors.emplace_back (Selector (list, exclusive, keep_self));
-  writers.emplace_back (new Tractography::WriterUnbuffered<float> (path, properties));
+  writers.emplace_back (new WriterBucket (path, properties));
   if (weights_path.size())
     writers.back()->set_weights_path (weights_path);
 }
@@ -248,39 +314,60 @@ void WriterExtraction::add (const vector<node_t>& list, const std::string& path,
 
 void WriterExtraction::clear()
 {
+  for (auto& w : writers) {
+    w->set_total_count (streamline_count);
+    w->flush();
+  }
   selectors.clear();
   writers.clear();
+  node_writers.clear();
+  edge_writers.clear();
+  list_writers.clear();
+  buffer_size = 0;
 }
 
 
 
-bool WriterExtraction::operator() (const Connectome::Streamline_nodepair& in) const
+bool WriterExtraction::operator() (const Connectome::Streamline_nodepair& in)
 {
+  ++streamline_count;
+  const NodePair& nodes (in.get_nodes());
   if (exclusive) {
     // Make sure that both nodes are within the list of nodes of interest;
     //   if not, don't bother passing to any of the selectors
     bool first_in_list = false, second_in_list = false;
     for (vector<node_t>::const_iterator i = node_list.begin(); i != node_list.end(); ++i) {
-      if (*i == in.get_nodes().first)  first_in_list = true;
-      if (*i == in.get_nodes().second) second_in_list = true;
+      if (*i == nodes.first)  first_in_list = true;
+      if (*i == nodes.second) second_in_list = true;
     }
-    if (!first_in_list || !second_in_list) {
-      for (size_t i = 0; i != file_count(); ++i)
-        writers[i]->skip();
+    if (!first_in_list || !second_in_list)
       return true;
+  }
+  auto edge = edge_writers.find (edge_key (nodes.first, nodes.second));
+  if (edge != edge_writers.end())
+    write (edge->second, in);
+  if (keep_self || nodes.first != nodes.second) {
+    auto node = node_writers.find (nodes.first);
+    if (node != node_writers.end())
+      write (node->second, in);
+    if (nodes.second != nodes.first) {
+      node = node_writers.find (nodes.second);
+      if (node != node_writers.end())
+        write (node->second, in);
     }
   }
-  for (size_t i = 0; i != file_count(); ++i) {
-    if (selectors[i] (in.get_nodes()))
-      (*writers[i]) (in);
-    else
-      writers[i]->skip();
+  for (auto i : list_writers) {
+    if (selectors[i] (nodes))
+      write (i, in);
   }
+  if (buffer_size > buffer_capacity)
+    flush();
   return true;
 }
 
-bool WriterExtraction::operator() (const Connectome::Streamline_nodelist& in) const
+bool WriterExtraction::operator() (const Connectome::Streamline_nodelist& in)
 {
+  ++streamline_count;
   if (exclusive) {
     // Make sure _all_ nodes are within the list of nodes of interest;
     //   if not, don't pass to any of the selectors
@@ -289,23 +376,57 @@ bool WriterExtraction::operator() (const Connectome::Streamline_nodelist& in) co
       for (size_t n = 0; n != in.get_nodes().size(); ++n)
         if (*i == in.get_nodes()[n]) in_list[n] = true;
     }
-    if (!in_list.full()) {
-      for (size_t i = 0; i != file_count(); ++i)
-        writers[i]->skip();
+    if (!in_list.full())
       return true;
+  }
+  vector<node_t> nodes (in.get_nodes());
+  std::sort (nodes.begin(), nodes.end());
+  nodes.erase (std::unique (nodes.begin(), nodes.end()), nodes.end());
+  for (size_t i = 0; i != nodes.size(); ++i) {
+    auto node = node_writers.find (nodes[i]);
+    if (node != node_writers.end())
+      write (node->second, in);
+    for (size_t j = i; j != nodes.size(); ++j) {
+      auto edge = edge_writers.find (edge_key (nodes[i], nodes[j]));
+      if (edge != edge_writers.end())
+        write (edge->second, in);
     }
   }
-  for (size_t i = 0; i != file_count(); ++i) {
+  for (auto i : list_writers) {
     if (selectors[i] (in.get_nodes()))
-      (*writers[i]) (in);
-    else
-      writers[i]->skip();
+      write (i, in);
   }
+  if (buffer_size > buffer_capacity)
+    flush();
   return true;
 }
 
 
 
+void WriterExtraction::write (const size_t index, const Tractography::Streamline<float>& tck)
+{
+  buffer_size += writers[index]->append (tck);
+}
+
+void WriterExtraction::write (const vector<size_t>& indices, const Tractography::Streamline<float>& tck)
+{
+  for (auto i : indices)
+    write (i, tck);
+}
+
+
+
+void WriterExtraction::flush()
+{
+  for (auto& w : writers) {
+    if (w->buffered_bytes())
+      w->flush();
+  }
+  buffer_size = 0;
+}
+
+
+
 
 
 
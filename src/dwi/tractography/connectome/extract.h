@@ -18,6 +18,8 @@
 #define __dwi_tractography_connectome_extract_h__
 
 
+#include <unordered_map>
+
 #include "file/ofstream.h"
 
 #include "dwi/tractography/file.h"
@@ -33,6 +35,17 @@ namespace Connectome {
 
 
 
+// Default total size of the RAM buffers (in bytes) used for holding streamlines
+//   data for all output files during streamlines extraction
+#define CONNECTOME_EXTRACTION_DEFAULT_BUFFER_SIZE 134217728
+
+
+
+// Unique key for each edge, irrespective of the order of the nodes
+inline uint64_t edge_key (const node_t one, const node_t two)
+{
+  return (uint64_t(std::min (one, two)) << 32) | uint64_t(std::max (one, two));
+}
 
 
 
@@ -90,6 +103,42 @@ class WriterExemplars
     float step_size;
     vector<Selector> selectors;
     vector<Exemplar> exemplars;
+    // Index of the exemplar corresponding to each edge
+    std::unordered_map<uint64_t, size_t> edge_exemplars;
+
+    void add (const node_t, const node_t, const size_t, const vector<Eigen::Vector3f>&);
+};
+
+
+
+
+
+
+// Track file writer that holds streamlines data in a RAM buffer of variable size,
+//   only committing this data to file when explicitly requested; this allows
+//   the RAM usage across a large number of output files to be managed jointly.
+//   Any data still buffered must be committed using flush() prior to destruction.
+class WriterBucket : public Tractography::WriterUnbuffered<float>
+{ NOMEMALIGN
+  public:
+    WriterBucket (const std::string& path, const Tractography::Properties& properties) :
+        Tractography::WriterUnbuffered<float> (path, properties) { }
+    WriterBucket (const WriterBucket&) = delete;
+
+    bool operator() (const Tractography::Streamline<float>& tck) override { append (tck); return true; }
+    // Returns the number of bytes added to the buffer
+    size_t append (const Tractography::Streamline<float>&);
+
+    void flush();
+
+    size_t buffered_bytes() const { return buffer.size() * sizeof (vector_type) + weights_buffer.size(); }
+
+    // All streamlines not written to this file are considered to have been skipped
+    void set_total_count (const uint64_t i) { assert (i >= count); total_count = i; }
+
+  private:
+    vector<vector_type> buffer;
+    std::string weights_buffer;
 };
 
 
@@ -110,10 +159,11 @@ class WriterExtraction
     void add (const node_t, const node_t, const std::string&, const std::string);
     void add (const vector<node_t>&, const std::string&, const std::string);
 
+    // Commits all buffered data and closes all output files
     void clear();
 
-    bool operator() (const Connectome::Streamline_nodepair&) const;
-    bool operator() (const Connectome::Streamline_nodelist&) const;
+    bool operator() (const Connectome::Streamline_nodepair&);
+    bool operator() (const Connectome::Streamline_nodelist&);
 
     size_t file_count() const { return writers.size(); }
 
@@ -124,8 +174,21 @@ class WriterExtraction
     const bool exclusive;
     const bool keep_self;
     vector< Selector > selectors;
-    vector< std::unique_ptr< Tractography::WriterUnbuffered<float> > > writers;
-    Tractography::Streamline<> empty_tck;
+    vector< std::unique_ptr<WriterBucket> > writers;
+
+    // Rather than testing every selector against every streamline, the output files
+    //   to which a streamline is to be written are found via lookup of its nodes
+    std::unordered_map<node_t, vector<size_t>> node_writers;
+    std::unordered_map<uint64_t, vector<size_t>> edge_writers;
+    vector<size_t> list_writers;
+
+    const size_t buffer_capacity;
+    size_t buffer_size;
+    uint64_t streamline_count;
+
+    void write (const size_t, const Tractography::Streamline<float>&);
+    void write (const vector<size_t>&, const Tractography::Streamline<float>&);
+    void flush();
 
 };
 
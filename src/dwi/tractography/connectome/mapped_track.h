@@ -33,20 +33,26 @@ namespace MR {
           public:
             Mapped_track_base() :
               track_index (-1),
-              factor (0.0),
+              factors (1, 0.0),
               weight (1.0) { }
 
             void set_track_index (const size_t i) { track_index = i; }
-            void set_factor      (const float i)  { factor = i; }
+            void set_factor      (const float i)  { factors.assign (1, i); }
             void set_weight      (const float i)  { weight = i; }
 
-            size_t get_track_index() const { return track_index; }
-            float  get_factor()      const { return factor; }
-            float  get_weight()      const { return weight; }
+            // One factor per metric, where multiple metrics are being quantified concurrently
+            void set_num_factors (const size_t i) { factors.resize (i); }
+            void set_factor      (const size_t index, const float i) { assert (index < factors.size()); factors[index] = i; }
+
+            size_t get_track_index()               const { return track_index; }
+            float  get_factor (const size_t i = 0) const { assert (i < factors.size()); return factors[i]; }
+            size_t num_factors()                   const { return factors.size(); }
+            float  get_weight()                    const { return weight; }
 
           private:
             size_t track_index;
-            float factor, weight;
+            vector<float> factors;
+            float weight;
         };
 
 
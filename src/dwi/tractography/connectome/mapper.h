@@ -37,11 +37,20 @@ class Mapper
   public:
     Mapper (const Tck2nodes_base& a, const Metric& b) :
       tck2nodes (a),
-      metric (b) { }
+      metrics (1, &b) { }
+
+    // Calculate the contribution of each streamline for multiple metrics
+    Mapper (const Tck2nodes_base& a, const vector<Metric>& b) :
+      tck2nodes (a)
+    {
+      assert (b.size());
+      for (const auto& m : b)
+        metrics.push_back (&m);
+    }
 
     Mapper (const Mapper& that) :
       tck2nodes (that.tck2nodes),
-      metric (that.metric) { }
+      metrics (that.metrics) { }
 
 
     bool operator() (const Tractography::Streamline<float>& in, Mapped_track_nodepair& out)
@@ -49,7 +58,9 @@ class Mapper
       assert (tck2nodes.provides_pair());
       out.set_track_index (in.get_index());
       out.set_nodes (tck2nodes (in));
-      out.set_factor (metric (in, out.get_nodes()));
+      out.set_num_factors (metrics.size());
+      for (size_t i = 0; i != metrics.size(); ++i)
+        out.set_factor (i, (*metrics[i]) (in, out.get_nodes()));
       out.set_weight (in.weight);
       return true;
     }
@@ -61,7 +72,9 @@ class Mapper
       vector<node_t> nodes;
       tck2nodes (in, nodes);
       out.set_nodes (std::move (nodes));
-      out.set_factor (metric (in, out.get_nodes()));
+      out.set_num_factors (metrics.size());
+      for (size_t i = 0; i != metrics.size(); ++i)
+        out.set_factor (i, (*metrics[i]) (in, out.get_nodes()));
       out.set_weight (in.weight);
       return true;
     }
@@ -69,13 +82,12 @@ class Mapper
 
   private:
     const Tck2nodes_base& tck2nodes;
-    const Metric& metric;
+    vector<const Metric*> metrics;
 
 };
 
 
 
-
 }
 }
 }
@@ -41,39 +41,36 @@ const App::Option EdgeStatisticOption
 
 
 template <typename T>
-bool Matrix<T>::operator() (const Mapped_track_nodepair& in)
+Matrix<T>::Partial::Partial (const Matrix& master) :
+    master (master),
+    stride (2 * master.num_channels())
 {
-  assert (in.get_first_node()  < mat2vec->mat_size());
-  assert (in.get_second_node() < mat2vec->mat_size());
-  assert (assignments_lists.empty());
-  if (is_vector()) {
-    assert (assignments_pairs.empty());
-    apply_data (in.get_second_node(), in.get_factor(), in.get_weight());
-    inc_count (in.get_second_node(), in.get_weight());
-    if (track_assignments) {
-      if (in.get_track_index() == assignments_single.size()) {
-        assignments_single.push_back (in.get_second_node());
-      } else if (in.get_track_index() < assignments_single.size()) {
-        assignments_single[in.get_track_index()] = in.get_second_node();
-      } else {
-        assignments_single.resize (in.get_track_index() + 1, 0);
-        assignments_single[in.get_track_index()] = in.get_second_node();
-      }
+  if (master.is_sparse())
+    return;
+  values.resize (master.num_edges() * stride);
+  for (size_t edge = 0; edge != master.num_edges(); ++edge) {
+    for (size_t c = 0; c != master.num_channels(); ++c) {
+      values[edge*stride + 2*c]   = initial_value (master.channels[c].statistic);
+      values[edge*stride + 2*c+1] = T(0);
     }
+  }
+}
+
+
+
+template <typename T>
+bool Matrix<T>::Partial::operator() (const Mapped_track_nodepair& in)
+{
+  assert (in.get_first_node()  < master.num_nodes);
+  assert (in.get_second_node() < master.num_nodes);
+  if (master.is_vector()) {
+    apply (in.get_second_node(), in);
+    if (master.track_assignments)
+      assignments_single.push_back (std::make_pair (in.get_track_index(), in.get_second_node()));
   } else {
-    assert (assignments_single.empty());
-    apply_data (in.get_first_node(), in.get_second_node(), in.get_factor(), in.get_weight());
-    inc_count (in.get_first_node(), in.get_second_node(), in.get_weight());
-    if (track_assignments) {
-      if (in.get_track_index() == assignments_pairs.size()) {
-        assignments_pairs.push_back (in.get_nodes());
-      } else if (in.get_track_index() < assignments_pairs.size()) {
-        assignments_pairs[in.get_track_index()] = in.get_nodes();
-      } else {
-        assignments_pairs.resize (in.get_track_index() + 1, std::make_pair<size_t, size_t> (0, 0));
-        assignments_pairs[in.get_track_index()] = in.get_nodes();
-      }
-    }
+    apply ((*master.mat2vec) (in.get_first_node(), in.get_second_node()), in);
+    if (master.track_assignments)
+      assignments_pairs.push_back (std::make_pair (in.get_track_index(), in.get_nodes()));
   }
   return true;
 }
@@ -81,80 +78,189 @@ bool Matrix<T>::operator() (const Mapped_track_nodepair& in)
 
 
 template <typename T>
-bool Matrix<T>::operator() (const Mapped_track_nodelist& in)
+bool Matrix<T>::Partial::operator() (const Mapped_track_nodelist& in)
 {
-  assert (assignments_single.empty());
-  assert (assignments_pairs.empty());
   vector<node_t> list (in.get_nodes());
   for (vector<node_t>::const_iterator i = list.begin(); i != list.end(); ++i) {
-    assert (*i < data.rows());
+    assert (*i < master.num_nodes);
   }
-  if (is_vector()) {
+  if (master.is_vector()) {
     if (list.empty()) {
-      apply_data (0, in.get_factor(), in.get_weight());
-      inc_count (0, in.get_weight());
+      apply (0, in);
       list.push_back (0);
     } else {
-      for (vector<node_t>::const_iterator n = list.begin(); n != list.end(); ++n) {
-        apply_data (*n, in.get_factor(), in.get_weight());
-        inc_count (*n, in.get_weight());
-      }
+      for (vector<node_t>::const_iterator n = list.begin(); n != list.end(); ++n)
+        apply (*n, in);
     }
   } else { // Matrix output
     if (list.empty()) {
-      apply_data (0, 0, in.get_factor(), in.get_weight());
-      inc_count (0, 0, in.get_weight());
+      apply ((*master.mat2vec) (0, 0), in);
       list.push_back (0);
     } else if (list.size() == 1) {
-      apply_data (0, list.front(), in.get_factor(), in.get_weight());
-      inc_count (0, list.front(), in.get_weight());
+      apply ((*master.mat2vec) (0, list.front()), in);
     } else {
       for (size_t i = 0; i != list.size(); ++i) {
-        for (size_t j = i; j != list.size(); ++j) {
-          apply_data (list[i], list[j], in.get_factor(), in.get_weight());
-          inc_count (list[i], list[j], in.get_weight());
-        }
+        for (size_t j = i; j != list.size(); ++j)
+          apply ((*master.mat2vec) (list[i], list[j]), in);
       }
     }
   }
-  if (track_assignments) {
+  if (master.track_assignments) {
     std::sort (list.begin(), list.end());
-    if (in.get_track_index() == assignments_lists.size()) {
-      assignments_lists.push_back (std::move (list));
-    } else if (in.get_track_index() < assignments_lists.size()) {
-      assignments_lists[in.get_track_index()] = std::move (list);
-    } else {
-      assignments_lists.resize (in.get_track_index() + 1, vector<node_t>());
-      assignments_lists[in.get_track_index()] = std::move (list);
-    }
+    assignments_lists.push_back (std::make_pair (in.get_track_index(), std::move (list)));
   }
   return true;
 }
 
 
 
+template <typename T>
+T* Matrix<T>::Partial::get (const size_t edge_index)
+{
+  assert (edge_index < master.num_edges());
+  if (!master.is_sparse())
+    return values.data() + edge_index*stride;
+  auto it = sparse_offsets.find (edge_index);
+  if (it != sparse_offsets.end())
+    return values.data() + it->second;
+  const size_t offset = values.size();
+  values.resize (offset + stride, T(0));
+  for (size_t c = 0; c != master.num_channels(); ++c)
+    values[offset + 2*c] = initial_value (master.channels[c].statistic);
+  sparse_offsets.insert (std::make_pair (edge_index, offset));
+  return values.data() + offset;
+}
+
+
+
+template <typename T>
+void Matrix<T>::Partial::apply (const size_t edge_index, const Mapped_track_base& in)
+{
+  assert (in.num_factors() == master.num_channels());
+  T* const target = get (edge_index);
+  for (size_t c = 0; c != master.num_channels(); ++c) {
+    apply_data (target[2*c], in.get_factor (c), in.get_weight(), master.channels[c].statistic);
+    target[2*c+1] += in.get_weight();
+  }
+}
+
+
+
+
+
+template <typename T>
+Matrix<T>::Channel::Channel (const stat_edge stat, const size_t size) :
+    statistic (stat),
+    data (vector_type::Constant (size, initial_value (stat))),
+    counts (stat == stat_edge::MEAN ? vector_type::Zero (size) : vector_type()) { }
+
+
+
+template <typename T>
+Matrix<T>::Matrix (const node_t max_node_index, const vector<stat_edge>& stats, const bool vector_output, const bool track_assignments) :
+    num_nodes (max_node_index + 1),
+    vector_output (vector_output),
+    track_assignments (track_assignments),
+    sparse (!vector_output && max_node_index >= node_count_ram_limit),
+    mat2vec (vector_output ?
+             nullptr :
+             new MR::Connectome::Mat2Vec (num_nodes))
+{
+  assert (stats.size());
+  for (auto s : stats)
+    channels.push_back (Channel (s, num_edges()));
+}
+
+
+
+template <typename T>
+typename Matrix<T>::Partial& Matrix<T>::create()
+{
+  std::lock_guard<std::mutex> lock (mutex);
+  partials.push_back (std::unique_ptr<Partial> (new Partial (*this)));
+  return *partials.back();
+}
+
+
+
 template <typename T>
 void Matrix<T>::finalize()
 {
-  switch (statistic) {
-    case stat_edge::SUM:
-      return;
-    case stat_edge::MEAN:
-      assert (counts.size());
-      for (ssize_t i = 0; i != data.size(); ++i) {
-        if (counts[i]) {
-          data[i] /= counts[i];
-          counts[i] = T(1.0);
+  for (auto& p : partials)
+    merge (*p);
+  partials.clear();
+
+  for (auto& channel : channels) {
+    switch (channel.statistic) {
+      case stat_edge::SUM:
+        break;
+      case stat_edge::MEAN:
+        assert (channel.counts.size());
+        for (ssize_t i = 0; i != channel.data.size(); ++i) {
+          if (channel.counts[i]) {
+            channel.data[i] /= channel.counts[i];
+            channel.counts[i] = T(1.0);
+          }
         }
+        break;
+      case stat_edge::MIN:
+      case stat_edge::MAX:
+        for (ssize_t i = 0; i != channel.data.size(); ++i) {
+          if (!std::isfinite (channel.data[i]))
+            channel.data[i] = std::numeric_limits<T>::quiet_NaN();
+        }
+        break;
+    }
+  }
+}
+
+
+
+template <typename T>
+void Matrix<T>::merge (Partial& partial)
+{
+  auto merge_edge = [&] (const size_t edge_index, const T* const source) {
+    for (size_t c = 0; c != num_channels(); ++c) {
+      Channel& channel (channels[c]);
+      switch (channel.statistic) {
+        case stat_edge::SUM:
+          channel.data[edge_index] += source[2*c];
+          break;
+        case stat_edge::MEAN:
+          channel.data[edge_index] += source[2*c];
+          channel.counts[edge_index] += source[2*c+1];
+          break;
+        case stat_edge::MIN:
+          channel.data[edge_index] = std::min (channel.data[edge_index], source[2*c]);
+          break;
+        case stat_edge::MAX:
+          channel.data[edge_index] = std::max (channel.data[edge_index], source[2*c]);
+          break;
       }
-      return;
-    case stat_edge::MIN:
-    case stat_edge::MAX:
-      for (ssize_t i = 0; i != data.size(); ++i) {
-        if (!std::isfinite (data[i]))
-          data[i] = std::numeric_limits<T>::quiet_NaN();
-      }
-      return;
+    }
+  };
+  if (sparse) {
+    for (const auto& i : partial.sparse_offsets)
+      merge_edge (i.first, partial.values.data() + i.second);
+  } else {
+    for (size_t edge_index = 0; edge_index != num_edges(); ++edge_index)
+      merge_edge (edge_index, partial.values.data() + edge_index*partial.stride);
+  }
+
+  for (const auto& i : partial.assignments_single) {
+    if (i.first >= assignments_single.size())
+      assignments_single.resize (i.first + 1, 0);
+    assignments_single[i.first] = i.second;
+  }
+  for (const auto& i : partial.assignments_pairs) {
+    if (i.first >= assignments_pairs.size())
+      assignments_pairs.resize (i.first + 1, std::make_pair<node_t, node_t> (0, 0));
+    assignments_pairs[i.first] = i.second;
+  }
+  for (auto& i : partial.assignments_lists) {
+    if (i.first >= assignments_lists.size())
+      assignments_lists.resize (i.first + 1, vector<node_t>());
+    assignments_lists[i.first] = std::move (i.second);
   }
 }
 
@@ -170,6 +276,7 @@ void Matrix<T>::error_check (const std::set<node_t>& missing_nodes)
   if (vector_output)
     return;
   assert (mat2vec);
+  const vector_type& data (channels.front().data);
   BitSet visited (mat2vec->mat_size());
   for (ssize_t i = 0; i != data.size(); ++i) {
     if (std::isfinite(data[i]) && data[i]) {
@@ -218,8 +325,11 @@ template <typename T>
 void Matrix<T>::save (const std::string& path,
                       const bool keep_unassigned,
                       const bool symmetric,
-                      const bool zero_diagonal) const
+                      const bool zero_diagonal,
+                      const size_t channel) const
 {
+  assert (channel < num_channels());
+  const vector_type& data (channels[channel].data);
   // Write the output file one line at a time
   // No point in keeping a dense matrix version of this function;
   //   it would just increase code management
@@ -259,22 +369,17 @@ void Matrix<T>::save (const std::string& path,
 
 
 template <typename T>
-void Matrix<T>::apply_data (const size_t index, const T value, const T weight)
+T Matrix<T>::initial_value (const stat_edge statistic)
 {
-  T& target = data[index];
-  apply_data (target, value, weight);
-}
-
-template <typename T>
-void Matrix<T>::apply_data (const size_t node_one, const size_t node_two, const T value, const T weight)
-{
-  assert (mat2vec);
-  T& target = data[(*mat2vec) (node_one, node_two)];
-  apply_data (target, value, weight);
+  switch (statistic) {
+    case stat_edge::MIN: return std::numeric_limits<T>::infinity();
+    case stat_edge::MAX: return -std::numeric_limits<T>::infinity();
+    default:             return T(0);
+  }
 }
 
 template <typename T>
-void Matrix<T>::apply_data (T& target, const T value, const T weight)
+void Matrix<T>::apply_data (T& target, const T value, const T weight, const stat_edge statistic)
 {
   switch (statistic) {
     case stat_edge::SUM:
@@ -290,25 +395,6 @@ void Matrix<T>::apply_data (T& target, const T value, const T weight)
   }
 }
 
-template <typename T>
-void Matrix<T>::inc_count (const size_t index, const T weight)
-{
-  if (statistic != stat_edge::MEAN)
-    return;
-  assert (counts.size());
-  counts[index] += weight;
-}
-
-template <typename T>
-void Matrix<T>::inc_count (const size_t node_one, const size_t node_two, const T weight)
-{
-  if (statistic != stat_edge::MEAN)
-    return;
-  assert (counts.size());
-  assert (mat2vec);
-  counts[(*mat2vec) (node_one, node_two)] += weight;
-}
-
 
 
 template class Matrix<float>;
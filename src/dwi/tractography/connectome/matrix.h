@@ -17,7 +17,9 @@
 #ifndef __dwi_tractography_connectome_matrix_h__
 #define __dwi_tractography_connectome_matrix_h__
 
+#include <mutex>
 #include <set>
+#include <unordered_map>
 
 #include "types.h"
 
@@ -53,30 +55,45 @@ class Matrix
   public:
     using vector_type = Eigen::Matrix<T, Eigen::Dynamic, 1>;
 
+    // Thread-local accumulation of streamline contributions to all channels of the matrix
+    // Per-edge storage is dense if the number of nodes is small, and sparse (i.e. only those
+    //   edges to which at least one streamline has been assigned) otherwise; the contents
+    //   are merged into the matrix data in finalize()
+    class Partial
+    { MEMALIGN(Partial)
+      public:
+        Partial (const Matrix& master);
+        Partial (const Partial&) = delete;
+
+        bool operator() (const Mapped_track_nodepair&);
+        bool operator() (const Mapped_track_nodelist&);
+
+      private:
+        const Matrix& master;
+        // For each edge, the accumulated value & count of each channel, interleaved
+        const size_t stride;
+        vector<T> values;
+        std::unordered_map<size_t, size_t> sparse_offsets;
+        vector<std::pair<size_t, node_t>> assignments_single;
+        vector<std::pair<size_t, NodePair>> assignments_pairs;
+        vector<std::pair<size_t, vector<node_t>>> assignments_lists;
+
+        T* get (const size_t edge_index);
+        void apply (const size_t edge_index, const Mapped_track_base&);
+
+        friend class Matrix;
+    };
+
+
     Matrix (const node_t max_node_index, const stat_edge stat, const bool vector_output, const bool track_assignments) :
-        statistic (stat),
-        vector_output (vector_output),
-        track_assignments (track_assignments),
-        mat2vec (vector_output ?
-                 nullptr :
-                 new MR::Connectome::Mat2Vec (max_node_index+1)),
-        data   (vector_type::Zero (vector_output ?
-                                   (max_node_index + 1) :
-                                   mat2vec->vec_size())),
-        counts (stat == stat_edge::MEAN ?
-                vector_type::Zero (vector_output ?
-                                   (max_node_index + 1) :
-                                   mat2vec->vec_size()) :
-                vector_type())
-    {
-      if (statistic == stat_edge::MIN)
-        data = vector_type::Constant (vector_output ? (max_node_index + 1) : mat2vec->vec_size(), std::numeric_limits<T>::infinity());
-      else if (statistic == stat_edge::MAX)
-        data = vector_type::Constant (vector_output ? (max_node_index + 1) : mat2vec->vec_size(), -std::numeric_limits<T>::infinity());
-    }
-
-    bool operator() (const Mapped_track_nodepair&);
-    bool operator() (const Mapped_track_nodelist&);
+        Matrix (max_node_index, vector<stat_edge> (1, stat), vector_output, track_assignments) { }
+
+    // One channel per statistic; the factor for each channel is taken from the
+    //   corresponding factor of the mapped streamlines
+    Matrix (const node_t max_node_index, const vector<stat_edge>& stats, const bool vector_output, const bool track_assignments);
+
+    // Thread-safe; one per mapping thread
+    Partial& create();
 
     void finalize();
 
@@ -85,27 +102,42 @@ class Matrix
     void write_assignments (const std::string&) const;
 
     bool is_vector() const { return (vector_output); }
+    bool is_sparse() const { return (sparse); }
+    size_t num_channels() const { return channels.size(); }
 
-    void save (const std::string&, const bool, const bool, const bool) const;
+    void save (const std::string&, const bool, const bool, const bool, const size_t channel = 0) const;
 
 
   private:
-    const stat_edge statistic;
+    class Channel
+    { MEMALIGN(Channel)
+      public:
+        Channel (const stat_edge stat, const size_t size);
+        const stat_edge statistic;
+        vector_type data, counts;
+    };
+
+    const node_t num_nodes;
     const bool vector_output;
     const bool track_assignments;
+    const bool sparse;
 
     const std::unique_ptr<MR::Connectome::Mat2Vec> mat2vec;
 
-    vector_type data, counts;
+    vector<Channel> channels;
     vector<node_t> assignments_single;
     vector<NodePair> assignments_pairs;
     vector< vector<node_t> > assignments_lists;
 
-    FORCE_INLINE void apply_data (const size_t, const T, const T);
-    FORCE_INLINE void apply_data (const size_t, const size_t, const T, const T);
-    FORCE_INLINE void apply_data (T&, const T, const T);
-    FORCE_INLINE void inc_count (const size_t, const T);
-    FORCE_INLINE void inc_count (const size_t, const size_t, const T);
+    std::mutex mutex;
+    vector<std::unique_ptr<Partial>> partials;
+
+    size_t num_edges() const { return (vector_output ? num_nodes : mat2vec->vec_size()); }
+
+    void merge (Partial&);
+
+    FORCE_INLINE static T initial_value (const stat_edge);
+    FORCE_INLINE static void apply_data (T&, const T, const T, const stat_edge);
 
 };
 
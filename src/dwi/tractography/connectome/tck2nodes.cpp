@@ -14,6 +14,7 @@
  * For more details, see http://www.mrtrix.org/.
  */
 
+#include <limits>
 #include <map>
 #include <set>
 
@@ -29,6 +30,104 @@ namespace Connectome {
 
 
 
+void Tck2nodes_base::initialise_distance_field()
+{
+  // Separable exact Euclidean distance transform (Felzenszwalb & Huttenlocher, 2012),
+  //   performed along each image axis in turn, accounting for voxel anisotropy
+  const size_t dims[3] = { size_t(nodes.size(0)), size_t(nodes.size(1)), size_t(nodes.size(2)) };
+  const size_t strides[3] = { 1, dims[0], dims[0] * dims[1] };
+  constexpr default_type infinity = std::numeric_limits<default_type>::infinity();
+
+  vector<default_type> data (dims[0] * dims[1] * dims[2]);
+  Image<node_t> v (nodes);
+  for (v.index(2) = 0; v.index(2) != v.size(2); ++v.index(2)) {
+    for (v.index(1) = 0; v.index(1) != v.size(1); ++v.index(1)) {
+      for (v.index(0) = 0; v.index(0) != v.size(0); ++v.index(0))
+        data[v.index(0) + strides[1]*v.index(1) + strides[2]*v.index(2)] = v.value() ? 0.0 : infinity;
+    }
+  }
+
+  vector<default_type> f, intersections;
+  vector<size_t> parabolas;
+  for (size_t axis = 0; axis != 3; ++axis) {
+    const size_t n = dims[axis];
+    const default_type sq_spacing = Math::pow2 (nodes.spacing (axis));
+    const size_t outer_axis = axis == 2 ? 1 : 2;
+    const size_t inner_axis = axis == 0 ? 1 : 0;
+    f.resize (n);
+    parabolas.resize (n);
+    intersections.resize (n + 1);
+    for (size_t j = 0; j != dims[outer_axis]; ++j) {
+      for (size_t i = 0; i != dims[inner_axis]; ++i) {
+        default_type* const line = data.data() + i*strides[inner_axis] + j*strides[outer_axis];
+        const size_t stride = strides[axis];
+        // Lower envelope of the parabolas rooted at each finite sample
+        size_t k = 0;
+        bool any = false;
+        for (size_t q = 0; q != n; ++q) {
+          f[q] = line[q*stride];
+          if (!std::isfinite (f[q]))
+            continue;
+          if (!any) {
+            parabolas[0] = q;
+            intersections[0] = -infinity;
+            intersections[1] = infinity;
+            any = true;
+            continue;
+          }
+          default_type s;
+          while (true) {
+            const size_t p = parabolas[k];
+            s = ((f[q] + sq_spacing*q*q) - (f[p] + sq_spacing*p*p)) / (2.0 * sq_spacing * (default_type(q) - default_type(p)));
+            if (s > intersections[k] || !k)
+              break;
+            --k;
+          }
+          if (s <= intersections[k]) {
+            parabolas[0] = q;
+            intersections[0] = -infinity;
+          } else {
+            ++k;
+            parabolas[k] = q;
+            intersections[k] = s;
+          }
+          intersections[k+1] = infinity;
+        }
+        if (!any)
+          continue;
+        k = 0;
+        for (size_t q = 0; q != n; ++q) {
+          while (intersections[k+1] < q)
+            ++k;
+          const size_t p = parabolas[k];
+          line[q*stride] = sq_spacing * Math::pow2 (default_type(q) - default_type(p)) + f[p];
+        }
+      }
+    }
+  }
+
+  sq_distances = std::make_shared<vector<float>> (data.begin(), data.end());
+}
+
+
+
+default_type Tck2nodes_base::get_min_distance (const Eigen::Array<int,3,1>& voxel) const
+{
+  if (!sq_distances)
+    return 0.0;
+  for (size_t axis = 0; axis != 3; ++axis) {
+    if (voxel[axis] < 0 || voxel[axis] >= nodes.size (axis))
+      return 0.0;
+  }
+  const float sq_distance = (*sq_distances)[voxel[0] + nodes.size(0) * (voxel[1] + nodes.size(1) * voxel[2])];
+  // Distances are stored with single precision; err on the side of smaller values
+  return std::sqrt (sq_distance) * (1.0 - 1e-5);
+}
+
+
+
+
+
 node_t Tck2nodes_end_voxels::select_node (const Tractography::Streamline<>& tck, Image<node_t>& v, const bool end) const
 {
   const Eigen::Vector3d p ((end ? tck.back() : tck.front()).cast<default_type>());
@@ -76,6 +175,21 @@ node_t Tck2nodes_radial::select_node (const Tractography::Streamline<>& tck, Ima
   const Eigen::Vector3d v_float = transform->scanner2voxel * p;
   const voxel_type centre { int(std::round (v_float[0])), int(std::round (v_float[1])), int(std::round (v_float[2])) };
 
+  // No voxel with a non-zero node index can be within range
+  if (get_min_distance (centre) - max_add_dist > max_dist)
+    return 0;
+  // Endpoint voxel has a non-zero node index, and its centre is unambiguously the
+  //   closest of any voxel centre to the endpoint: the first voxel tested in the search
+  //   is guaranteed to be the result
+  if ((v_float - centre.matrix().cast<default_type>()).array().abs().maxCoeff() < 0.49) {
+    assign_pos_of (centre).to (v);
+    if (!is_out_of_bounds (v)) {
+      const node_t this_node = v.value();
+      if (this_node && (p - transform->voxel2scanner * centre.matrix().cast<default_type>()).norm() < max_dist)
+        return this_node;
+    }
+  }
+
   for (vector<voxel_type>::const_iterator offset = radial_search.begin(); offset != radial_search.end(); ++offset) {
 
     const voxel_type this_voxel (centre + *offset);
@@ -111,16 +225,26 @@ node_t Tck2nodes_revsearch::select_node (const Tractography::Streamline<>& tck,
 
   default_type dist = 0.0;
 
+  // Points along the streamline for which it is not possible to be within a voxel with non-zero node index,
+  //   based on the distance transform at the most recently tested point, are not tested
+  default_type length_from_test = 0.0, skip_length = -1.0;
+
   for (int index = start_index; index != midpoint_index; index += step) {
-    const Eigen::Vector3d v_float = transform->scanner2voxel * tck[index].cast<default_type>();
-    const voxel_type voxel { int(std::round (v_float[0])), int(std::round (v_float[1])), int(std::round (v_float[2])) };
-    assign_pos_of (voxel).to (v);
-    if (!is_out_of_bounds (v)) {
-      const node_t this_node = v.value();
-      if (this_node)
-        return this_node;
+    if (length_from_test >= skip_length) {
+      const Eigen::Vector3d v_float = transform->scanner2voxel * tck[index].cast<default_type>();
+      const voxel_type voxel { int(std::round (v_float[0])), int(std::round (v_float[1])), int(std::round (v_float[2])) };
+      assign_pos_of (voxel).to (v);
+      if (!is_out_of_bounds (v)) {
+        const node_t this_node = v.value();
+        if (this_node)
+          return this_node;
+      }
+      length_from_test = 0.0;
+      skip_length = get_min_distance (voxel) - 2.0 * max_add_dist;
     }
-    if (max_dist && ((dist += (tck[index] - tck[index+step]).norm()) > max_dist))
+    const default_type step_length = (tck[index] - tck[index+step]).norm();
+    length_from_test += step_length;
+    if (max_dist && ((dist += step_length) > max_dist))
       return 0;
   }
 
@@ -163,6 +287,9 @@ node_t Tck2nodes_forwardsearch::select_node (const Tractography::Streamline<>& t
   const voxel_type voxel { int(std::round (vp[0])), int(std::round (vp[1])), int(std::round (vp[2])) };
   if (is_out_of_bounds (v, voxel))
     return 0;
+  // No voxel within the search space can have a non-zero node index
+  if (get_min_distance (voxel) - max_add_dist > max_dist)
+    return 0;
   visited.insert (voxel);
   to_test.insert (std::make_pair (default_type(0.0), voxel));
 
@@ -83,6 +83,21 @@ class Tck2nodes_base { MEMALIGN(Tck2nodes_base)
       throw Exception ("Calling empty virtual function Tck2nodes_base::select_nodes()");
     }
 
+    // Euclidean distance transform of the parcellation image: squared distance (in mm^2) from the
+    //   centre of each voxel to the centre of the nearest voxel with non-zero node index
+    // This is used by the search-based mechanisms to determine in constant time when the outcome
+    //   of the search is already known, or when part of the search can be skipped; the result of
+    //   the search is therefore unaffected
+    std::shared_ptr<vector<float>> sq_distances;
+    void initialise_distance_field();
+    // Lower bound on the distance from a voxel centre to the nearest voxel with non-zero node
+    //   index (accounting for floating-point precision); returns 0.0 if outside the image
+    default_type get_min_distance (const Eigen::Array<int,3,1>&) const;
+    // Maximal distance from a point to the centre of the voxel in which it resides
+    default_type get_half_voxel_diagonal() const {
+      return std::sqrt (Math::pow2 (0.5 * nodes.spacing(2)) + Math::pow2 (0.5 * nodes.spacing(1)) + Math::pow2 (0.5 * nodes.spacing(0)));
+    }
+
     class voxel_type : public Eigen::Array<int,3,1>
     { MEMALIGN(voxel_type)
       public:
@@ -127,9 +142,10 @@ class Tck2nodes_radial : public Tck2nodes_base { MEMALIGN(Tck2nodes_radial)
     Tck2nodes_radial (const Image<node_t>& nodes_data, const default_type radius) :
         Tck2nodes_base (nodes_data, true),
         max_dist       (radius),
-        max_add_dist   (std::sqrt (Math::pow2 (0.5 * nodes.spacing(2)) + Math::pow2 (0.5 * nodes.spacing(1)) + Math::pow2 (0.5 * nodes.spacing(0))))
+        max_add_dist   (get_half_voxel_diagonal())
     {
       initialise_search ();
+      initialise_distance_field ();
     }
 
     Tck2nodes_radial (const Tck2nodes_radial& that) :
@@ -164,11 +180,16 @@ class Tck2nodes_revsearch : public Tck2nodes_base
   public:
     Tck2nodes_revsearch (const Image<node_t>& nodes_data, const default_type length) :
         Tck2nodes_base (nodes_data, true),
-        max_dist       (length) { }
+        max_dist       (length),
+        max_add_dist   (get_half_voxel_diagonal())
+    {
+      initialise_distance_field ();
+    }
 
     Tck2nodes_revsearch (const Tck2nodes_revsearch& that) :
         Tck2nodes_base (that),
-        max_dist       (that.max_dist) { }
+        max_dist       (that.max_dist),
+        max_add_dist   (that.max_add_dist) { }
 
     ~Tck2nodes_revsearch() { }
 
@@ -176,6 +197,7 @@ class Tck2nodes_revsearch : public Tck2nodes_base
     node_t select_node (const Tractography::Streamline<>&, Image<node_t>&, const bool) const override;
 
     const default_type max_dist;
+    const default_type max_add_dist;
 
 };
 
@@ -189,11 +211,16 @@ class Tck2nodes_forwardsearch : public Tck2nodes_base
     Tck2nodes_forwardsearch (const Image<node_t>& nodes_data, const default_type length) :
         Tck2nodes_base (nodes_data, true),
         max_dist       (length),
-        angle_limit    (Math::pi_4) { } // 45 degree limit
+        max_add_dist   (get_half_voxel_diagonal()),
+        angle_limit    (Math::pi_4) // 45 degree limit
+    {
+      initialise_distance_field ();
+    }
 
     Tck2nodes_forwardsearch (const Tck2nodes_forwardsearch& that) :
         Tck2nodes_base (that),
         max_dist       (that.max_dist),
+        max_add_dist   (that.max_add_dist),
         angle_limit    (that.angle_limit) { }
 
     ~Tck2nodes_forwardsearch() { }
@@ -202,6 +229,7 @@ class Tck2nodes_forwardsearch : public Tck2nodes_base
     node_t select_node (const Tractography::Streamline<>&, Image<node_t>&, const bool) const override;
 
     const default_type max_dist;
+    const default_type max_add_dist;
     const default_type angle_limit;
 
     default_type get_cf (const Eigen::Vector3d&, const Eigen::Vector3d&, const voxel_type&) const;
@@ -26,21 +26,39 @@ namespace MR {
 
 
 
+        void Receiver::set_scalars (const std::string& input_path, const Properties& input_tck_properties,
+                                    const std::string& output_path, const Properties& properties)
+        {
+          if (crop)
+            throw Exception ("Cannot process track scalar files when cropping streamlines using a mask");
+          Properties scalar_properties;
+          scalar_reader.reset (new ScalarReader<> (input_path, scalar_properties));
+          check_properties_match (input_tck_properties, scalar_properties, "track scalar file");
+          // Output track scalar file must share the timestamp of the output track file
+          scalar_writer.reset (new ScalarWriter<> (output_path, properties));
+        }
+
+
+
         bool Receiver::operator() (const Streamline<>& in)
         {
-          auto display_func = [&]() {
-            return (printf ("%8" PRIu64 " read, %8" PRIu64 " written", total_count, count)
-                    + (crop ? printf(", %8" PRIu64 " segments", segments) : ""));
-          };
+          auto display_func = [&]() { return progress_text(); };
 
           if (number && (count == number))
             return false;
 
           ++total_count;
 
+          if (scalar_reader) {
+            if (!(*scalar_reader) (scalars))
+              throw Exception ("Track scalar file contains fewer entries than track file");
+            if (in.size() && scalars.size() != in.size())
+              throw Exception ("Track scalar file does not correspond to track file: mismatched number of vertices in streamline " + str(in.get_index()));
+          }
+
           if (in.empty()) {
-            writer.skip();
-            progress.update (display_func);
+            skip_output();
+            progress->update (display_func);
             return true;
           }
 
@@ -48,10 +66,10 @@ namespace MR {
 
             if (skip) {
               --skip;
-              progress.update (display_func);
+              progress->update (display_func);
               return true;
             }
-            writer (in);
+            write (in);
             ++segments;
 
           } else {
@@ -65,7 +83,7 @@ namespace MR {
               } else if (temp.size()) {
                 temp.set_index (in.get_index());
                 temp.weight = in.weight;
-                writer (temp);
+                write (temp);
                 ++segments;
                 temp.clear();
               }
@@ -75,13 +93,71 @@ namespace MR {
           }
 
           ++count;
-          progress.update (display_func);
+          progress->update (display_func);
           return (!(number && (count == number)));
 
         }
 
 
 
+        void Receiver::finalise()
+        {
+          if (!sort)
+            return;
+          progress->set_text (progress_text());
+          progress.reset();
+
+          const auto order = sort->order();
+          ProgressBar write_progress ("writing spatially sorted streamlines", order.size());
+          for (const auto i : order) {
+            writer (sort_tracks[i]);
+            if (scalar_writer)
+              (*scalar_writer) (sort_scalars[i]);
+            ++write_progress;
+          }
+          // Rejected streamlines are accounted for only after all output streamlines
+          //   have been written, such that the track and track scalar files remain in step
+          for (; sort_skipped; --sort_skipped) {
+            writer.skip();
+            if (scalar_writer)
+              scalar_writer->skip();
+          }
+          sort.reset();
+          sort_tracks.clear();
+          sort_scalars.clear();
+        }
+
+
+
+        void Receiver::write (const Streamline<>& tck)
+        {
+          if (sort) {
+            sort->add (tck);
+            sort_tracks.push_back (tck);
+            if (scalar_writer)
+              sort_scalars.push_back (scalars);
+          } else {
+            writer (tck);
+            if (scalar_writer)
+              (*scalar_writer) (scalars);
+          }
+        }
+
+
+
+        void Receiver::skip_output()
+        {
+          if (sort) {
+            ++sort_skipped;
+            return;
+          }
+          writer.skip();
+          if (scalar_writer)
+            scalar_writer->skip();
+        }
+
+
+
       }
     }
   }
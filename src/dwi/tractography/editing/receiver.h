@@ -25,6 +25,8 @@
 
 #include "dwi/tractography/file.h"
 #include "dwi/tractography/properties.h"
+#include "dwi/tractography/scalar_file.h"
+#include "dwi/tractography/spatial_sort.h"
 #include "dwi/tractography/streamline.h"
 
 
@@ -50,19 +52,33 @@ namespace MR {
               total_count (0),
               crop (properties.mask.size()),
               segments (0),
-              progress (std::string("       0 read,        0 written") + (crop ? ",        0 segments" : "")) { }
+              sort_skipped (0),
+              progress (new ProgressBar (std::string("       0 read,        0 written") + (crop ? ",        0 segments" : ""))) { }
 
             ~Receiver()
             {
-              // Use set_text() rather than update() here to force update of the text before progress goes out of scope
-              progress.set_text (std::string(printf ("%8" PRIu64 " read, %8" PRIu64 " written", total_count, count)) + (crop ? printf(", %8" PRIu64 " segments", segments) : ""));
+              if (progress) {
+                // Use set_text() rather than update() here to force update of the text before progress goes out of scope
+                progress->set_text (progress_text());
+              }
               if (number && (count != number))
                 WARN ("User requested " + str(number) + " streamlines, but only " + str(count) + " were written to file");
             }
 
+            //! write the output streamlines in order along a space-filling curve
+            /*! Streamlines are held in memory until finalise() is called */
+            void set_sort (const SpatialSort::curve_t curve) { sort.reset (new SpatialSort (curve)); }
+
+            //! read track scalars corresponding to the input streamlines, and write
+            //! those corresponding to the output streamlines
+            void set_scalars (const std::string& input_path, const Properties& input_tck_properties,
+                              const std::string& output_path, const Properties& properties);
 
             bool operator() (const Streamline<>&);
 
+            //! write any streamlines held in memory to the output file
+            void finalise();
+
 
           private:
 
@@ -72,7 +88,27 @@ namespace MR {
             uint64_t count, total_count;
             bool crop;
             uint64_t segments;
-            ProgressBar progress;
+            // Number of rejected streamlines yet to be accounted for in the output
+            //   files when sorting
+            uint64_t sort_skipped;
+            std::unique_ptr<ProgressBar> progress;
+
+            std::unique_ptr<SpatialSort> sort;
+            vector<Streamline<>> sort_tracks;
+            vector<TrackScalar<>> sort_scalars;
+
+            std::unique_ptr<ScalarReader<>> scalar_reader;
+            std::unique_ptr<ScalarWriter<>> scalar_writer;
+            TrackScalar<> scalars;
+
+            void write (const Streamline<>&);
+            void skip_output();
+
+            std::string progress_text() const
+            {
+              return printf ("%8" PRIu64 " read, %8" PRIu64 " written", total_count, count)
+                     + (crop ? printf(", %8" PRIu64 " segments", segments) : "");
+            }
 
         };
 
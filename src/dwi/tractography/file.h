@@ -25,6 +25,7 @@
 #include "file/config.h"
 #include "file/key_value.h"
 #include "file/ofstream.h"
+#include "file/utils.h"
 #include "dwi/tractography/file_base.h"
 #include "dwi/tractography/properties.h"
 #include "dwi/tractography/streamline.h"
@@ -216,12 +217,20 @@ namespace MR
           using vector_type = Eigen::Matrix<ValueType,3,1>;
 
           //! create a new track file with the specified properties
-          WriterUnbuffered (const std::string& file, const Properties& properties) :
+          /*! If \a resume is valid, the existing file is instead re-opened,
+           * and any data following the state of the file at that point are
+           * discarded; further tracks are then appended from that point. */
+          WriterUnbuffered (const std::string& file, const Properties& properties, const WriterState& resume = WriterState()) :
               __WriterBase__<ValueType> (file) {
 
             if (!Path::has_suffix (name, ".tck"))
               throw Exception ("output track files must use the .tck suffix");
 
+            if (resume.valid()) {
+              reopen (resume);
+              return;
+            }
+
             File::OFStream out;
             try {
               out.open (name, std::ios::out | std::ios::binary | std::ios::trunc);
@@ -269,6 +278,17 @@ namespace MR
           }
 
 
+          //! the state of the file, as of the last commit of data
+          WriterState get_state () const {
+            WriterState state;
+            state.count = count;
+            state.total_count = total_count;
+            state.count_offset = this->count_offset;
+            state.barrier_offset = barrier_addr;
+            return state;
+          }
+
+
           //! set the path to the track weights
           void set_weights_path (const std::string& path) {
             if (weights_name.size())
@@ -296,6 +316,29 @@ namespace MR
               dest = { BE(src[0]), BE(src[1]), BE(src[2]) };
           }
 
+          void reopen (const WriterState& state) {
+            const int64_t end = state.barrier_offset + sizeof (vector_type);
+            std::ifstream in (name, std::ios::in | std::ios::binary | std::ios::ate);
+            if (!in)
+              throw Exception ("unable to resume writing to track file \"" + name + "\": " + strerror (errno));
+            if (int64_t (in.tellg()) < end)
+              throw Exception ("unable to resume writing to track file \"" + name + "\": file is shorter than expected");
+            in.close();
+            File::resize (name, end);
+            count = state.count;
+            total_count = state.total_count;
+            this->count_offset = state.count_offset;
+            barrier_addr = state.barrier_offset;
+            File::OFStream out (name, std::ios::in | std::ios::out | std::ios::binary);
+            vector_type x;
+            format_point (barrier(), x);
+            out.seekp (barrier_addr, out.beg);
+            out.write (reinterpret_cast<char*> (&x[0]), sizeof (x));
+            verify_stream (out);
+            update_counts (out);
+            open_success = true;
+          }
+
           //! write track weights data to file
           void write_weights (const std::string& contents) {
             File::OFStream out (weights_name, std::ios::in | std::ios::out | std::ios::binary | std::ios::ate);
@@ -371,8 +414,8 @@ namespace MR
           //CONF writing track files. MRtrix will store the output tracks in a
           //CONF relatively large buffer to limit the number of write() calls,
           //CONF avoid associated issues such as file fragmentation.
-          Writer (const std::string& file, const Properties& properties, size_t default_buffer_capacity = 16777216) :
-            WriterUnbuffered<ValueType> (file, properties),
+          Writer (const std::string& file, const Properties& properties, const WriterState& resume = WriterState(), size_t default_buffer_capacity = 16777216) :
+            WriterUnbuffered<ValueType> (file, properties, resume),
             buffer_capacity (File::Config::get_int ("TrackWriterBufferSize", default_buffer_capacity) / sizeof (vector_type)),
             buffer (new vector_type [buffer_capacity]),
             buffer_size (0) { }
@@ -403,6 +446,11 @@ namespace MR
             return true;
           }
 
+          //! commit all buffered data to file
+          void flush () {
+            commit();
+          }
+
 
         protected:
           const size_t buffer_capacity;
@@ -58,13 +58,33 @@ namespace MR
       };
 
 
+      //! \endcond
+
+
+
+      //! The state of a track file at a point where all data have been committed
+      /*! This allows a subsequent writer to resume appending tracks to the
+       * file from that point (see tckgen -resume). A default-constructed
+       * instance indicates that a new file should be created. */
+      class WriterState
+      { NOMEMALIGN
+        public:
+          WriterState () : count (0), total_count (0), count_offset (0), barrier_offset (0) { }
+          bool valid () const { return count_offset > 0; }
+          uint64_t count, total_count;
+          int64_t count_offset, barrier_offset;
+      };
+
+
+
+      //! \cond skip
       template <typename ValueType = float>
         class __WriterBase__
         { NOMEMALIGN
           public:
             using value_type = ValueType;
 
-            __WriterBase__(const std::string& name) :
+            __WriterBase__(const std::string& name, const bool check_overwrite = true) :
               count (0),
               total_count (0),
               name (name),
@@ -77,7 +97,8 @@ namespace MR
                 dtype != DataType::Float64LE && dtype != DataType::Float64BE)
               throw Exception ("only supported datatype for tracks file are "
                   "Float32LE, Float32BE, Float64LE & Float64BE");
-            App::check_overwrite (name);
+            if (check_overwrite)
+              App::check_overwrite (name);
           }
 
             ~__WriterBase__()
@@ -0,0 +1,195 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __dwi_tractography_mapping_accumulator_h__
+#define __dwi_tractography_mapping_accumulator_h__
+
+
+#include <mutex>
+
+#include "header.h"
+#include "memory.h"
+
+#include "dwi/tractography/streamline.h"
+#include "dwi/tractography/mapping/partial_buffer.h"
+#include "dwi/tractography/mapping/writer.h"
+
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace Mapping {
+
+
+
+        // Number of values accumulated per voxel in a partial buffer for a given output type:
+        //   DEC requires an additional channel to store the streamline weights
+        inline size_t partial_channels (const Header& header, const writer_dim type)
+        {
+          switch (type) {
+            case GREYSCALE: return 1;
+            case DEC:       return 4;
+            case DIXEL:
+            case TOD:       return header.size(3);
+            default:        throw Exception ("Invalid TWI writer image dimensionality");
+          }
+        }
+
+
+
+        // Functor that both maps streamlines and accumulates the result, for use with
+        //   Thread::multi(): each copy sums the contributions of the streamlines it
+        //   receives into its own partial buffer, so that no single thread is responsible
+        //   for writing the output image. Once all streamlines have been processed,
+        //   finalise() sums the per-thread partial buffers using a parallel tree
+        //   reduction and passes the result to the writer.
+        // This is only applicable for the V_SUM voxel statistic.
+        // If the total size of the partial buffers exceeds the limit provided, the
+        //   offending thread instead flushes its partial buffer to the writer (under
+        //   a mutex) and continues with an empty buffer.
+        template <class MapperType, class SetType>
+          class MapAccumulator
+        { MEMALIGN(MapAccumulator<MapperType,SetType>)
+
+          public:
+            MapAccumulator (const MapperType& mapper, MapWriterBase& writer, const Header& header, const writer_dim type, const size_t num_threads, const size_t memory_limit) :
+                mapper (mapper),
+                shared (new Shared (writer, header, partial_channels (header, type), num_threads ? memory_limit / num_threads : memory_limit)),
+                partial (shared->create()) { }
+
+            MapAccumulator (const MapAccumulator& that) :
+                mapper (that.mapper),
+                shared (that.shared),
+                partial (shared->create()) { }
+
+            bool operator() (Streamline<>& in)
+            {
+              mapper (in, set);
+              accumulate (set);
+              if (partial->bytes() > shared->thread_limit) {
+                std::lock_guard<std::mutex> lock (shared->mutex);
+                shared->writer.add (*partial);
+                partial->clear();
+                shared->flushed = true;
+              }
+              return true;
+            }
+
+            void finalise ()
+            {
+              if (shared->flushed)
+                INFO ("per-thread partial buffers exceeded memory limit; some contributions were flushed to the output image during mapping");
+              vector<PartialBuffer*> partials;
+              for (auto& p : shared->partials)
+                partials.push_back (p.get());
+              tree_reduce (partials, [] (PartialBuffer* a, PartialBuffer* b) { a->merge (*b); });
+              if (partials.size())
+                shared->writer.add (*partials[0]);
+              shared->partials.clear();
+            }
+
+
+          private:
+            class Shared
+            { NOMEMALIGN
+              public:
+                Shared (MapWriterBase& writer, const Header& header, const size_t channels, const size_t thread_limit) :
+                    writer (writer),
+                    header (header),
+                    channels (channels),
+                    thread_limit (thread_limit),
+                    flushed (false) { }
+
+                PartialBuffer* create () {
+                  std::lock_guard<std::mutex> lock (mutex);
+                  partials.push_back (make_unique<PartialBuffer> (header, channels));
+                  return partials.back().get();
+                }
+
+                MapWriterBase& writer;
+                const Header& header;
+                const size_t channels, thread_limit;
+                vector<std::unique_ptr<PartialBuffer>> partials;
+                std::mutex mutex;
+                bool flushed;
+            };
+
+            MapperType mapper;
+            std::shared_ptr<Shared> shared;
+            PartialBuffer* const partial;
+            SetType set;
+
+            void accumulate (const SetVoxel& in)    { accumulate_greyscale (in); }
+            void accumulate (const SetVoxelDEC& in) { accumulate_dec       (in); }
+            void accumulate (const SetDixel& in)    { accumulate_dixel     (in); }
+            void accumulate (const SetVoxelTOD& in) { accumulate_tod       (in); }
+
+            void accumulate (const Gaussian::SetVoxel& in)    { accumulate_greyscale (in); }
+            void accumulate (const Gaussian::SetVoxelDEC& in) { accumulate_dec       (in); }
+            void accumulate (const Gaussian::SetDixel& in)    { accumulate_dixel     (in); }
+            void accumulate (const Gaussian::SetVoxelTOD& in) { accumulate_tod       (in); }
+
+            template <class Cont>
+              void accumulate_greyscale (const Cont& in)
+              {
+                for (const auto& i : in)
+                  (*partial) (i)[0] += in.weight * i.get_length() * get_factor (i, in);
+              }
+
+            template <class Cont>
+              void accumulate_dec (const Cont& in)
+              {
+                for (const auto& i : in) {
+                  const default_type weight = in.weight * i.get_length();
+                  const Eigen::Vector3d scaled_colour = i.get_colour() * (weight * get_factor (i, in));
+                  float* data = (*partial) (i);
+                  data[0] += scaled_colour[0];
+                  data[1] += scaled_colour[1];
+                  data[2] += scaled_colour[2];
+                  data[3] += weight;
+                }
+              }
+
+            template <class Cont>
+              void accumulate_dixel (const Cont& in)
+              {
+                for (const auto& i : in)
+                  (*partial) (i)[i.get_dir()] += in.weight * i.get_length() * get_factor (i, in);
+              }
+
+            template <class Cont>
+              void accumulate_tod (const Cont& in)
+              {
+                for (const auto& i : in) {
+                  const default_type multiplier = in.weight * i.get_length() * get_factor (i, in);
+                  const auto& sh_coefs = i.get_tod();
+                  float* data = (*partial) (i);
+                  for (ssize_t index = 0; index != sh_coefs.size(); ++index)
+                    data[index] += sh_coefs[index] * multiplier;
+                }
+              }
+
+        };
+
+
+
+      }
+    }
+  }
+}
+
+#endif
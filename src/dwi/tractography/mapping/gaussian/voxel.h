@@ -167,7 +167,7 @@ namespace MR {
 
 
 
-          class SetVoxel : public std::set<Voxel>, public Mapping::SetVoxelExtras
+          class SetVoxel : public Mapping::VoxelSetBase<Voxel, SetVoxel>, public Mapping::SetVoxelExtras
           { MEMALIGN(SetVoxel)
             public:
 
@@ -176,16 +176,13 @@ namespace MR {
               inline void insert (const Eigen::Vector3i& v, const default_type l, const default_type f)
               {
                 const Voxel temp (v, l, f);
-                iterator existing = std::set<Voxel>::find (temp);
-                if (existing == std::set<Voxel>::end())
-                  std::set<Voxel>::insert (temp);
-                else
-                  (*existing).add (l, f);
+                Mapping::VoxelSetBase<Voxel, SetVoxel>::insert (temp);
               }
+              static void merge (const Voxel& existing, const Voxel& v) { existing.add (v.get_length(), v.get_factor()); }
           };
 
 
-          class SetVoxelDEC : public std::set<VoxelDEC>, public Mapping::SetVoxelExtras
+          class SetVoxelDEC : public Mapping::VoxelSetBase<VoxelDEC, SetVoxelDEC>, public Mapping::SetVoxelExtras
           { MEMALIGN(SetVoxelDEC)
             public:
 
@@ -194,16 +191,13 @@ namespace MR {
               inline void insert (const Eigen::Vector3i& v, const Eigen::Vector3d& d, const default_type l, const default_type f)
               {
                 const VoxelDEC temp (v, d, l, f);
-                iterator existing = std::set<VoxelDEC>::find (temp);
-                if (existing == std::set<VoxelDEC>::end())
-                  std::set<VoxelDEC>::insert (temp);
-                else
-                  (*existing).add (d, l, f);
+                Mapping::VoxelSetBase<VoxelDEC, SetVoxelDEC>::insert (temp);
               }
+              static void merge (const VoxelDEC& existing, const VoxelDEC& v) { existing.add (v.get_colour(), v.get_length(), v.get_factor()); }
           };
 
 
-          class SetDixel : public std::set<Dixel>, public Mapping::SetVoxelExtras
+          class SetDixel : public Mapping::VoxelSetBase<Dixel, SetDixel>, public Mapping::SetVoxelExtras
           { MEMALIGN(SetDixel)
             public:
 
@@ -213,16 +207,13 @@ namespace MR {
               inline void insert (const Eigen::Vector3i& v, const dir_index_type d, const default_type l, const default_type f)
               {
                 const Dixel temp (v, d, l, f);
-                iterator existing = std::set<Dixel>::find (temp);
-                if (existing == std::set<Dixel>::end())
-                  std::set<Dixel>::insert (temp);
-                else
-                  (*existing).add (l, f);
+                Mapping::VoxelSetBase<Dixel, SetDixel>::insert (temp);
               }
+              static void merge (const Dixel& existing, const Dixel& v) { existing.add (v.get_length(), v.get_factor()); }
           };
 
 
-          class SetVoxelTOD : public std::set<VoxelTOD>, public Mapping::SetVoxelExtras
+          class SetVoxelTOD : public Mapping::VoxelSetBase<VoxelTOD, SetVoxelTOD, true>, public Mapping::SetVoxelExtras
           { MEMALIGN(SetVoxelTOD)
             public:
 
@@ -232,12 +223,9 @@ namespace MR {
               inline void insert (const Eigen::Vector3i& v, const vector_type& t, const default_type l, const default_type f)
               {
                 const VoxelTOD temp (v, t, l, f);
-                iterator existing = std::set<VoxelTOD>::find (temp);
-                if (existing == std::set<VoxelTOD>::end())
-                  std::set<VoxelTOD>::insert (temp);
-                else
-                  (*existing).add (t, l, f);
+                Mapping::VoxelSetBase<VoxelTOD, SetVoxelTOD, true>::insert (temp);
               }
+              static void merge (const VoxelTOD& existing, const VoxelTOD& v) { existing.add (v.get_tod(), v.get_length(), v.get_factor()); }
           };
 
 
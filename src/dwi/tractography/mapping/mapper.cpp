@@ -31,8 +31,11 @@ void TrackMapperBase::voxelise (const Streamline<>& tck, SetVoxel& voxels) const
   for (const auto& i : tck) {
     vox = round (scanner2voxel * i);
     if (check (vox, info))
-      voxels.std::set<Voxel>::insert (vox);
+      voxels.insert (Voxel (vox));
   }
+  // Each voxel traversed contributes once, regardless of the number of vertices within it
+  for (auto& v : voxels)
+    v.normalize();
 }
 
 
@@ -117,7 +117,8 @@ namespace MR {
                 if (in.empty())
                   return true;
                 if (preprocess (in, out) || map_zero) {
-                  Streamline<> temp;
+                  // Re-use the memory allocated for the upsampled streamline
+                  static thread_local Streamline<> temp;
                   upsampler (in, temp);
                   if (precise)
                     voxelise_precise (temp, out);
@@ -0,0 +1,102 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "dwi/tractography/mapping/partial_buffer.h"
+
+#include "file/config.h"
+
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace Mapping {
+
+
+
+        size_t partial_buffer_memory_limit ()
+        {
+          //CONF option: TrackMappingPartialBufferSize
+          //CONF default: 1024
+          //CONF The total amount of memory (in MB) that may be used by
+          //CONF per-thread partial buffers when mapping streamlines (e.g.
+          //CONF in tckmap and tck2fixel). Each thread then accumulates its
+          //CONF own contributions, and the partial results are summed once
+          //CONF all streamlines have been mapped. If the buffers would
+          //CONF exceed this size, commands fall back to flushing to (or
+          //CONF sharing) a single output buffer. Set to 0 to disable
+          //CONF per-thread accumulation entirely.
+          static const float limit = File::Config::get_float ("TrackMappingPartialBufferSize", 1024.0f);
+          return limit > 0.0f ? size_t(limit * 1024.0f * 1024.0f) : 0;
+        }
+
+
+
+        PartialBuffer::PartialBuffer (const Header& header, const size_t channels) :
+            dims ({ { header.size(0), header.size(1), header.size(2) } }),
+            num_bricks ({ { size_t((header.size(0) + brick_mask) >> brick_shift),
+                            size_t((header.size(1) + brick_mask) >> brick_shift),
+                            size_t((header.size(2) + brick_mask) >> brick_shift) } }),
+            num_channels (channels),
+            brick_size (brick_width * brick_width * brick_width * channels),
+            bricks (num_bricks[0] * num_bricks[1] * num_bricks[2]),
+            num_allocated (0) { }
+
+
+
+        void PartialBuffer::merge (PartialBuffer& that)
+        {
+          assert (that.bricks.size() == bricks.size() && that.num_channels == num_channels);
+          for (size_t b = 0; b != bricks.size(); ++b) {
+            if (!that.bricks[b])
+              continue;
+            if (bricks[b]) {
+              float* const out = bricks[b].get();
+              const float* const in = that.bricks[b].get();
+              for (size_t i = 0; i != brick_size; ++i)
+                out[i] += in[i];
+              that.bricks[b].reset();
+            } else {
+              bricks[b] = std::move (that.bricks[b]);
+              ++num_allocated;
+            }
+          }
+          that.num_allocated = 0;
+        }
+
+
+
+        void PartialBuffer::clear()
+        {
+          for (auto& b : bricks)
+            b.reset();
+          num_allocated = 0;
+        }
+
+
+
+        void PartialBuffer::allocate (const size_t brick)
+        {
+          bricks[brick].reset (new float[brick_size]());
+          ++num_allocated;
+        }
+
+
+
+      }
+    }
+  }
+}
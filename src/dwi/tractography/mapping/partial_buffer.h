@@ -0,0 +1,179 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __dwi_tractography_mapping_partial_buffer_h__
+#define __dwi_tractography_mapping_partial_buffer_h__
+
+
+#include <array>
+#include <atomic>
+
+#include "header.h"
+#include "memory.h"
+#include "thread.h"
+#include "types.h"
+
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace Mapping {
+
+
+
+        // Size (in bytes) permitted for the per-thread partial buffers summed
+        //   across all threads; beyond this, the fallback behaviour of each
+        //   command is invoked (0 disables per-thread accumulation entirely)
+        size_t partial_buffer_memory_limit ();
+
+
+
+        // Sparse per-thread accumulator of partial voxel sums
+        // The image is divided into bricks of 8x8x8 voxels, with storage for
+        //   a brick allocated only once some streamline has contributed to a
+        //   voxel within it; each voxel stores a fixed number of channels
+        //   (e.g. one per volume of the output image)
+        class PartialBuffer
+        { NOMEMALIGN
+
+          public:
+            PartialBuffer (const Header& header, const size_t channels);
+            PartialBuffer (const PartialBuffer&) = delete;
+
+            size_t channels() const { return num_channels; }
+            size_t bytes() const { return num_allocated * brick_size * sizeof(float); }
+            bool empty() const { return !num_allocated; }
+
+            // Voxel must lie within the image; the mappers already guarantee this
+            float* operator() (const Eigen::Vector3i& voxel)
+            {
+              assert (voxel[0] >= 0 && voxel[0] < dims[0]);
+              assert (voxel[1] >= 0 && voxel[1] < dims[1]);
+              assert (voxel[2] >= 0 && voxel[2] < dims[2]);
+              const size_t brick = ((voxel[2] >> brick_shift) * num_bricks[1] + (voxel[1] >> brick_shift)) * num_bricks[0] + (voxel[0] >> brick_shift);
+              const size_t offset = ((voxel[2] & brick_mask) * brick_width + (voxel[1] & brick_mask)) * brick_width + (voxel[0] & brick_mask);
+              if (!bricks[brick])
+                allocate (brick);
+              return bricks[brick].get() + offset * num_channels;
+            }
+
+            // Add the contents of another buffer into this one;
+            //   the other buffer is left empty
+            void merge (PartialBuffer&);
+
+            void clear();
+
+            // Call functor (const Eigen::Vector3i& voxel, const float* data)
+            //   for every voxel with at least one non-zero channel
+            template <class Functor>
+              void for_each (Functor&& functor) const;
+
+          private:
+            static constexpr int brick_shift = 3;
+            static constexpr int brick_width = 1 << brick_shift;
+            static constexpr int brick_mask = brick_width - 1;
+
+            const std::array<ssize_t,3> dims;
+            const std::array<size_t,3> num_bricks;
+            const size_t num_channels, brick_size;
+            vector<std::unique_ptr<float[]>> bricks;
+            size_t num_allocated;
+
+            void allocate (const size_t);
+        };
+
+
+
+        template <class Functor>
+          void PartialBuffer::for_each (Functor&& functor) const
+          {
+            Eigen::Vector3i voxel;
+            size_t brick = 0;
+            for (size_t bz = 0; bz != num_bricks[2]; ++bz) {
+              for (size_t by = 0; by != num_bricks[1]; ++by) {
+                for (size_t bx = 0; bx != num_bricks[0]; ++bx, ++brick) {
+                  if (!bricks[brick])
+                    continue;
+                  const float* data = bricks[brick].get();
+                  for (int z = 0; z != brick_width; ++z) {
+                    voxel[2] = (bz << brick_shift) + z;
+                    for (int y = 0; y != brick_width; ++y) {
+                      voxel[1] = (by << brick_shift) + y;
+                      for (int x = 0; x != brick_width; ++x, data += num_channels) {
+                        voxel[0] = (bx << brick_shift) + x;
+                        if (voxel[0] >= dims[0] || voxel[1] >= dims[1] || voxel[2] >= dims[2])
+                          continue;
+                        for (size_t c = 0; c != num_channels; ++c) {
+                          if (data[c]) {
+                            functor (voxel, data);
+                            break;
+                          }
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+            }
+          }
+
+
+
+
+        // Sum a set of per-thread partial results using a parallel pairwise
+        //   tree reduction: at each level, partials[i] += partials[i+stride]
+        //   is performed concurrently for all valid i; the final result is
+        //   left in partials[0]
+        template <class PartialType, class MergeFunctor>
+          void tree_reduce (vector<PartialType>& partials, MergeFunctor&& merge)
+          {
+            class Worker
+            { NOMEMALIGN
+              public:
+                Worker (vector<PartialType>& partials, MergeFunctor& merge, const size_t stride, std::atomic<size_t>& next) :
+                    partials (partials), merge (merge), stride (stride), next (next) { }
+                void execute () {
+                  size_t i;
+                  while ((i = 2 * stride * next++) + stride < partials.size())
+                    merge (partials[i], partials[i+stride]);
+                }
+              private:
+                vector<PartialType>& partials;
+                MergeFunctor& merge;
+                const size_t stride;
+                std::atomic<size_t>& next;
+            };
+
+            for (size_t stride = 1; stride < partials.size(); stride *= 2) {
+              const size_t num_pairs = (partials.size() + stride - 1) / (2 * stride);
+              std::atomic<size_t> next (0);
+              Worker worker (partials, merge, stride, next);
+              if (num_pairs > 1)
+                Thread::run (Thread::multi (worker, std::min (num_pairs, Thread::threads_to_execute())), "partial buffer reduction");
+              else
+                worker.execute();
+            }
+          }
+
+
+
+      }
+    }
+  }
+}
+
+#endif
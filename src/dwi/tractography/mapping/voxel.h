@@ -19,9 +19,11 @@
 
 
 
-#include <set>
+#include <algorithm>
+#include <numeric>
 
 #include "image.h"
+#include "types.h"
 
 #include "dwi/directions/set.h"
 
@@ -280,43 +282,118 @@ namespace MR {
 
 
 
-        // Set classes that give sensible behaviour to the insert() function depending on the base voxel class
+        // Container classes that give sensible behaviour to the insert() function depending on the base voxel class
+        //
+        // Rather than maintaining a balanced tree (which requires a heap allocation & an O(log(n))
+        //   search for every vertex of every streamline), voxels are appended to a contiguous buffer.
+        //   Since consecutive streamline vertices mostly lie within the same voxel, an insertion
+        //   matching the most recently inserted voxel is merged immediately; any remaining
+        //   duplicates (from streamlines re-visiting a voxel) are merged, and the contents
+        //   sorted, the first time that the contents are accessed. The buffers retain their
+        //   capacity through clear(), so containers that are re-used between streamlines (as
+        //   is the case for those within Thread::Queue batches) cease to allocate memory once
+        //   they have grown to accommodate the longest streamlines encountered.
+        //
+        // Derived classes provide the static function merge(), which combines the
+        //   contribution of one voxel into another that corresponds to the same voxel.
+        //   Where this operation is not associative (e.g. for TOD mapping, where the first
+        //   contribution to a voxel is treated differently to those that follow), ordered_merge
+        //   should be set: once any voxel has been re-visited, insertions are then no longer
+        //   merged immediately, such that every subsequent contribution is merged individually
+        //   into the first instance of that voxel, exactly as a std::set would do.
 
-        class SetVoxel : public std::set<Voxel>, public SetVoxelExtras
+        template <class VoxType, class Derived, bool ordered_merge = false>
+        class VoxelSetBase
         { NOMEMALIGN
           public:
-            using VoxType = Voxel;
-            inline void insert (const Voxel& v)
+            using value_type = VoxType;
+            using iterator = typename vector<VoxType>::iterator;
+            using const_iterator = typename vector<VoxType>::const_iterator;
+
+            VoxelSetBase () : sorted (true) { }
+
+            void clear() { data.clear(); sorted = true; }
+            bool empty() const { return data.empty(); }
+            size_t size() const { finalise(); return data.size(); }
+            void reserve (const size_t n) { data.reserve (n); }
+
+            iterator begin() { finalise(); return data.begin(); }
+            iterator end() { finalise(); return data.end(); }
+            const_iterator begin() const { finalise(); return data.cbegin(); }
+            const_iterator end() const { finalise(); return data.cend(); }
+            const_iterator cbegin() const { return begin(); }
+            const_iterator cend() const { return end(); }
+
+            inline void insert (const VoxType& v)
+            {
+              if (data.size()) {
+                const VoxType& last (data.back());
+                if (!(last < v)) {
+                  if (!(v < last) && (sorted || !ordered_merge)) {
+                    Derived::merge (last, v);
+                    return;
+                  }
+                  sorted = false;
+                }
+              }
+              data.push_back (v);
+            }
+
+          private:
+            mutable vector<VoxType> data;
+            mutable bool sorted;
+
+            void finalise() const
             {
-              iterator existing = std::set<Voxel>::find (v);
-              if (existing == std::set<Voxel>::end())
-                std::set<Voxel>::insert (v);
-              else
-                (*existing) += v.get_length();
+              if (sorted)
+                return;
+              // Sort on voxel, then on order of insertion, such that duplicates
+              //   are merged in the same order in which they were inserted
+              static thread_local vector<uint32_t> order;
+              static thread_local vector<VoxType> merged;
+              order.resize (data.size());
+              std::iota (order.begin(), order.end(), 0);
+              std::sort (order.begin(), order.end(), [&] (const uint32_t a, const uint32_t b) {
+                  return data[a] < data[b] || (!(data[b] < data[a]) && a < b);
+              });
+              merged.clear();
+              for (const auto i : order) {
+                if (merged.size() && !(merged.back() < data[i]))
+                  Derived::merge (merged.back(), data[i]);
+                else
+                  merged.push_back (std::move (data[i]));
+              }
+              std::swap (data, merged);
+              sorted = true;
             }
+        };
+
+
+
+
+
+        class SetVoxel : public VoxelSetBase<Voxel, SetVoxel>, public SetVoxelExtras
+        { NOMEMALIGN
+          public:
+            using VoxType = Voxel;
+            using VoxelSetBase<Voxel, SetVoxel>::insert;
             inline void insert (const Eigen::Vector3i& v, const default_type l)
             {
               const Voxel temp (v, l);
               insert (temp);
             }
+            static void merge (const Voxel& existing, const Voxel& v) { existing += v.get_length(); }
         };
 
 
 
 
 
-        class SetVoxelDEC : public std::set<VoxelDEC>, public SetVoxelExtras
+        class SetVoxelDEC : public VoxelSetBase<VoxelDEC, SetVoxelDEC>, public SetVoxelExtras
         { NOMEMALIGN
           public:
             using VoxType = VoxelDEC;
-            inline void insert (const VoxelDEC& v)
-            {
-              iterator existing = std::set<VoxelDEC>::find (v);
-              if (existing == std::set<VoxelDEC>::end())
-                std::set<VoxelDEC>::insert (v);
-              else
-                existing->add (v.get_colour(), v.get_length());
-            }
+            using VoxelSetBase<VoxelDEC, SetVoxelDEC>::insert;
             inline void insert (const Eigen::Vector3i& v, const Eigen::Vector3d& d)
             {
               const VoxelDEC temp (v, d);
@@ -327,23 +404,17 @@ namespace MR {
               const VoxelDEC temp (v, d, l);
               insert (temp);
             }
+            static void merge (const VoxelDEC& existing, const VoxelDEC& v) { existing.add (v.get_colour(), v.get_length()); }
         };
 
 
 
 
-        class SetVoxelDir : public std::set<VoxelDir>, public SetVoxelExtras
+        class SetVoxelDir : public VoxelSetBase<VoxelDir, SetVoxelDir>, public SetVoxelExtras
         { NOMEMALIGN
           public:
             using VoxType = VoxelDir;
-            inline void insert (const VoxelDir& v)
-            {
-              iterator existing = std::set<VoxelDir>::find (v);
-              if (existing == std::set<VoxelDir>::end())
-                std::set<VoxelDir>::insert (v);
-              else
-                existing->add (v.get_dir(), v.get_length());
-            }
+            using VoxelSetBase<VoxelDir, SetVoxelDir>::insert;
             inline void insert (const Eigen::Vector3i& v, const Eigen::Vector3d& d)
             {
               const VoxelDir temp (v, d);
@@ -354,24 +425,18 @@ namespace MR {
               const VoxelDir temp (v, d, l);
               insert (temp);
             }
+            static void merge (const VoxelDir& existing, const VoxelDir& v) { existing.add (v.get_dir(), v.get_length()); }
         };
 
 
-        class SetDixel : public std::set<Dixel>, public SetVoxelExtras
+        class SetDixel : public VoxelSetBase<Dixel, SetDixel>, public SetVoxelExtras
         { NOMEMALIGN
           public:
 
             using VoxType = Dixel;
             using dir_index_type = Dixel::dir_index_type;
 
-            inline void insert (const Dixel& v)
-            {
-              iterator existing = std::set<Dixel>::find (v);
-              if (existing == std::set<Dixel>::end())
-                std::set<Dixel>::insert (v);
-              else
-                (*existing) += v.get_length();
-            }
+            using VoxelSetBase<Dixel, SetDixel>::insert;
             inline void insert (const Eigen::Vector3i& v, const dir_index_type d)
             {
               const Dixel temp (v, d);
@@ -382,27 +447,21 @@ namespace MR {
               const Dixel temp (v, d, l);
               insert (temp);
             }
+            static void merge (const Dixel& existing, const Dixel& v) { existing += v.get_length(); }
         };
 
 
 
 
 
-        class SetVoxelTOD : public std::set<VoxelTOD>, public SetVoxelExtras
+        class SetVoxelTOD : public VoxelSetBase<VoxelTOD, SetVoxelTOD, true>, public SetVoxelExtras
         { NOMEMALIGN
           public:
 
             using VoxType = VoxelTOD;
             using vector_type = VoxelTOD::vector_type;
 
-            inline void insert (const VoxelTOD& v)
-            {
-              iterator existing = std::set<VoxelTOD>::find (v);
-              if (existing == std::set<VoxelTOD>::end())
-                std::set<VoxelTOD>::insert (v);
-              else
-                (*existing) += v.get_tod();
-            }
+            using VoxelSetBase<VoxelTOD, SetVoxelTOD, true>::insert;
             inline void insert (const Eigen::Vector3i& v, const vector_type& t)
             {
               const VoxelTOD temp (v, t);
@@ -413,6 +472,7 @@ namespace MR {
               const VoxelTOD temp (v, t, l);
               insert (temp);
             }
+            static void merge (const VoxelTOD& existing, const VoxelTOD& v) { existing += v.get_tod(); }
         };
 
 
@@ -24,6 +24,7 @@
 #include "algo/loop.h"
 #include "thread_queue.h"
 
+#include "dwi/tractography/mapping/partial_buffer.h"
 #include "dwi/tractography/mapping/twi_stats.h"
 #include "dwi/tractography/mapping/voxel.h"
 #include "dwi/tractography/mapping/gaussian/voxel.h"
@@ -45,6 +46,21 @@ namespace MR {
 
 
 
+        // These acquire the TWI factor at any point along the streamline;
+        //   For the standard SetVoxel classes, this is a single value 'factor' for the set as
+        //     stored in SetVoxelExtras
+        //   For the Gaussian SetVoxel classes, there is a factor per mapped element
+        inline default_type get_factor (const Voxel&    element, const SetVoxel&    set) { return set.factor; }
+        inline default_type get_factor (const VoxelDEC& element, const SetVoxelDEC& set) { return set.factor; }
+        inline default_type get_factor (const Dixel&    element, const SetDixel&    set) { return set.factor; }
+        inline default_type get_factor (const VoxelTOD& element, const SetVoxelTOD& set) { return set.factor; }
+        inline default_type get_factor (const Gaussian::Voxel&    element, const Gaussian::SetVoxel&    set) { return element.get_factor(); }
+        inline default_type get_factor (const Gaussian::VoxelDEC& element, const Gaussian::SetVoxelDEC& set) { return element.get_factor(); }
+        inline default_type get_factor (const Gaussian::Dixel&    element, const Gaussian::SetDixel&    set) { return element.get_factor(); }
+        inline default_type get_factor (const Gaussian::VoxelTOD& element, const Gaussian::SetVoxelTOD& set) { return element.get_factor(); }
+
+
+
         class MapWriterBase
         { MEMALIGN(MapWriterBase)
 
@@ -78,6 +94,10 @@ namespace MR {
             virtual bool operator() (const Gaussian::SetDixel&)    { return false; }
             virtual bool operator() (const Gaussian::SetVoxelTOD&) { return false; }
 
+            // Add the summed contributions accumulated in a per-thread partial buffer;
+            //   only meaningful for the V_SUM voxel statistic
+            virtual void add (const PartialBuffer&) { throw Exception ("Partial buffer accumulation not supported by this writer"); }
+
 
           protected:
             const Header& H;
@@ -247,6 +267,8 @@ namespace MR {
           bool operator() (const Gaussian::SetDixel& in)    override { receive_dixel     (in); return true; }
           bool operator() (const Gaussian::SetVoxelTOD& in) override { receive_tod       (in); return true; }
 
+          void add (const PartialBuffer&) override;
+
 
           private:
           Image<value_type> buffer;
@@ -262,20 +284,6 @@ namespace MR {
           //   regarding using multiplication in a boolean context
           inline void add (const default_type, const default_type);
 
-          // These acquire the TWI factor at any point along the streamline;
-          //   For the standard SetVoxel classes, this is a single value 'factor' for the set as
-          //     stored in SetVoxelExtras
-          //   For the Gaussian SetVoxel classes, there is a factor per mapped element
-          default_type get_factor (const Voxel&    element, const SetVoxel&    set) const { return set.factor; }
-          default_type get_factor (const VoxelDEC& element, const SetVoxelDEC& set) const { return set.factor; }
-          default_type get_factor (const Dixel&    element, const SetDixel&    set) const { return set.factor; }
-          default_type get_factor (const VoxelTOD& element, const SetVoxelTOD& set) const { return set.factor; }
-          default_type get_factor (const Gaussian::Voxel&    element, const Gaussian::SetVoxel&    set) const { return element.get_factor(); }
-          default_type get_factor (const Gaussian::VoxelDEC& element, const Gaussian::SetVoxelDEC& set) const { return element.get_factor(); }
-          default_type get_factor (const Gaussian::Dixel&    element, const Gaussian::SetDixel&    set) const { return element.get_factor(); }
-          default_type get_factor (const Gaussian::VoxelTOD& element, const Gaussian::SetVoxelTOD& set) const { return element.get_factor(); }
-
-
           // Convenience functions for Directionally-Encoded Colour processing
           Eigen::Vector3d get_dec ();
           void           set_dec (const Eigen::Vector3d&);
@@ -440,6 +448,56 @@ namespace MR {
 
 
 
+        template <typename value_type>
+          void MapWriter<value_type>::add (const PartialBuffer& partial)
+          {
+            assert (voxel_statistic == V_SUM);
+            switch (type) {
+              case GREYSCALE:
+                partial.for_each ([&] (const Eigen::Vector3i& voxel, const float* data) {
+                  assign_pos_of (voxel).to (buffer);
+                  add (data[0], 1.0);
+                });
+                break;
+              case DEC:
+                assert (counts && partial.channels() == 4);
+                partial.for_each ([&] (const Eigen::Vector3i& voxel, const float* data) {
+                  assign_pos_of (voxel).to (buffer, *counts);
+                  set_dec (get_dec() + Eigen::Vector3d (data[0], data[1], data[2]));
+                  counts->value() += data[3];
+                });
+                break;
+              case DIXEL:
+                assert (partial.channels() == size_t(buffer.size(3)));
+                partial.for_each ([&] (const Eigen::Vector3i& voxel, const float* data) {
+                  assign_pos_of (voxel).to (buffer);
+                  for (size_t dir = 0; dir != partial.channels(); ++dir) {
+                    if (data[dir]) {
+                      buffer.index(3) = dir;
+                      add (data[dir], 1.0);
+                    }
+                  }
+                });
+                break;
+              case TOD: {
+                assert (partial.channels() == size_t(buffer.size(3)));
+                VoxelTOD::vector_type sh_coefs;
+                partial.for_each ([&] (const Eigen::Vector3i& voxel, const float* data) {
+                  assign_pos_of (voxel).to (buffer);
+                  get_tod (sh_coefs);
+                  for (ssize_t index = 0; index != sh_coefs.size(); ++index)
+                    sh_coefs[index] += data[index];
+                  set_tod (sh_coefs);
+                });
+                } break;
+              default:
+                throw Exception ("Unknown / unhandled writer dimensionality in MapWriter::add()");
+            }
+          }
+
+
+
+
         template <>
         inline void MapWriter<bool>::add (const default_type weight, const default_type factor)
         {
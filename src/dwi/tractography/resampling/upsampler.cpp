@@ -38,12 +38,13 @@ namespace MR {
           out.weight = in.weight;
           if (in.empty())
             return true;
-          Streamline<> in_padded (in);
+          static thread_local Streamline<> in_padded;
+          in_padded = in;
           interp_prepare (in_padded);
           for (size_t i = 3; i < in_padded.size(); ++i) {
             out.push_back (in_padded[i-2]);
             increment (in_padded[i]);
-            temp = M * data;
+            temp.noalias() = M * data;
             for (ssize_t row = 0; row != temp.rows(); ++row)
               out.push_back (Eigen::Vector3f (temp.row (row)));
           }
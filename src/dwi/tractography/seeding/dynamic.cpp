@@ -72,6 +72,8 @@ namespace MR
           track_count (0),
           attempts (0),
           seeds (0),
+          mapped_count (0),
+          checkpoint_requested (false),
 #ifdef DYNAMIC_SEED_DEBUGGING
           seed_output ("seeds.tck", Tractography::Properties()),
           test_fixel (0),
@@ -269,6 +271,76 @@ namespace MR
 
 
 
+      void Dynamic::write_state (std::ostream& out)
+      {
+        const uint64_t counts[3] = { track_count.load(), attempts.load(), seeds.load() };
+        out.write (reinterpret_cast<const char*> (counts), sizeof (counts));
+        out.write (reinterpret_cast<const char*> (&TD_sum), sizeof (TD_sum));
+        for (auto& fixel : fixels) {
+          const double TD = fixel.get_TD();
+          float probs[2];
+          size_t track_count_at_last_update, seed_count;
+          fixel.get_state (probs[0], probs[1], track_count_at_last_update, seed_count);
+          const uint64_t fixel_counts[2] = { track_count_at_last_update, seed_count };
+          out.write (reinterpret_cast<const char*> (&TD), sizeof (TD));
+          out.write (reinterpret_cast<const char*> (probs), sizeof (probs));
+          out.write (reinterpret_cast<const char*> (fixel_counts), sizeof (fixel_counts));
+        }
+      }
+
+
+
+      void Dynamic::read_state (std::istream& in)
+      {
+        uint64_t counts[3];
+        in.read (reinterpret_cast<char*> (counts), sizeof (counts));
+        in.read (reinterpret_cast<char*> (&TD_sum), sizeof (TD_sum));
+        track_count = counts[0];
+        attempts = counts[1];
+        seeds = counts[2];
+        for (auto& fixel : fixels) {
+          double TD;
+          float probs[2];
+          uint64_t fixel_counts[2];
+          in.read (reinterpret_cast<char*> (&TD), sizeof (TD));
+          in.read (reinterpret_cast<char*> (probs), sizeof (probs));
+          in.read (reinterpret_cast<char*> (fixel_counts), sizeof (fixel_counts));
+          fixel.set_state (TD, probs[0], probs[1], fixel_counts[0], fixel_counts[1]);
+        }
+        if (!in.good())
+          throw Exception ("error reading dynamic seeding state: " + std::string (strerror (errno)));
+      }
+
+
+
+      vector<size_t> Dynamic::get_unmapped (const size_t count) const
+      {
+        vector<size_t> result;
+        for (size_t index = mapped_count; index < count; ++index) {
+          if (!mapped_ahead.count (index))
+            result.push_back (index);
+        }
+        return result;
+      }
+
+
+
+      void Dynamic::add_mapped (const size_t index)
+      {
+        if (index != mapped_count) {
+          mapped_ahead.insert (index);
+          return;
+        }
+        ++mapped_count;
+        while (mapped_ahead.size() && *mapped_ahead.begin() == mapped_count) {
+          mapped_ahead.erase (mapped_ahead.begin());
+          ++mapped_count;
+        }
+      }
+
+
+
+
 #ifdef DYNAMIC_SEED_DEBUGGING
       void Dynamic::write_seed (const Eigen::Vector3f& p)
       {
@@ -367,7 +439,10 @@ namespace MR
 
         bool WriteKernelDynamic::operator() (const Tracking::GeneratedTrack& in, Tractography::Streamline<>& out)
         {
-          out.set_index (writer.count);
+          // Prevents the seeding model thread from writing a checkpoint while the
+          //   output file & counts are being modified
+          std::lock_guard<std::mutex> lock (checkpoint_mutex);
+          const size_t index = writer.count;
           out.weight = 1.0f;
           if (!WriteKernel::operator() (in)) {
             out.clear();
@@ -377,6 +452,8 @@ namespace MR
             return true;
           }
           out = in;
+          // Index is needed to track which streamlines have been mapped into the seeding model
+          out.set_index (index);
           return out.size(); // New pipe functor interpretation: Don't bother sending empty tracks
         }
 
@@ -20,6 +20,8 @@
 #include <fstream>
 #include <queue>
 #include <atomic>
+#include <functional>
+#include <set>
 
 #include "transform.h"
 #include "thread_queue.h"
@@ -164,6 +166,29 @@ namespace MR
           float get_old_prob()   const { return old_prob; }
           float get_prob()       const { return applied_prob; }
           size_t get_seed_count() const { return seed_count; }
+          size_t get_track_count_at_last_update() const { return track_count_at_last_update; }
+
+          // Used when writing a checkpoint; acquires the same lock as get_cumulative_prob()
+          //   so that a consistent set of values is obtained
+          void get_state (float& old, float& applied, size_t& track_count, size_t& seeds)
+          {
+            while (updating.test_and_set (std::memory_order_acquire));
+            old = old_prob;
+            applied = applied_prob;
+            track_count = track_count_at_last_update;
+            seeds = seed_count;
+            updating.clear (std::memory_order_release);
+          }
+
+          // Used when resuming from a checkpoint
+          void set_state (const double td, const float old, const float applied, const size_t track_count, const size_t seeds)
+          {
+            TD.store (td, std::memory_order_relaxed);
+            old_prob = old;
+            applied_prob = applied;
+            track_count_at_last_update = track_count;
+            seed_count = seeds;
+          }
 
 
 
@@ -228,6 +253,23 @@ namespace MR
         //   includes the voxel location for easier determination of seed location
         bool operator() (const FMLS::FOD_lobes&) override;
 
+        // Store / restore the state of the seeding model, for tckgen checkpointing;
+        //   write_state() must only be called from within the thread updating the model
+        //   (i.e. from the function provided to set_checkpoint_func())
+        size_t num_fixels() const { return fixels.size(); }
+        void write_state (std::ostream&);
+        void read_state (std::istream&);
+
+        // Since the streamlines are mapped by multiple threads, the model does not
+        //   necessarily include all streamlines written to file thus far
+        vector<size_t> get_unmapped (const size_t count) const;
+        void reset_mapped (const size_t count) { mapped_count = count; mapped_ahead.clear(); }
+
+        // The checkpoint is written by the thread updating the model, the next
+        //   time that it receives a streamline after a checkpoint is requested
+        void set_checkpoint_func (std::function<void()> func) { checkpoint_func = func; }
+        void request_checkpoint() { checkpoint_requested.store (true, std::memory_order_relaxed); }
+
         bool operator() (const Mapping::SetDixel& i) override
         {
           if (!i.weight) // Flags that tracking should terminate
@@ -244,7 +286,11 @@ namespace MR
               return false;
 #endif
           }
-          return SIFT::ModelBase<Fixel_TD_seed>::operator() (i);
+          SIFT::ModelBase<Fixel_TD_seed>::operator() (i);
+          add_mapped (i.index);
+          if (checkpoint_requested.exchange (false, std::memory_order_relaxed))
+            checkpoint_func();
+          return true;
         }
 
 
@@ -262,6 +308,14 @@ namespace MR
         // Want to know statistics on dynamic seeding sampling
         std::atomic<uint64_t> attempts, seeds;
 
+        // Used for checkpointing: all streamlines with index less than mapped_count
+        //   have been mapped, as have those in mapped_ahead
+        size_t mapped_count;
+        std::set<size_t> mapped_ahead;
+        std::function<void()> checkpoint_func;
+        std::atomic<bool> checkpoint_requested;
+        void add_mapped (const size_t index);
+
 
 #ifdef DYNAMIC_SEED_DEBUGGING
         Tractography::Writer<float> seed_output;
@@ -285,8 +339,11 @@ namespace MR
       class WriteKernelDynamic : public Tracking::WriteKernel
         { MEMALIGN(WriteKernelDynamic)
           public:
-            WriteKernelDynamic (const Tracking::SharedBase& shared, const std::string& output_file, const Properties& properties) :
-              Tracking::WriteKernel (shared, output_file, properties) { }
+            WriteKernelDynamic (const Tracking::SharedBase& shared, const std::string& output_file, const Properties& properties, Dynamic& seeder, const Mapping::TrackMapperBase& mapper) :
+              Tracking::WriteKernel (shared, output_file, properties)
+            {
+              set_dynamic_seeder (seeder, mapper);
+            }
           WriteKernelDynamic (const WriteKernelDynamic&) = delete;
           WriteKernelDynamic& operator= (const WriteKernelDynamic&) = delete;
           bool operator() (const Tracking::GeneratedTrack&, Streamline<>&);
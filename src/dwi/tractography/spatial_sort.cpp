@@ -0,0 +1,128 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "dwi/tractography/spatial_sort.h"
+
+#include <algorithm>
+#include <numeric>
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+
+
+
+      const char* spatial_sort_curves[] = { "morton", "hilbert", nullptr };
+
+
+
+      namespace {
+
+        // Interleave the bits of the three axes, most significant first
+        inline uint64_t interleave (const std::array<uint32_t, 3>& X)
+        {
+          uint64_t key = 0;
+          for (ssize_t b = SpatialSort::bits - 1; b >= 0; --b) {
+            for (size_t axis = 0; axis != 3; ++axis)
+              key = (key << 1) | ((X[axis] >> b) & 1);
+          }
+          return key;
+        }
+
+      }
+
+
+
+      uint64_t SpatialSort::morton_key (const std::array<uint32_t, 3>& X)
+      {
+        return interleave (X);
+      }
+
+
+
+      // Conversion of axis coordinates to the "transposed" Hilbert index, from:
+      //   Skilling J. Programming the Hilbert curve. AIP Conference Proceedings 2004; 707:381-387
+      uint64_t SpatialSort::hilbert_key (const std::array<uint32_t, 3>& in)
+      {
+        std::array<uint32_t, 3> X (in);
+        const uint32_t M = uint32_t(1) << (bits - 1);
+        // Inverse undo
+        for (uint32_t Q = M; Q > 1; Q >>= 1) {
+          const uint32_t P = Q - 1;
+          for (size_t i = 0; i != 3; ++i) {
+            if (X[i] & Q) {
+              X[0] ^= P;
+            } else {
+              const uint32_t t = (X[0] ^ X[i]) & P;
+              X[0] ^= t;
+              X[i] ^= t;
+            }
+          }
+        }
+        // Gray encode
+        for (size_t i = 1; i != 3; ++i)
+          X[i] ^= X[i-1];
+        uint32_t t = 0;
+        for (uint32_t Q = M; Q > 1; Q >>= 1) {
+          if (X[2] & Q)
+            t ^= Q - 1;
+        }
+        for (size_t i = 0; i != 3; ++i)
+          X[i] ^= t;
+        return interleave (X);
+      }
+
+
+
+      vector<size_t> SpatialSort::order() const
+      {
+        vector<size_t> result (positions.size());
+        std::iota (result.begin(), result.end(), 0);
+        if (positions.size() < 2)
+          return result;
+
+        Eigen::Vector3f lower (positions.front()), upper (lower);
+        for (const auto& p : positions) {
+          lower = lower.cwiseMin (p);
+          upper = upper.cwiseMax (p);
+        }
+        const float max_extent = (upper - lower).maxCoeff();
+        const uint32_t max_cell = (uint32_t(1) << bits) - 1;
+        const float multiplier = max_extent > 0.0f ? float(max_cell) / max_extent : 0.0f;
+
+        vector<uint64_t> keys (positions.size());
+        for (size_t i = 0; i != positions.size(); ++i) {
+          std::array<uint32_t, 3> cell;
+          for (size_t axis = 0; axis != 3; ++axis)
+            cell[axis] = std::min (max_cell, uint32_t (std::round (multiplier * (positions[i][axis] - lower[axis]))));
+          keys[i] = curve == curve_t::HILBERT ? hilbert_key (cell) : morton_key (cell);
+        }
+
+        // Stable sort, such that streamlines within the same cell retain their original order
+        std::stable_sort (result.begin(), result.end(), [&] (const size_t a, const size_t b) { return keys[a] < keys[b]; });
+        return result;
+      }
+
+
+
+    }
+  }
+}
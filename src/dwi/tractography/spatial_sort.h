@@ -0,0 +1,92 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __dwi_tractography_spatial_sort_h__
+#define __dwi_tractography_spatial_sort_h__
+
+#include <array>
+
+#include "types.h"
+
+#include "dwi/tractography/streamline.h"
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+
+
+
+      extern const char* spatial_sort_curves[];
+
+
+
+      //! Determine an ordering of streamlines along a space-filling curve
+      /*! Each streamline is represented by the centre of its bounding box;
+       * these positions are quantised onto a regular grid spanning all
+       * streamlines, and the streamlines sorted according to the position of
+       * their grid cell along either a Morton (Z-order) or Hilbert curve.
+       * Streamlines that are adjacent in the resulting order therefore tend to
+       * traverse the same region of space, which improves cache utilisation of
+       * any per-voxel or per-fixel data accessed during subsequent mapping.
+       * Of the two, the Hilbert curve provides better locality, as it contains
+       * no long-range jumps between consecutive cells. */
+      class SpatialSort
+      { MEMALIGN(SpatialSort)
+        public:
+          enum class curve_t { MORTON, HILBERT };
+
+          //! number of bits of precision per spatial axis
+          static constexpr size_t bits = 21;
+
+          SpatialSort (const curve_t curve) : curve (curve) { }
+
+          template <typename ValueType>
+          void add (const Streamline<ValueType>& tck)
+          {
+            assert (tck.size());
+            Eigen::Vector3f lower (tck.front().template cast<float>()), upper (lower);
+            for (const auto& p : tck) {
+              lower = lower.cwiseMin (p.template cast<float>());
+              upper = upper.cwiseMax (p.template cast<float>());
+            }
+            positions.push_back (0.5f * (lower + upper));
+          }
+
+          size_t size() const { return positions.size(); }
+
+          //! the order in which the streamlines provided via add() should be written
+          vector<size_t> order() const;
+
+          static uint64_t morton_key  (const std::array<uint32_t, 3>&);
+          static uint64_t hilbert_key (const std::array<uint32_t, 3>&);
+
+        private:
+          const curve_t curve;
+          vector<Eigen::Vector3f> positions;
+      };
+
+
+
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,238 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "dwi/tractography/tracking/checkpoint.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include "file/key_value.h"
+#include "file/ofstream.h"
+#include "math/rng.h"
+#include "dwi/tractography/file.h"
+#include "dwi/tractography/mapping/mapper.h"
+#include "dwi/tractography/seeding/dynamic.h"
+
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace Tracking
+      {
+
+
+
+        namespace {
+
+          constexpr const char* checkpoint_first_line = "mrtrix tckgen checkpoint";
+
+          default_type get_interval (const Properties& properties)
+          {
+            const auto p = properties.find ("checkpoint_interval");
+            return p == properties.end() ? 0.0 : to<default_type> (p->second);
+          }
+
+          template <typename T, size_t N>
+          std::string join (const std::array<T, N>& data)
+          {
+            std::string result;
+            for (size_t i = 0; i != N; ++i)
+              result += (i ? "," : "") + str(data[i]);
+            return result;
+          }
+
+          template <typename T>
+          std::string join (const vector<T>& data)
+          {
+            std::string result;
+            for (size_t i = 0; i != data.size(); ++i)
+              result += (i ? "," : "") + str(data[i]);
+            return result;
+          }
+
+          template <typename T, size_t N>
+          void split (const std::string& key, const std::string& value, std::array<T, N>& data)
+          {
+            const auto values = parse_ints<uint64_t> (value);
+            if (values.size() != N)
+              throw Exception ("malformed entry \"" + key + "\" in tckgen checkpoint file");
+            for (size_t i = 0; i != N; ++i)
+              data[i] = values[i];
+          }
+
+        }
+
+
+
+        Checkpoint::State::State () :
+            seeds (0),
+            streamlines (0),
+            selected (0),
+            seed_output_offset (-1),
+            rng_seed (0)
+        {
+          terminations.fill (0);
+          rejections.fill (0);
+        }
+
+
+
+        Checkpoint::Checkpoint (const Properties& properties, const std::string& output_path) :
+            output_path (output_path),
+            timer (get_interval (properties)),
+            resumed_num_fixels (0),
+            resumed_data_offset (0)
+        {
+          auto p = properties.find ("checkpoint");
+          if (p != properties.end())
+            path = p->second;
+          p = properties.find ("resume");
+          if (p != properties.end()) {
+            resume_path = p->second;
+            load();
+          }
+        }
+
+
+
+        void Checkpoint::load ()
+        {
+          File::KeyValue::Reader kv (resume_path, checkpoint_first_line);
+          std::string output;
+          while (kv.next()) {
+            const std::string key = kv.key();
+            const std::string value = kv.value();
+            if (key == "output")                  output = value;
+            else if (key == "count")              resumed.tracks.count = to<uint64_t> (value);
+            else if (key == "total_count")        resumed.tracks.total_count = to<uint64_t> (value);
+            else if (key == "count_offset")       resumed.tracks.count_offset = to<int64_t> (value);
+            else if (key == "barrier_offset")     resumed.tracks.barrier_offset = to<int64_t> (value);
+            else if (key == "seeds")              resumed.seeds = to<size_t> (value);
+            else if (key == "streamlines")        resumed.streamlines = to<size_t> (value);
+            else if (key == "selected")           resumed.selected = to<size_t> (value);
+            else if (key == "seed_output_offset") resumed.seed_output_offset = to<int64_t> (value);
+            else if (key == "terminations")       split (key, value, resumed.terminations);
+            else if (key == "rejections")         split (key, value, resumed.rejections);
+            else if (key == "rng_seed")           resumed.rng_seed = to<std::mt19937::result_type> (value);
+            else if (key == "dynamic_fixels")     resumed_num_fixels = to<size_t> (value);
+            else if (key == "unmapped")           resumed.unmapped = parse_ints<size_t> (value);
+            else
+              WARN ("unknown entry \"" + key + "\" in tckgen checkpoint file \"" + resume_path + "\" - ignored");
+          }
+          kv.close();
+
+          if (output != output_path)
+            throw Exception ("tckgen checkpoint file \"" + resume_path + "\" was written for output \"" + output + "\", not \"" + output_path + "\"");
+          if (!resumed.tracks.valid())
+            throw Exception ("tckgen checkpoint file \"" + resume_path + "\" does not specify the state of the output track file");
+
+          // Any dynamic seeding model data immediately follow the END line
+          if (resumed_num_fixels) {
+            std::ifstream in (resume_path, std::ios::in | std::ios::binary);
+            std::string line;
+            while (std::getline (in, line) && line != "END");
+            if (!in.good())
+              throw Exception ("error reading tckgen checkpoint file \"" + resume_path + "\"");
+            resumed_data_offset = in.tellg();
+          }
+
+          Math::RNG::set_next_seed (resumed.rng_seed);
+          INFO ("resuming tracking from checkpoint \"" + resume_path + "\": " + str(resumed.seeds) + " seeds, " + str(resumed.selected) + " streamlines selected");
+        }
+
+
+
+        void Checkpoint::restore (Seeding::Dynamic& seeder, const Mapping::TrackMapperBase& mapper) const
+        {
+          if (!resuming())
+            return;
+          if (resumed_num_fixels != seeder.num_fixels())
+            throw Exception ("dynamic seeding model in tckgen checkpoint file \"" + resume_path + "\" does not match that of the current invocation");
+          {
+            std::ifstream in (resume_path, std::ios::in | std::ios::binary);
+            in.seekg (resumed_data_offset);
+            seeder.read_state (in);
+          }
+          if (resumed.unmapped.size()) {
+            Properties properties;
+            Reader<float> reader (output_path, properties);
+            Streamline<float> tck;
+            Mapping::SetDixel dixels;
+            auto next = resumed.unmapped.begin();
+            while (next != resumed.unmapped.end() && reader (tck)) {
+              if (tck.get_index() == *next) {
+                tck.weight = 1.0f;
+                mapper (tck, dixels);
+                seeder (dixels);
+                ++next;
+              }
+            }
+            if (next != resumed.unmapped.end())
+              throw Exception ("unable to map all streamlines recorded in tckgen checkpoint file \"" + resume_path + "\": output track file is shorter than expected");
+            DEBUG (str(resumed.unmapped.size()) + " streamlines from track file \"" + output_path + "\" mapped into dynamic seeding model");
+          }
+          seeder.reset_mapped (resumed.tracks.count);
+        }
+
+
+
+        void Checkpoint::save (const State& state, Seeding::Dynamic* seeder) const
+        {
+          // Write to a temporary file first, so that an interruption during
+          //   writing does not corrupt the previous checkpoint
+          const std::string temp_path = path + ".tmp";
+          {
+            File::OFStream out (temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+            out << checkpoint_first_line << "\n";
+            out << "output: " << output_path << "\n";
+            out << "count: " << state.tracks.count << "\n";
+            out << "total_count: " << state.tracks.total_count << "\n";
+            out << "count_offset: " << state.tracks.count_offset << "\n";
+            out << "barrier_offset: " << state.tracks.barrier_offset << "\n";
+            out << "seeds: " << state.seeds << "\n";
+            out << "streamlines: " << state.streamlines << "\n";
+            out << "selected: " << state.selected << "\n";
+            if (state.seed_output_offset >= 0)
+              out << "seed_output_offset: " << state.seed_output_offset << "\n";
+            out << "terminations: " << join (state.terminations) << "\n";
+            out << "rejections: " << join (state.rejections) << "\n";
+            out << "rng_seed: " << state.rng_seed << "\n";
+            if (state.unmapped.size())
+              out << "unmapped: " << join (state.unmapped) << "\n";
+            if (seeder)
+              out << "dynamic_fixels: " << seeder->num_fixels() << "\n";
+            out << "END\n";
+            if (seeder)
+              seeder->write_state (out);
+            if (!out.good())
+              throw Exception ("error writing tckgen checkpoint file \"" + temp_path + "\": " + strerror (errno));
+          }
+          if (std::rename (temp_path.c_str(), path.c_str()))
+            throw Exception ("error writing tckgen checkpoint file \"" + path + "\": " + strerror (errno));
+          DEBUG ("tckgen checkpoint written: " + str(state.seeds) + " seeds, " + str(state.selected) + " streamlines selected");
+        }
+
+
+
+      }
+    }
+  }
+}
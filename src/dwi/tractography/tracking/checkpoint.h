@@ -0,0 +1,121 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __dwi_tractography_tracking_checkpoint_h__
+#define __dwi_tractography_tracking_checkpoint_h__
+
+#include <array>
+#include <random>
+
+#include "memory.h"
+#include "timer.h"
+#include "types.h"
+#include "dwi/tractography/file_base.h"
+#include "dwi/tractography/properties.h"
+#include "dwi/tractography/tracking/types.h"
+
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+
+      namespace Mapping { class TrackMapperBase; }
+      namespace Seeding { class Dynamic; }
+
+      namespace Tracking
+      {
+
+
+
+        //! Periodic checkpointing of streamlines tractography
+        /*! At intervals of (at least) the requested duration, the output track
+         * file is flushed, and the information necessary to continue tracking
+         * from that point is written to the checkpoint file: the state of the
+         * track file, the seed / streamline / selection counts, the
+         * termination & rejection counts, the next RNG seed, and (if
+         * applicable) the dynamic seeding model, along with the indices of
+         * any streamlines already written to file but not yet mapped into
+         * that model (these are re-mapped on resume). tckgen -resume then
+         * continues from the most recent checkpoint, discarding any
+         * streamlines written after it.
+         *
+         * Since the order in which streamlines are generated by multiple
+         * threads is not deterministic, the RNG states are not reproduced
+         * exactly; instead, the resumed process draws RNG seeds that were not
+         * used prior to the checkpoint, such that the result is statistically
+         * equivalent to that of an uninterrupted run. */
+        class Checkpoint { MEMALIGN(Checkpoint)
+
+          public:
+
+            class State { MEMALIGN(State)
+              public:
+                State ();
+                WriterState tracks;
+                size_t seeds, streamlines, selected;
+                int64_t seed_output_offset;
+                std::array<size_t, TERMINATION_REASON_COUNT> terminations;
+                std::array<size_t, REJECTION_REASON_COUNT> rejections;
+                std::mt19937::result_type rng_seed;
+                vector<size_t> unmapped;
+            };
+
+
+            Checkpoint (const Properties& properties, const std::string& output_path);
+
+            //! whether checkpoints are to be written
+            bool enabled () const { return path.size(); }
+            //! whether tracking is being resumed from a prior checkpoint
+            bool resuming () const { return resume_path.size(); }
+
+            //! the state at the time of the checkpoint from which tracking is being resumed
+            const State& resume_state () const { return resumed; }
+            //! restore the dynamic seeding model from the checkpoint
+            /*! Any streamlines that had been written to the output file but not
+             * yet mapped into the model are read from the file and mapped. */
+            void restore (Seeding::Dynamic&, const Mapping::TrackMapperBase&) const;
+
+            //! whether it is time to write the next checkpoint
+            bool due () { return enabled() && bool(timer); }
+            void save (const State&, Seeding::Dynamic*) const;
+
+
+          private:
+            const std::string output_path;
+            std::string path, resume_path;
+            IntervalTimer timer;
+            State resumed;
+            size_t resumed_num_fixels;
+            int64_t resumed_data_offset;
+
+            void load ();
+
+        };
+
+
+
+      }
+    }
+  }
+}
+
+#endif
+
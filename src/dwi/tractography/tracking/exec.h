@@ -52,6 +52,10 @@ namespace MR
       {
 
 
+        template <class Method> class ExecPacket;
+
+
+
         // TODO Try having ACT as a template boolean; allow compiler to optimise out branch statements
 
         template <class Method> class Exec { MEMALIGN(Exec<Method>)
@@ -88,13 +92,13 @@ namespace MR
 
                 typename Method::Shared shared (diff_path, properties);
 
-                Writer       writer  (shared, destination, properties);
-                Exec<Method> tracker (shared);
-
                 TckMapper mapper (fod_data, dirs);
                 mapper.set_upsample_ratio (Mapping::determine_upsample_ratio (fod_data, properties, 0.25));
                 mapper.set_use_precise_mapping (true);
 
+                Writer       writer  (shared, destination, properties, *seeder, mapper);
+                Exec<Method> tracker (shared);
+
                 Thread::run_queue (
                     Thread::multi (tracker),
                     Thread::batch (GeneratedTrack(), TRACKING_BATCH_SIZE),
@@ -132,15 +136,7 @@ namespace MR
                 return true;
               }
               gen_track (item);
-              if (track_rejected (item)) {
-                item.clear();
-                item.set_status (GeneratedTrack::status_t::TRACK_REJECTED);
-              } else if (S.downsampler.get_ratio() > 1 || (S.is_act() && S.act().crop_at_gmwmi())) {
-                S.downsampler (item);
-                check_downsampled_length (item);
-              } else {
-                item.set_status (GeneratedTrack::status_t::ACCEPTED);
-              }
+              finalise_track (item);
               return true;
             }
 
@@ -155,8 +151,14 @@ namespace MR
 
             term_t iterate ()
             {
-              const term_t method_term = (S.rk4 ? next_rk4() : method.next());
+              return check_step (S.rk4 ? next_rk4() : method.next());
+            }
+
 
+
+            // Apply the structural, ROI & stopping criteria following a single step of the method
+            term_t check_step (const term_t method_term)
+            {
               if (method_term)
                 return (S.is_act() && method.act().sgm_depth) ? TERM_IN_SGM : method_term;
 
@@ -298,6 +300,13 @@ namespace MR
 
               }
 
+              terminate_unidir (tck, termination);
+            }
+
+
+
+            void terminate_unidir (GeneratedTrack& tck, term_t termination)
+            {
               apply_priors (termination);
 
               if (termination == EXIT_SGM) {
@@ -385,6 +394,21 @@ namespace MR
 
 
 
+            void finalise_track (GeneratedTrack& tck)
+            {
+              if (track_rejected (tck)) {
+                tck.clear();
+                tck.set_status (GeneratedTrack::status_t::TRACK_REJECTED);
+              } else if (S.downsampler.get_ratio() > 1 || (S.is_act() && S.act().crop_at_gmwmi())) {
+                S.downsampler (tck);
+                check_downsampled_length (tck);
+              } else {
+                tck.set_status (GeneratedTrack::status_t::ACCEPTED);
+              }
+            }
+
+
+
             bool track_rejected (const GeneratedTrack& tck)
             {
 
@@ -579,6 +603,7 @@ namespace MR
             }
 
 
+            friend class ExecPacket<Method>;
 
         };
 
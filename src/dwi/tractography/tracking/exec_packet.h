@@ -0,0 +1,224 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __dwi_tractography_tracking_exec_packet_h__
+#define __dwi_tractography_tracking_exec_packet_h__
+
+
+#include "thread.h"
+#include "thread_queue.h"
+#include "dwi/tractography/tracking/exec.h"
+#include "dwi/tractography/tracking/generated_track.h"
+#include "dwi/tractography/tracking/packet.h"
+#include "dwi/tractography/tracking/shared.h"
+#include "dwi/tractography/tracking/write_kernel.h"
+
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace Tracking
+      {
+
+
+
+        //! Generate packets of streamlines in lockstep
+        /*! Each thread propagates packet_size streamlines simultaneously: at
+         * each iteration, a single step is performed for all streamlines in
+         * the packet that have not yet terminated, such that the
+         * transformation to voxel space and the interpolation weights can be
+         * computed for the whole packet at once (see PacketInterp); the
+         * diffusion model is then evaluated for each lane in turn. Seeding, the structural / ROI criteria and the
+         * acceptance tests are performed per streamline by an Exec instance
+         * for each lane, such that the resulting streamlines are identical to
+         * those generated by Exec, and
+         * are written in the same order.
+         *
+         * Only applicable to deterministic algorithms providing
+         * Method::next (Packet<Method>&); for RK4 integration or dynamic
+         * seeding, this reverts to Exec. */
+        template <class Method> class ExecPacket { MEMALIGN(ExecPacket<Method>)
+
+          public:
+
+            using packet_type = vector<GeneratedTrack>;
+
+            static void run (const std::string& diff_path, const std::string& destination, DWI::Tractography::Properties& properties)
+            {
+              if (properties.find ("seed_dynamic") != properties.end()) {
+                WARN ("Lockstep tracking is not compatible with dynamic seeding; streamlines will be generated individually");
+                Exec<Method>::run (diff_path, destination, properties);
+                return;
+              }
+
+              typename Method::Shared shared (diff_path, properties);
+              WriteKernel writer (shared, destination, properties);
+
+              if (shared.rk4) {
+                WARN ("Lockstep tracking is not compatible with 4th-order Runge-Kutta integration; streamlines will be generated individually");
+                Exec<Method> tracker (shared);
+                Thread::run_queue (Thread::multi (tracker), Thread::batch (GeneratedTrack(), TRACKING_BATCH_SIZE), writer);
+                return;
+              }
+
+              ExecPacket<Method> tracker (shared);
+              PacketWriter packet_writer (writer);
+              Thread::run_queue (Thread::multi (tracker), packet_type(), packet_writer);
+            }
+
+
+
+            ExecPacket (const typename Method::Shared& shared) :
+                S (shared),
+                packet (shared.source)
+            {
+              lanes.reserve (packet_size);
+              for (size_t lane = 0; lane != packet_size; ++lane)
+                lanes.emplace_back (shared);
+              connect();
+            }
+
+            ExecPacket (const ExecPacket& that) :
+                S (that.S),
+                lanes (that.lanes),
+                packet (S.source)
+            {
+              connect();
+            }
+
+
+            bool operator() (packet_type& tracks)
+            {
+              tracks.resize (packet_size);
+              size_t count = 0;
+              for (; count != packet_size; ++count) {
+                if (!lanes[count].seed_track (tracks[count]))
+                  break;
+                packet.active[count] = !lanes[count].track_excluded;
+                if (packet.active[count])
+                  start (count, tracks[count]);
+                else
+                  S.add_rejection (INVALID_SEED);
+              }
+              for (size_t lane = count; lane != packet_size; ++lane)
+                packet.active[lane] = false;
+              tracks.resize (count);
+              if (!count)
+                return false;
+
+              while (packet.any()) {
+                Method::next (packet);
+                for (size_t lane = 0; lane != count; ++lane) {
+                  if (packet.active[lane])
+                    step (lane, tracks[lane]);
+                }
+              }
+
+              for (size_t lane = 0; lane != count; ++lane) {
+                if (tracks[lane].get_status() != GeneratedTrack::status_t::SEED_REJECTED)
+                  lanes[lane].finalise_track (tracks[lane]);
+              }
+              return true;
+            }
+
+
+          private:
+
+            class PacketWriter { MEMALIGN(PacketWriter)
+              public:
+                PacketWriter (WriteKernel& writer) : writer (writer) { }
+                bool operator() (const packet_type& tracks)
+                {
+                  for (const auto& tck : tracks) {
+                    if (!writer (tck))
+                      return false;
+                  }
+                  return true;
+                }
+              private:
+                WriteKernel& writer;
+            };
+
+
+            const typename Method::Shared& S;
+            vector<Exec<Method>> lanes;
+            Packet<Method> packet;
+            std::array<bool, packet_size> unidirectional, reversed;
+            std::array<Eigen::Vector3f, packet_size> seed_dirs;
+
+
+            void connect ()
+            {
+              for (size_t lane = 0; lane != packet_size; ++lane)
+                packet.lanes[lane] = &lanes[lane].method;
+            }
+
+
+            // Equivalent to the commencement of Exec::gen_track()
+            void start (const size_t lane, GeneratedTrack& tck)
+            {
+              auto& E = lanes[lane];
+              unidirectional[lane] = S.unidirectional;
+              if (S.is_act() && !unidirectional[lane])
+                unidirectional[lane] = E.method.act().seed_is_unidirectional (E.method.pos, E.method.dir);
+              E.include_visitation (E.method.pos);
+              seed_dirs[lane] = E.method.dir;
+              reversed[lane] = false;
+              tck.push_back (E.method.pos);
+            }
+
+
+            // Equivalent to a single iteration of Exec::gen_track_unidir(),
+            //   followed where necessary by the reversal in Exec::gen_track()
+            void step (const size_t lane, GeneratedTrack& tck)
+            {
+              auto& E = lanes[lane];
+              term_t termination = E.check_step (packet.terminations[lane]);
+              if (term_add_to_tck[termination])
+                tck.push_back (E.method.pos);
+              if (!termination && tck.size() >= S.max_num_points_preds)
+                termination = LENGTH_EXCEED;
+              if (!termination)
+                return;
+
+              E.terminate_unidir (tck, termination);
+              if (!reversed[lane] && !E.track_excluded && !unidirectional[lane]) {
+                tck.reverse();
+                E.method.pos = tck.back();
+                E.method.dir = -seed_dirs[lane];
+                E.method.reverse_track();
+                reversed[lane] = true;
+              } else {
+                packet.active[lane] = false;
+              }
+            }
+
+        };
+
+
+
+      }
+    }
+  }
+}
+
+#endif
+
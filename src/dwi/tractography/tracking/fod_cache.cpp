@@ -0,0 +1,189 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "dwi/tractography/tracking/fod_cache.h"
+
+#include "algo/threaded_loop.h"
+
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace Tracking
+      {
+
+
+
+        const char* fod_cache_precisions[] = { "float32", "float16", nullptr };
+
+
+
+        FODCache::FODCache (Image<float>& image, const precision_t precision) :
+            transform (image),
+            dim { image.size(0), image.size(1), image.size(2) },
+            ncoefs (image.ndim() > 3 ? image.size(3) : 1),
+            storage_precision (precision),
+            data (nullptr),
+            nonzero (dim[0] * dim[1] * dim[2], 0)
+        {
+          const size_t element_bytes = (precision == precision_t::FLOAT16) ? sizeof (Math::Half::storage_type) : sizeof (float);
+          // Pad each voxel to a multiple of 8 elements; a brick of 64 voxels
+          //   is then always a whole number of 64-byte cache lines
+          voxel_stride = 8 * ((ncoefs + 7) / 8);
+          for (size_t axis = 0; axis != 2; ++axis)
+            nbricks[axis] = (dim[axis] + brick_size - 1) / brick_size;
+          const size_t nbricks_z = (dim[2] + brick_size - 1) / brick_size;
+          const size_t data_bytes = nbricks[0] * nbricks[1] * nbricks_z * brick_size * brick_size * brick_size * voxel_stride * element_bytes;
+          buffer.assign (data_bytes + 64, 0);
+          data = buffer.data() + ((64 - (reinterpret_cast<uintptr_t> (buffer.data()) % 64)) % 64);
+
+          auto fill = [&] (Image<float>& in) {
+            const ssize_t x = in.index(0), y = in.index(1), z = in.index(2);
+            const size_t offset = voxel_offset (x, y, z);
+            bool any_nonzero = false;
+            if (storage_precision == precision_t::FLOAT16) {
+              Math::Half::storage_type* p = reinterpret_cast<Math::Half::storage_type*> (data) + offset;
+              for (size_t n = 0; n != ncoefs; ++n) {
+                if (in.ndim() > 3)
+                  in.index(3) = n;
+                const float value = in.value();
+                any_nonzero |= bool (value);
+                p[n] = Math::Half::float2half (value);
+              }
+            } else {
+              float* p = reinterpret_cast<float*> (data) + offset;
+              for (size_t n = 0; n != ncoefs; ++n) {
+                if (in.ndim() > 3)
+                  in.index(3) = n;
+                p[n] = in.value();
+                any_nonzero |= bool (p[n]);
+              }
+            }
+            nonzero[voxel_index (x, y, z)] = any_nonzero;
+          };
+          ThreadedLoop ("loading image into tracking cache", image, 0, 3).run (fill, image);
+
+          INFO ("tracking cache for image \"" + image.name() + "\" occupies " + str (bytes() / (1024*1024)) + " MB "
+                "(" + std::string (fod_cache_precisions[size_t(precision)]) + ")");
+        }
+
+
+
+
+        FODCache::Interp::Interp (const FODCache& cache) :
+            C (cache),
+            next_entry (0)
+        {
+          keys.fill (-1);
+          for (auto& c : corners)
+            c.resize (C.ncoefs, 8);
+        }
+
+
+
+        bool FODCache::Interp::get (const Eigen::Vector3f& scanner_pos, Eigen::VectorXf& values)
+        {
+          const Eigen::Vector3d pos = C.transform.scanner2voxel * scanner_pos.cast<default_type>();
+
+          // Same bounds & implicit masking behaviour as Interp::Masked<Interp::Linear>
+          for (size_t axis = 0; axis != 3; ++axis) {
+            if (pos[axis] <= -0.5 || pos[axis] >= C.dim[axis] - 0.5) {
+              values.fill (NaN);
+              return false;
+            }
+          }
+          if (!C.nonzero[C.voxel_index (std::round (pos[0]), std::round (pos[1]), std::round (pos[2]))]) {
+            values.fill (NaN);
+            return false;
+          }
+
+          ssize_t cell[3];
+          float weights[3][2];
+          for (size_t axis = 0; axis != 3; ++axis) {
+            const default_type floor = std::floor (pos[axis]);
+            cell[axis] = ssize_t (floor);
+            const float f = (pos[axis] < 0.0 || pos[axis] > C.dim[axis] - 1.0) ? 0.0f : float (pos[axis] - floor);
+            weights[axis][0] = 1.0f - f;
+            weights[axis][1] = f;
+          }
+
+          Eigen::Matrix<float, 8, 1> factors;
+          size_t i = 0;
+          for (size_t z = 0; z != 2; ++z) {
+            for (size_t y = 0; y != 2; ++y) {
+              const float partial_weight = weights[1][y] * weights[2][z];
+              for (size_t x = 0; x != 2; ++x) {
+                factors[i] = weights[0][x] * partial_weight;
+                if (factors[i] < 1.0e-6f)
+                  factors[i] = 0.0f;
+                ++i;
+              }
+            }
+          }
+
+          // Cells are keyed by the index of their lower corner, which lies in [-1, dim-1] along each axis
+          const ssize_t key = (cell[0]+1) + (C.dim[0]+1) * ((cell[1]+1) + (C.dim[1]+1) * (cell[2]+1));
+          size_t entry = 0;
+          while (entry != num_entries && keys[entry] != key)
+            ++entry;
+          if (entry == num_entries)
+            entry = load (key, cell);
+
+          values.noalias() = corners[entry] * factors;
+          return !std::isnan (values[0]);
+        }
+
+
+
+        size_t FODCache::Interp::load (const ssize_t key, const ssize_t* cell)
+        {
+          const size_t entry = next_entry;
+          next_entry = (next_entry + 1) % num_entries;
+          keys[entry] = key;
+          auto& M = corners[entry];
+          auto clamp = [] (const ssize_t x, const ssize_t dim) { return std::min (std::max (x, ssize_t(0)), dim-1); };
+          size_t i = 0;
+          for (ssize_t z = 0; z != 2; ++z) {
+            const ssize_t vz = clamp (cell[2] + z, C.dim[2]);
+            for (ssize_t y = 0; y != 2; ++y) {
+              const ssize_t vy = clamp (cell[1] + y, C.dim[1]);
+              for (ssize_t x = 0; x != 2; ++x) {
+                const ssize_t vx = clamp (cell[0] + x, C.dim[0]);
+                if (C.storage_precision == precision_t::FLOAT16) {
+                  const Math::Half::storage_type* p = C.voxel_data<Math::Half::storage_type> (vx, vy, vz);
+                  for (size_t n = 0; n != C.ncoefs; ++n)
+                    M(n, i) = Math::Half::half2float (p[n]);
+                } else {
+                  M.col (i) = Eigen::Map<const Eigen::VectorXf> (C.voxel_data<float> (vx, vy, vz), C.ncoefs);
+                }
+                ++i;
+              }
+            }
+          }
+          return entry;
+        }
+
+
+
+      }
+    }
+  }
+}
@@ -0,0 +1,139 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __dwi_tractography_tracking_fod_cache_h__
+#define __dwi_tractography_tracking_fod_cache_h__
+
+#include "image.h"
+#include "memory.h"
+#include "transform.h"
+#include "types.h"
+#include "math/half.h"
+
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace Tracking
+      {
+
+
+
+        extern const char* fod_cache_precisions[];
+
+
+
+        //! A copy of the diffusion model image laid out for streamlines tractography
+        /*! The image is divided into bricks of brick_size^3 voxels; within
+         * each brick, the coefficients of each voxel are stored contiguously,
+         * and each brick starts on a cache line boundary. All eight voxels
+         * contributing to a tri-linear interpolation therefore reside in at
+         * most eight (and typically one or two) contiguous blocks of memory,
+         * rather than being scattered across the strides of the source image.
+         *
+         * Coefficients can optionally be stored in half-precision, which
+         * halves the memory footprint (and memory bandwidth) at the expense
+         * of a relative precision of approximately 1e-3.
+         *
+         * Interpolation is performed via the per-thread Interp class, which
+         * reproduces the behaviour of Interp::Masked<Interp::Linear>, and
+         * additionally caches the (decoded) coefficients of the eight corners
+         * of the most recently sampled voxel cells. */
+        class FODCache { MEMALIGN(FODCache)
+
+          public:
+            enum class precision_t { FLOAT32, FLOAT16 };
+
+            static constexpr size_t brick_size = 4;
+
+            FODCache (Image<float>& image, const precision_t precision);
+
+            size_t num_coefs() const { return ncoefs; }
+            precision_t precision() const { return storage_precision; }
+            size_t bytes() const { return buffer.size(); }
+
+
+            class Interp { MEMALIGN(Interp)
+              public:
+                Interp (const FODCache& cache);
+
+                //! Get the interpolated coefficients at scanner-space position \a pos
+                /*! Returns false if the position lies outside of the image, or
+                 * the nearest voxel contains no non-zero data; in either case,
+                 * \a values will be filled with NaN. */
+                bool get (const Eigen::Vector3f& pos, Eigen::VectorXf& values);
+
+              private:
+                static constexpr size_t num_entries = 4;
+
+                const FODCache& C;
+                std::array<ssize_t, num_entries> keys;
+                std::array<Eigen::Matrix<float, Eigen::Dynamic, 8>, num_entries> corners;
+                size_t next_entry;
+
+                size_t load (const ssize_t key, const ssize_t* cell);
+            };
+
+
+          private:
+            const MR::Transform transform;
+            const ssize_t dim[3];
+            const size_t ncoefs;
+            const precision_t storage_precision;
+            // Per-voxel storage stride, in elements; padded for alignment
+            size_t voxel_stride;
+            size_t nbricks[2];
+            vector<uint8_t> buffer;
+            uint8_t* data;
+            // Whether or not each voxel contains any non-zero data;
+            //   equivalent to the test performed by Interp::Masked
+            vector<uint8_t> nonzero;
+
+            size_t voxel_offset (const ssize_t x, const ssize_t y, const ssize_t z) const
+            {
+              const size_t brick = (x / brick_size) + nbricks[0] * ((y / brick_size) + nbricks[1] * (z / brick_size));
+              const size_t within = (x % brick_size) + brick_size * ((y % brick_size) + brick_size * (z % brick_size));
+              return voxel_stride * (brick * brick_size * brick_size * brick_size + within);
+            }
+
+            size_t voxel_index (const ssize_t x, const ssize_t y, const ssize_t z) const
+            {
+              return x + dim[0] * (y + dim[1] * z);
+            }
+
+            template <typename StorageType>
+            const StorageType* voxel_data (const ssize_t x, const ssize_t y, const ssize_t z) const
+            {
+              return reinterpret_cast<const StorageType*> (data) + voxel_offset (x, y, z);
+            }
+
+            friend class Interp;
+        };
+
+
+
+      }
+    }
+  }
+}
+
+#endif
+
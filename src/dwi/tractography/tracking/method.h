@@ -45,6 +45,7 @@ namespace MR
               dir (0.0, 0.0, 1.0),
               S (shared),
               act_method_additions (S.is_act() ? new ACT::ACT_Method_additions (S) : nullptr),
+              fod_interp (S.has_fod_cache() ? new FODCache::Interp (S.fod_cache()) : nullptr),
               values (shared.source.size(3)) { }
 
             MethodBase (const MethodBase& that) :
@@ -52,6 +53,7 @@ namespace MR
               dir (0.0, 0.0, 1.0),
               S (that.S),
               act_method_additions (S.is_act() ? new ACT::ACT_Method_additions (that.act()) : nullptr),
+              fod_interp (S.has_fod_cache() ? new FODCache::Interp (S.fod_cache()) : nullptr),
               uniform (that.uniform),
               values (that.values.size()) { }
 
@@ -59,6 +61,8 @@ namespace MR
             template <class InterpolatorType>
             FORCE_INLINE bool get_data (InterpolatorType& source, const Eigen::Vector3f& position)
             {
+              if (fod_interp)
+                return fod_interp->get (position, values);
               if (!source.scanner (position))
                 return false;
               for (auto l = Loop (3) (source); l; ++l)
@@ -89,6 +93,7 @@ namespace MR
           private:
             const SharedBase& S;
             std::unique_ptr<ACT::ACT_Method_additions> act_method_additions;
+            std::unique_ptr<FODCache::Interp> fod_interp;
 
 
           protected:
@@ -0,0 +1,164 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "dwi/tractography/tracking/packet.h"
+
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace Tracking
+      {
+
+
+
+        PacketInterp::PacketInterp (const Image<float>& source) :
+            image (source),
+            transform (source),
+            dim { source.size(0), source.size(1), source.size(2) },
+            num_volumes (source.ndim() > 3 ? source.size(3) : 1)
+        {
+          for (size_t axis = 0; axis != 4; ++axis) {
+            strides[axis] = axis < image.ndim() ? image.stride (axis) : 0;
+            if (axis < image.ndim())
+              image.index (axis) = 0;
+          }
+          data = image.address();
+        }
+
+
+
+        void PacketInterp::to_voxel (const positions_type& positions, const lane_mask_type& active, voxel_type& voxel, lane_mask_type& valid) const
+        {
+          using row_type = Eigen::Array<default_type, 1, packet_size>;
+          const row_type x = positions.row(0).cast<default_type>();
+          const row_type y = positions.row(1).cast<default_type>();
+          const row_type z = positions.row(2).cast<default_type>();
+          const auto& M (transform.scanner2voxel.matrix());
+
+          // Same bounds behaviour as Interp::Base::set_out_of_bounds()
+          Eigen::Array<bool, 1, packet_size> inside;
+          inside.setConstant (true);
+          for (size_t axis = 0; axis != 3; ++axis) {
+            voxel.row (axis) = M(axis,0)*x + M(axis,1)*y + M(axis,2)*z + M(axis,3);
+            inside = inside && (voxel.row (axis) > -0.5) && (voxel.row (axis) < dim[axis] - 0.5);
+          }
+
+          // Implicit masking as per Interp::Masked: the nearest voxel must contain some non-zero value
+          index_type nearest = index_type::Zero();
+          for (size_t axis = 0; axis != 3; ++axis)
+            nearest.row (axis) = inside.select (voxel.row (axis).round(), 0.0).cast<ssize_t>();
+          for (size_t lane = 0; lane != packet_size; ++lane) {
+            valid[lane] = false;
+            if (!active[lane] || !inside[lane])
+              continue;
+            const float* p = data + offset (nearest(0,lane), nearest(1,lane), nearest(2,lane));
+            for (ssize_t n = 0; n != num_volumes; ++n) {
+              if (p[n*strides[3]]) {
+                valid[lane] = true;
+                break;
+              }
+            }
+          }
+        }
+
+
+
+        void PacketInterp::linear (const positions_type& positions, const lane_mask_type& active, values_type& values, lane_mask_type& valid) const
+        {
+          voxel_type voxel;
+          to_voxel (positions, active, voxel, valid);
+
+          using row_type = Eigen::Array<float, 1, packet_size>;
+          const Eigen::Map<const Eigen::Array<bool, 1, packet_size>> mask (valid.data());
+          index_type lower, upper;
+          row_type weights[3][2];
+          for (size_t axis = 0; axis != 3; ++axis) {
+            const auto v = voxel.row (axis);
+            const Eigen::Array<default_type, 1, packet_size> floor = v.floor();
+            // Same edge behaviour and rounding as Interp::Linear
+            const Eigen::Array<default_type, 1, packet_size> f = ((v < 0.0) || (v > dim[axis] - 1.0)).select (0.0, v - floor);
+            weights[axis][0] = (1.0 - f).cast<float>();
+            weights[axis][1] = f.cast<float>();
+            const Eigen::Array<ssize_t, 1, packet_size> cell = mask.select (floor, 0.0).cast<ssize_t>();
+            lower.row (axis) = cell.max (ssize_t(0)).min (dim[axis]-1);
+            upper.row (axis) = (cell + 1).max (ssize_t(0)).min (dim[axis]-1);
+          }
+
+          Eigen::Array<float, 8, packet_size, Eigen::RowMajor> factors;
+          size_t i = 0;
+          for (size_t z = 0; z != 2; ++z) {
+            for (size_t y = 0; y != 2; ++y) {
+              const row_type partial_weight = weights[1][y] * weights[2][z];
+              for (size_t x = 0; x != 2; ++x)
+                factors.row (i++) = weights[0][x] * partial_weight;
+            }
+          }
+          factors = (factors < 1.0e-6f).select (0.0f, factors);
+
+          for (size_t lane = 0; lane != packet_size; ++lane) {
+            if (!valid[lane]) {
+              if (active[lane])
+                values.col (lane).fill (NaN);
+              continue;
+            }
+            const ssize_t x[2] = { lower(0,lane), upper(0,lane) };
+            const ssize_t y[2] = { lower(1,lane), upper(1,lane) };
+            const ssize_t z[2] = { lower(2,lane), upper(2,lane) };
+            ssize_t offsets[8];
+            for (size_t n = 0; n != 8; ++n)
+              offsets[n] = offset (x[n&1], y[(n>>1)&1], z[n>>2]);
+            // Each volume is interpolated exactly as by Interp::Linear::value(),
+            //   such that results are bit-identical to those of Exec
+            const Eigen::Matrix<float, 8, 1> lane_factors = factors.col (lane);
+            Eigen::Matrix<float, 8, 1> corners;
+            for (ssize_t volume = 0; volume != num_volumes; ++volume) {
+              for (size_t n = 0; n != 8; ++n)
+                corners[n] = data[offsets[n] + volume*strides[3]];
+              values(volume,lane) = corners.dot (lane_factors);
+            }
+            valid[lane] = !std::isnan (values(0,lane));
+          }
+        }
+
+
+
+        void PacketInterp::nearest (const positions_type& positions, const lane_mask_type& active, values_type& values, lane_mask_type& valid) const
+        {
+          voxel_type voxel;
+          to_voxel (positions, active, voxel, valid);
+          for (size_t lane = 0; lane != packet_size; ++lane) {
+            if (!valid[lane]) {
+              if (active[lane])
+                values.col (lane).fill (NaN);
+              continue;
+            }
+            copy (offset (std::round (voxel(0,lane)), std::round (voxel(1,lane)), std::round (voxel(2,lane))), values, lane);
+            valid[lane] = !std::isnan (values(0,lane));
+          }
+        }
+
+
+
+      }
+    }
+  }
+}
@@ -0,0 +1,165 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __dwi_tractography_tracking_packet_h__
+#define __dwi_tractography_tracking_packet_h__
+
+#include <array>
+
+#include "image.h"
+#include "memory.h"
+#include "transform.h"
+#include "types.h"
+#include "dwi/tractography/tracking/types.h"
+
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+      namespace Tracking
+      {
+
+
+
+        //! The number of streamlines propagated in lockstep by ExecPacket
+        constexpr size_t packet_size = 8;
+
+        using lane_mask_type = std::array<bool, packet_size>;
+
+
+
+        //! Interpolation of the source image for a packet of streamline positions
+        /*! The transformation to voxel space, the bounds and implicit masking
+         * checks, and the interpolation weights are computed for all lanes at
+         * once in structure-of-arrays form; the image data for each lane are
+         * then gathered and combined using those weights, one lane at a time,
+         * and written to one column of a (volumes x packet_size) matrix.
+         *
+         * Results are identical to those of Interp::Masked<Interp::Linear> and
+         * Interp::Masked<Interp::Nearest> respectively. The image must be
+         * accessible via direct IO. */
+        class PacketInterp { MEMALIGN(PacketInterp)
+
+          public:
+            using positions_type = Eigen::Array<float, 3, packet_size, Eigen::RowMajor>;
+            using values_type = Eigen::Matrix<float, Eigen::Dynamic, packet_size>;
+
+            PacketInterp (const Image<float>& image);
+
+            //! Tri-linear interpolation at the positions of the active lanes
+            void linear (const positions_type& positions, const lane_mask_type& active, values_type& values, lane_mask_type& valid) const;
+            //! Nearest-neighbour interpolation at the positions of the active lanes
+            void nearest (const positions_type& positions, const lane_mask_type& active, values_type& values, lane_mask_type& valid) const;
+
+          private:
+            using voxel_type = Eigen::Array<default_type, 3, packet_size, Eigen::RowMajor>;
+            using index_type = Eigen::Array<ssize_t, 3, packet_size, Eigen::RowMajor>;
+
+            Image<float> image;
+            const MR::Transform transform;
+            const ssize_t dim[3];
+            const ssize_t num_volumes;
+            const float* data;
+            ssize_t strides[4];
+
+            void to_voxel (const positions_type& positions, const lane_mask_type& active, voxel_type& voxel, lane_mask_type& valid) const;
+
+            ssize_t offset (const ssize_t x, const ssize_t y, const ssize_t z) const
+            {
+              return x*strides[0] + y*strides[1] + z*strides[2];
+            }
+
+            void copy (const ssize_t offset, values_type& values, const size_t lane) const
+            {
+              if (strides[3] == 1)
+                values.col (lane) = Eigen::Map<const Eigen::VectorXf> (data + offset, num_volumes);
+              else
+                values.col (lane) = Eigen::Map<const Eigen::VectorXf, 0, Eigen::InnerStride<>> (data + offset, num_volumes, Eigen::InnerStride<> (strides[3]));
+            }
+        };
+
+
+
+        //! The state of a packet of streamlines, as presented to a tracking algorithm
+        /*! Algorithms supporting lockstep tracking provide a static function:
+         * \code
+         * static void next (Packet<Method>& packet);
+         * \endcode
+         * which must perform a single step for each of the active lanes, and
+         * write the resulting termination flag for that lane into
+         * \a terminations. The interpolate_*() functions fill \a values and
+         * \a valid using the current positions of the active lanes. */
+        template <class MethodType>
+        class Packet { MEMALIGN(Packet<MethodType>)
+
+          public:
+            Packet (const Image<float>& image) :
+                values (image.size(3), packet_size),
+                interp (image)
+            {
+              lanes.fill (nullptr);
+              active.fill (false);
+              valid.fill (false);
+              terminations.fill (CONTINUE);
+            }
+
+            std::array<MethodType*, packet_size> lanes;
+            lane_mask_type active, valid;
+            std::array<term_t, packet_size> terminations;
+            PacketInterp::values_type values;
+
+            void interpolate_linear () { interp.linear (positions(), active, values, valid); }
+            void interpolate_nearest () { interp.nearest (positions(), active, values, valid); }
+
+            bool any() const
+            {
+              for (const auto i : active) {
+                if (i)
+                  return true;
+              }
+              return false;
+            }
+
+          private:
+            PacketInterp interp;
+
+            PacketInterp::positions_type positions() const
+            {
+              PacketInterp::positions_type result;
+              for (size_t lane = 0; lane != packet_size; ++lane) {
+                if (active[lane])
+                  result.col (lane) = lanes[lane]->pos.array();
+                else
+                  result.col (lane).setZero();
+              }
+              return result;
+            }
+        };
+
+
+
+      }
+    }
+  }
+}
+
+#endif
+
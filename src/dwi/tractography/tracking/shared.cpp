@@ -179,6 +179,23 @@ namespace MR
 
 
 
+        void SharedBase::init_fod_cache()
+        {
+          auto it = properties.find ("fod_cache");
+          if (it == properties.end())
+            return;
+          FODCache::precision_t precision;
+          if (it->second == fod_cache_precisions[0])
+            precision = FODCache::precision_t::FLOAT32;
+          else if (it->second == fod_cache_precisions[1])
+            precision = FODCache::precision_t::FLOAT16;
+          else
+            throw Exception ("Invalid FOD cache precision \"" + it->second + "\"");
+          fod_cache_data.reset (new FODCache (source, precision));
+        }
+
+
+
         void SharedBase::set_step_and_angle (const float voxel_frac, const float angle, const bool is_higher_order)
         {
           step_size = voxel_frac * vox();
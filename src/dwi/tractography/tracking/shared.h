@@ -27,6 +27,7 @@
 #include "dwi/tractography/roi.h"
 #include "dwi/tractography/ACT/shared.h"
 #include "dwi/tractography/resampling/downsampler.h"
+#include "dwi/tractography/tracking/fod_cache.h"
 #include "dwi/tractography/tracking/types.h"
 #include "dwi/tractography/tracking/tractography.h"
 
@@ -74,6 +75,10 @@ namespace MR
             bool is_act() const { return bool (act_shared_additions); }
             const ACT::ACT_Shared_additions& act() const { return *act_shared_additions; }
 
+            // Optional tracking-specific copy of the FOD image
+            bool has_fod_cache() const { return bool (fod_cache_data); }
+            const FODCache& fod_cache() const { return *fod_cache_data; }
+
             float vox () const
             {
               return std::pow (source.spacing(0)*source.spacing(1)*source.spacing(2), float (1.0/3.0));
@@ -93,17 +98,30 @@ namespace MR
             void add_termination (const term_t i)   const { terminations[i].fetch_add (1, std::memory_order_relaxed); }
             void add_rejection   (const reject_t i) const { rejections[i]  .fetch_add (1, std::memory_order_relaxed); }
 
+            // Used for checkpointing
+            size_t num_terminations (const term_t i)   const { return terminations[i].load (std::memory_order_relaxed); }
+            size_t num_rejections   (const reject_t i) const { return rejections[i]  .load (std::memory_order_relaxed); }
+            void add_terminations (const term_t i,   const size_t count) const { terminations[i].fetch_add (count, std::memory_order_relaxed); }
+            void add_rejections   (const reject_t i, const size_t count) const { rejections[i]  .fetch_add (count, std::memory_order_relaxed); }
+
 
 #ifdef DEBUG_TERMINATIONS
             void add_termination (const term_t i, const Eigen::Vector3f& p) const;
 #endif
 
 
+          protected:
+            // To be called by the Shared classes of those algorithms that
+            //   interpolate the source image using Interpolator<>::type
+            void init_fod_cache();
+
+
           private:
             mutable std::atomic<size_t> terminations[TERMINATION_REASON_COUNT];
             mutable std::atomic<size_t> rejections  [REJECTION_REASON_COUNT];
 
             std::unique_ptr<ACT::ACT_Shared_additions> act_shared_additions;
+            std::unique_ptr<FODCache> fod_cache_data;
 
 #ifdef DEBUG_TERMINATIONS
             Header debug_header;
@@ -15,6 +15,8 @@
  */
 
 #include "dwi/tractography/tracking/tractography.h"
+#include "dwi/tractography/tracking/fod_cache.h"
+#include "dwi/tractography/tracking/packet.h"
 
 
 namespace MR
@@ -88,6 +90,21 @@ namespace MR
             "do NOT pre-compute legendre polynomial values. Warning: "
             "this will slow down the algorithm by a factor of approximately 4.")
 
+      + Option ("fod_cache",
+            "store the FOD image in memory using a layout optimised for tractography, "
+            "with coefficients stored using either single-precision (float32) or "
+            "half-precision (float16) floating-point; the latter halves the memory "
+            "footprint of the image at the expense of a small loss of precision "
+            "(only used for iFOD1 / iFOD2 / SD_Stream)")
+          + Argument ("precision").type_choice (fod_cache_precisions)
+
+      + Option ("lockstep",
+            "propagate streamlines in packets of " + str(packet_size) + ", with the image "
+            "interpolation weights at each step computed for all streamlines in the packet "
+            "simultaneously; the diffusion model is still evaluated separately for each "
+            "streamline, and the generated streamlines are identical to those generated otherwise "
+            "(only used for FACT / SD_Stream / Tensor_Det; not used in conjunction with -fod_cache)")
+
       + Option ("rk4", "use 4th-order Runge-Kutta integration "
                        "(slower, but eliminates curvature overshoot in 1st-order deterministic methods)")
 
@@ -95,7 +112,22 @@ namespace MR
 
       + Option ("downsample", "downsample the generated streamlines to reduce output file size "
                               "(default is (samples-1) for iFOD2, no downsampling for all other algorithms)")
-          + Argument ("factor").type_integer (1);
+          + Argument ("factor").type_integer (1)
+
+      + Option ("checkpoint", "periodically flush the output track file to disk and write the "
+                              "state of the tracking process to a checkpoint file, so that an "
+                              "interrupted run can be continued using the -resume option "
+                              "(not compatible with seeding mechanisms that provide a finite number of seeds)")
+          + Argument ("path").type_file_out()
+          + Argument ("interval").type_float (0.0)
+
+      + Option ("resume", "continue a previously interrupted run from the checkpoint file provided, "
+                          "appending to the existing output track file; all other command-line "
+                          "arguments must match those of the original run (other than the "
+                          "-select and -seeds options, which may be increased in order to extend a "
+                          "completed run), and the -force option must be provided for the existing "
+                          "output files to be re-opened")
+          + Argument ("path").type_file_in();
 
 
       /**
@@ -135,6 +167,12 @@ namespace MR
         opt = get_options ("noprecomputed");
         if (opt.size()) properties["sh_precomputed"] = "0";
 
+        opt = get_options ("fod_cache");
+        if (opt.size()) properties["fod_cache"] = fod_cache_precisions[int(opt[0][0])];
+
+        opt = get_options ("lockstep");
+        if (opt.size()) properties["lockstep"] = "1";
+
         opt = get_options ("rk4");
         if (opt.size()) properties["rk4"] = "1";
 
@@ -154,6 +192,15 @@ namespace MR
         opt = get_options ("grad");
         if (opt.size()) properties["DW_scheme"] = std::string (opt[0][0]);
 
+        opt = get_options ("checkpoint");
+        if (opt.size()) {
+          properties["checkpoint"] = std::string (opt[0][0]);
+          properties["checkpoint_interval"] = std::string (opt[0][1]);
+        }
+
+        opt = get_options ("resume");
+        if (opt.size()) properties["resume"] = std::string (opt[0][0]);
+
       }
 
 
@@ -16,6 +16,9 @@
 
 #include "dwi/tractography/tracking/write_kernel.h"
 
+#include "math/rng.h"
+#include "dwi/tractography/seeding/dynamic.h"
+
 
 namespace MR
 {
@@ -46,11 +49,53 @@ namespace MR
               WARN ("Track generation terminating prematurely: Highly unlikely to reach target number of streamlines (p<" + str(TCKGEN_EARLY_EXIT_PROB_THRESHOLD,1) + ")");
               return false;
             }
+            if (checkpoint.due()) {
+              if (dynamic_seeder)
+                dynamic_seeder->request_checkpoint();
+              else
+                save_checkpoint();
+            }
             return true;
           }
 
 
 
+          void WriteKernel::set_dynamic_seeder (Seeding::Dynamic& seeder, const Mapping::TrackMapperBase& mapper)
+          {
+            dynamic_seeder = &seeder;
+            checkpoint.restore (seeder, mapper);
+            seeder.set_checkpoint_func ([&] () {
+              std::lock_guard<std::mutex> lock (checkpoint_mutex);
+              save_checkpoint();
+            });
+          }
+
+
+
+          void WriteKernel::save_checkpoint ()
+          {
+            writer.flush();
+            Checkpoint::State state;
+            state.tracks = writer.get_state();
+            state.seeds = seeds;
+            state.streamlines = streamlines;
+            state.selected = selected;
+            if (output_seeds) {
+              output_seeds->flush();
+              state.seed_output_offset = output_seeds->tellp();
+            }
+            for (size_t i = 0; i != TERMINATION_REASON_COUNT; ++i)
+              state.terminations[i] = S.num_terminations (term_t(i));
+            for (size_t i = 0; i != REJECTION_REASON_COUNT; ++i)
+              state.rejections[i] = S.num_rejections (reject_t(i));
+            state.rng_seed = Math::RNG::next_seed();
+            if (dynamic_seeder)
+              state.unmapped = dynamic_seeder->get_unmapped (writer.count);
+            checkpoint.save (state, dynamic_seeder);
+          }
+
+
+
       }
     }
   }
@@ -18,6 +18,7 @@
 #define __dwi_tractography_tracking_write_kernel_h__
 
 #include <cinttypes>
+#include <mutex>
 #include <string>
 
 #include "timer.h"
@@ -27,6 +28,7 @@
 #include "dwi/tractography/properties.h"
 #include "dwi/tractography/streamline.h"
 
+#include "dwi/tractography/tracking/checkpoint.h"
 #include "dwi/tractography/tracking/early_exit.h"
 #include "dwi/tractography/tracking/generated_track.h"
 #include "dwi/tractography/tracking/shared.h"
@@ -52,20 +54,37 @@ namespace MR
               const std::string& output_file,
               const DWI::Tractography::Properties& properties) :
                 S (shared),
-                writer (output_file, properties),
+                checkpoint (properties, output_file),
+                writer (output_file, properties, checkpoint.resume_state().tracks),
                 always_increment (S.properties.seeds.is_finite() || !S.max_num_tracks),
                 warn_on_max_seeds (S.implicit_max_num_seeds),
-                seeds (0),
-                streamlines (0),
-                selected (0),
-                progress (printf ("       0 seeds,        0 streamlines,        0 selected", 0, 0), always_increment ? S.max_num_seeds : S.max_num_tracks),
+                seeds (checkpoint.resume_state().seeds),
+                streamlines (checkpoint.resume_state().streamlines),
+                selected (checkpoint.resume_state().selected),
+                dynamic_seeder (nullptr),
+                progress (printf ("%8" PRIu64 " seeds, %8" PRIu64 " streamlines, %8" PRIu64 " selected", seeds, streamlines, selected),
+                          always_increment ? (S.max_num_seeds ? S.max_num_seeds - seeds : 0) : S.max_num_tracks - selected),
                 early_exit (shared)
           {
             const auto p = properties.find ("seed_output");
             if (p != properties.end()) {
-              output_seeds.reset (new File::OFStream (p->second, std::ios_base::out | std::ios_base::trunc));
-              (*output_seeds) << "# " << App::command_history_string << "\n";
-              (*output_seeds) << "#Track_index,Seed_index,Pos_x,Pos_y,Pos_z,\n";
+              if (checkpoint.resuming()) {
+                if (checkpoint.resume_state().seed_output_offset < 0)
+                  throw Exception ("cannot resume writing seeds to file \"" + p->second + "\": not recorded in checkpoint");
+                App::check_overwrite (p->second);
+                File::resize (p->second, checkpoint.resume_state().seed_output_offset);
+                output_seeds.reset (new File::OFStream (p->second, std::ios_base::out | std::ios_base::app));
+              } else {
+                output_seeds.reset (new File::OFStream (p->second, std::ios_base::out | std::ios_base::trunc));
+                (*output_seeds) << "# " << App::command_history_string << "\n";
+                (*output_seeds) << "#Track_index,Seed_index,Pos_x,Pos_y,Pos_z,\n";
+              }
+            }
+            if (checkpoint.resuming()) {
+              for (size_t i = 0; i != TERMINATION_REASON_COUNT; ++i)
+                S.add_terminations (term_t(i), checkpoint.resume_state().terminations[i]);
+              for (size_t i = 0; i != REJECTION_REASON_COUNT; ++i)
+                S.add_rejections (reject_t(i), checkpoint.resume_state().rejections[i]);
             }
           }
 
@@ -95,12 +114,23 @@ namespace MR
 
         protected:
           const SharedBase& S;
+          Checkpoint checkpoint;
           Writer<> writer;
           const bool always_increment, warn_on_max_seeds;
           size_t seeds, streamlines, selected;
+          Seeding::Dynamic* dynamic_seeder;
           std::unique_ptr<File::OFStream> output_seeds;
           ProgressBar progress;
           EarlyExit early_exit;
+
+          // With dynamic seeding, checkpoints are written by the thread updating
+          //   the seeding model, during which the writer must be locked
+          std::mutex checkpoint_mutex;
+
+          // Required for the dynamic seeding model to be included in checkpoints
+          void set_dynamic_seeder (Seeding::Dynamic&, const Mapping::TrackMapperBase&);
+
+          void save_checkpoint ();
       };
 
 
@@ -18,6 +18,8 @@
 #ifndef __fixel_filter_base_h__
 #define __fixel_filter_base_h__
 
+#include "image.h"
+
 namespace MR
 {
   namespace Fixel
@@ -51,6 +53,14 @@ namespace MR
             throw Exception ("Running empty function Fixel::Filter::Base::operator()");
           }
 
+          // Filters that can share work across data files should override this
+          virtual void operator() (vector<Image<float>>& inputs, vector<Image<float>>& outputs) const
+          {
+            assert (inputs.size() == outputs.size());
+            for (size_t i = 0; i != inputs.size(); ++i)
+              (*this) (inputs[i], outputs[i]);
+          }
+
         protected:
           std::string message;
 
@@ -31,6 +31,31 @@ namespace MR
 
 
 
+      namespace {
+        // Number of fixels processed by each thread at a time
+        constexpr size_t fixels_per_block = 1024;
+
+        class BlockSource
+        { NOMEMALIGN
+          public:
+            BlockSource (const size_t num_fixels) :
+                num_blocks ((num_fixels + fixels_per_block - 1) / fixels_per_block),
+                counter (0) { }
+            bool operator() (size_t& block)
+            {
+              if ((block = counter) == num_blocks)
+                return false;
+              ++counter;
+              return true;
+            }
+          private:
+            const size_t num_blocks;
+            size_t counter;
+        };
+      }
+
+
+
       Smooth::Smooth (Image<index_type> index_image,
                       const Matrix::Reader& matrix,
                       const Image<bool>& mask_image,
@@ -38,9 +63,10 @@ namespace MR
                       const float smoothing_threshold) :
           mask_image (mask_image),
           matrix (matrix),
-          threshold (smoothing_threshold)
+          threshold (smoothing_threshold),
+          kernel_mask (matrix.size()),
+          kernel_disconnected (matrix.size())
       {
-        set_fwhm (smoothing_fwhm);
         // For smoothing, we need to be able to quickly
         //   calculate the distance between any pair of fixels
         fixel_positions.resize (matrix.size());
@@ -55,6 +81,7 @@ namespace MR
           for (size_t fixel_index = 0; fixel_index != count; ++fixel_index)
             fixel_positions[offset + fixel_index] = scanner;
         }
+        set_fwhm (smoothing_fwhm);
       }
 
       Smooth::Smooth (Image<index_type> index_image,
@@ -74,6 +101,7 @@ namespace MR
         mask_image = Image<bool>::scratch (mask_header, "full scratch fixel mask");
         for (auto l = Loop(0) (mask_image); l; ++l)
           mask_image.value() = true;
+        build_kernel();
       }
 
       Smooth::Smooth (Image<index_type> index_image,
@@ -87,97 +115,208 @@ namespace MR
         stdev = fwhm / 2.3548f;
         gaussian_const1 = 1.0 / (stdev * std::sqrt (2.0 * Math::pi));
         gaussian_const2 = -1.0 / (2.0 * stdev * stdev);
+        // Kernel can only be constructed once the fixel mask is available
+        if (mask_image.valid())
+          build_kernel();
       }
 
 
 
-      // TODO Provide an alternative functor for when the input & output images contain more than one column
-      //   (more efficient to construct the smoothing kernel once per fixel, then loop over image channels)
-      void Smooth::operator() (Image<float>& input, Image<float>& output) const
+      void Smooth::build_kernel()
       {
-        Fixel::check_data_file (input);
-        Fixel::check_data_file (output);
-
-        check_dimensions (input, output);
-
-        if (size_t (input.size(0)) != matrix.size())
-          throw Exception ("Size of fixel data file \"" + input.name() + "\" (" + str(input.size(0)) +
-                           ") does not match fixel connectivity matrix (" + str(matrix.size()) + ")");
+        const size_t num_fixels = matrix.size();
+        kernel_mask.clear();
+        kernel_disconnected.clear();
+        for (auto l = Loop(0) (mask_image); l; ++l) {
+          if (mask_image.value())
+            kernel_mask[mask_image.index(0)] = true;
+        }
 
-        class Source
+        // Each block of fixels is computed independently,
+        //   then concatenated into a single kernel
+        class Chunk
         { NOMEMALIGN
           public:
-            Source (const size_t N) :
-                number (N),
-                counter (0) { }
-            bool operator() (size_t& fixel)
-            {
-              if ((fixel = counter) == number)
-                return false;
-              ++counter;
-              return true;
-            }
-          private:
-            const size_t number;
-            size_t counter;
+            vector<size_t> row_sizes;
+            vector<index_type> indices;
+            vector<float> weights;
         };
+        vector<Chunk> chunks ((num_fixels + fixels_per_block - 1) / fixels_per_block);
 
         class Worker
         { MEMALIGN(Worker)
           public:
-            Worker (const Smooth& master, const Image<float>& input, const Image<float>& output) :
+            Worker (const Smooth& master, vector<Chunk>& chunks) :
                 master (master),
                 matrix (master.matrix),
-                input (input),
-                output (output),
-                mask (master.mask_image) { }
+                chunks (chunks) { }
 
-            bool operator() (const size_t fixel)
+            bool operator() (const size_t block)
             {
-              mask.index(0) = output.index(0) = fixel;
-              if (mask.value()) {
+              Chunk& chunk (chunks[block]);
+              const size_t first = block * fixels_per_block;
+              const size_t last = std::min (first + fixels_per_block, master.matrix.size());
+              chunk.row_sizes.assign (last - first, 0);
+              for (size_t fixel = first; fixel != last; ++fixel) {
+                if (!master.kernel_mask[fixel])
+                  continue;
                 const Eigen::Vector3f& pos (master.fixel_positions[fixel]);
                 const auto connectivity = matrix[fixel];
-                default_type sum_weights (0.0);
-                output.value() = 0.0;
                 for (const auto& c : connectivity) {
-                  mask.index (0) = input.index(0) = c.index();
-                  if (mask.value() && std::isfinite (static_cast<float>(input.value()))) {
+                  if (master.kernel_mask[c.index()]) {
                     const Matrix::connectivity_value_type weight = c.value() * master.gaussian_const1 * std::exp (master.gaussian_const2 * (master.fixel_positions[c.index()] - pos).squaredNorm());
                     if (weight >= master.threshold) {
-                      output.value() += weight * input.value();
-                      sum_weights += weight;
+                      chunk.indices.push_back (c.index());
+                      chunk.weights.push_back (weight);
+                      ++chunk.row_sizes[fixel - first];
                     }
                   }
                 }
-                if (sum_weights) {
-                  output.value() /= sum_weights;
-                } else if (connectivity.empty()) {
-                  // Provide unsmoothed value if disconnected
-                  input.index(0) = fixel;
-                  output.value() = input.value();
-                } else {
-                  output.value() = std::numeric_limits<float>::quiet_NaN();
-                }
-              } else {
-                output.value() = std::numeric_limits<float>::quiet_NaN();
+                // Flag disconnected fixels, such that they can be provided with their unsmoothed value
+                if (connectivity.empty())
+                  chunk.row_sizes[fixel - first] = std::numeric_limits<size_t>::max();
               }
               return true;
             }
 
           private:
             const Smooth& master;
-            // Need a local copy of each of these
             Matrix::Reader matrix;
-            Image<float> input;
-            Image<float> output;
-            Image<bool> mask;
+            vector<Chunk>& chunks;
         };
 
-        Thread::run_queue (Source (input.size (0)),
+        Thread::run_queue (BlockSource (num_fixels),
                            Thread::batch (size_t()),
-                           Thread::multi (Worker (*this, input, output)));
+                           Thread::multi (Worker (*this, chunks)));
+
+        size_t nnz = 0;
+        for (const auto& chunk : chunks)
+          nnz += chunk.indices.size();
+        kernel_offsets.assign (num_fixels + 1, 0);
+        kernel_indices.clear();
+        kernel_weights.clear();
+        kernel_indices.reserve (nnz);
+        kernel_weights.reserve (nnz);
+        size_t fixel = 0;
+        for (auto& chunk : chunks) {
+          for (const auto row_size : chunk.row_sizes) {
+            if (row_size == std::numeric_limits<size_t>::max()) {
+              kernel_disconnected[fixel] = true;
+              kernel_offsets[fixel+1] = kernel_offsets[fixel];
+            } else {
+              kernel_offsets[fixel+1] = kernel_offsets[fixel] + row_size;
+            }
+            ++fixel;
+          }
+          kernel_indices.insert (kernel_indices.end(), chunk.indices.begin(), chunk.indices.end());
+          kernel_weights.insert (kernel_weights.end(), chunk.weights.begin(), chunk.weights.end());
+          vector<size_t>().swap (chunk.row_sizes);
+          vector<index_type>().swap (chunk.indices);
+          vector<float>().swap (chunk.weights);
+        }
+        assert (fixel == num_fixels);
+        assert (kernel_offsets.back() == nnz);
+        DEBUG ("Fixel smoothing kernel: " + str(nnz) + " non-zero weights across " + str(num_fixels) + " fixels");
+      }
+
+
 
+      void Smooth::operator() (Image<float>& input, Image<float>& output) const
+      {
+        vector<Image<float>> inputs (1, input), outputs (1, output);
+        (*this) (inputs, outputs);
+      }
+
+
+
+      void Smooth::operator() (vector<Image<float>>& inputs, vector<Image<float>>& outputs) const
+      {
+        assert (inputs.size() == outputs.size());
+        if (inputs.empty())
+          return;
+        for (size_t i = 0; i != inputs.size(); ++i) {
+          Fixel::check_data_file (inputs[i]);
+          Fixel::check_data_file (outputs[i]);
+          check_dimensions (inputs[i], outputs[i]);
+          if (size_t (inputs[i].size(0)) != matrix.size())
+            throw Exception ("Size of fixel data file \"" + inputs[i].name() + "\" (" + str(inputs[i].size(0)) +
+                             ") does not match fixel connectivity matrix (" + str(matrix.size()) + ")");
+        }
+
+        data_matrix_type input_data (matrix.size(), inputs.size());
+        for (size_t i = 0; i != inputs.size(); ++i) {
+          for (auto l = Loop(0) (inputs[i]); l; ++l)
+            input_data (ssize_t (inputs[i].index(0)), i) = inputs[i].value();
+        }
+        data_matrix_type output_data;
+        (*this) (input_data, output_data);
+        for (size_t i = 0; i != outputs.size(); ++i) {
+          for (auto l = Loop(0) (outputs[i]); l; ++l)
+            outputs[i].value() = output_data (ssize_t (outputs[i].index(0)), i);
+        }
+      }
+
+
+
+      void Smooth::operator() (const data_matrix_type& input, data_matrix_type& output) const
+      {
+        if (size_t (input.rows()) != matrix.size())
+          throw Exception ("Number of rows in fixel data (" + str(input.rows()) +
+                           ") does not match fixel connectivity matrix (" + str(matrix.size()) + ")");
+        output.resize (input.rows(), input.cols());
+
+        class Worker
+        { MEMALIGN(Worker)
+          public:
+            Worker (const Smooth& master, const data_matrix_type& input, data_matrix_type& output) :
+                master (master),
+                input (input),
+                output (output),
+                numerator (input.cols()),
+                denominator (input.cols()) { }
+
+            bool operator() (const size_t block)
+            {
+              const size_t first = block * fixels_per_block;
+              const size_t last = std::min (first + fixels_per_block, size_t(input.rows()));
+              for (size_t fixel = first; fixel != last; ++fixel) {
+                if (!master.kernel_mask[fixel]) {
+                  output.row (fixel).fill (std::numeric_limits<float>::quiet_NaN());
+                  continue;
+                }
+                // Provide unsmoothed value if disconnected
+                if (master.kernel_disconnected[fixel]) {
+                  output.row (fixel) = input.row (fixel);
+                  continue;
+                }
+                numerator.setZero();
+                denominator.setZero();
+                for (size_t k = master.kernel_offsets[fixel]; k != master.kernel_offsets[fixel+1]; ++k) {
+                  const default_type weight = master.kernel_weights[k];
+                  const auto neighbour = input.row (master.kernel_indices[k]);
+                  for (ssize_t i = 0; i != input.cols(); ++i) {
+                    if (std::isfinite (neighbour[i])) {
+                      numerator[i] += weight * neighbour[i];
+                      denominator[i] += weight;
+                    }
+                  }
+                }
+                for (ssize_t i = 0; i != input.cols(); ++i)
+                  output (fixel, i) = denominator[i] ? float(numerator[i] / denominator[i]) : std::numeric_limits<float>::quiet_NaN();
+              }
+              return true;
+            }
+
+          private:
+            const Smooth& master;
+            const data_matrix_type& input;
+            data_matrix_type& output;
+            Eigen::Array<default_type, Eigen::Dynamic, 1> numerator, denominator;
+        };
+
+        Thread::run_queue (BlockSource (input.rows()),
+                           Thread::batch (size_t()),
+                           Thread::multi (Worker (*this, input, output)));
       }
 
 
@@ -18,6 +18,8 @@
 #ifndef __fixel_filter_smooth_h__
 #define __fixel_filter_smooth_h__
 
+#include "types.h"
+#include "misc/bitset.h"
 #include "fixel/matrix.h"
 #include "fixel/filter/base.h"
 
@@ -48,6 +50,12 @@ namespace MR
        * smooth_filter (fixel_data_in, fixel_data_out);
        *
        * \endcode
+       *
+       * The combined connectivity and spatial weights of all neighbouring
+       * fixels are computed once upon construction (or upon changing the
+       * FWHM), and stored as a sparse kernel in compressed sparse row
+       * format; applying the filter to multiple data files at once then
+       * requires only a single pass over this kernel.
        */
 
       class Smooth : public Base
@@ -72,6 +80,11 @@ namespace MR
           void set_fwhm (const float fwhm);
 
           void operator() (Image<float>& input, Image<float>& output) const override;
+          void operator() (vector<Image<float>>& inputs, vector<Image<float>>& outputs) const override;
+
+          // One row per fixel, one column per data file
+          using data_matrix_type = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+          void operator() (const data_matrix_type& input, data_matrix_type& output) const;
 
         protected:
           Image<bool> mask_image;
@@ -79,6 +92,16 @@ namespace MR
           vector<Eigen::Vector3f> fixel_positions;
           float stdev, gaussian_const1, gaussian_const2, threshold;
 
+          // Smoothing kernel in compressed sparse row format:
+          //   weights of neighbours of fixel i are stored in
+          //   [kernel_offsets[i], kernel_offsets[i+1])
+          vector<size_t> kernel_offsets;
+          vector<index_type> kernel_indices;
+          vector<float> kernel_weights;
+          BitSet kernel_mask, kernel_disconnected;
+
+          void build_kernel();
+
       };
     //! @}
 
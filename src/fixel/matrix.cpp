@@ -17,7 +17,10 @@
 
 #include "fixel/matrix.h"
 
+#include "algo/loop.h"
 #include "app.h"
+#include "raw.h"
+#include "signal_handler.h"
 #include "thread_queue.h"
 #include "types.h"
 #include "file/ofstream.h"
@@ -123,11 +126,7 @@ namespace MR
 
 
 
-      init_matrix_type generate (
-          const std::string& track_filename,
-          Image<index_type>& index_image,
-          Image<bool>& fixel_mask,
-          const float angular_threshold)
+      namespace
       {
 
         class TrackProcessor { MEMALIGN(TrackProcessor)
@@ -148,9 +147,7 @@ namespace MR
                              vector<index_type>& out) const
             {
               using direction_type = Eigen::Vector3d;
-              using SetVoxelDir = DWI::Tractography::Mapping::SetVoxelDir;
 
-              SetVoxelDir in;
               mapper (tck, in);
 
               // For each voxel tract tangent, assign to a fixel
@@ -190,41 +187,68 @@ namespace MR
             }
 
           private:
-            const DWI::Tractography::Mapping::TrackMapperBase& mapper;
+            // Each thread requires its own copy of the mapper, as the upsampler is not thread-safe
+            const DWI::Tractography::Mapping::TrackMapperBase mapper;
             mutable Image<index_type> fixel_indexer;
             mutable Image<default_type> fixel_directions;
             mutable Image<bool> fixel_mask;
             const default_type angular_threshold_dp;
+            // Re-used between streamlines to avoid repeated memory allocation
+            mutable DWI::Tractography::Mapping::SetVoxelDir in;
         };
 
 
-        auto directions_image = Fixel::find_directions_header (Path::dirname (index_image.name())).template get_image<default_type>().with_direct_io ({+2,+1});
-        DWI::Tractography::Properties properties;
-        DWI::Tractography::Reader<float> track_file (track_filename, properties);
-        const uint32_t num_tracks = properties["count"].empty() ? 0 : to<uint32_t>(properties["count"]);
-        DWI::Tractography::Mapping::TrackLoader loader (track_file, num_tracks, "computing fixel-fixel connectivity matrix");
-        DWI::Tractography::Mapping::TrackMapperBase mapper (index_image);
-        mapper.set_upsample_ratio (DWI::Tractography::Mapping::determine_upsample_ratio (index_image, properties, 0.333f));
-        mapper.set_use_precise_mapping (true);
-        TrackProcessor track_processor (mapper, index_image, directions_image, fixel_mask, angular_threshold);
+
+        // Map all streamlines to the set of fixels traversed by each; the sink
+        //   receives one sorted vector of fixel indices per streamline
+        template <class SinkType>
+        void map_streamlines (const std::string& track_filename,
+                              Image<index_type>& index_image,
+                              Image<bool>& fixel_mask,
+                              const float angular_threshold,
+                              SinkType&& sink)
+        {
+          auto directions_image = Fixel::find_directions_header (Path::dirname (index_image.name())).template get_image<default_type>().with_direct_io ({+2,+1});
+          DWI::Tractography::Properties properties;
+          DWI::Tractography::Reader<float> track_file (track_filename, properties);
+          const uint32_t num_tracks = properties["count"].empty() ? 0 : to<uint32_t>(properties["count"]);
+          DWI::Tractography::Mapping::TrackLoader loader (track_file, num_tracks, "computing fixel-fixel connectivity matrix");
+          DWI::Tractography::Mapping::TrackMapperBase mapper (index_image);
+          mapper.set_upsample_ratio (DWI::Tractography::Mapping::determine_upsample_ratio (index_image, properties, 0.333f));
+          mapper.set_use_precise_mapping (true);
+          TrackProcessor track_processor (mapper, index_image, directions_image, fixel_mask, angular_threshold);
+          Thread::run_queue (loader,
+                             Thread::batch (DWI::Tractography::Streamline<float>()),
+                             Thread::multi (track_processor),
+                             Thread::batch (vector<index_type>()),
+                             std::forward<SinkType> (sink));
+        }
+
+      }
+
+
+
+      init_matrix_type generate (
+          const std::string& track_filename,
+          Image<index_type>& index_image,
+          Image<bool>& fixel_mask,
+          const float angular_threshold)
+      {
         init_matrix_type connectivity_matrix (Fixel::get_number_of_fixels (index_image));
-        Thread::run_queue (loader,
-                           Thread::batch (DWI::Tractography::Streamline<float>()),
-                           track_processor,
-                           Thread::batch (vector<index_type>()),
-                           // Inline lambda function for receiving streamline fixel visitations and
-                           //   updating the connectivity matrix
-                           [&] (const vector<index_type>& fixels)
-                           {
-                             try {
-                               for (auto f : fixels)
-                                 connectivity_matrix[f].add (fixels);
-                               return true;
-                             } catch (...) {
-                               throw Exception ("Error assigning memory for CFE connectivity matrix");
-                               return false;
-                             }
-                           });
+        map_streamlines (track_filename, index_image, fixel_mask, angular_threshold,
+                         // Inline lambda function for receiving streamline fixel visitations and
+                         //   updating the connectivity matrix
+                         [&] (const vector<index_type>& fixels)
+                         {
+                           try {
+                             for (auto f : fixels)
+                               connectivity_matrix[f].add (fixels);
+                             return true;
+                           } catch (...) {
+                             throw Exception ("Error assigning memory for CFE connectivity matrix");
+                             return false;
+                           }
+                         });
         return connectivity_matrix;
       }
 
@@ -232,12 +256,77 @@ namespace MR
 
 
 
-      void normalise_and_write (init_matrix_type& matrix,
-                                const connectivity_value_type threshold,
-                                const std::string& path,
-                                const KeyValues& keyvals)
+      namespace
       {
 
+        const char csr_magic[] = "mrtrix fixel csr";
+        constexpr size_t csr_magic_size = 16;
+        constexpr size_t csr_header_size = 64;
+        constexpr uint32_t csr_version = 1;
+        constexpr uint32_t csr_encoding_float32 = 0;
+        constexpr uint32_t csr_encoding_uint16 = 1;
+
+        const std::string mif_leadin = "mrtrix image\ndim: ";
+        // Need enough space for the largest possible 64-bit unsigned integer,
+        //   plus ",1,1" for the two dummy axes
+        const size_t mif_dim_padding = std::log10 (std::numeric_limits<size_t>::max()) + 4;
+
+
+
+        // Normalise the connectivity of one fixel by its streamline count, and
+        //   retain only those connections surviving the threshold
+        void normalise_fixel (const InitFixel& fixel,
+                              const connectivity_value_type threshold,
+                              vector<index_type>& fixel_buffer,
+                              vector<connectivity_value_type>& value_buffer)
+        {
+          fixel_buffer.clear();
+          value_buffer.clear();
+          fixel_buffer.reserve (fixel.size());
+          value_buffer.reserve (fixel.size());
+          const connectivity_value_type normalisation_factor = connectivity_value_type(1) / connectivity_value_type (fixel.count());
+          for (auto& it : fixel) {
+            const connectivity_value_type connectivity = normalisation_factor * it.value();
+            if (connectivity >= threshold) {
+              fixel_buffer.push_back (it.index());
+              value_buffer.push_back (connectivity);
+            }
+          }
+        }
+
+
+
+        FORCE_INLINE void write_varint (uint64_t value, vector<uint8_t>& data)
+        {
+          while (value >= 0x80) {
+            data.push_back (uint8_t(value) | 0x80);
+            value >>= 7;
+          }
+          data.push_back (uint8_t(value));
+        }
+
+        FORCE_INLINE uint64_t zigzag_encode (const int64_t value)
+        {
+          return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+        }
+
+      }
+
+
+
+      Writer::Writer (const std::string& path,
+                      const size_t num_fixels,
+                      const format_type format,
+                      const KeyValues& keyvals) :
+          path (path),
+          num_fixels (num_fixels),
+          format (format),
+          next_fixel (0),
+          data_count (0),
+          csr_position (0),
+          csr_row_table_offset (0),
+          csr_data_offset (0)
+      {
         if (Path::exists (path)) {
           if (!Path::is_dir (path)) {
             if (App::overwrite_files) {
@@ -250,101 +339,620 @@ namespace MR
           File::mkdir (path);
         }
 
-        Header index_header;
-        index_header.ndim() = 4;
-        index_header.size(0) = matrix.size();
-        index_header.size(1) = 1;
-        index_header.size(2) = 1;
-        index_header.size(3) = 2;
-        index_header.stride(0) = 2;
-        index_header.stride(1) = 3;
-        index_header.stride(2) = 4;
-        index_header.stride(3) = 1;
-        index_header.spacing(0) = index_header.spacing(1) = index_header.spacing(2) = 1.0;
-        index_header.transform() = transform_type::Identity();
-        index_header.keyval() = keyvals;
-        index_header.keyval()["nfixels"] = str(matrix.size());
-        index_header.datatype() = DataType::from<index_image_type>();
-        Image<index_image_type> index_image = Image<index_image_type>::create (Path::join (path, "index.mif"), index_header);
-
-        // Can't use function write_mrtrix_header() as the file offset of the
-        //   first entry of the "dim" field needs to be known
-        //   (and enough space needs to be left to fill in a large number upon completion)
-        File::OFStream fixel_stream (Path::join (path, "fixels.mif"), std::ios_base::out | std::ios_base::binary);
-        File::OFStream value_stream (Path::join (path, "values.mif"), std::ios_base::out | std::ios_base::binary);
-
-        const std::string leadin = "mrtrix image\ndim: ";
-        // Need enough space for the largest possible 64-bit unsigned integer,
-        //   plus ",1,1" for the two dummy axes
-        const size_t dim_padding = std::log10 (std::numeric_limits<size_t>::max()) + 4;
-
-        Eigen::IOFormat fmt(Eigen::FullPrecision, Eigen::DontAlignCols, ", ", "\ntransform: ", "", "", "\ntransform: ", "");
-
-        for (size_t stream_index = 0; stream_index != 2; ++stream_index) {
-          File::OFStream& stream (stream_index ? value_stream : fixel_stream);
-          stream << leadin << std::string (dim_padding, ' ') << "\n";
-          stream << "vox: 1,1,1\n";
-          stream << "layout: +0,+1,+2\n";
-          stream << "datatype: ";
-          if (stream_index)
-            stream << DataType::from<connectivity_value_type>().specifier();
-          else
-            stream << DataType::from<index_type>().specifier();
-          stream << transform_type::Identity().matrix().topLeftCorner(3,4).format(fmt) << "\n";
-          stream << "scaling: 0,1\n";
-          stream << "nfixels: " + str(matrix.size()) + "\n";
-          File::KeyValue::write (stream, keyvals, "", true);
-          stream << "file: ";
-          uint64_t offset = uint64_t(stream.tellp()) + 18;
-          offset += ((4 - (offset % 4)) % 4);
-          stream << ". " << offset << "\nEND\n";
-          stream << std::string (offset - uint64_t(stream.tellp()), '\0');
+        // Don't leave behind data from a matrix previously written in the other format,
+        //   as the Reader would then be unable to determine which to use
+        const vector<std::string> stale_files = (format == format_type::MIF) ?
+                                                vector<std::string> ({ "connectivity.csr" }) :
+                                                vector<std::string> ({ "index.mif", "fixels.mif", "values.mif" });
+        for (const auto& f : stale_files) {
+          const std::string stale_path = Path::join (path, f);
+          if (Path::exists (stale_path)) {
+            App::check_overwrite (stale_path);
+            File::remove (stale_path);
+          }
         }
 
+        if (format == format_type::MIF) {
+
+          Header index_header;
+          index_header.ndim() = 4;
+          index_header.size(0) = num_fixels;
+          index_header.size(1) = 1;
+          index_header.size(2) = 1;
+          index_header.size(3) = 2;
+          index_header.stride(0) = 2;
+          index_header.stride(1) = 3;
+          index_header.stride(2) = 4;
+          index_header.stride(3) = 1;
+          index_header.spacing(0) = index_header.spacing(1) = index_header.spacing(2) = 1.0;
+          index_header.transform() = transform_type::Identity();
+          index_header.keyval() = keyvals;
+          index_header.keyval()["nfixels"] = str(num_fixels);
+          index_header.datatype() = DataType::from<index_image_type>();
+          index_image = Image<index_image_type>::create (Path::join (path, "index.mif"), index_header);
+
+          // Can't use function write_mrtrix_header() as the file offset of the
+          //   first entry of the "dim" field needs to be known
+          //   (and enough space needs to be left to fill in a large number upon completion)
+          fixel_stream.reset (new File::OFStream (Path::join (path, "fixels.mif"), std::ios_base::out | std::ios_base::binary));
+          value_stream.reset (new File::OFStream (Path::join (path, "values.mif"), std::ios_base::out | std::ios_base::binary));
+
+          Eigen::IOFormat fmt(Eigen::FullPrecision, Eigen::DontAlignCols, ", ", "\ntransform: ", "", "", "\ntransform: ", "");
+
+          for (size_t stream_index = 0; stream_index != 2; ++stream_index) {
+            File::OFStream& stream (stream_index ? *value_stream : *fixel_stream);
+            stream << mif_leadin << std::string (mif_dim_padding, ' ') << "\n";
+            stream << "vox: 1,1,1\n";
+            stream << "layout: +0,+1,+2\n";
+            stream << "datatype: ";
+            if (stream_index)
+              stream << DataType::from<connectivity_value_type>().specifier();
+            else
+              stream << DataType::from<index_type>().specifier();
+            stream << transform_type::Identity().matrix().topLeftCorner(3,4).format(fmt) << "\n";
+            stream << "scaling: 0,1\n";
+            stream << "nfixels: " + str(num_fixels) + "\n";
+            File::KeyValue::write (stream, keyvals, "", true);
+            stream << "file: ";
+            uint64_t offset = uint64_t(stream.tellp()) + 18;
+            offset += ((4 - (offset % 4)) % 4);
+            stream << ". " << offset << "\nEND\n";
+            stream << std::string (offset - uint64_t(stream.tellp()), '\0');
+          }
+
+        } else {
+
+          std::stringstream keyval_stream;
+          for (const auto& kv : keyvals)
+            keyval_stream << kv.first << ": " << kv.second << "\n";
+          csr_keyvals = keyval_stream.str();
+          csr_row_table_offset = csr_header_size + ((csr_keyvals.size() + 7) & ~uint64_t(7));
+          csr_data_offset = csr_row_table_offset + (num_fixels+1) * sizeof(uint64_t) + num_fixels * sizeof(uint32_t);
+          csr_row_offsets.assign (num_fixels+1, 0);
+          csr_row_counts.assign (num_fixels, 0);
+
+          const std::string filename = Path::join (path, "connectivity.csr");
+          File::create (filename);
+          csr_stream.reset (new File::OFStream (filename, std::ios_base::out | std::ios_base::binary));
+          // Header and row table are written once all rows are complete
+          *csr_stream << std::string (csr_data_offset, '\0');
+          csr_position = csr_data_offset;
+
+        }
+      }
+
+
+
+      void Writer::add (const size_t fixel,
+                        const vector<index_type>& fixels,
+                        const vector<connectivity_value_type>& values)
+      {
+        assert (fixel >= next_fixel && fixel < num_fixels);
+        assert (fixels.size() == values.size());
+
+        if (format == format_type::MIF) {
+
+          index_image.index (0) = fixel;
+          index_image.index (3) = 0; index_image.value() = uint64_t(fixels.size());
+          index_image.index (3) = 1; index_image.value() = fixels.size() ? data_count : uint64_t(0);
+          fixel_stream->write (reinterpret_cast<const char*>(fixels.data()), fixels.size() * sizeof (index_type));
+          value_stream->write (reinterpret_cast<const char*>(values.data()), values.size() * sizeof (connectivity_value_type));
+
+        } else {
+
+          assert (std::is_sorted (fixels.begin(), fixels.end()));
+          const bool quantise = (format == format_type::CSR16);
+          const size_t value_size = quantise ? sizeof(uint16_t) : sizeof(float);
+          for (; next_fixel != fixel; ++next_fixel)
+            csr_row_offsets[next_fixel] = csr_position;
+          row_data.clear();
+          int64_t previous = fixel;
+          for (size_t i = 0; i != fixels.size(); ++i) {
+            if (i)
+              write_varint (uint64_t(fixels[i] - previous), row_data);
+            else
+              write_varint (zigzag_encode (int64_t(fixels[i]) - previous), row_data);
+            previous = fixels[i];
+          }
+          while ((csr_position + row_data.size()) % value_size)
+            row_data.push_back (0);
+          const size_t value_start = row_data.size();
+          row_data.resize (value_start + values.size() * value_size);
+          for (size_t i = 0; i != values.size(); ++i) {
+            if (quantise)
+              Raw::store_LE<uint16_t> (uint16_t (std::round (std::min (std::max (values[i], 0.0f), 1.0f) * 65535.0f)), row_data.data() + value_start, i);
+            else
+              Raw::store_LE<float> (values[i], row_data.data() + value_start, i);
+          }
+          csr_stream->write (reinterpret_cast<const char*>(row_data.data()), row_data.size());
+          csr_row_offsets[fixel] = csr_position;
+          csr_row_counts[fixel] = fixels.size();
+          csr_position += row_data.size();
+
+        }
+
+        data_count += fixels.size();
+        next_fixel = fixel + 1;
+      }
+
+
+
+      void Writer::finalise()
+      {
+        if (format == format_type::MIF) {
+
+          // Update headers to reflect the number of fixel-fixel connections
+          std::string dim_string = str(data_count) + ",1,1";
+          dim_string += std::string (mif_dim_padding - dim_string.size(), ' ');
+          for (size_t stream_index = 0; stream_index != 2; ++stream_index) {
+            File::OFStream& stream (stream_index ? *value_stream : *fixel_stream);
+            stream.seekp (mif_leadin.size());
+            stream << dim_string;
+          }
+          fixel_stream.reset();
+          value_stream.reset();
+          index_image = Image<index_image_type>();
+
+        } else {
+
+          for (; next_fixel != num_fixels+1; ++next_fixel)
+            csr_row_offsets[next_fixel] = csr_position;
+
+          uint8_t header[csr_header_size];
+          memset (header, 0, csr_header_size);
+          memcpy (header, csr_magic, csr_magic_size);
+          Raw::store_LE<uint32_t> (csr_version, header + 16);
+          Raw::store_LE<uint32_t> (format == format_type::CSR16 ? csr_encoding_uint16 : csr_encoding_float32, header + 20);
+          Raw::store_LE<uint64_t> (num_fixels, header + 24);
+          Raw::store_LE<uint64_t> (data_count, header + 32);
+          Raw::store_LE<uint64_t> (csr_keyvals.size(), header + 40);
+          Raw::store_LE<uint64_t> (csr_row_table_offset, header + 48);
+          Raw::store_LE<uint64_t> (csr_data_offset, header + 56);
+          for (auto& i : csr_row_offsets)
+            i = ByteOrder::LE (i);
+          for (auto& i : csr_row_counts)
+            i = ByteOrder::LE (i);
+          csr_stream->seekp (0);
+          csr_stream->write (reinterpret_cast<const char*>(header), csr_header_size);
+          csr_stream->write (csr_keyvals.c_str(), csr_keyvals.size());
+          csr_stream->seekp (csr_row_table_offset);
+          csr_stream->write (reinterpret_cast<const char*>(csr_row_offsets.data()), csr_row_offsets.size() * sizeof(uint64_t));
+          csr_stream->write (reinterpret_cast<const char*>(csr_row_counts.data()), csr_row_counts.size() * sizeof(uint32_t));
+          if (!csr_stream->good())
+            throw Exception ("Error writing fixel-fixel connectivity matrix file \"" + Path::join (path, "connectivity.csr") + "\"");
+          csr_stream.reset();
+          vector<uint64_t>().swap (csr_row_offsets);
+          vector<uint32_t>().swap (csr_row_counts);
+
+        }
+      }
+
+
+
+
+
+
+      void normalise_and_write (init_matrix_type& matrix,
+                                const connectivity_value_type threshold,
+                                const std::string& path,
+                                const format_type format,
+                                const KeyValues& keyvals)
+      {
+        Writer writer (path, matrix.size(), format, keyvals);
         ProgressBar progress ("Normalising and writing fixel-fixel connectivity matrix to directory \"" + path + "\"", matrix.size());
-        size_t data_count = 0;
         vector<index_type> fixel_buffer;
         vector<connectivity_value_type> value_buffer;
         for (size_t fixel_index = 0; fixel_index != matrix.size(); ++fixel_index) {
+          normalise_fixel (matrix[fixel_index], threshold, fixel_buffer, value_buffer);
+          writer.add (fixel_index, fixel_buffer, value_buffer);
+          // Force deallocation of memory used for this fixel in the generated matrix
+          InitFixel().swap (matrix[fixel_index]);
+          ++progress;
+        }
+        writer.finalise();
+      }
 
-          fixel_buffer.clear();
-          value_buffer.clear();
-          fixel_buffer.reserve (matrix[fixel_index].size());
-          value_buffer.reserve (matrix[fixel_index].size());
 
-          const connectivity_value_type normalisation_factor = connectivity_value_type(1) / connectivity_value_type (matrix[fixel_index].count());
-          for (auto& it : matrix[fixel_index]) {
-            const connectivity_value_type connectivity = normalisation_factor * it.value();
-            if (connectivity >= threshold) {
-              fixel_buffer.push_back (it.index());
-              value_buffer.push_back (connectivity);
+
+
+
+
+
+      namespace
+      {
+
+        // One entry of the fixel-fixel connectivity matrix prior to normalisation,
+        //   as stored in the temporary files
+        class Connection
+        { NOMEMALIGN
+          public:
+            fixel_index_type row, column;
+            count_type count;
+            FORCE_INLINE bool operator< (const Connection& that) const {
+              return row < that.row || (row == that.row && column < that.column);
             }
-          }
+        };
 
-          index_image.index (0) = fixel_index;
-          index_image.index (3) = 0; index_image.value() = uint64_t(fixel_buffer.size());
-          index_image.index (3) = 1; index_image.value() = fixel_buffer.size() ? data_count : uint64_t(0);
+        // Maximal number of temporary files to be read simultaneously
+        constexpr size_t max_merge_inputs = 256;
+        // Number of entries buffered for each temporary file being read or written
+        constexpr size_t run_buffer_size = 65536;
 
-          fixel_stream.write (reinterpret_cast<const char*>(fixel_buffer.data()), fixel_buffer.size() * sizeof (index_type));
-          value_stream.write (reinterpret_cast<const char*>(value_buffer.data()), value_buffer.size() * sizeof (connectivity_value_type));
 
-          data_count += fixel_buffer.size();
 
-          // Force deallocation of memory used for this fixel in the generated matrix
-          InitFixel().swap (matrix[fixel_index]);
+        void remove_run (const std::string& path)
+        {
+          std::remove (path.c_str());
+          SignalHandler::unmark_file_for_deletion (path);
+        }
 
-          ++progress;
+
+
+        // The temporary file is deleted on destruction unless it has been
+        //   finalised, in which case responsibility for it is transferred
+        //   to the caller
+        class RunWriter
+        { MEMALIGN(RunWriter)
+          public:
+            RunWriter () :
+                path (File::create_tempfile (0, "dat")),
+                finalised (false)
+            {
+              SignalHandler::mark_file_for_deletion (path);
+              out.open (path, std::ios_base::out | std::ios_base::binary);
+              buffer.reserve (run_buffer_size);
+            }
+            ~RunWriter()
+            {
+              if (!finalised) {
+                out.close();
+                remove_run (path);
+              }
+            }
+            void operator() (const Connection& c) {
+              buffer.push_back (c);
+              if (buffer.size() == run_buffer_size)
+                flush();
+            }
+            std::string finalise() {
+              flush();
+              out.close();
+              if (!out)
+                throw Exception ("Error writing temporary file \"" + path + "\" during fixel-fixel connectivity matrix construction");
+              finalised = true;
+              return path;
+            }
+          private:
+            const std::string path;
+            bool finalised;
+            File::OFStream out;
+            vector<Connection> buffer;
+            void flush() {
+              out.write (reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof (Connection));
+              buffer.clear();
+            }
+        };
+
+
+
+        // Accumulation of fixel-fixel connectivity from a subset of streamlines
+        class PartialMatrix
+        { MEMALIGN(PartialMatrix)
+          public:
+            PartialMatrix (const size_t num_fixels) :
+                rows (num_fixels),
+                bytes (0) { }
+
+            void add (const vector<index_type>& fixels)
+            {
+              for (auto f : fixels) {
+                const size_t old_capacity = rows[f].capacity();
+                rows[f].add (fixels);
+                bytes += (rows[f].capacity() - old_capacity) * sizeof (InitElement);
+              }
+            }
+
+            // Includes the per-fixel storage, which is retained when spilling
+            size_t memory() const { return rows.size() * sizeof (InitFixel) + bytes; }
+
+            // Write the contents to a temporary file as a sorted run,
+            //   and release the memory
+            std::string spill()
+            {
+              RunWriter writer;
+              Connection c;
+              for (size_t row = 0; row != rows.size(); ++row) {
+                c.row = row;
+                for (const auto& e : rows[row]) {
+                  c.column = e.index();
+                  c.count = e.value();
+                  writer (c);
+                }
+                InitFixel().swap (rows[row]);
+              }
+              bytes = 0;
+              return writer.finalise();
+            }
+
+            const init_matrix_type& data() const { return rows; }
+
+          private:
+            init_matrix_type rows;
+            size_t bytes;
+        };
+
+
+
+        // Ownership of partial matrices and temporary files across threads
+        class RunStore
+        { MEMALIGN(RunStore)
+          public:
+            RunStore (const size_t num_fixels, const size_t memory_limit) :
+                num_fixels (num_fixels),
+                limit_per_thread (std::max (size_t(1), memory_limit / std::max (size_t(1), Thread::threads_to_execute())))
+            {
+              const size_t fixed_memory = num_fixels * sizeof (InitFixel);
+              if (limit_per_thread <= fixed_memory)
+                WARN ("Memory limit per thread (" + str(limit_per_thread) + " bytes) does not exceed that required "
+                      "to index all fixels (" + str(fixed_memory) + " bytes); "
+                      "temporary files will be written after every streamline");
+            }
+            ~RunStore()
+            {
+              for (const auto& path : files)
+                remove_run (path);
+            }
+
+            PartialMatrix& create()
+            {
+              std::lock_guard<std::mutex> lock (mutex);
+              partials.emplace_back (new PartialMatrix (num_fixels));
+              return *partials.back();
+            }
+
+            void spill (PartialMatrix& partial)
+            {
+              const std::string path = partial.spill();
+              std::lock_guard<std::mutex> lock (mutex);
+              files.push_back (path);
+            }
+
+            const size_t num_fixels, limit_per_thread;
+            vector<std::unique_ptr<PartialMatrix>> partials;
+            vector<std::string> files;
+
+          private:
+            std::mutex mutex;
+        };
+
+
+
+        class Accumulator
+        { MEMALIGN(Accumulator)
+          public:
+            Accumulator (RunStore& store) :
+                store (store),
+                partial (nullptr) { }
+            Accumulator (const Accumulator& that) :
+                store (that.store),
+                partial (nullptr) { }
+
+            bool operator() (const vector<index_type>& fixels)
+            {
+              if (!partial)
+                partial = &store.create();
+              try {
+                partial->add (fixels);
+              } catch (std::bad_alloc&) {
+                throw Exception ("Error assigning memory for fixel-fixel connectivity matrix");
+              }
+              if (partial->memory() > store.limit_per_thread)
+                store.spill (*partial);
+              return true;
+            }
+
+          private:
+            RunStore& store;
+            PartialMatrix* partial;
+        };
+
+
+
+        // Sources of sorted matrix entries for merging
+        class RunSource
+        { NOMEMALIGN
+          public:
+            virtual ~RunSource() { }
+            // Advance to the next entry; returns false once exhausted
+            virtual bool next() = 0;
+            Connection current;
+        };
+
+        class FileRunSource : public RunSource
+        { MEMALIGN(FileRunSource)
+          public:
+            FileRunSource (const std::string& path) :
+                path (path),
+                in (path, std::ios_base::in | std::ios_base::binary),
+                buffer (run_buffer_size),
+                position (0),
+                filled (0)
+            {
+              if (!in)
+                throw Exception ("Error opening temporary file \"" + path + "\" during fixel-fixel connectivity matrix construction");
+            }
+            bool next() override
+            {
+              if (position == filled) {
+                in.read (reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof (Connection));
+                filled = in.gcount() / sizeof (Connection);
+                position = 0;
+                if (!filled)
+                  return false;
+              }
+              current = buffer[position++];
+              return true;
+            }
+          private:
+            const std::string path;
+            std::ifstream in;
+            vector<Connection> buffer;
+            size_t position, filled;
+        };
+
+        class PartialRunSource : public RunSource
+        { MEMALIGN(PartialRunSource)
+          public:
+            PartialRunSource (const PartialMatrix& partial) :
+                rows (partial.data()),
+                row (0),
+                element (0) { }
+            bool next() override
+            {
+              while (row != rows.size() && element == rows[row].size()) {
+                ++row;
+                element = 0;
+              }
+              if (row == rows.size())
+                return false;
+              current.row = row;
+              current.column = rows[row][element].index();
+              current.count = rows[row][element].value();
+              ++element;
+              return true;
+            }
+          private:
+            const init_matrix_type& rows;
+            size_t row, element;
+        };
+
+
+
+        // Merge sorted sources, combining the counts of matching entries
+        template <class Functor>
+        void merge_runs (vector<std::unique_ptr<RunSource>>& sources, Functor&& functor)
+        {
+          auto compare = [&] (const size_t a, const size_t b) { return sources[b]->current < sources[a]->current; };
+          vector<size_t> heap;
+          for (size_t i = 0; i != sources.size(); ++i) {
+            if (sources[i]->next())
+              heap.push_back (i);
+          }
+          std::make_heap (heap.begin(), heap.end(), compare);
+          Connection pending;
+          bool have_pending = false;
+          while (heap.size()) {
+            std::pop_heap (heap.begin(), heap.end(), compare);
+            const Connection& c (sources[heap.back()]->current);
+            if (have_pending && pending.row == c.row && pending.column == c.column) {
+              pending.count += c.count;
+            } else {
+              if (have_pending)
+                functor (pending);
+              pending = c;
+              have_pending = true;
+            }
+            if (sources[heap.back()]->next())
+              std::push_heap (heap.begin(), heap.end(), compare);
+            else
+              heap.pop_back();
+          }
+          if (have_pending)
+            functor (pending);
         }
 
-        // Update headers to reflect the number of fixel-fixel connections
-        std::string dim_string = str(data_count) + ",1,1";
-        dim_string += std::string (dim_padding - dim_string.size(), ' ');
-        for (size_t stream_index = 0; stream_index != 2; ++stream_index) {
-          File::OFStream& stream (stream_index ? value_stream : fixel_stream);
-          stream.seekp (leadin.size());
-          stream << dim_string;
+      }
+
+
+
+      void generate_and_write (const std::string& track_filename,
+                               Image<index_type>& index_image,
+                               Image<bool>& fixel_mask,
+                               const float angular_threshold,
+                               const connectivity_value_type threshold,
+                               const std::string& path,
+                               const size_t memory_limit,
+                               const format_type format,
+                               const KeyValues& keyvals)
+      {
+        const size_t num_fixels = Fixel::get_number_of_fixels (index_image);
+        RunStore store (num_fixels, memory_limit);
+        Accumulator accumulator (store);
+        map_streamlines (track_filename, index_image, fixel_mask, angular_threshold, Thread::multi (accumulator));
+
+        if (store.files.size())
+          INFO ("Fixel-fixel connectivity matrix written to " + str(store.files.size()) + " temporary files during construction");
+
+        // Reduce the number of temporary files to be merged in the final pass if necessary
+        while (store.files.size() > max_merge_inputs) {
+          const vector<std::string> inputs (store.files.begin(), store.files.begin() + max_merge_inputs);
+          vector<std::unique_ptr<RunSource>> sources;
+          for (const auto& f : inputs)
+            sources.emplace_back (new FileRunSource (f));
+          RunWriter writer;
+          merge_runs (sources, writer);
+          store.files.push_back (writer.finalise());
+          sources.clear();
+          for (const auto& f : inputs)
+            remove_run (f);
+          store.files.erase (store.files.begin(), store.files.begin() + max_merge_inputs);
         }
 
+        vector<std::unique_ptr<RunSource>> sources;
+        for (const auto& f : store.files)
+          sources.emplace_back (new FileRunSource (f));
+        for (const auto& p : store.partials)
+          sources.emplace_back (new PartialRunSource (*p));
+
+        Writer writer (path, num_fixels, format, keyvals);
+        ProgressBar progress ("Normalising and writing fixel-fixel connectivity matrix to directory \"" + path + "\"", num_fixels);
+        size_t progress_count = 0;
+        size_t current_row = num_fixels;
+        count_type track_count = 0;
+        vector<fixel_index_type> row_fixels;
+        vector<count_type> row_counts;
+        vector<index_type> fixel_buffer;
+        vector<connectivity_value_type> value_buffer;
+
+        // Every streamline traversing a fixel contributes to the diagonal element of
+        //   the matrix, so this provides the streamline count for normalisation
+        auto write_row = [&] ()
+        {
+          fixel_buffer.clear();
+          value_buffer.clear();
+          const connectivity_value_type normalisation_factor = connectivity_value_type(1) / connectivity_value_type (track_count);
+          for (size_t i = 0; i != row_fixels.size(); ++i) {
+            const connectivity_value_type connectivity = normalisation_factor * row_counts[i];
+            if (connectivity >= threshold) {
+              fixel_buffer.push_back (row_fixels[i]);
+              value_buffer.push_back (connectivity);
+            }
+          }
+          writer.add (current_row, fixel_buffer, value_buffer);
+        };
+
+        merge_runs (sources, [&] (const Connection& c)
+        {
+          if (c.row != current_row) {
+            if (current_row != num_fixels)
+              write_row();
+            current_row = c.row;
+            row_fixels.clear();
+            row_counts.clear();
+            track_count = 0;
+            for (; progress_count != current_row; ++progress_count)
+              ++progress;
+          }
+          if (c.column == c.row)
+            track_count = c.count;
+          row_fixels.push_back (c.column);
+          row_counts.push_back (c.count);
+        });
+        if (current_row != num_fixels)
+          write_row();
+        for (; progress_count != num_fixels; ++progress_count)
+          ++progress;
+        writer.finalise();
       }
 
 
@@ -361,20 +969,57 @@ namespace MR
 
       Reader::Reader (const std::string& path, const Image<bool>& mask) :
           directory (path),
-          mask_image (mask)
+          num_fixels (0),
+          mask_image (mask),
+          csr_quantised (false),
+          csr_row_table (nullptr)
       {
         try {
-          index_image = Image<index_image_type>::open (Path::join (directory, "index.mif"));
-          if (index_image.ndim() != 4)
-            throw Exception ("Fixel-fixel connectivity matrix index image must be 4D");
-          if (index_image.size (1) != 1 || index_image.size (2) != 1 || index_image.size (3) != 2)
-            throw Exception ("Fixel-fixel connectivity matrix index image must have size Nx1x1x2");
-          fixel_image = Image<fixel_index_type>::open (Path::join (directory, "fixels.mif"));
-          value_image = Image<connectivity_value_type>::open (Path::join (directory, "values.mif"));
-          if (value_image.size (0) != fixel_image.size (0))
-            throw Exception ("Number of fixels in value image (" + str(value_image.size (0)) + ") does not match number of fixels in fixel image (" + str(fixel_image.size (0)) + ")");
+          const std::string csr_path = Path::join (directory, "connectivity.csr");
+          if (Path::exists (csr_path)) {
+            csr.reset (new File::MMap (File::Entry (csr_path)));
+            const uint8_t* const base = csr->address();
+            const uint64_t file_size = csr->size();
+            if (file_size < csr_header_size || memcmp (base, csr_magic, csr_magic_size))
+              throw Exception ("File \"" + csr_path + "\" is not a fixel-fixel connectivity matrix");
+            if (Raw::fetch_LE<uint32_t> (base + 16) != csr_version)
+              throw Exception ("Unsupported version of fixel-fixel connectivity matrix file format");
+            const uint32_t encoding = Raw::fetch_LE<uint32_t> (base + 20);
+            if (encoding != csr_encoding_float32 && encoding != csr_encoding_uint16)
+              throw Exception ("Unsupported encoding of fixel-fixel connectivity values");
+            csr_quantised = (encoding == csr_encoding_uint16);
+            num_fixels = Raw::fetch_LE<uint64_t> (base + 24);
+            const uint64_t row_table_offset = Raw::fetch_LE<uint64_t> (base + 48);
+            const uint64_t data_offset = Raw::fetch_LE<uint64_t> (base + 56);
+            if (row_table_offset % sizeof(uint64_t) ||
+                data_offset != row_table_offset + (num_fixels+1) * sizeof(uint64_t) + num_fixels * sizeof(uint32_t) ||
+                data_offset > file_size)
+              throw Exception ("Malformed row table");
+            csr_row_table = base + row_table_offset;
+            if (Raw::fetch_LE<uint64_t> (csr_row_table, num_fixels) > file_size)
+              throw Exception ("File is truncated");
+          } else {
+            index_image = Image<index_image_type>::open (Path::join (directory, "index.mif"));
+            if (index_image.ndim() != 4)
+              throw Exception ("Fixel-fixel connectivity matrix index image must be 4D");
+            if (index_image.size (1) != 1 || index_image.size (2) != 1 || index_image.size (3) != 2)
+              throw Exception ("Fixel-fixel connectivity matrix index image must have size Nx1x1x2");
+            fixel_image = Image<fixel_index_type>::open (Path::join (directory, "fixels.mif"));
+            value_image = Image<connectivity_value_type>::open (Path::join (directory, "values.mif"));
+            if (value_image.size (0) != fixel_image.size (0))
+              throw Exception ("Number of fixels in value image (" + str(value_image.size (0)) + ") does not match number of fixels in fixel image (" + str(fixel_image.size (0)) + ")");
+            num_fixels = index_image.size (0);
+          }
           if (mask_image.valid() && size_t(mask_image.size (0)) != size())
             throw Exception ("Fixel image \"" + mask_image.name() + "\" has different number of fixels (" + str(mask_image.size (0)) + ") to fixel-fixel connectivity matrix (" + str(size()) + ")");
+          if (csr && mask_image.valid()) {
+            csr_mask = std::make_shared<BitSet> (num_fixels);
+            Image<bool> mask (mask_image);
+            for (auto l = Loop (0) (mask); l; ++l) {
+              if (mask.value())
+                (*csr_mask)[mask.index (0)] = true;
+            }
+          }
         } catch (Exception& e) {
           throw Exception (e, "Unable to load path \"" + directory + "\" as fixel-fixel connectivity data");
         }
@@ -392,6 +1037,16 @@ namespace MR
 
       NormFixel Reader::operator[] (const size_t i) const
       {
+        if (csr) {
+          NormFixel result;
+          connectivity_value_type sum (connectivity_value_type (0));
+          for (const auto& c : row (i)) {
+            result.push_back (c);
+            sum += c.value();
+          }
+          result.normalise (sum);
+          return result;
+        }
         // For thread-safety
         Image<index_image_type> index (index_image);
         Image<fixel_index_type> fixel (fixel_image);
@@ -434,10 +1089,27 @@ namespace MR
 
 
 
+      MappedRow Reader::row (const size_t i) const
+      {
+        assert (csr);
+        if (csr_mask && !(*csr_mask)[i])
+          return MappedRow();
+        const size_t num_connections = size (i);
+        const uint8_t* const base = csr->address();
+        const size_t value_size = csr_quantised ? sizeof(uint16_t) : sizeof(float);
+        // Connectivity values are stored at the end of each row
+        const uint8_t* const values = base + Raw::fetch_LE<uint64_t> (csr_row_table, i+1) - num_connections * value_size;
+        return MappedRow (i, num_connections, base + Raw::fetch_LE<uint64_t> (csr_row_table, i), values, csr_quantised, csr_mask.get());
+      }
+
+
+
 
 
       size_t Reader::size (const size_t fixel) const
       {
+        if (csr)
+          return Raw::fetch_LE<uint32_t> (csr_row_table + (num_fixels+1) * sizeof(uint64_t), fixel);
         // For thread-safety
         Image<index_image_type> index (index_image);
         index.index (0) = fixel;
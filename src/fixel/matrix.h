@@ -19,9 +19,12 @@
 #define __fixel_matrix_h__
 
 #include "image.h"
+#include "raw.h"
 #include "types.h"
+#include "file/mmap.h"
 #include "file/ofstream.h"
 #include "fixel/index_remapper.h"
+#include "misc/bitset.h"
 
 namespace MR
 {
@@ -138,6 +141,118 @@ namespace MR
 
 
 
+      // Decoding of the variable-length integers used to store fixel indices
+      //   within the single-file CSR format (see below)
+      FORCE_INLINE uint64_t read_varint (const uint8_t*& ptr)
+      {
+        uint64_t value = 0;
+        for (size_t shift = 0; ; shift += 7) {
+          const uint8_t byte = *ptr++;
+          value |= uint64_t(byte & 0x7F) << shift;
+          if (!(byte & 0x80))
+            return value;
+        }
+      }
+
+      FORCE_INLINE int64_t zigzag_decode (const uint64_t value)
+      {
+        return int64_t(value >> 1) ^ -int64_t(value & 1);
+      }
+
+
+
+      // View of the connectivity of a single fixel within a matrix stored in the
+      //   single-file CSR format, reading directly from the memory-mapped file:
+      //   the connectivity values are a contiguous array, whereas the connected
+      //   fixel indices are delta-coded and are therefore decoded during iteration.
+      //   Connections to fixels outside of the mask (if any) are skipped.
+      class MappedRow
+      { NOMEMALIGN
+        public:
+          MappedRow () :
+              fixel (0),
+              num_connections (0),
+              indices (nullptr),
+              values (nullptr),
+              quantised (false),
+              mask (nullptr) { }
+          MappedRow (const size_t fixel,
+                     const size_t num_connections,
+                     const uint8_t* indices,
+                     const uint8_t* values,
+                     const bool quantised,
+                     const BitSet* mask) :
+              fixel (fixel),
+              num_connections (num_connections),
+              indices (indices),
+              values (values),
+              quantised (quantised),
+              mask (mask) { }
+
+          class const_iterator
+          { NOMEMALIGN
+            public:
+              const_iterator (const MappedRow& row, const size_t n) :
+                  num_connections (row.num_connections),
+                  ptr (row.indices),
+                  values (row.values),
+                  quantised (row.quantised),
+                  mask (row.mask),
+                  n (n),
+                  fixel (row.fixel) { seek(); }
+              FORCE_INLINE const_iterator& operator++() { ++n; seek(); return *this; }
+              FORCE_INLINE bool operator!= (const const_iterator& that) const { return n != that.n; }
+              FORCE_INLINE NormElement operator*() const { return NormElement (index(), value()); }
+              FORCE_INLINE index_type index() const { return index_type (fixel); }
+              FORCE_INLINE connectivity_value_type value() const { return fetch_value (values, quantised, n); }
+              // Raw fixed-point value; only applicable if the row is quantised
+              FORCE_INLINE uint16_t quantised_value() const { assert (quantised); return Raw::fetch_LE<uint16_t> (values, n); }
+            private:
+              size_t num_connections;
+              const uint8_t* ptr;
+              const uint8_t* values;
+              bool quantised;
+              const BitSet* mask;
+              size_t n;
+              int64_t fixel;
+              FORCE_INLINE void seek()
+              {
+                for (; n < num_connections; ++n) {
+                  const uint64_t code = read_varint (ptr);
+                  fixel += n ? int64_t(code) : zigzag_decode (code);
+                  if (!mask || (*mask)[fixel])
+                    return;
+                }
+              }
+          };
+
+          const_iterator begin() const { return const_iterator (*this, 0); }
+          const_iterator end() const { return const_iterator (*this, num_connections); }
+
+          // Number of connections stored, prior to any masking
+          size_t size() const { return num_connections; }
+          bool is_quantised() const { return quantised; }
+
+          FORCE_INLINE static connectivity_value_type fetch_value (const uint8_t* values, const bool quantised, const size_t n)
+          {
+            return quantised ?
+                   connectivity_value_type (Raw::fetch_LE<uint16_t> (values, n)) / connectivity_value_type (65535) :
+                   Raw::fetch_LE<float> (values, n);
+          }
+
+        private:
+          size_t fixel, num_connections;
+          const uint8_t* indices;
+          const uint8_t* values;
+          bool quantised;
+          const BitSet* mask;
+      };
+
+
+
+
+
+
       // Different types are used depending on whether the connectivity matrix
       //   is in the process of being built, or whether it has been normalised
       // TODO Revise
@@ -181,14 +296,103 @@ namespace MR
       // - Normalisation of the matrix
       // - Writing to the three images
       // - Erasing the memory used for that matrix in the initial building
+      //
+      // Alternatively, the matrix can be written to a single file "connectivity.csr"
+      //   within the directory, which is intended to be memory-mapped directly
+      //   (and hence shared between concurrent processes via the page cache).
+      //   All values are little-endian:
+      // - Fixed 64-byte header:
+      //     - 16 bytes: "mrtrix fixel csr"
+      //     - uint32: format version (currently 1)
+      //     - uint32: encoding of connectivity values: 0 = float32;
+      //         1 = uint16 fixed-point, where value = stored / 65535
+      //     - uint64: number of fixels N
+      //     - uint64: total number of fixel-fixel connections C
+      //     - uint64: number of bytes of key-value text immediately following the header
+      //     - uint64: file offset of the row table
+      //     - uint64: file offset of the first row
+      // - Row table: N+1 uint64 file offsets to the start of each row (the last
+      //     being the end of the data), followed by N uint32 connection counts
+      // - For each fixel, the indices of connected fixels in increasing order,
+      //     delta-coded as unsigned LEB128 variable-length integers (the first
+      //     relative to the index of that fixel itself, zig-zag encoded);
+      //     followed by the connectivity values, aligned to their own size
+
+      enum class format_type { MIF, CSR, CSR16 };
 
       void normalise_and_write (init_matrix_type& matrix,
                                 const connectivity_value_type threshold,
                                 const std::string& path,
+                                const format_type format = format_type::MIF,
                                 const KeyValues& keyvals = KeyValues());
 
 
 
+      // Generate the fixel-fixel connectivity matrix and write it to the filesystem,
+      //   without requiring that the whole matrix reside in RAM at once:
+      // - Each processing thread accumulates connectivity for the streamlines it
+      //   receives in its own partial matrix
+      // - Whenever the memory used by a partial matrix exceeds its share of
+      //   memory_limit (in bytes), its contents are written to a temporary file
+      //   (within TmpFileDir) as a sorted run of (fixel, fixel, count) triplets,
+      //   and the partial matrix is emptied
+      // - Once all streamlines are processed, these runs and the remaining partial
+      //   matrices are merged, and each fixel is normalised, thresholded and
+      //   written to the output in turn
+      void generate_and_write (const std::string& track_filename,
+                               Image<index_type>& index_image,
+                               Image<bool>& fixel_mask,
+                               const float angular_threshold,
+                               const connectivity_value_type threshold,
+                               const std::string& path,
+                               const size_t memory_limit,
+                               const format_type format = format_type::MIF,
+                               const KeyValues& keyvals = KeyValues());
+
+
+
+      // Write the fixel-fixel connectivity matrix to the filesystem one fixel at a
+      //   time, in either format; rows must be provided in increasing order of
+      //   fixel index, and any fixel for which no row is provided is written as
+      //   having no connectivity
+      class Writer
+      { MEMALIGN(Writer)
+
+        public:
+          Writer (const std::string& path,
+                  const size_t num_fixels,
+                  const format_type format = format_type::MIF,
+                  const KeyValues& keyvals = KeyValues());
+
+          void add (const size_t fixel,
+                    const vector<index_type>& fixels,
+                    const vector<connectivity_value_type>& values);
+
+          // Must be called once all rows have been provided, in order to
+          //   complete the information in the file headers
+          void finalise();
+
+        protected:
+          const std::string path;
+          const size_t num_fixels;
+          const format_type format;
+          size_t next_fixel;
+          uint64_t data_count;
+
+          Image<index_image_type> index_image;
+          std::unique_ptr<File::OFStream> fixel_stream, value_stream;
+
+          std::unique_ptr<File::OFStream> csr_stream;
+          std::string csr_keyvals;
+          uint64_t csr_position, csr_row_table_offset, csr_data_offset;
+          vector<uint64_t> csr_row_offsets;
+          vector<uint32_t> csr_row_counts;
+          vector<uint8_t> row_data;
+
+      };
+
+
+
       // Wrapper class for reading the connectivity matrix from the filesystem
       class Reader
       { MEMALIGN(Reader)
@@ -213,18 +417,29 @@ namespace MR
 
           NormFixel operator[] (const size_t index) const;
 
-          // TODO Define iteration constructs?
+          // If the matrix is stored in the single-file CSR format, the connectivity
+          //   of each fixel can be traversed directly from the memory-mapped file,
+          //   without any memory allocation or copying
+          bool is_mapped() const { return bool(csr); }
+          MappedRow row (const size_t index) const;
 
-          size_t size() const { return index_image.size (0); }
+          size_t size() const { return num_fixels; }
           size_t size (const size_t) const;
 
         protected:
           const std::string directory;
+          size_t num_fixels;
           // Not to be manipulated directly; need to copy in order to ensure thread-safety
           Image<index_image_type> index_image;
           Image<fixel_index_type> fixel_image;
           Image<connectivity_value_type> value_image;
           Image<bool> mask_image;
+          // Only used if the matrix is stored in the single-file CSR format;
+          //   mapped read-only, so copies of the Reader share the same data
+          std::shared_ptr<File::MMap> csr;
+          bool csr_quantised;
+          const uint8_t* csr_row_table;
+          std::shared_ptr<BitSet> csr_mask;
 
 
       };
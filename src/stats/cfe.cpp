@@ -16,6 +16,8 @@
 
 #include "stats/cfe.h"
 
+#include "progressbar.h"
+
 namespace MR
 {
   namespace Stats
@@ -34,17 +36,14 @@ namespace MR
         E (E),
         H (H),
         C (C),
-        normalise (norm) { }
-
-
-
-    void CFE::operator() (in_column_type stats, out_column_type enhanced_stats) const
+        normalise (norm),
+        norm_multipliers (matrix.size(), Fixel::Matrix::connectivity_value_type(1))
     {
-      enhanced_stats.setZero();
-      vector<default_type> connected_stats;
-      for (size_t fixel = 0; fixel < matrix.size(); ++fixel) {
-        if (stats[fixel] < dh)
-          continue;
+      const bool mapped = matrix.is_mapped();
+      if (!mapped)
+        offsets.assign (matrix.size()+1, 0);
+      ProgressBar progress ("Pre-computing CFE connectivity weights", matrix.size());
+      for (size_t fixel = 0; fixel != matrix.size(); ++fixel) {
         auto connections = matrix[fixel];
         // Need to re-normalise based on the value of the power C
         if (C != 1.0) {
@@ -55,30 +54,94 @@ namespace MR
           }
           connections.normalise (Fixel::Matrix::connectivity_value_type (sum));
         }
-        // Rather than allocating data for the stats and then looping over dh,
-        //   divide statistic by dh to determine the number of cluster sizes that should
-        //   be incremented, and dynamically increment all cluster sizes for that
-        //   particular connected fixel
-        vector<Fixel::Matrix::connectivity_value_type> extents (std::floor (stats[fixel]/dh), Fixel::Matrix::connectivity_value_type(0));
-        for (const auto& connection : connections) {
-          const default_type connection_stat = stats[connection.index()];
-          if (connection_stat > dh) {
-            const size_t cluster_count = std::min (extents.size(), size_t(std::floor (connection_stat / dh)));
-            for (size_t cluster_index = 0; cluster_index != cluster_count; ++cluster_index)
-              extents[cluster_index] += connection.value();
+        if (!mapped) {
+          for (const auto& c : connections) {
+            indices.push_back (c.index());
+            weights.push_back (c.value());
+          }
+          offsets[fixel+1] = indices.size();
+        }
+        norm_multipliers[fixel] = connections.norm_multiplier;
+        ++progress;
+      }
+      indices.shrink_to_fit();
+      weights.shrink_to_fit();
+      if (mapped && C != 1.0) {
+        quantised_weights.resize (65536);
+        for (size_t i = 0; i != 65536; ++i) {
+          Fixel::Matrix::NormElement element (0, Fixel::Matrix::connectivity_value_type (i) / Fixel::Matrix::connectivity_value_type (65535));
+          element.exponentiate (C);
+          quantised_weights[i] = element.value();
+        }
+      }
+    }
+
+
+
+    void CFE::operator() (in_column_type stats, out_column_type enhanced_stats) const
+    {
+      enhanced_stats.setZero();
+      const size_t num_fixels = norm_multipliers.size();
+      // Scratch buffers are retained between calls, such that there is no
+      //   memory allocation within each permutation
+      static thread_local vector<uint32_t> levels;
+      static thread_local vector<default_type> level_sums;
+      static thread_local vector<default_type> h_pow_H;
+
+      // Rather than allocating data for the stats and then looping over dh,
+      //   divide statistic by dh to determine the number of cluster sizes to
+      //   which each fixel contributes; note that a fixel contributes to the
+      //   cluster extents of other fixels only if its statistic exceeds dh,
+      //   whereas it is itself enhanced if its statistic is at least dh
+      levels.resize (num_fixels);
+      uint32_t max_level = 0;
+      for (size_t fixel = 0; fixel != num_fixels; ++fixel) {
+        const default_type ratio = stats[fixel] / dh;
+        levels[fixel] = (std::isfinite (ratio) && stats[fixel] > dh) ? uint32_t(std::floor (ratio)) : 0;
+        max_level = std::max (max_level, stats[fixel] == dh ? uint32_t(1) : levels[fixel]);
+      }
+      if (!max_level)
+        return;
+
+      // Pre-calculate h^H
+      h_pow_H.resize (max_level);
+      for (size_t ih = 0; ih != max_level; ++ih)
+        h_pow_H[ih] = std::pow (dh*(ih+1), H);
+
+      level_sums.resize (max_level+1);
+      for (size_t fixel = 0; fixel != num_fixels; ++fixel) {
+        const uint32_t fixel_level = stats[fixel] == dh ? uint32_t(1) : levels[fixel];
+        if (!fixel_level)
+          continue;
+        // Each connected fixel contributes its connectivity weight to the
+        //   cluster extent at every height up to the lesser of its own
+        //   level and that of the fixel being enhanced; accumulate these
+        //   contributions at that level only, and then integrate downwards
+        std::fill (level_sums.begin(), level_sums.begin() + fixel_level + 1, 0.0);
+        if (matrix.is_mapped()) {
+          const auto row = matrix.row (fixel);
+          const auto end = row.end();
+          if (C == 1.0) {
+            for (auto c = row.begin(); c != end; ++c)
+              level_sums[std::min (fixel_level, levels[c.index()])] += c.value();
+          } else if (row.is_quantised()) {
+            for (auto c = row.begin(); c != end; ++c)
+              level_sums[std::min (fixel_level, levels[c.index()])] += quantised_weights[c.quantised_value()];
+          } else {
+            for (auto c = row.begin(); c != end; ++c)
+              level_sums[std::min (fixel_level, levels[c.index()])] += std::pow (c.value(), Fixel::Matrix::connectivity_value_type (C));
           }
+        } else {
+          const size_t row_end = offsets[fixel+1];
+          for (size_t i = offsets[fixel]; i != row_end; ++i)
+            level_sums[std::min (fixel_level, levels[indices[i]])] += weights[i];
         }
-        // Pre-calculate h^H
-        if (h_pow_H.size() < extents.size()) {
-          const size_t old_size = h_pow_H.size();
-          h_pow_H.resize (extents.size());
-          for (size_t ih = old_size; ih != h_pow_H.size(); ++ih)
-            h_pow_H[ih] = std::pow (dh*(ih+1), H);
+        default_type extent = 0.0, sum = 0.0;
+        for (size_t cluster_index = fixel_level; cluster_index--;) {
+          extent += level_sums[cluster_index+1];
+          sum += std::pow (extent, E) * h_pow_H[cluster_index];
         }
-        for (size_t cluster_index = 0; cluster_index != extents.size(); ++cluster_index)
-          enhanced_stats[fixel] += std::pow (extents[cluster_index], E) * h_pow_H[cluster_index];
-        if (normalise)
-          enhanced_stats[fixel] *= connections.norm_multiplier;
+        enhanced_stats[fixel] = normalise ? sum * norm_multipliers[fixel] : sum;
       }
     }
 
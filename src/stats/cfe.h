@@ -46,7 +46,18 @@ namespace MR
         const value_type dh, E, H, C;
         const bool normalise;
 
-        mutable vector<value_type> h_pow_H;
+        // If the connectivity matrix is stored in the single-file CSR format, it is
+        //   traversed directly from the memory-mapped file during enhancement;
+        //   where values are stored in fixed-point, a lookup table provides each
+        //   value raised to the power C. Otherwise, the connectivity weights raised
+        //   to the power C are pre-computed in compressed sparse row form, as reading
+        //   them from the matrix images in every permutation would be far slower.
+        //   Neither depends on the statistic being enhanced.
+        vector<size_t> offsets;
+        vector<Fixel::Matrix::fixel_index_type> indices;
+        vector<Fixel::Matrix::connectivity_value_type> weights;
+        vector<Fixel::Matrix::connectivity_value_type> quantised_weights;
+        vector<Fixel::Matrix::connectivity_value_type> norm_multipliers;
 
         void operator() (in_column_type, out_column_type) const override;
     };
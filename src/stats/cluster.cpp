@@ -37,6 +37,16 @@ namespace MR
 
 
 
+      bool ClusterSize::integrate (in_column_type input, const vector<value_type>& thresholds, const value_type E, const value_type H, out_column_type output) const
+      {
+        TFCE::integrate_clusters (input, connector.adjacency,
+                                  [] (const value_type value, const value_type T) { return value > T; },
+                                  thresholds, E, H, output);
+        return true;
+      }
+
+
+
     }
   }
 }
@@ -16,6 +16,17 @@
 
 #include "stats/permtest.h"
 
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "file/config.h"
+#include "file/ofstream.h"
+#include "file/path.h"
+#include "raw.h"
+#include "signal_handler.h"
+#include "timer.h"
+
 namespace MR
 {
   namespace Stats
@@ -25,11 +36,251 @@ namespace MR
 
 
 
-      PreProcessor::PreProcessor (const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
+      namespace
+      {
+
+        const char shard_magic[] = "mrtrix permshard";
+        constexpr size_t shard_magic_size = 16;
+        constexpr size_t shard_header_size = 96;
+        constexpr uint32_t shard_version = 2;
+        constexpr uint32_t shard_flag_empirical = 0x1;
+
+
+
+        template <typename ValueType>
+        void write_LE (std::ostream& out, const ValueType* data, const size_t count)
+        {
+          vector<uint8_t> buffer (count * sizeof (ValueType));
+          for (size_t i = 0; i != count; ++i)
+            Raw::store_LE<ValueType> (data[i], buffer.data(), i);
+          out.write (reinterpret_cast<const char*> (buffer.data()), buffer.size());
+        }
+
+        template <typename ValueType>
+        void read_LE (std::istream& in, ValueType* data, const size_t count)
+        {
+          vector<uint8_t> buffer (count * sizeof (ValueType));
+          in.read (reinterpret_cast<char*> (buffer.data()), buffer.size());
+          for (size_t i = 0; i != count; ++i)
+            data[i] = Raw::fetch_LE<ValueType> (buffer.data(), i);
+        }
+
+
+
+        // Statistics that are accumulated across threads in no fixed order (e.g. the
+        //   empirical statistic) may differ between invocations by floating-point rounding only
+        bool same_statistic (const matrix_type& a, const matrix_type& b)
+        {
+          if (a.rows() != b.rows() || a.cols() != b.cols())
+            return false;
+          for (ssize_t col = 0; col != a.cols(); ++col) {
+            for (ssize_t row = 0; row != a.rows(); ++row) {
+              if (std::isfinite (a (row, col)) && std::isfinite (b (row, col))) {
+                if (std::abs (a (row, col) - b (row, col)) > 1e-9 * std::max (std::abs (a (row, col)), std::abs (b (row, col))))
+                  return false;
+              } else if (!(a (row, col) == b (row, col) || (std::isnan (a (row, col)) && std::isnan (b (row, col))))) {
+                return false;
+              }
+            }
+          }
+          return true;
+        }
+
+
+
+        // The partial outcome of permutation testing for one contiguous subset ("shard") of the shuffles
+        class Shard
+        { MEMALIGN(Shard)
+          public:
+            Shard () :
+                num_shuffles (0), index (0), count (0),
+                num_elements (0), num_hypotheses (0), num_null_columns (0),
+                fingerprint (0), completed (0) { }
+
+            Shard (const size_t num_shuffles, const size_t index, const size_t count,
+                   const size_t num_elements, const size_t num_hypotheses, const size_t num_null_columns,
+                   const uint64_t fingerprint) :
+                num_shuffles (num_shuffles), index (index), count (count),
+                num_elements (num_elements), num_hypotheses (num_hypotheses), num_null_columns (num_null_columns),
+                fingerprint (fingerprint), completed (0),
+                null_dist (matrix_type::Zero (size(), num_null_columns)),
+                null_dist_contributions (count_matrix_type::Zero (num_elements, num_hypotheses)),
+                uncorrected_pvalue_counts (count_matrix_type::Zero (num_elements, num_hypotheses)) { }
+
+            uint64_t num_shuffles, index, count;
+            uint64_t num_elements, num_hypotheses, num_null_columns;
+            uint64_t fingerprint, completed;
+            matrix_type null_dist;
+            count_matrix_type null_dist_contributions, uncorrected_pvalue_counts;
+            // The statistic for the default permutation identifies the input data,
+            //   design and hypotheses from which the shard was generated
+            matrix_type default_enhanced_statistic, empirical_enhanced_statistic;
+
+            // Shuffles [first(), last()) belong to this shard
+            size_t first() const { return index * num_shuffles / count; }
+            size_t last() const { return (index+1) * num_shuffles / count; }
+            size_t size() const { return last() - first(); }
+
+            bool same_test (const Shard& that) const
+            {
+              return (num_shuffles == that.num_shuffles &&
+                      count == that.count &&
+                      num_elements == that.num_elements &&
+                      num_hypotheses == that.num_hypotheses &&
+                      num_null_columns == that.num_null_columns &&
+                      fingerprint == that.fingerprint);
+            }
+
+            void load (const std::string& path)
+            {
+              std::ifstream in (path, std::ios_base::in | std::ios_base::binary);
+              if (!in)
+                throw Exception ("Unable to open permutation testing shard file \"" + path + "\"");
+              uint8_t header[shard_header_size];
+              in.read (reinterpret_cast<char*> (header), shard_header_size);
+              if (!in || memcmp (header, shard_magic, shard_magic_size))
+                throw Exception ("File \"" + path + "\" is not a permutation testing shard file");
+              if (Raw::fetch_LE<uint32_t> (header + 16) != shard_version)
+                throw Exception ("Unsupported version of permutation testing shard file \"" + path + "\"");
+              const uint32_t flags = Raw::fetch_LE<uint32_t> (header + 20);
+              num_shuffles     = Raw::fetch_LE<uint64_t> (header + 24);
+              index            = Raw::fetch_LE<uint64_t> (header + 32);
+              count            = Raw::fetch_LE<uint64_t> (header + 40);
+              num_elements     = Raw::fetch_LE<uint64_t> (header + 48);
+              num_hypotheses   = Raw::fetch_LE<uint64_t> (header + 56);
+              num_null_columns = Raw::fetch_LE<uint64_t> (header + 64);
+              fingerprint      = Raw::fetch_LE<uint64_t> (header + 72);
+              completed        = Raw::fetch_LE<uint64_t> (header + 80);
+              if (!count || index >= count || completed > size())
+                throw Exception ("Malformed permutation testing shard file \"" + path + "\"");
+              // Null distribution is stored one shuffle at a time
+              Eigen::Matrix<default_type, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> null_rows (size(), num_null_columns);
+              read_LE (in, null_rows.data(), null_rows.size());
+              null_dist = null_rows;
+              null_dist_contributions.resize (num_elements, num_hypotheses);
+              read_LE (in, null_dist_contributions.data(), null_dist_contributions.size());
+              uncorrected_pvalue_counts.resize (num_elements, num_hypotheses);
+              read_LE (in, uncorrected_pvalue_counts.data(), uncorrected_pvalue_counts.size());
+              default_enhanced_statistic.resize (num_elements, num_hypotheses);
+              read_LE (in, default_enhanced_statistic.data(), default_enhanced_statistic.size());
+              if (flags & shard_flag_empirical) {
+                empirical_enhanced_statistic.resize (num_elements, num_hypotheses);
+                read_LE (in, empirical_enhanced_statistic.data(), empirical_enhanced_statistic.size());
+              } else {
+                empirical_enhanced_statistic.resize (0, 0);
+              }
+              if (!in)
+                throw Exception ("Permutation testing shard file \"" + path + "\" is truncated");
+            }
+
+            // Write to a temporary file and then rename, such that a pre-empted
+            //   job can never leave behind a partially-written checkpoint
+            void save (const std::string& path) const
+            {
+              const std::string temp_path = path + ".tmp";
+              SignalHandler::mark_file_for_deletion (temp_path);
+              {
+                File::OFStream out (temp_path, std::ios_base::out | std::ios_base::binary);
+                uint8_t header[shard_header_size];
+                memset (header, 0, shard_header_size);
+                memcpy (header, shard_magic, shard_magic_size);
+                Raw::store_LE<uint32_t> (shard_version, header + 16);
+                Raw::store_LE<uint32_t> (empirical_enhanced_statistic.size() ? shard_flag_empirical : 0, header + 20);
+                Raw::store_LE<uint64_t> (num_shuffles,     header + 24);
+                Raw::store_LE<uint64_t> (index,            header + 32);
+                Raw::store_LE<uint64_t> (count,            header + 40);
+                Raw::store_LE<uint64_t> (num_elements,     header + 48);
+                Raw::store_LE<uint64_t> (num_hypotheses,   header + 56);
+                Raw::store_LE<uint64_t> (num_null_columns, header + 64);
+                Raw::store_LE<uint64_t> (fingerprint,      header + 72);
+                Raw::store_LE<uint64_t> (completed,        header + 80);
+                out.write (reinterpret_cast<const char*> (header), shard_header_size);
+                const Eigen::Matrix<default_type, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> null_rows (null_dist);
+                write_LE (out, null_rows.data(), null_rows.size());
+                write_LE (out, null_dist_contributions.data(), null_dist_contributions.size());
+                write_LE (out, uncorrected_pvalue_counts.data(), uncorrected_pvalue_counts.size());
+                write_LE (out, default_enhanced_statistic.data(), default_enhanced_statistic.size());
+                if (empirical_enhanced_statistic.size())
+                  write_LE (out, empirical_enhanced_statistic.data(), empirical_enhanced_statistic.size());
+                if (!out.good())
+                  throw Exception ("Error writing permutation testing shard file \"" + temp_path + "\"");
+              }
+              if (std::rename (temp_path.c_str(), path.c_str()))
+                throw Exception ("Error renaming permutation testing shard file \"" + temp_path + "\" to \"" + path + "\": " + strerror (errno));
+              SignalHandler::unmark_file_for_deletion (temp_path);
+            }
+        };
+
+
+
+        // Load all shards listed in the file provided to the -merge_shards option,
+        //   and verify that together they constitute one complete set of shuffles
+        vector<Shard> load_shards (const std::string& list_path)
+        {
+          std::ifstream list (list_path);
+          if (!list)
+            throw Exception ("Unable to open shard list file \"" + list_path + "\"");
+          vector<Shard> shards;
+          std::string line;
+          while (std::getline (list, line)) {
+            line = strip (line);
+            if (line.empty())
+              continue;
+            shards.push_back (Shard());
+            shards.back().load (line);
+            if (shards.back().completed != shards.back().size())
+              throw Exception ("Permutation testing shard file \"" + line + "\" is incomplete "
+                               "(" + str(shards.back().completed) + " of " + str(shards.back().size()) + " shuffles processed)");
+            if (!shards.back().same_test (shards.front()))
+              throw Exception ("Permutation testing shard file \"" + line + "\" does not correspond to the same test as the other shards");
+            if (!same_statistic (shards.back().default_enhanced_statistic, shards.front().default_enhanced_statistic))
+              throw Exception ("Permutation testing shard file \"" + line + "\" was generated from different input data than the other shards");
+            if (!same_statistic (shards.back().empirical_enhanced_statistic, shards.front().empirical_enhanced_statistic))
+              throw Exception ("Permutation testing shard file \"" + line + "\" was generated using a different empirical statistic "
+                               "for non-stationarity correction than the other shards");
+          }
+          if (shards.empty())
+            throw Exception ("No shard files listed in file \"" + list_path + "\"");
+          vector<bool> present (shards.front().count, false);
+          for (const auto& shard : shards) {
+            if (present[shard.index])
+              throw Exception ("Duplicate permutation testing shard files for shard " + str(shard.index) + " in file \"" + list_path + "\"");
+            present[shard.index] = true;
+          }
+          for (size_t i = 0; i != present.size(); ++i) {
+            if (!present[i])
+              throw Exception ("Permutation testing shard " + str(i) + " of " + str(present.size()) + " not listed in file \"" + list_path + "\"");
+          }
+          return shards;
+        }
+
+      }
+
+
+
+
+      bool ShuffleBlockSource::operator() (vector<Math::Stats::Shuffle>& shuffles)
+      {
+        const size_t size = std::min (block_size, limit - count);
+        shuffles.resize (size);
+        size_t num_in_block = 0;
+        while (num_in_block != size && shuffler.next (shuffles[num_in_block].index))
+          ++num_in_block;
+        shuffles.resize (num_in_block);
+        count += num_in_block;
+        return num_in_block;
+      }
+
+
+
+
+      PreProcessor::PreProcessor (const Math::Stats::Shuffler& shuffler,
+                                  const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
                                   const std::shared_ptr<EnhancerBase> enhancer,
                                   const default_type skew,
                                   matrix_type& global_enhanced_sum,
                                   count_matrix_type& global_enhanced_count) :
+          shuffler (shuffler),
           stats_calculator (stats_calculator),
           enhancer (enhancer),
           skew (skew),
@@ -37,7 +288,6 @@ namespace MR
           global_enhanced_count (global_enhanced_count),
           enhanced_sum (matrix_type::Zero (stats_calculator->num_elements(), stats_calculator->num_hypotheses())),
           enhanced_count (count_matrix_type::Zero (stats_calculator->num_elements(), stats_calculator->num_hypotheses())),
-          stats (global_enhanced_sum.rows(), global_enhanced_sum.cols()),
           enhanced_stats (global_enhanced_sum.rows(), global_enhanced_sum.cols()),
           mutex (new std::mutex())
       {
@@ -56,17 +306,20 @@ namespace MR
 
 
 
-      bool PreProcessor::operator() (const Math::Stats::Shuffle& shuffle)
+      bool PreProcessor::operator() (const vector<Math::Stats::Shuffle>& shuffles)
       {
-        if (!shuffle.data.rows())
-          return false;
-        (*stats_calculator) (shuffle.data, stats);
-        (*enhancer) (stats, enhanced_stats);
-        for (size_t ih = 0; ih != stats_calculator->num_hypotheses(); ++ih) {
-          for (size_t ie = 0; ie != stats_calculator->num_elements(); ++ie) {
-            if (enhanced_stats(ie, ih) > 0.0) {
-              enhanced_sum(ie, ih) += std::pow (enhanced_stats(ie, ih), skew);
-              enhanced_count(ie, ih)++;
+        shuffling_matrices.resize (shuffles.size());
+        for (size_t i = 0; i != shuffles.size(); ++i)
+          shuffler.get (shuffles[i].index, shuffling_matrices[i]);
+        stats_calculator->batch (shuffling_matrices, stats);
+        for (const auto& s : stats) {
+          (*enhancer) (s, enhanced_stats);
+          for (size_t ih = 0; ih != stats_calculator->num_hypotheses(); ++ih) {
+            for (size_t ie = 0; ie != stats_calculator->num_elements(); ++ie) {
+              if (enhanced_stats(ie, ih) > 0.0) {
+                enhanced_sum(ie, ih) += std::pow (enhanced_stats(ie, ih), skew);
+                enhanced_count(ie, ih)++;
+              }
             }
           }
         }
@@ -79,18 +332,19 @@ namespace MR
 
 
 
-      Processor::Processor (const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
+      Processor::Processor (const Math::Stats::Shuffler& shuffler,
+                            const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
                             const std::shared_ptr<EnhancerBase> enhancer,
                             const matrix_type& empirical_enhanced_statistics,
                             const matrix_type& default_enhanced_statistics,
                             matrix_type& perm_dist,
                             count_matrix_type& perm_dist_contributions,
                             count_matrix_type& global_uncorrected_pvalue_counter) :
+          shuffler (shuffler),
           stats_calculator (stats_calculator),
           enhancer (enhancer),
           empirical_enhanced_statistics (empirical_enhanced_statistics),
           default_enhanced_statistics (default_enhanced_statistics),
-          statistics (stats_calculator->num_elements(), stats_calculator->num_hypotheses()),
           enhanced_statistics (stats_calculator->num_elements(), stats_calculator->num_hypotheses()),
           null_dist (perm_dist),
           global_null_dist_contributions (perm_dist_contributions),
@@ -113,25 +367,37 @@ namespace MR
 
 
 
-      bool Processor::operator() (const Math::Stats::Shuffle& shuffle)
+      bool Processor::operator() (const vector<Math::Stats::Shuffle>& shuffles)
+      {
+        shuffling_matrices.resize (shuffles.size());
+        for (size_t i = 0; i != shuffles.size(); ++i)
+          shuffler.get (shuffles[i].index, shuffling_matrices[i]);
+        stats_calculator->batch (shuffling_matrices, statistics);
+        for (size_t i = 0; i != shuffles.size(); ++i)
+          process (shuffles[i].index, statistics[i]);
+        return true;
+      }
+
+
+
+      void Processor::process (const size_t index, const matrix_type& stats)
       {
-        (*stats_calculator) (shuffle.data, statistics);
         if (enhancer)
-          (*enhancer) (statistics, enhanced_statistics);
+          (*enhancer) (stats, enhanced_statistics);
         else
-          enhanced_statistics = statistics;
+          enhanced_statistics = stats;
 
         if (empirical_enhanced_statistics.size())
           enhanced_statistics.array() /= empirical_enhanced_statistics.array();
 
         if (null_dist.cols() == 1) { // strong fwe control
           ssize_t max_element, max_hypothesis;
-          null_dist(shuffle.index, 0) = enhanced_statistics.maxCoeff (&max_element, &max_hypothesis);
+          null_dist(index, 0) = enhanced_statistics.maxCoeff (&max_element, &max_hypothesis);
           null_dist_contribution_counter(max_element, max_hypothesis)++;
         } else { // weak fwe control
           ssize_t max_index;
           for (ssize_t ih = 0; ih != enhanced_statistics.cols(); ++ih) {
-            null_dist(shuffle.index, ih) = enhanced_statistics.col (ih).maxCoeff (&max_index);
+            null_dist(index, ih) = enhanced_statistics.col (ih).maxCoeff (&max_index);
             null_dist_contribution_counter(max_index, ih)++;
           }
         }
@@ -142,8 +408,6 @@ namespace MR
               uncorrected_pvalue_counter(ie, ih)++;
           }
         }
-
-        return true;
       }
 
 
@@ -158,12 +422,25 @@ namespace MR
                                       matrix_type& empirical_statistic)
       {
         assert (stats_calculator);
+        auto opt = App::get_options ("merge_shards");
+        if (opt.size()) {
+          const vector<Shard> shards = load_shards (opt[0][0]);
+          if (!shards.front().empirical_enhanced_statistic.size())
+            throw Exception ("Permutation testing shards were not generated with non-stationarity correction");
+          empirical_statistic = shards.front().empirical_enhanced_statistic;
+          return;
+        }
         empirical_statistic = matrix_type::Zero (stats_calculator->num_elements(), stats_calculator->num_hypotheses());
         count_matrix_type global_enhanced_count (count_matrix_type::Zero (stats_calculator->num_elements(), stats_calculator->num_hypotheses()));
         {
           Math::Stats::Shuffler shuffler (stats_calculator->num_inputs(), true, "Pre-computing empirical statistic for non-stationarity correction");
-          PreProcessor preprocessor (stats_calculator, enhancer, skew, empirical_statistic, global_enhanced_count);
-          Thread::run_queue (shuffler, Math::Stats::Shuffle(), Thread::multi (preprocessor));
+          if ((App::get_options ("shard").size() || App::get_options ("resume_shard").size()) && !shuffler.is_reproducible())
+            throw Exception ("Sharded permutation testing with non-stationarity correction requires that all shards generate the same empirical statistic; "
+                             "either provide the shuffles explicitly using the -permutations_nonstationarity option, "
+                             "or set the MRTRIX_RNG_SEED environment variable to the same value for all shards");
+          PreProcessor preprocessor (shuffler, stats_calculator, enhancer, skew, empirical_statistic, global_enhanced_count);
+          ShuffleBlockSource source (shuffler, stats_calculator->batch_size());
+          Thread::run_queue (source, vector<Math::Stats::Shuffle>(), Thread::multi (preprocessor));
         }
         for (size_t contrast = 0; contrast != stats_calculator->num_hypotheses(); ++contrast) {
           for (size_t ie = 0; ie != stats_calculator->num_elements(); ++ie) {
@@ -209,7 +486,7 @@ namespace MR
 
 
 
-      void run_permutations (const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
+      bool run_permutations (const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
                              const std::shared_ptr<EnhancerBase> enhancer,
                              const matrix_type& empirical_enhanced_statistic,
                              const matrix_type& default_enhanced_statistics,
@@ -219,21 +496,127 @@ namespace MR
                              matrix_type& uncorrected_pvalues)
       {
         assert (stats_calculator);
+        const size_t num_null_columns = fwe_strong ? 1 : stats_calculator->num_hypotheses();
+
+        auto opt = App::get_options ("merge_shards");
+        if (opt.size()) {
+          const vector<Shard> shards = load_shards (opt[0][0]);
+          const Shard& header (shards.front());
+          if (header.num_elements != stats_calculator->num_elements() ||
+              header.num_hypotheses != stats_calculator->num_hypotheses())
+            throw Exception ("Permutation testing shards do not match dimensions of data / hypotheses");
+          if (header.num_null_columns != num_null_columns)
+            throw Exception (std::string ("Permutation testing shards were generated using ") +
+                             (fwe_strong ? "weak" : "strong") + " familywise error control, " +
+                             "whereas this invocation requests " + (fwe_strong ? "strong" : "weak"));
+          if (bool(header.empirical_enhanced_statistic.size()) != bool(empirical_enhanced_statistic.size()))
+            throw Exception ("Mismatch in use of non-stationarity correction between permutation testing shards and this invocation");
+          if (!same_statistic (header.default_enhanced_statistic, default_enhanced_statistics))
+            throw Exception ("Permutation testing shards were generated from different input data, design or hypotheses than this invocation");
+          null_dist.resize (header.num_shuffles, num_null_columns);
+          null_dist_contributions = count_matrix_type::Zero (stats_calculator->num_elements(), stats_calculator->num_hypotheses());
+          count_matrix_type global_uncorrected_pvalue_count (count_matrix_type::Zero (stats_calculator->num_elements(), stats_calculator->num_hypotheses()));
+          for (const auto& shard : shards) {
+            null_dist.middleRows (shard.first(), shard.size()) = shard.null_dist;
+            null_dist_contributions += shard.null_dist_contributions;
+            global_uncorrected_pvalue_count += shard.uncorrected_pvalue_counts;
+          }
+          uncorrected_pvalues = global_uncorrected_pvalue_count.cast<default_type>() / default_type(header.num_shuffles);
+          return true;
+        }
+
+        opt = App::get_options ("shard");
+        auto resume_opt = App::get_options ("resume_shard");
+        if (opt.size() || resume_opt.size()) {
+          if (opt.size() && resume_opt.size())
+            throw Exception ("Options -shard and -resume_shard are mutually exclusive");
+          // When resuming, the shard index and count are read from the existing file
+          Shard previous;
+          if (resume_opt.size())
+            previous.load (resume_opt[0][0]);
+          const size_t index = opt.size() ? size_t(opt[0][0]) : previous.index;
+          const size_t count = opt.size() ? size_t(opt[0][1]) : previous.count;
+          const std::string path (opt.size() ? opt[0][2] : resume_opt[0][0]);
+          if (index >= count)
+            throw Exception ("Shard index (" + str(index) + ") must be less than the number of shards (" + str(count) + ")");
+          Math::Stats::Shuffler shuffler (stats_calculator->num_inputs(), false, "Running permutations for shard " + str(index) + " of " + str(count));
+          if (!shuffler.is_reproducible())
+            throw Exception ("Sharded permutation testing requires that all shards generate the same set of shuffles; "
+                             "either provide the shuffles explicitly using the -permutations option, "
+                             "or set the MRTRIX_RNG_SEED environment variable to the same value for all shards");
+          if (count > shuffler.size())
+            throw Exception ("Number of shards (" + str(count) + ") exceeds number of shuffles (" + str(shuffler.size()) + ")");
+
+          Shard shard (shuffler.size(), index, count,
+                       stats_calculator->num_elements(), stats_calculator->num_hypotheses(), num_null_columns,
+                       shuffler.fingerprint());
+          shard.default_enhanced_statistic = default_enhanced_statistics;
+          shard.empirical_enhanced_statistic = empirical_enhanced_statistic;
+          if (resume_opt.size()) {
+            if (!previous.same_test (shard))
+              throw Exception ("Shard file \"" + path + "\" was not generated using the same shuffles and command-line options as this invocation");
+            if (!same_statistic (previous.default_enhanced_statistic, shard.default_enhanced_statistic))
+              throw Exception ("Shard file \"" + path + "\" was generated from different input data, design or hypotheses than this invocation");
+            if (!same_statistic (previous.empirical_enhanced_statistic, shard.empirical_enhanced_statistic))
+              throw Exception ("Shard file \"" + path + "\" was generated using a different empirical statistic for non-stationarity correction");
+            shard = std::move (previous);
+            INFO ("Resuming shard " + str(index) + " from checkpoint after " + str(shard.completed) + " of " + str(shard.size()) + " shuffles");
+          }
+
+          //CONF option: PermutationCheckpointInterval
+          //CONF default: 60.0
+          //CONF The interval in seconds between checkpoints written when processing
+          //CONF a shard of the shuffles in permutation testing (-shard option).
+          const default_type checkpoint_interval = File::Config::get_float ("PermutationCheckpointInterval", 60.0);
+
+          // Processor writes the null distribution using the global shuffle index
+          matrix_type shuffle_null_dist (shuffler.size(), num_null_columns);
+          shuffler.set_range (shard.first() + shard.completed, shard.last());
+          // The number of shuffles between checkpoints is adapted to the observed
+          //   throughput, beginning with one block of shuffles per thread
+          size_t shuffles_per_checkpoint = stats_calculator->batch_size() * std::max (size_t(1), Thread::number_of_threads());
+          while (shard.completed != shard.size()) {
+            Timer timer;
+            ShuffleBlockSource source (shuffler, stats_calculator->batch_size(), shuffles_per_checkpoint);
+            {
+              Processor processor (shuffler, stats_calculator, enhancer,
+                                   empirical_enhanced_statistic,
+                                   default_enhanced_statistics,
+                                   shuffle_null_dist,
+                                   shard.null_dist_contributions,
+                                   shard.uncorrected_pvalue_counts);
+              Thread::run_queue (source, vector<Math::Stats::Shuffle>(), Thread::multi (processor));
+            }
+            shard.null_dist.middleRows (shard.completed, source.num_shuffles()) =
+                shuffle_null_dist.middleRows (shard.first() + shard.completed, source.num_shuffles());
+            shard.completed += source.num_shuffles();
+            shard.save (path);
+            const default_type elapsed = timer.elapsed();
+            if (elapsed > 0.0)
+              shuffles_per_checkpoint = std::max (stats_calculator->batch_size(),
+                                                  size_t (std::min (default_type (shard.size()),
+                                                                    std::ceil (checkpoint_interval * source.num_shuffles() / elapsed))));
+          }
+          return false;
+        }
+
         Math::Stats::Shuffler shuffler (stats_calculator->num_inputs(), false, "Running permutations");
-        null_dist.resize (shuffler.size(), fwe_strong ? 1 : stats_calculator->num_hypotheses());
+        null_dist.resize (shuffler.size(), num_null_columns);
         null_dist_contributions = count_matrix_type::Zero (stats_calculator->num_elements(), stats_calculator->num_hypotheses());
 
         count_matrix_type global_uncorrected_pvalue_count (count_matrix_type::Zero (stats_calculator->num_elements(), stats_calculator->num_hypotheses()));
         {
-          Processor processor (stats_calculator, enhancer,
+          Processor processor (shuffler, stats_calculator, enhancer,
                                empirical_enhanced_statistic,
                                default_enhanced_statistics,
                                null_dist,
                                null_dist_contributions,
                                global_uncorrected_pvalue_count);
-          Thread::run_queue (shuffler, Math::Stats::Shuffle(), Thread::multi (processor));
+          ShuffleBlockSource source (shuffler, stats_calculator->batch_size());
+          Thread::run_queue (source, vector<Math::Stats::Shuffle>(), Thread::multi (processor));
         }
         uncorrected_pvalues = global_uncorrected_pvalue_count.cast<default_type>() / default_type(shuffler.size());
+        return true;
       }
 
 
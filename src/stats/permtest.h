@@ -53,10 +53,40 @@ namespace MR
 
 
 
+      /*! Draw shuffles from a Shuffler in blocks, such that the GLM is able
+       *  to process multiple shuffles at once where it supports doing so.
+       *  Only the shuffle indices are yielded; each processing thread
+       *  generates the corresponding shuffling matrices itself.
+       *  If a limit is provided, no more than that number of shuffles are
+       *  yielded, such that a checkpoint can subsequently be written */
+      class ShuffleBlockSource { NOMEMALIGN
+        public:
+          ShuffleBlockSource (Math::Stats::Shuffler& shuffler,
+                              const size_t block_size,
+                              const size_t limit = std::numeric_limits<size_t>::max()) :
+              shuffler (shuffler),
+              block_size (block_size),
+              limit (limit),
+              count (0) { }
+
+          bool operator() (vector<Math::Stats::Shuffle>&);
+
+          size_t num_shuffles() const { return count; }
+
+        protected:
+          Math::Stats::Shuffler& shuffler;
+          const size_t block_size, limit;
+          size_t count;
+      };
+
+
+
+
       /*! A class to pre-compute the empirical enhanced statistic image for non-stationarity correction */
       class PreProcessor { MEMALIGN (PreProcessor)
         public:
-          PreProcessor (const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
+          PreProcessor (const Math::Stats::Shuffler& shuffler,
+                        const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
                         const std::shared_ptr<EnhancerBase> enhancer,
                         const default_type skew,
                         matrix_type& global_enhanced_sum,
@@ -64,9 +94,10 @@ namespace MR
 
           ~PreProcessor();
 
-          bool operator() (const Math::Stats::Shuffle&);
+          bool operator() (const vector<Math::Stats::Shuffle>&);
 
         protected:
+          const Math::Stats::Shuffler& shuffler;
           std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator;
           std::shared_ptr<EnhancerBase> enhancer;
           const default_type skew;
@@ -74,7 +105,8 @@ namespace MR
           count_matrix_type& global_enhanced_count;
           matrix_type enhanced_sum;
           count_matrix_type enhanced_count;
-          matrix_type stats;
+          vector<matrix_type> shuffling_matrices;
+          vector<matrix_type> stats;
           matrix_type enhanced_stats;
           std::shared_ptr<std::mutex> mutex;
       };
@@ -85,7 +117,8 @@ namespace MR
       /*! A class to perform the permutation testing */
       class Processor { MEMALIGN (Processor)
         public:
-          Processor (const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
+          Processor (const Math::Stats::Shuffler& shuffler,
+                     const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
                      const std::shared_ptr<EnhancerBase> enhancer,
                      const matrix_type& empirical_enhanced_statistics,
                      const matrix_type& default_enhanced_statistics,
@@ -95,14 +128,16 @@ namespace MR
 
           ~Processor();
 
-          bool operator() (const Math::Stats::Shuffle&);
+          bool operator() (const vector<Math::Stats::Shuffle>&);
 
         protected:
+          const Math::Stats::Shuffler& shuffler;
           std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator;
           std::shared_ptr<EnhancerBase> enhancer;
           const matrix_type& empirical_enhanced_statistics;
           const matrix_type& default_enhanced_statistics;
-          matrix_type statistics;
+          vector<matrix_type> shuffling_matrices;
+          vector<matrix_type> statistics;
           matrix_type enhanced_statistics;
           matrix_type& null_dist;
           count_matrix_type& global_null_dist_contributions;
@@ -110,12 +145,15 @@ namespace MR
           count_matrix_type& global_uncorrected_pvalue_counter;
           count_matrix_type uncorrected_pvalue_counter;
           std::shared_ptr<std::mutex> mutex;
+
+          void process (const size_t index, const matrix_type& stats);
       };
 
 
 
 
       // Precompute the empircal test statistic for non-stationarity adjustment
+      // If merging shards (-merge_shards option), this is instead imported from the shard files
       void precompute_empirical_stat (const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
                                       const std::shared_ptr<EnhancerBase> enhancer,
                                       const default_type skew,
@@ -135,7 +173,11 @@ namespace MR
 
 
       // Functions for running a large number of permutations
-      void run_permutations (const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
+      // If only a subset of the shuffles is to be processed (-shard option), the partial results are
+      //   written to file and false is returned; the null distribution is then not available.
+      // If merging shards (-merge_shards option), the null distribution is assembled from the
+      //   shard files rather than being computed.
+      bool run_permutations (const std::shared_ptr<Math::Stats::GLM::TestBase> stats_calculator,
                              const std::shared_ptr<EnhancerBase> enhancer,
                              const matrix_type& empirical_enhanced_statistic,
                              const matrix_type& default_enhanced_statistics,
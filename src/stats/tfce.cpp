@@ -45,9 +45,14 @@ namespace MR
 
       void Wrapper::operator() (in_column_type in, out_column_type out) const
       {
-        out.setZero();
         const value_type max_input_value = in.maxCoeff();
-        for (value_type h = dH; (h-dH) < max_input_value; h += dH) {
+        vector<value_type> thresholds;
+        for (value_type h = dH; (h-dH) < max_input_value; h += dH)
+          thresholds.push_back (h);
+        if (enhancer->integrate (in, thresholds, E, H, out))
+          return;
+        out.setZero();
+        for (auto h : thresholds) {
           matrix_type temp (in.size(), 1);
           (*enhancer) (in, h, temp.col(0));
           const value_type h_multiplier = std::pow (h, H);
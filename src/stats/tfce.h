@@ -17,6 +17,9 @@
 #ifndef __stats_tfce_h__
 #define __stats_tfce_h__
 
+#include <algorithm>
+#include <limits>
+
 #include "thread_queue.h"
 #include "filter/connected_components.h"
 #include "math/stats/typedefs.h"
@@ -49,11 +52,123 @@ namespace MR
           // Alternative functor that also takes the threshold value;
           //   makes TFCE integration cleaner
           virtual void operator() (in_column_type /*input_statistics*/, const value_type /*threshold*/, out_column_type /*enhanced_statistics*/) const = 0;
+          // Optionally compute the complete TFCE integral over the provided thresholds in
+          //   a single operation; returns false if not supported by the derived class, in
+          //   which case enhancement is instead performed separately at each threshold
+          virtual bool integrate (in_column_type /*input_statistics*/, const vector<value_type>& /*thresholds*/,
+                                  const value_type /*E*/, const value_type /*H*/, out_column_type /*enhanced_statistics*/) const { return false; }
           friend class Wrapper;
       };
 
 
 
+      // Exact single-pass evaluation of the discretised TFCE integral, for enhancers where
+      //   the extent of each element at any threshold is the number of elements in the
+      //   connected cluster of supra-threshold elements to which it belongs
+      // Elements are added in decreasing order of the number of thresholds that they exceed,
+      //   and clusters are merged using a union-find data structure; each time the composition
+      //   of a cluster changes, its contribution to the integral across the range of thresholds
+      //   over which that composition persisted is stored in a tree of cluster merges, and the
+      //   result for each element is the sum of contributions along its path through this tree
+      // Functor "above" determines whether a value exceeds a particular threshold
+      template <class AdjacencyType, class Functor>
+      void integrate_clusters (matrix_type::ConstColXpr in,
+                               const AdjacencyType& adjacency,
+                               Functor&& above,
+                               const vector<value_type>& thresholds,
+                               const value_type E,
+                               const value_type H,
+                               matrix_type::ColXpr out)
+      {
+        const uint32_t num_elements = in.size();
+        const uint32_t num_levels = thresholds.size();
+        vector<value_type> cumulative (num_levels + 1, value_type(0));
+        for (uint32_t k = 0; k != num_levels; ++k)
+          cumulative[k+1] = cumulative[k] + std::pow (thresholds[k], H);
+        // Every element contributes at every threshold
+        if (!E) {
+          out.fill (cumulative[num_levels]);
+          return;
+        }
+
+        // Number of thresholds exceeded by each element,
+        //   and order of elements by decreasing value of this number
+        vector<uint32_t> levels (num_elements), offsets (num_levels + 2, 0);
+        for (uint32_t i = 0; i != num_elements; ++i) {
+          levels[i] = std::partition_point (thresholds.begin(), thresholds.end(),
+                                            [&] (const value_type h) { return above (in[i], h); }) - thresholds.begin();
+          ++offsets[num_levels - levels[i] + 1];
+        }
+        for (uint32_t k = 1; k != num_levels + 2; ++k)
+          offsets[k] += offsets[k-1];
+        vector<uint32_t> order (num_elements);
+        for (uint32_t i = 0; i != num_elements; ++i)
+          order[offsets[num_levels - levels[i]]++] = i;
+
+        // Union-find over elements; for each cluster root: the number of elements,
+        //   the highest level at which the present cluster composition has not yet
+        //   contributed to the integral, and the corresponding node in the merge tree
+        // Leaves of the merge tree are the elements themselves
+        constexpr uint32_t no_parent = std::numeric_limits<uint32_t>::max();
+        vector<uint32_t> parent (num_elements), size (num_elements), last (num_elements), node (num_elements);
+        vector<uint32_t> tree_parent (2 * num_elements, no_parent);
+        vector<value_type> tree_contribution (2 * num_elements, value_type(0));
+        uint32_t num_nodes = num_elements;
+        auto find = [&] (uint32_t i) {
+          while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+          }
+          return i;
+        };
+        auto flush = [&] (const uint32_t root, const uint32_t level) {
+          tree_contribution[node[root]] = std::pow (value_type(size[root]), E) * (cumulative[last[root]] - cumulative[level]);
+        };
+
+        size_t position = 0;
+        for (uint32_t k = num_levels; k; --k) {
+          const size_t first = position;
+          for (; position != num_elements && levels[order[position]] == k; ++position) {
+            const uint32_t i = order[position];
+            parent[i] = node[i] = i;
+            size[i] = 1;
+            last[i] = k;
+          }
+          for (size_t p = first; p != position; ++p) {
+            const uint32_t i = order[p];
+            for (const auto n : adjacency[i]) {
+              if (levels[n] < k)
+                continue;
+              uint32_t one = find (i), two = find (n);
+              if (one == two)
+                continue;
+              flush (one, k);
+              flush (two, k);
+              if (size[one] < size[two])
+                std::swap (one, two);
+              parent[two] = one;
+              size[one] += size[two];
+              last[one] = k;
+              tree_parent[node[one]] = tree_parent[node[two]] = num_nodes;
+              node[one] = num_nodes++;
+            }
+          }
+        }
+        for (uint32_t i = 0; i != num_elements; ++i) {
+          if (levels[i] && parent[i] == i)
+            flush (i, 0);
+        }
+
+        // Merges always produce a node with a higher index than those merged
+        for (uint32_t n = num_nodes; n--; ) {
+          if (tree_parent[n] != no_parent)
+            tree_contribution[n] += tree_contribution[tree_parent[n]];
+        }
+        for (uint32_t i = 0; i != num_elements; ++i)
+          out[i] = levels[i] ? tree_contribution[i] : value_type(0);
+      }
+
+
 
       class Wrapper : public Stats::EnhancerBase
       { MEMALIGN (Wrapper)
@@ -0,0 +1,150 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "command.h"
+#include "exception.h"
+#include "types.h"
+#include "math/least_squares.h"
+#include "math/rng.h"
+#include "math/stats/glm.h"
+#include "math/stats/measurements.h"
+#include "math/stats/shuffle.h"
+#include "math/stats/typedefs.h"
+
+using namespace MR;
+using namespace App;
+using namespace Math::Stats;
+
+#define NUM_SHUFFLES 20
+// Permissible relative difference between statistics computed with
+//   different groupings of the underlying matrix products
+#define TOLERANCE 1e-9
+
+void usage ()
+{
+  AUTHOR = "Robert E. Smith (robert.smith@florey.edu.au)";
+  SYNOPSIS = "Verify that stacked evaluation of multiple shuffles in the fixed-design GLM agrees with evaluation of individual shuffles";
+  REQUIRES_AT_LEAST_ONE_ARGUMENT = false;
+}
+
+
+
+void run ()
+{
+  vector<std::string> failed_tests;
+  auto test = [&] (const bool result, const std::string msg) {
+    if (!result)
+      failed_tests.push_back (msg);
+  };
+
+  Math::RNG::Normal<default_type> rng;
+
+  auto close = [] (const default_type a, const default_type b) {
+    return abs (a - b) <= TOLERANCE * std::max (default_type(1), std::max (abs (a), abs (b)));
+  };
+
+  // Numbers of elements chosen to exercise both single and multiple blocks of elements
+  for (const auto& dims : vector<std::pair<size_t, size_t>> { { 12, 9 }, { 12, 5000 }, { 60, 890 }, { 150, 1964 } }) {
+    const size_t num_inputs = dims.first;
+    const size_t num_elements = dims.second;
+    const std::string dims_string = str(num_inputs) + " inputs, " + str(num_elements) + " elements";
+
+    matrix_type design (num_inputs, 3);
+    for (size_t i = 0; i != num_inputs; ++i) {
+      design (i, 0) = 1.0;
+      design (i, 1) = i % 2 ? 1.0 : 0.0;
+      design (i, 2) = rng();
+    }
+    matrix_type data (num_inputs, num_elements);
+    for (size_t e = 0; e != num_elements; ++e) {
+      for (size_t i = 0; i != num_inputs; ++i)
+        data (i, e) = rng() + (e % 3 ? 0.5 * design (i, 1) : 0.0);
+    }
+    const matrix_type reference_data (data);
+    const Measurements measurements (std::move (data));
+
+    matrix_type contrast_data (2, 3);
+    contrast_data << 0.0, 1.0, 0.0,
+                     0.0, 0.0, 1.0;
+    const matrix_type contrasts (contrast_data);
+    vector<GLM::Hypothesis> hypotheses;
+    hypotheses.emplace_back (GLM::Hypothesis (contrasts.row (0), 0));
+    hypotheses.emplace_back (GLM::Hypothesis (contrasts, 0));
+
+    const GLM::TestFixedHomoscedastic glm (measurements, design, hypotheses);
+
+    Shuffler shuffler (num_inputs, NUM_SHUFFLES, Shuffler::error_t::BOTH, false);
+    vector<matrix_type> shuffling_matrices;
+    Shuffle shuffle;
+    while (shuffler (shuffle))
+      shuffling_matrices.push_back (shuffle.data);
+
+    vector<matrix_type> batch_zstats;
+    glm.batch (shuffling_matrices, batch_zstats);
+    test (batch_zstats.size() == shuffling_matrices.size(), "Incorrect number of outputs from batch(); " + dims_string);
+
+    // Freedman-Lane evaluated directly on the full data matrix for comparison
+    const matrix_type pinvM = Math::pinv (design);
+    const matrix_type Rm = matrix_type::Identity (num_inputs, num_inputs) - (design*pinvM);
+
+    matrix_type stats, zstats;
+    for (size_t is = 0; is != shuffling_matrices.size(); ++is) {
+      glm (shuffling_matrices[is], stats, zstats);
+      bool batch_match = is < batch_zstats.size() && batch_zstats[is].rows() == zstats.rows() && batch_zstats[is].cols() == zstats.cols();
+      for (ssize_t ie = 0; batch_match && ie != zstats.rows(); ++ie) {
+        for (ssize_t ih = 0; ih != zstats.cols(); ++ih)
+          batch_match = batch_match && close (zstats (ie, ih), batch_zstats[is] (ie, ih));
+      }
+      test (batch_match, "Batched Z-statistics differ from those of individual shuffle " + str(is) + "; " + dims_string);
+
+      for (size_t ih = 0; ih != hypotheses.size(); ++ih) {
+        const auto partition = hypotheses[ih].partition (design);
+        const matrix_type XtX = partition.X.transpose() * partition.X;
+        const size_t dof = num_inputs - partition.rank_x - partition.rank_z;
+        const default_type one_over_dof = 1.0 / default_type(dof);
+        const matrix_type Sy = shuffling_matrices[is] * partition.Rz * reference_data;
+        const matrix_type lambdas = pinvM * Sy;
+        const vector_type sse = (Rm*Sy).colwise().squaredNorm();
+        bool match = true;
+        matrix_type beta;
+        for (size_t ie = 0; ie != num_elements; ++ie) {
+          beta.noalias() = hypotheses[ih].matrix() * lambdas.col (ie);
+          const default_type F = ((beta.transpose() * XtX * beta) (0,0) / hypotheses[ih].rank()) / (one_over_dof * sse[ie]);
+          default_type expected;
+          if (!std::isfinite (F))
+            expected = 0.0;
+          else if (hypotheses[ih].is_F())
+            expected = F;
+          else
+            expected = std::sqrt (F) * (beta.sum() > 0.0 ? 1.0 : -1.0);
+          if (!close (stats (ie, ih), expected))
+            match = false;
+        }
+        test (match, "Statistics for shuffle " + str(is) + " of hypothesis " + hypotheses[ih].name() + " differ from evaluation on full data; " + dims_string);
+      }
+    }
+
+    test (glm.batch_size() >= 1, "Invalid batch size; " + dims_string);
+  }
+
+  if (failed_tests.size()) {
+    Exception e (str(failed_tests.size()) + " tests of GLM batch evaluation failed:");
+    for (auto s : failed_tests)
+      e.push_back (s);
+    throw e;
+  }
+}
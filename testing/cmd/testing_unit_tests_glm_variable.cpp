@@ -0,0 +1,175 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "command.h"
+#include "exception.h"
+#include "types.h"
+#include "math/least_squares.h"
+#include "math/rng.h"
+#include "math/stats/glm.h"
+#include "math/stats/import.h"
+#include "math/stats/measurements.h"
+#include "math/stats/shuffle.h"
+#include "math/stats/typedefs.h"
+
+using namespace MR;
+using namespace App;
+using namespace Math::Stats;
+
+#define NUM_INPUTS 32
+#define NUM_SHUFFLES 4
+// Number of elements for which each pattern of missing inputs is unique;
+//   exceeds the number of decompositions of the masked design matrix that
+//   TestVariableHomoscedastic caches
+#define NUM_UNIQUE_ELEMENTS 4800
+#define NUM_DUPLICATE_ELEMENTS 100
+#define TOLERANCE 1e-9
+
+void usage ()
+{
+  AUTHOR = "Robert E. Smith (robert.smith@florey.edu.au)";
+  SYNOPSIS = "Verify the variable-design GLM for data with missing values against fitting of each element to only its finite inputs";
+  REQUIRES_AT_LEAST_ONE_ARGUMENT = false;
+}
+
+
+
+void run ()
+{
+  vector<std::string> failed_tests;
+  auto test = [&] (const bool result, const std::string msg) {
+    if (!result)
+      failed_tests.push_back (msg);
+  };
+
+  auto close = [] (const default_type a, const default_type b) {
+    return abs (a - b) <= TOLERANCE * std::max (default_type(1), std::max (abs (a), abs (b)));
+  };
+
+  Math::RNG::Normal<default_type> rng;
+
+  matrix_type design (NUM_INPUTS, 3);
+  for (size_t i = 0; i != NUM_INPUTS; ++i) {
+    design (i, 0) = 1.0;
+    design (i, 1) = i % 2 ? 1.0 : 0.0;
+    design (i, 2) = rng();
+  }
+
+  // Each of the first NUM_UNIQUE_ELEMENTS elements excludes a different set of three inputs,
+  //   other than every 500th element, which has no missing values; the remaining elements
+  //   duplicate both the data and the pattern of missing values of elements processed
+  //   early (whose decompositions are cached) and late (after the cache has been filled)
+  const size_t num_elements = NUM_UNIQUE_ELEMENTS + 2 * NUM_DUPLICATE_ELEMENTS;
+  matrix_type data (NUM_INPUTS, num_elements);
+  for (size_t e = 0; e != NUM_UNIQUE_ELEMENTS; ++e) {
+    for (size_t i = 0; i != NUM_INPUTS; ++i)
+      data (i, e) = rng() + (e % 3 ? 0.5 * design (i, 1) : 0.0);
+  }
+  size_t e = 0;
+  for (size_t i = 0; i != NUM_INPUTS && e != NUM_UNIQUE_ELEMENTS; ++i) {
+    for (size_t j = i+1; j != NUM_INPUTS && e != NUM_UNIQUE_ELEMENTS; ++j) {
+      for (size_t k = j+1; k != NUM_INPUTS && e != NUM_UNIQUE_ELEMENTS; ++k, ++e) {
+        if (e % 500) {
+          data (i, e) = NaN;
+          data (j, e) = e % 2 ? Inf : NaN;
+          data (k, e) = NaN;
+        }
+      }
+    }
+  }
+  for (size_t d = 0; d != NUM_DUPLICATE_ELEMENTS; ++d) {
+    data.col (NUM_UNIQUE_ELEMENTS + d) = data.col (d + 1);
+    data.col (NUM_UNIQUE_ELEMENTS + NUM_DUPLICATE_ELEMENTS + d) = data.col (NUM_UNIQUE_ELEMENTS - NUM_DUPLICATE_ELEMENTS + d);
+  }
+  const matrix_type reference_data (data);
+  const Measurements measurements (std::move (data));
+
+  matrix_type contrast_data (2, 3);
+  contrast_data << 0.0, 1.0, 0.0,
+                   0.0, 0.0, 1.0;
+  const matrix_type contrasts (contrast_data);
+  vector<GLM::Hypothesis> hypotheses;
+  hypotheses.emplace_back (GLM::Hypothesis (contrasts.row (0), 0));
+  hypotheses.emplace_back (GLM::Hypothesis (contrasts, 0));
+
+  const vector<CohortDataImport> extra_columns;
+  const GLM::TestVariableHomoscedastic glm (extra_columns, measurements, design, hypotheses, true, false);
+
+  // Sign-flipping only: for a diagonal shuffling matrix, removal of the rows & columns
+  //   of excluded inputs is equivalent to shuffling only the included inputs
+  Shuffler shuffler (NUM_INPUTS, NUM_SHUFFLES, Shuffler::error_t::ISE, false);
+  Shuffle shuffle;
+  matrix_type stats, zstats;
+  while (shuffler (shuffle)) {
+    const std::string shuffle_string = "shuffle " + str(shuffle.index);
+    glm (shuffle.data, stats, zstats);
+    test (stats.rows() == ssize_t(num_elements) && stats.cols() == ssize_t(hypotheses.size()), "Incorrect dimensions of statistics; " + shuffle_string);
+    test (stats.allFinite() && zstats.allFinite(), "Non-finite statistics; " + shuffle_string);
+
+    bool match = true, nonzero = true;
+    for (size_t e = 0; e != NUM_UNIQUE_ELEMENTS; ++e) {
+      vector<size_t> included;
+      for (size_t i = 0; i != NUM_INPUTS; ++i) {
+        if (std::isfinite (reference_data (i, e)))
+          included.push_back (i);
+      }
+      const size_t n = included.size();
+      matrix_type M (n, design.cols()), S (matrix_type::Zero (n, n));
+      vector_type y (n);
+      for (size_t i = 0; i != n; ++i) {
+        M.row (i) = design.row (included[i]);
+        S (i, i) = shuffle.data (included[i], included[i]);
+        y[i] = reference_data (included[i], e);
+      }
+      const matrix_type pinvM = Math::pinv (M);
+      const matrix_type Rm = matrix_type::Identity (n, n) - (M*pinvM);
+      for (size_t ih = 0; ih != hypotheses.size(); ++ih) {
+        const auto partition = hypotheses[ih].partition (M);
+        const matrix_type XtX = partition.X.transpose() * partition.X;
+        const default_type dof = n - partition.rank_x - partition.rank_z;
+        const vector_type Sy = S * partition.Rz * y.matrix();
+        const vector_type beta = hypotheses[ih].matrix() * (pinvM * Sy.matrix());
+        const default_type sse = (Rm * Sy.matrix()).squaredNorm();
+        const default_type F = ((beta.matrix().transpose() * XtX * beta.matrix()) (0,0) / hypotheses[ih].rank()) / (sse / dof);
+        const default_type expected = hypotheses[ih].is_F() ? F : std::sqrt (F) * (beta.sum() > 0.0 ? 1.0 : -1.0);
+        if (!close (stats (e, ih), expected))
+          match = false;
+        if (!stats (e, ih))
+          nonzero = false;
+      }
+    }
+    test (match, "Statistics differ from fitting of each element to only its finite inputs; " + shuffle_string);
+    test (nonzero, "Statistics not computed for all elements; " + shuffle_string);
+
+    bool duplicates_match = true;
+    for (size_t d = 0; d != NUM_DUPLICATE_ELEMENTS; ++d) {
+      for (size_t ih = 0; ih != hypotheses.size(); ++ih) {
+        if (!close (stats (NUM_UNIQUE_ELEMENTS + d, ih), stats (d + 1, ih)) ||
+            !close (stats (NUM_UNIQUE_ELEMENTS + NUM_DUPLICATE_ELEMENTS + d, ih), stats (NUM_UNIQUE_ELEMENTS - NUM_DUPLICATE_ELEMENTS + d, ih)))
+          duplicates_match = false;
+      }
+    }
+    test (duplicates_match, "Statistics differ between elements with identical data, depending on caching of design matrix decomposition; " + shuffle_string);
+  }
+
+  if (failed_tests.size()) {
+    Exception e (str(failed_tests.size()) + " tests of variable GLM with missing values failed:");
+    for (auto s : failed_tests)
+      e.push_back (s);
+    throw e;
+  }
+}
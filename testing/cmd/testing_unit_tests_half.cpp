@@ -0,0 +1,79 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "command.h"
+#include "exception.h"
+#include "math/half.h"
+#include "math/rng.h"
+
+using namespace MR;
+using namespace App;
+using namespace MR::Math::Half;
+
+void usage ()
+{
+  AUTHOR = "Robert E. Smith (robert.smith@florey.edu.au)";
+  SYNOPSIS = "Verify correct operation of the half-precision floating-point conversion functions";
+  REQUIRES_AT_LEAST_ONE_ARGUMENT = false;
+}
+
+
+void run ()
+{
+  vector<std::string> failed_tests;
+  auto test = [&] (const bool result, const std::string msg) {
+    if (!result)
+      failed_tests.push_back (msg);
+  };
+
+  // Every half-precision value must survive a round trip through single-precision
+  for (uint32_t i = 0; i != 0x10000u; ++i) {
+    const storage_type h = storage_type (i);
+    const float f = half2float (h);
+    const storage_type g = float2half (f);
+    if (std::isnan (f))
+      test (std::isnan (half2float (g)), "NaN half " + str(i) + " not preserved as NaN");
+    else
+      test (g == h, "half " + str(i) + " (" + str(f) + ") round-trips to " + str(g));
+  }
+
+  // Known values
+  test (half2float (float2half (1.0f)) == 1.0f, "1.0 not exactly representable");
+  test (half2float (float2half (-2.5f)) == -2.5f, "-2.5 not exactly representable");
+  test (half2float (float2half (65504.0f)) == 65504.0f, "Maximal half value not exactly representable");
+  test (std::isinf (half2float (float2half (65520.0f))), "Overflow does not saturate to infinity");
+  test (half2float (float2half (std::pow (2.0f, -24.0f))) == std::pow (2.0f, -24.0f), "Minimal subnormal half value not exactly representable");
+  test (half2float (float2half (1.0e-8f)) == 0.0f, "Underflow does not flush to zero");
+  test (float2half (-0.0f) == 0x8000u, "Negative zero not preserved");
+  test (float2half (1.0f + std::pow (2.0f, -11.0f)) == float2half (1.0f), "Tie not rounded to even (down)");
+  test (float2half (1.0f + 3.0f * std::pow (2.0f, -11.0f)) == float2half (1.0f + std::pow (2.0f, -9.0f)), "Tie not rounded to even (up)");
+
+  // Relative error of conversion within the normal range
+  Math::RNG::Uniform<float> rng;
+  for (size_t i = 0; i != 100000; ++i) {
+    const float f = std::ldexp (rng() + 1.0f, int(std::floor (rng() * 29.0f)) - 14) * (rng() < 0.5f ? -1.0f : 1.0f);
+    const float g = half2float (float2half (f));
+    test (std::abs (g - f) <= std::abs (f) * std::pow (2.0f, -11.0f), "Conversion of " + str(f) + " to " + str(g) + " exceeds tolerance");
+  }
+
+  if (failed_tests.size()) {
+    Exception e (str(failed_tests.size()) + " tests of half-precision conversion failed:");
+    for (auto s : failed_tests)
+      e.push_back (s);
+    throw e;
+  }
+}
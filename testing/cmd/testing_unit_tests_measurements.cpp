@@ -0,0 +1,179 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include <cstdio>
+
+#include "command.h"
+#include "exception.h"
+#include "types.h"
+#include "file/utils.h"
+#include "math/rng.h"
+#include "math/stats/import.h"
+#include "math/stats/measurements.h"
+#include "math/stats/typedefs.h"
+
+using namespace MR;
+using namespace App;
+using namespace Math::Stats;
+
+#define NUM_INPUTS 37
+#define NUM_ELEMENTS 1000
+
+void usage ()
+{
+  AUTHOR = "Robert E. Smith (robert.smith@florey.edu.au)";
+  SYNOPSIS = "Verify import of measurement data at each precision, and writing & memory-mapping of cohort files";
+  REQUIRES_AT_LEAST_ONE_ARGUMENT = false;
+}
+
+
+
+// Subject data held in memory, rather than being read from a file
+class MemoryDataImport : public SubjectDataImportBase
+{ NOMEMALIGN
+  public:
+    MemoryDataImport (const std::string& name, const vector_type& data) :
+        SubjectDataImportBase (name),
+        data (data) { }
+    void operator() (matrix_type::RowXpr row) const override { row = data.transpose(); }
+    default_type operator[] (const size_t index) const override { return data[index]; }
+    size_t size() const override { return data.size(); }
+  private:
+    const vector_type data;
+};
+
+class MemoryCohortImport : public CohortDataImport
+{ NOMEMALIGN
+  public:
+    MemoryCohortImport (const matrix_type& data)
+    {
+      for (ssize_t i = 0; i != data.rows(); ++i)
+        files.emplace_back (std::make_shared<MemoryDataImport> ("input " + str(i), data.row (i).transpose()));
+    }
+};
+
+
+
+void run ()
+{
+  vector<std::string> failed_tests;
+  auto test = [&] (const bool result, const std::string msg) {
+    if (!result)
+      failed_tests.push_back (msg);
+  };
+
+  Math::RNG::Normal<default_type> rng;
+  matrix_type data (NUM_INPUTS, NUM_ELEMENTS);
+  for (size_t i = 0; i != NUM_INPUTS; ++i) {
+    for (size_t e = 0; e != NUM_ELEMENTS; ++e)
+      data (i, e) = 100.0 * rng();
+  }
+  data (3, 5) = NaN;
+  const MemoryCohortImport importer (data);
+
+  const vector<Measurements::storage_type> types { Measurements::storage_type::FLOAT64,
+                                                   Measurements::storage_type::FLOAT32,
+                                                   Measurements::storage_type::FLOAT16 };
+  const uint64_t fingerprint = 0x0123456789abcdefull;
+
+  for (const auto type : types) {
+    const std::string type_string (precision_choices[int(type)]);
+    const Measurements imported (importer, type, "Importing test data");
+    test (imported.rows() == NUM_INPUTS && imported.cols() == NUM_ELEMENTS, "Incorrect dimensions of imported data; " + type_string);
+    test (imported.storage() == type && !imported.is_mapped(), "Incorrect storage of imported data; " + type_string);
+
+    // Values must be as would be obtained by conversion to the storage type
+    bool match = true;
+    for (size_t i = 0; i != NUM_INPUTS; ++i) {
+      for (size_t e = 0; e != NUM_ELEMENTS; ++e) {
+        default_type expected;
+        switch (type) {
+          case Measurements::storage_type::FLOAT64: expected = data (i, e); break;
+          case Measurements::storage_type::FLOAT32: expected = float (data (i, e)); break;
+          case Measurements::storage_type::FLOAT16: expected = float (Eigen::half (float (data (i, e)))); break;
+        }
+        const default_type value = imported (i, e);
+        if (!(value == expected || (std::isnan (value) && std::isnan (expected))))
+          match = false;
+      }
+    }
+    test (match, "Imported data do not match input; " + type_string);
+    test (!imported.allFinite() && !imported.allFinite (5) && imported.allFinite (6), "Missing value not detected; " + type_string);
+
+    const std::string path = File::create_tempfile (0, "cohort");
+    try {
+      imported.save (path, fingerprint);
+
+      Measurements mapped (path, fingerprint);
+      test (mapped.is_mapped() && mapped.storage() == type, "Incorrect storage of memory-mapped data; " + type_string);
+      test (mapped.rows() == NUM_INPUTS && mapped.cols() == NUM_ELEMENTS, "Incorrect dimensions of memory-mapped data; " + type_string);
+      const matrix_type imported_block (imported.block (0, NUM_ELEMENTS));
+      const matrix_type mapped_block (mapped.block (0, NUM_ELEMENTS));
+      test ((imported_block.array() == mapped_block.array() || (imported_block.array().isNaN() && mapped_block.array().isNaN())).all(),
+            "Memory-mapped data do not match imported data; " + type_string);
+      test (mapped.block (100, 50) == imported_block.middleCols (100, 50), "Block of memory-mapped data does not match; " + type_string);
+
+      bool rejected = false;
+      try {
+        Measurements mismatched (path, fingerprint + 1);
+      } catch (Exception&) {
+        rejected = true;
+      }
+      test (rejected, "Cohort file with non-matching fingerprint not rejected; " + type_string);
+
+      rejected = false;
+      try {
+        mapped.set (0, 0, 1.0);
+      } catch (Exception&) {
+        rejected = true;
+      }
+      test (rejected, "Modification of memory-mapped data not prevented; " + type_string);
+    } catch (Exception& e) {
+      test (false, "Unexpected exception in writing / memory-mapping cohort file; " + type_string + ": " + e[0]);
+    }
+    std::remove (path.c_str());
+  }
+
+  // Values beyond the range of half-precision must not silently become infinite
+  matrix_type overflow_data (data);
+  overflow_data (7, 11) = -7.0e4;
+  bool rejected = false;
+  try {
+    Measurements overflow (MemoryCohortImport (overflow_data), Measurements::storage_type::FLOAT16, "Importing test data");
+  } catch (Exception&) {
+    rejected = true;
+  }
+  test (rejected, "Import of values exceeding float16 range not rejected");
+
+  Measurements modifiable (importer, Measurements::storage_type::FLOAT16, "Importing test data");
+  rejected = false;
+  try {
+    modifiable.set (0, 0, 1.0e5);
+  } catch (Exception&) {
+    rejected = true;
+  }
+  test (rejected, "Setting of value exceeding float16 range not rejected");
+  modifiable.set (0, 0, 65504.0);
+  test (modifiable (0, 0) == 65504.0, "Maximal float16 value not stored exactly");
+
+  if (failed_tests.size()) {
+    Exception e (str(failed_tests.size()) + " tests of measurement storage failed:");
+    for (auto s : failed_tests)
+      e.push_back (s);
+    throw e;
+  }
+}
@@ -15,6 +15,7 @@
  */
 
 
+#include <cstdlib>
 #include <set>
 
 #include "command.h"
@@ -33,6 +34,9 @@ using MR::Math::Stats::index_array_type;
 
 #define ROWS size_t(6)
 #define BLOCK_INDICES 0,1,0,1,2,2 // Must increment from zero, and must be equal number in each
+// Sufficiently many rows that shuffles are generated randomly rather than exhaustively
+#define RANDOM_ROWS size_t(20)
+#define RANDOM_SHUFFLES size_t(100)
 enum exchange_t { NONE, WITHIN, WHOLE };
 vector<std::string> exchange_strings { "Unrestricted", "within-block", "whole-block" };
 
@@ -138,17 +142,15 @@ void run ()
   auto test_unique = [&] (Shuffler& in, const std::string& msg)
   {
     in.reset();
-    vector<Shuffle> matrices;
+    std::set<size_t> indices;
+    std::set<vector<default_type>> matrices;
     Shuffle temp;
     bool duplicate_index = false, duplicate_data = false;
     while (in (temp)) {
-      for (const auto& previous : matrices) {
-        if (temp.index == previous.index)
-          duplicate_index = true;
-        if (temp.data == previous.data)
-          duplicate_data = true;
-        matrices.push_back (temp);
-      }
+      if (!indices.insert (temp.index).second)
+        duplicate_index = true;
+      if (!matrices.insert (vector<default_type> (temp.data.data(), temp.data.data() + temp.data.size())).second)
+        duplicate_data = true;
     }
     if (duplicate_index)
       failed_tests.push_back (msg + " (duplicate shuffle index)");
@@ -216,6 +218,8 @@ void run ()
       const std::string error_string (error_index ? "ISE" : "EE");
       const size_t max_num (error_index ? max_num_signflips : max_num_permutations);
       test_kernel (max_num/2, max_num/2, error_type, eb_within, eb_whole, error_string, eb_string, "less than max shuffles", true);
+      // Random generation with the greatest possible reliance on rejection of duplicates
+      test_kernel (max_num-1, max_num-1, error_type, eb_within, eb_whole, error_string, eb_string, "one less than max shuffles", true);
       test_kernel (max_num, max_num, error_type, eb_within, eb_whole, error_string, eb_string, "exactly max shuffles", true);
       test_kernel (2*max_num, max_num, error_type, eb_within, eb_whole, error_string, eb_string, "more than max shuffles", true);
     }
@@ -235,6 +239,74 @@ void run ()
 
   }
 
+  // Randomly generated shuffles are not stored, but regenerated from per-shuffle keys
+  //   whenever requested; verify that next() & get() yield the same shuffles as
+  //   operator() regardless of the order in which they are requested, as does
+  //   operator() when restricted to a subset of the shuffles
+  auto test_regeneration = [&] (Shuffler& in, const std::string& msg)
+  {
+    in.reset();
+    vector<Shuffle> shuffles;
+    Shuffle temp;
+    while (in (temp))
+      shuffles.push_back (temp);
+    test (shuffles.size() == RANDOM_SHUFFLES, "Incorrect number of shuffles; " + msg);
+
+    in.reset();
+    size_t index;
+    bool indices_match = true;
+    for (const auto& s : shuffles) {
+      if (!in.next (index) || index != s.index)
+        indices_match = false;
+    }
+    test (indices_match && !in.next (index), "Shuffle indices from next() differ from those of operator(); " + msg);
+
+    matrix_type data, repeat;
+    bool data_match = true;
+    for (auto s = shuffles.rbegin(); s != shuffles.rend(); ++s) {
+      in.get (s->index, data);
+      in.get (s->index, repeat);
+      if (data != s->data || repeat != s->data)
+        data_match = false;
+    }
+    test (data_match, "Shuffling matrices from get() differ from those of operator(); " + msg);
+
+    const size_t first = RANDOM_SHUFFLES / 4, last = 3 * RANDOM_SHUFFLES / 4;
+    in.set_range (first, last);
+    size_t expected_index = first;
+    bool range_match = true;
+    while (in (temp)) {
+      if (expected_index >= last || temp.index != expected_index || temp.data != shuffles[expected_index].data)
+        range_match = false;
+      ++expected_index;
+    }
+    test (range_match && expected_index == last, "Shuffles from restricted range differ from those of full range; " + msg);
+
+    // Random shuffles can only be reproduced by another invocation if the seed is fixed
+    test (in.is_reproducible() == bool(getenv ("MRTRIX_RNG_SEED")), "Incorrect reproducibility of random shuffles; " + msg);
+  };
+
+  {
+    index_array_type random_block_indices (RANDOM_ROWS);
+    for (size_t i = 0; i != RANDOM_ROWS; ++i)
+      random_block_indices[i] = i % 10;
+    for (size_t exchange_index = 0; exchange_index != 3; ++exchange_index) {
+      const index_array_type eb_within (exchange_t(exchange_index) == exchange_t::WITHIN ?
+                                        random_block_indices :
+                                        index_array_type());
+      const index_array_type eb_whole  (exchange_t(exchange_index) == exchange_t::WHOLE ?
+                                        random_block_indices :
+                                        index_array_type());
+      for (size_t error_index = 0; error_index != 3; ++error_index) {
+        const Shuffler::error_t error_type (error_index == 0 ? Shuffler::error_t::EE :
+                                            (error_index == 1 ? Shuffler::error_t::ISE : Shuffler::error_t::BOTH));
+        const std::string error_string (error_index == 0 ? "EE" : (error_index == 1 ? "ISE" : "BOTH"));
+        Shuffler shuffler (RANDOM_ROWS, RANDOM_SHUFFLES, error_type, false, eb_within, eb_whole);
+        test_regeneration (shuffler, error_string + "; " + exchange_strings[exchange_index] + "; random shuffles");
+      }
+    }
+  }
+
   if (failed_tests.size()) {
     Exception e (str(failed_tests.size()) + " tests of shuffling mechanisms failed:");
     for (auto s : failed_tests)
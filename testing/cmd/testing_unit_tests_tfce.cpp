@@ -0,0 +1,171 @@
+/* Copyright (c) 2008-2024 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Covered Software is provided under this License on an "as is"
+ * basis, without warranty of any kind, either expressed, implied, or
+ * statutory, including, without limitation, warranties that the
+ * Covered Software is free of defects, merchantable, fit for a
+ * particular purpose or non-infringing.
+ * See the Mozilla Public License v. 2.0 for more details.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "command.h"
+#include "exception.h"
+#include "header.h"
+#include "image.h"
+#include "types.h"
+#include "algo/loop.h"
+#include "filter/connected_components.h"
+#include "math/rng.h"
+#include "math/stats/typedefs.h"
+#include "misc/voxel2vector.h"
+
+#include "connectome/enhance.h"
+#include "connectome/mat2vec.h"
+#include "stats/cluster.h"
+#include "stats/tfce.h"
+
+using namespace MR;
+using namespace App;
+using namespace Math::Stats;
+
+#define IMAGE_SIZE 14
+#define NUM_NODES 24
+#define NUM_REPEATS 5
+#define TOLERANCE 1e-9
+
+void usage ()
+{
+  AUTHOR = "Robert E. Smith (robert.smith@florey.edu.au)";
+  SYNOPSIS = "Verify single-pass TFCE integration against enhancement at each threshold for cluster-based enhancers";
+  REQUIRES_AT_LEAST_ONE_ARGUMENT = false;
+}
+
+
+
+// Disable the single-pass integration, such that
+//   TFCE::Wrapper falls back to enhancement at each threshold
+class ClusterSizeStepwise : public Stats::Cluster::ClusterSize
+{ MEMALIGN (ClusterSizeStepwise)
+  public:
+    using Stats::Cluster::ClusterSize::ClusterSize;
+  protected:
+    bool integrate (in_column_type, const vector<value_type>&, const value_type, const value_type, out_column_type) const override { return false; }
+};
+
+class NBSStepwise : public Connectome::Enhance::NBS
+{ MEMALIGN (NBSStepwise)
+  public:
+    using Connectome::Enhance::NBS::NBS;
+    bool integrate (in_column_type, const vector<value_type>&, const value_type, const value_type, out_column_type) const override { return false; }
+};
+
+
+
+void run ()
+{
+  vector<std::string> failed_tests;
+  auto test = [&] (const bool result, const std::string msg) {
+    if (!result)
+      failed_tests.push_back (msg);
+  };
+
+  // Parameters of mrclusterstats and connectomestats -algorithm tfnbs,
+  //   as well as some that exercise the special cases of E and H
+  const vector<std::array<default_type, 3>> parameters { { 0.1, 0.5, 2.0 },
+                                                         { 0.1, 0.4, 3.0 },
+                                                         { 0.05, 1.0, 1.0 },
+                                                         { 0.25, 0.0, 2.0 },
+                                                         { 0.1, 0.5, 0.0 } };
+
+  auto compare = [&] (const Stats::EnhancerBase& integrated, const Stats::EnhancerBase& stepwise,
+                      const matrix_type& input, const std::string& description) {
+    matrix_type integrated_output (input.rows(), input.cols()), stepwise_output (input.rows(), input.cols());
+    integrated (input, integrated_output);
+    stepwise (input, stepwise_output);
+    const default_type max_diff = (integrated_output - stepwise_output).array().abs().maxCoeff();
+    const default_type max_value = stepwise_output.array().abs().maxCoeff();
+    test (integrated_output.allFinite(), "Non-finite enhanced statistic; " + description);
+    test (max_value > 0.0, "Stepwise enhancement yields no non-zero statistic; " + description);
+    test (max_diff <= TOLERANCE * max_value,
+          "Single-pass integration differs from stepwise enhancement (max abs diff " + str(max_diff) + " vs max value " + str(max_value) + "); " + description);
+  };
+
+  Math::RNG::Normal<default_type> rng;
+
+  // Voxel-wise clusters; spatially smooth data to yield non-trivial cluster structure,
+  //   with some negative values & isolated voxels
+  Header header;
+  header.ndim() = 3;
+  for (size_t axis = 0; axis != 3; ++axis) {
+    header.size (axis) = IMAGE_SIZE;
+    header.spacing (axis) = 1.0;
+  }
+  header.transform().setIdentity();
+  header.datatype() = DataType::Bit;
+  auto mask = Image<bool>::scratch (header, "scratch mask");
+  for (auto l = Loop (mask) (mask); l; ++l)
+    mask.value() = !(mask.index(0) == 3 && mask.index(1) > 2);
+  Voxel2Vector v2v (mask, header);
+  const size_t num_voxels = v2v.size();
+
+  for (const bool use_26_neighbours : { false, true }) {
+    Filter::Connector connector;
+    connector.adjacency.set_26_adjacency (use_26_neighbours);
+    connector.adjacency.initialise (header, v2v);
+    const std::string connectivity = use_26_neighbours ? "26" : "6";
+    for (size_t repeat = 0; repeat != NUM_REPEATS; ++repeat) {
+      vector_type noise (num_voxels);
+      for (size_t i = 0; i != num_voxels; ++i)
+        noise[i] = rng();
+      matrix_type input (num_voxels, 2);
+      for (size_t i = 0; i != num_voxels; ++i) {
+        default_type sum = noise[i];
+        for (const auto n : connector.adjacency[i])
+          sum += noise[n];
+        input (i, 0) = 1.5 * sum / std::sqrt (default_type(connector.adjacency[i].size() + 1));
+        input (i, 1) = 4.0 * std::abs (noise[i]);
+      }
+      for (const auto& p : parameters) {
+        const std::string description = "ClusterSize, " + connectivity + "-connectivity, dH=" + str(p[0]) + ", E=" + str(p[1]) + ", H=" + str(p[2]);
+        Stats::TFCE::Wrapper integrated (std::make_shared<Stats::Cluster::ClusterSize> (connector, 0.0), p[0], p[1], p[2]);
+        Stats::TFCE::Wrapper stepwise (std::make_shared<ClusterSizeStepwise> (connector, 0.0), p[0], p[1], p[2]);
+        compare (integrated, stepwise, input, description);
+      }
+    }
+  }
+
+  // Edge-wise clusters in a connectome; include non-finite values,
+  //   which NBS treats as not exceeding any threshold
+  const size_t num_edges = Connectome::Mat2Vec (NUM_NODES).vec_size();
+  const auto nbs = std::make_shared<Connectome::Enhance::NBS> (NUM_NODES);
+  const auto nbs_stepwise = std::make_shared<NBSStepwise> (NUM_NODES);
+  for (size_t repeat = 0; repeat != NUM_REPEATS; ++repeat) {
+    matrix_type input (num_edges, 2);
+    for (size_t i = 0; i != num_edges; ++i) {
+      input (i, 0) = rng() + 1.0;
+      input (i, 1) = std::abs (rng()) * 3.0;
+    }
+    input (repeat, 0) = NaN;
+    input (num_edges - repeat - 1, 1) = -Inf;
+    for (const auto& p : parameters) {
+      const std::string description = "NBS, dH=" + str(p[0]) + ", E=" + str(p[1]) + ", H=" + str(p[2]);
+      Stats::TFCE::Wrapper integrated (nbs, p[0], p[1], p[2]);
+      Stats::TFCE::Wrapper stepwise (nbs_stepwise, p[0], p[1], p[2]);
+      compare (integrated, stepwise, input, description);
+    }
+  }
+
+  if (failed_tests.size()) {
+    Exception e (str(failed_tests.size()) + " tests of single-pass TFCE integration failed:");
+    for (auto s : failed_tests)
+      e.push_back (s);
+    throw e;
+  }
+}